@@ -36,9 +36,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #define __LIBED2K_ALERT__
 
 #include <memory>
-#include <queue>
+#include <new>
 #include <string>
 #include <typeinfo>
+#include <vector>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -65,6 +66,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_MAX_ALERT_TYPES 7
 #endif
 
+/**
+  * every alert type has unique integer id for switch based dispatch:
+  * switch (a->type()) { case peer_connected_alert::alert_type: ... }
+ */
+#define LIBED2K_DEFINE_ALERT_TYPE(id)    \
+    const static int alert_type = id; \
+    virtual int type() const { return alert_type; }
+
 namespace libed2k {
 class alert {
    public:
@@ -97,22 +106,54 @@ class alert {
     virtual char const* what() const = 0;
     virtual std::string message() const = 0;
     virtual int category() const = 0;
+    virtual int type() const = 0;
     virtual std::auto_ptr<alert> clone() const = 0;
 
    private:
     ptime m_timestamp;
 };
 
+// exact type is checked by id first, dynamic_cast is left for base alert types
 template <class T>
 T* alert_cast(alert* a) {
+    if (a && a->type() == T::alert_type) return static_cast<T*>(a);
     return dynamic_cast<T*>(a);
 }
 
 template <class T>
 T const* alert_cast(alert const* a) {
+    if (a && a->type() == T::alert_type) return static_cast<T const*>(a);
     return dynamic_cast<T const*>(a);
 }
 
+/**
+  * bump allocator for alerts of one batch
+  * blocks are kept on reset and reused by next batches
+ */
+class alert_arena {
+   public:
+    alert_arena();
+    ~alert_arena();
+
+    void* allocate(size_t bytes);
+
+    /**
+      * objects allocated here must be destroyed before
+     */
+    void reset();
+
+   private:
+    alert_arena(const alert_arena&);
+    alert_arena& operator=(const alert_arena&);
+
+    enum { block_size = 32 * 1024, alignment = 16 };
+
+    std::vector<char*> m_blocks;
+    std::vector<char*> m_large;  //!< allocations bigger than block, freed on reset
+    size_t m_block;              //!< current block
+    size_t m_used;               //!< bytes used in current block
+};
+
 class alert_manager {
    public:
     enum { queue_size_limit_default = 1000 };
@@ -120,14 +161,38 @@ class alert_manager {
     alert_manager(io_service& ios);
     ~alert_manager();
 
-    bool post_alert(const alert& alert_);
+    /**
+      * copy alert into arena of current batch, T must be the exact alert type
+     */
+    template <class T>
+    bool post_alert(const T& alert_) {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        if (m_dispatch) {
+            dispatch(alert_);
+            return true;
+        }
+
+        if (queued() >= m_queue_size_limit) return false;
+        alert_batch& b = m_batches[m_current];
+        b.alerts.push_back(new (b.arena.allocate(sizeof(T))) T(alert_));
+        m_condition.notify_all();
+        return true;
+    }
+
     bool pending() const;
     std::auto_ptr<alert> get();
 
+    /**
+      * take all queued alerts with one lock, they are owned by alert manager
+      * and stay valid until the next call of pop_alerts
+     */
+    void pop_alerts(std::vector<alert*>& alerts);
+
     template <class T>
     bool should_post() const {
         boost::mutex::scoped_lock lock(m_mutex);
-        if (m_alerts.size() >= m_queue_size_limit) return false;
+        if (queued() >= m_queue_size_limit) return false;
         return (m_alert_mask & T::static_category) != 0;
     }
 
@@ -151,7 +216,24 @@ class alert_manager {
     void set_dispatch_function(boost::function<void(alert const&)> const&);
 
    private:
-    std::queue<alert*> m_alerts;
+    /**
+      * alerts posted between two pop_alerts calls, alerts before head
+      * were already taken one by one with get and destroyed
+     */
+    struct alert_batch {
+        alert_batch() : head(0) {}
+        std::vector<alert*> alerts;
+        size_t head;
+        alert_arena arena;
+    };
+
+    size_t queued() const { return m_batches[m_current].alerts.size() - m_batches[m_current].head; }
+    void dispatch(const alert& alert_);
+    void release(alert_batch& batch);
+
+    // producers fill current batch, the other one is held by pop_alerts caller
+    alert_batch m_batches[2];
+    int m_current;
     mutable boost::mutex m_mutex;
     boost::condition m_condition;
     boost::uint32_t m_alert_mask;
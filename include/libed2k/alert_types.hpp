@@ -6,6 +6,7 @@
 #include "libed2k/alert.hpp"
 #include "libed2k/error_code.hpp"
 #include "libed2k/packet_struct.hpp"
+#include "libed2k/search_aggregator.hpp"
 #include "libed2k/kademlia/kad_packet_struct.hpp"
 #include "libed2k/transfer_handle.hpp"
 #include "libed2k/socket_io.hpp"
@@ -15,6 +16,7 @@
 
 namespace libed2k {
 struct server_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(1)
     const static int static_category = alert::status_notification | alert::server_notification;
     server_alert(const std::string& nm, const std::string& h, int p) : name(nm), host(h), port(p) {}
     virtual int category() const { return static_category; }
@@ -29,6 +31,7 @@ struct server_alert : alert {
 };
 
 struct server_name_resolved_alert : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(2)
     server_name_resolved_alert(const std::string& name, const std::string& host, int port, const std::string endp)
         : server_alert(name, host, port), endpoint(endp) {}
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new server_name_resolved_alert(*this)); }
@@ -40,6 +43,7 @@ struct server_name_resolved_alert : server_alert {
   * after server handshake completed
  */
 struct server_connection_initialized_alert : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(3)
     server_connection_initialized_alert(const std::string& name, const std::string& host, int port, boost::uint32_t cid,
                                         boost::uint32_t tcpf, boost::uint32_t auxp)
         : server_alert(name, host, port), client_id(cid), tcp_flags(tcpf), aux_port(auxp) {}
@@ -58,6 +62,7 @@ struct server_connection_initialized_alert : server_alert {
   * emit on OP_SERVERSTATUS
  */
 struct server_status_alert : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(4)
     server_status_alert(const std::string& name, const std::string& host, int port, boost::uint32_t fcount,
                         boost::uint32_t ucount)
         : server_alert(name, host, port), files_count(fcount), users_count(ucount) {}
@@ -74,6 +79,7 @@ struct server_status_alert : server_alert {
  */
 
 struct server_identity_alert : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(5)
     server_identity_alert(const std::string& name, const std::string& host, int port, const md4_hash& shash,
                           const net_identifier& saddr, const std::string& sname, const std::string& sdescr)
         : server_alert(name, host, port),
@@ -96,6 +102,7 @@ struct server_identity_alert : server_alert {
   * emit for every server message
  */
 struct server_message_alert : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(6)
     server_message_alert(const std::string& name, const std::string host, int port, const std::string& msg)
         : server_alert(name, host, port), server_message(msg) {}
     virtual std::string message() const { return server_message; }
@@ -105,6 +112,7 @@ struct server_message_alert : server_alert {
 };
 
 struct server_connection_closed : server_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(7)
     server_connection_closed(const std::string& name, const std::string& host, int port, const error_code& error)
         : server_alert(name, host, port), m_error(error) {}
     virtual std::string message() const { return m_error.message(); }
@@ -114,6 +122,7 @@ struct server_connection_closed : server_alert {
 };
 
 struct listen_failed_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(8)
     listen_failed_alert(tcp::endpoint const& ep, error_code const& ec) : endpoint(ep), error(ec) {}
 
     tcp::endpoint endpoint;
@@ -132,6 +141,7 @@ struct listen_failed_alert : alert {
 };
 
 struct peer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(9)
     const static int static_category = alert::peer_notification;
     peer_alert(const net_identifier& np, const md4_hash& hash) : m_np(np), m_hash(hash) {}
 
@@ -150,6 +160,7 @@ struct peer_alert : alert {
   * this alert throws on server search results and on user shared files
  */
 struct shared_files_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(10)
     const static int static_category = alert::server_notification | alert::peer_notification;
 
     shared_files_alert(const net_identifier& np, const md4_hash& hash, const shared_files_list& files, bool more)
@@ -166,6 +177,7 @@ struct shared_files_alert : peer_alert {
 };
 
 struct shared_directories_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(11)
     const static int static_category = alert::peer_notification;
 
     shared_directories_alert(const net_identifier& np, const md4_hash& hash,
@@ -190,6 +202,7 @@ struct shared_directories_alert : peer_alert {
   * this alert throws on server search results and on user shared files
  */
 struct shared_directory_files_alert : shared_files_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(12)
     const static int static_category = alert::peer_notification;
 
     shared_directory_files_alert(const net_identifier& np, const md4_hash& hash, const std::string& strDirectory,
@@ -209,6 +222,7 @@ struct shared_directory_files_alert : shared_files_alert {
 };
 
 struct ismod_shared_directory_files_alert : shared_files_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(13)
     const static int static_category = alert::peer_notification;
 
     ismod_shared_directory_files_alert(const net_identifier& np, const md4_hash& hash, const md4_hash& dir_hash,
@@ -228,6 +242,7 @@ struct ismod_shared_directory_files_alert : shared_files_alert {
 };
 
 struct peer_connected_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(14)
     virtual int category() const { return static_category | alert::status_notification; }
     peer_connected_alert(const net_identifier& np, const md4_hash& hash, bool bActive)
         : peer_alert(np, hash), m_active(bActive) {}
@@ -240,6 +255,7 @@ struct peer_connected_alert : peer_alert {
 };
 
 struct peer_disconnected_alert : public peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(15)
     virtual int category() const { return static_category | alert::status_notification; }
     peer_disconnected_alert(const net_identifier& np, const md4_hash& hash, const error_code& ec)
         : peer_alert(np, hash), m_ec(ec) {}
@@ -252,6 +268,7 @@ struct peer_disconnected_alert : public peer_alert {
 };
 
 struct peer_message_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(16)
     peer_message_alert(const net_identifier& np, const md4_hash& hash, const std::string& strMessage)
         : peer_alert(np, hash), m_strMessage(strMessage) {}
 
@@ -264,6 +281,7 @@ struct peer_message_alert : peer_alert {
 };
 
 struct peer_captcha_request_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(17)
     peer_captcha_request_alert(const net_identifier& np, const md4_hash& hash,
                                const std::vector<unsigned char>& captcha)
         : peer_alert(np, hash), m_captcha(captcha) {}
@@ -277,6 +295,7 @@ struct peer_captcha_request_alert : peer_alert {
 };
 
 struct peer_captcha_result_alert : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(18)
     peer_captcha_result_alert(const net_identifier& np, const md4_hash& hash, boost::uint8_t nResult)
         : peer_alert(np, hash), m_nResult(nResult) {}
 
@@ -289,6 +308,7 @@ struct peer_captcha_result_alert : peer_alert {
 };
 
 struct shared_files_access_denied : peer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(19)
     shared_files_access_denied(const net_identifier& np, const md4_hash& hash) : peer_alert(np, hash) {}
     virtual int category() const { return static_category; }
 
@@ -299,6 +319,7 @@ struct shared_files_access_denied : peer_alert {
 };
 
 struct added_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(20)
     const static int static_category = alert::status_notification;
 
     added_transfer_alert(const transfer_handle& h) : m_handle(h) {}
@@ -314,6 +335,7 @@ struct added_transfer_alert : alert {
 };
 
 struct paused_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(21)
     const static int static_category = alert::status_notification;
 
     paused_transfer_alert(const transfer_handle& h) : m_handle(h) {}
@@ -329,6 +351,7 @@ struct paused_transfer_alert : alert {
 };
 
 struct resumed_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(22)
     const static int static_category = alert::status_notification;
 
     resumed_transfer_alert(const transfer_handle& h) : m_handle(h) {}
@@ -344,6 +367,7 @@ struct resumed_transfer_alert : alert {
 };
 
 struct deleted_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(23)
     const static int static_category = alert::status_notification;
 
     deleted_transfer_alert(const md4_hash& hash) : m_hash(hash) {}
@@ -359,6 +383,7 @@ struct deleted_transfer_alert : alert {
 };
 
 struct finished_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(24)
     const static int static_category = alert::status_notification;
 
     finished_transfer_alert(const transfer_handle& h, bool has_picker) : m_handle(h), m_had_picker(has_picker) {}
@@ -375,6 +400,7 @@ struct finished_transfer_alert : alert {
 };
 
 struct file_renamed_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(25)
     const static int static_category = alert::status_notification;
 
     file_renamed_alert(const transfer_handle& h, const std::string& name) : m_handle(h), m_name(name) {}
@@ -391,6 +417,7 @@ struct file_renamed_alert : alert {
 };
 
 struct file_rename_failed_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(26)
     const static int static_category = alert::status_notification;
 
     file_rename_failed_alert(const transfer_handle& h, const error_code& error) : m_handle(h), m_error(error) {}
@@ -407,6 +434,7 @@ struct file_rename_failed_alert : alert {
 };
 
 struct storage_moved_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(27)
     const static int static_category = alert::status_notification;
 
     storage_moved_alert(const transfer_handle& h, const std::string& path) : m_handle(h), m_path(path) {}
@@ -423,6 +451,7 @@ struct storage_moved_alert : alert {
 };
 
 struct storage_moved_failed_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(28)
     const static int static_category = alert::status_notification;
 
     storage_moved_failed_alert(const transfer_handle& h, const error_code& error) : m_handle(h), m_error(error) {}
@@ -439,6 +468,7 @@ struct storage_moved_failed_alert : alert {
 };
 
 struct deleted_file_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(29)
     const static int static_category = alert::status_notification;
 
     deleted_file_alert(const transfer_handle& h, const md4_hash& hash) : m_handle(h), m_hash(hash) {}
@@ -455,6 +485,7 @@ struct deleted_file_alert : alert {
 };
 
 struct delete_failed_transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(30)
     const static int static_category = alert::status_notification;
 
     delete_failed_transfer_alert(const transfer_handle& h, const error_code& error) : m_handle(h), m_error(error) {}
@@ -471,6 +502,7 @@ struct delete_failed_transfer_alert : alert {
 };
 
 struct state_changed_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(31)
     const static int static_category = alert::status_notification;
 
     state_changed_alert(const transfer_handle& h, transfer_status::state_t new_state,
@@ -490,6 +522,7 @@ struct state_changed_alert : alert {
 };
 
 struct transfer_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(32)
     transfer_alert(transfer_handle const& h) : m_handle(h) {}
 
     virtual std::string message() const { return m_handle.is_valid() ? m_handle.hash().toString() : " - "; }
@@ -498,6 +531,7 @@ struct transfer_alert : alert {
 };
 
 struct save_resume_data_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(33)
     save_resume_data_alert(boost::shared_ptr<entry> const& rd, transfer_handle const& h)
         : transfer_alert(h), resume_data(rd) {}
 
@@ -512,6 +546,7 @@ struct save_resume_data_alert : transfer_alert {
 };
 
 struct save_resume_data_failed_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(34)
     save_resume_data_failed_alert(transfer_handle const& h, error_code const& e) : transfer_alert(h), error(e) {}
 
     error_code error;
@@ -528,6 +563,7 @@ struct save_resume_data_failed_alert : transfer_alert {
 };
 
 struct LIBED2K_EXPORT fastresume_rejected_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(35)
     fastresume_rejected_alert(transfer_handle const& h, error_code const& e) : transfer_alert(h), error(e) {}
 
     error_code error;
@@ -542,6 +578,7 @@ struct LIBED2K_EXPORT fastresume_rejected_alert : transfer_alert {
 };
 
 struct LIBED2K_EXPORT peer_blocked_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(36)
     peer_blocked_alert(transfer_handle const& h, address const& ip_) : transfer_alert(h), ip(ip_) {}
 
     address ip;
@@ -557,6 +594,7 @@ struct LIBED2K_EXPORT peer_blocked_alert : transfer_alert {
 };
 
 struct LIBED2K_EXPORT file_error_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(37)
     file_error_alert(std::string const& f, transfer_handle const& h, error_code const& e)
         : transfer_alert(h), file(f), error(e) {}
 
@@ -574,6 +612,7 @@ struct LIBED2K_EXPORT file_error_alert : transfer_alert {
 };
 
 struct transfer_checked_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(38)
     transfer_checked_alert(transfer_handle const& h) : transfer_alert(h) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new transfer_checked_alert(*this)); }
@@ -584,6 +623,7 @@ struct transfer_checked_alert : transfer_alert {
 };
 
 struct hash_failed_alert : transfer_alert {
+    LIBED2K_DEFINE_ALERT_TYPE(39)
     hash_failed_alert(transfer_handle const& h, int failed_index) : transfer_alert(h), index(failed_index) {}
 
     int index;
@@ -596,6 +636,7 @@ struct hash_failed_alert : transfer_alert {
 };
 
 struct transfer_params_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(40)
     const static int static_category = alert::status_notification;
     transfer_params_alert(const add_transfer_params& atp, const error_code& ec) : m_atp(atp), m_ec(ec) {}
 
@@ -610,6 +651,7 @@ struct transfer_params_alert : alert {
 };
 
 struct portmap_log_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(41)
     portmap_log_alert(int t, std::string const& m) : map_type(t), msg(m) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new portmap_log_alert(*this)); }
@@ -630,6 +672,7 @@ struct portmap_log_alert : alert {
 };
 
 struct portmap_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(42)
     portmap_alert(int i, int port, int t) : mapping(i), external_port(port), map_type(t) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new portmap_alert(*this)); }
@@ -652,6 +695,7 @@ struct portmap_alert : alert {
 };
 
 struct portmap_error_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(43)
     portmap_error_alert(int i, int t, error_code const& e) : mapping(i), map_type(t), error(e) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new portmap_error_alert(*this)); }
@@ -672,6 +716,7 @@ struct portmap_error_alert : alert {
 };
 
 struct udp_error_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(44)
     udp_error_alert(udp::endpoint const& ep, error_code const& ec) : endpoint(ep), error(ec) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new udp_error_alert(*this)); }
@@ -690,6 +735,7 @@ struct udp_error_alert : alert {
 };
 
 struct dht_started : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(45)
     dht_started() {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new dht_started(*this)); }
@@ -701,6 +747,7 @@ struct dht_started : alert {
 };
 
 struct dht_stopped : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(46)
     dht_stopped() {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new dht_stopped(*this)); }
@@ -712,6 +759,7 @@ struct dht_stopped : alert {
 };
 
 struct dht_traverse_finished : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(47)
     dht_traverse_finished(const md4_hash& h) : hash(h) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new dht_traverse_finished(*this)); }
@@ -724,6 +772,7 @@ struct dht_traverse_finished : alert {
 };
 
 struct dht_announce_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(48)
     dht_announce_alert(address const& ip_, int port_, md4_hash const& info_hash_)
         : ip(ip_), port(port_), info_hash(info_hash_) {}
 
@@ -745,6 +794,7 @@ struct dht_announce_alert : alert {
 };
 
 struct dht_get_peers_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(49)
     dht_get_peers_alert(md4_hash const& info_hash_) : info_hash(info_hash_) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new dht_get_peers_alert(*this)); }
@@ -763,6 +813,7 @@ struct dht_get_peers_alert : alert {
 };
 
 struct external_ip_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(50)
     external_ip_alert(address const& ip) : external_address(ip) {}
 
     virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new external_ip_alert(*this)); }
@@ -780,6 +831,7 @@ struct external_ip_alert : alert {
 };
 
 struct dht_keyword_search_result_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(51)
     dht_keyword_search_result_alert(const md4_hash& h, const std::deque<kad_info_entry>& entries)
         : m_hash(h), m_entries(entries) {}
 
@@ -796,6 +848,24 @@ struct dht_keyword_search_result_alert : alert {
     md4_hash m_hash;
     std::deque<kad_info_entry> m_entries;
 };
+
+/**
+  * changes of top ranked files of a search merged by session,
+  * see session_settings::aggregate_search_results
+ */
+struct search_results_alert : alert {
+    LIBED2K_DEFINE_ALERT_TYPE(52)
+    const static int static_category = alert::server_notification;
+
+    search_results_alert(const search_results_delta& delta) : m_delta(delta) {}
+
+    virtual int category() const { return static_category; }
+    virtual std::string message() const { return "search results updated"; }
+    virtual char const* what() const { return "search results"; }
+    virtual std::auto_ptr<alert> clone() const { return std::auto_ptr<alert>(new search_results_alert(*this)); }
+
+    search_results_delta m_delta;
+};
 }
 
 #endif  //__LIBED2K_ALERT_TYPES__
@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_ALLOCATOR_HPP_INCLUDED
 
 #include <cstddef>
+#include <utility>
 #include <libed2k/config.hpp>
 
 namespace libed2k {
@@ -48,6 +49,25 @@ struct LIBED2K_EXTRA_EXPORT page_aligned_allocator {
     static void free(char* const block);
 };
 
+/**
+  * allocates chunks backed by huge pages to cut TLB misses of large disk
+  * caches. Explicit huge pages (MAP_HUGETLB) are tried first, then the
+  * mapping is aligned to the huge page size and advised for transparent
+  * huge pages. Falls back to page_aligned_allocator where not supported
+ */
+struct LIBED2K_EXTRA_EXPORT huge_page_allocator {
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    static int huge_page_size();
+    static char* malloc(const size_type bytes);
+    static void free(char* const block);
+
+    // the [start, end) range of the chunk p points into,
+    // or (0, 0) if it isn't part of any
+    static std::pair<char*, char*> mapping(char const* p);
+};
+
 struct LIBED2K_EXTRA_EXPORT aligned_holder {
     aligned_holder() : m_buf(0) {}
     aligned_holder(int size) : m_buf(page_aligned_allocator::malloc(size)) {}
@@ -0,0 +1,28 @@
+#ifndef __LIBED2K_BANDWIDTH_CLASS__
+#define __LIBED2K_BANDWIDTH_CLASS__
+
+#include <string>
+
+namespace libed2k {
+
+/**
+  * named node of the tree of bandwidth classes. Peers are put in a class by their
+  * address with session::set_bandwidth_class_filter, transfers with
+  * transfer_handle::set_bandwidth_class. Classes under a common parent share the
+  * bandwidth of the parent by weight, every class may have limits of its own
+ */
+struct bandwidth_class {
+    bandwidth_class()
+        : parent(-1), weight(1), upload_limit(0), download_limit(0), upload_burst(0), download_burst(0) {}
+
+    std::string name;
+    int parent;          //!< index of the parent class or -1
+    int weight;          //!< share of the parent bandwidth relative to the sibling classes
+    int upload_limit;    //!< bytes per second, 0 is unlimited
+    int download_limit;  //!< bytes per second, 0 is unlimited
+    int upload_burst;    //!< bytes above one second of the limit saved up while idle, 0 is two seconds
+    int download_burst;
+};
+}
+
+#endif  //__LIBED2K_BANDWIDTH_CLASS__
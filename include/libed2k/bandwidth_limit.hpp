@@ -53,6 +53,10 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_channel {
         return int(m_limit);
     }
 
+    // bytes beyond one second of the limit the channel may
+    // save up while idle. 0 means two seconds of the limit
+    void burst(int bytes);
+
     int quota_left() const;
     void update_quota(int dt_milliseconds);
 
@@ -62,12 +66,20 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_channel {
     void return_quota(int amount);
     void use_quota(int amount);
 
-    // used as temporary storage while distributing
-    // bandwidth
+    // the sum of the priorities of the requests
+    // queued on this channel
     int tmp;
 
-    // this is the number of bytes to distribute this round
-    int distribute_quota;
+    // the channel of the parent bandwidth class. Its bandwidth
+    // is shared among the child channels with requests by weight
+    bandwidth_channel* parent;
+    int weight;
+
+    // sum of the weights of the child channels with requests
+    int tmp_weight;
+
+    // quota held back for the requests that found the channel drained
+    int reserved;
 
    private:
     // this is the amount of bandwidth we have
@@ -77,6 +89,8 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_channel {
     // the limit is the number of bytes
     // per second we are allowed to use.
     boost::int64_t m_limit;
+
+    boost::int64_t m_burst;
 };
 }
 
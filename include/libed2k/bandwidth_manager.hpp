@@ -34,46 +34,89 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_BANDWIDTH_MANAGER_HPP_INCLUDED
 
 #include <vector>
-#include <boost/intrusive_ptr.hpp>
 
 #include "libed2k/bandwidth_limit.hpp"
 #include "libed2k/bandwidth_queue_entry.hpp"
+#include "libed2k/bandwidth_socket.hpp"
 #include "libed2k/ptime.hpp"
 
-using boost::intrusive_ptr;
-
 namespace libed2k {
 
+/**
+  * hands out the quota of the bandwidth channels to the peers waiting for it.
+  * Waiting requests earn their quantum per slice in a deficit round robin and
+  * are parked in a timer wheel until their deficit and the quota of their
+  * channels cover the next grant, so a slice only visits the requests due in it.
+  * A request earns for the time it waited once it is due
+ */
 struct LIBED2K_EXTRA_EXPORT bandwidth_manager {
+    enum {
+        wheel_size = 512,  //!< slots of the timer wheel, one slice each
+        min_grant = 1024,  //!< smaller grants are saved up unless the request is smaller
+        max_wait = 2000    //!< milliseconds after which a slow request gets what it earned
+    };
+
     bandwidth_manager(int channel);
 
     void close();
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
-    bool is_queued(const peer_connection* peer) const;
+    bool is_queued(const bandwidth_socket* peer) const;
 #endif
 
     int queue_size() const;
     int queued_bytes() const;
 
-    // non prioritized means that, if there's a line for bandwidth,
-    // others will cut in front of the non-prioritized peers.
-    // this is used by web seeds
+    // the length of a scheduler round in milliseconds
+    void set_slice(int ms);
+    int slice() const { return m_slice; }
+
     // returns the number of bytes to assign to the peer, or 0
     // if the peer's 'assign_bandwidth' callback will be called later
-    int request_bandwidth(const intrusive_ptr<peer_connection>& peer, int blk, int priority,
-                          bandwidth_channel* chan1 = 0, bandwidth_channel* chan2 = 0, bandwidth_channel* chan3 = 0,
-                          bandwidth_channel* chan4 = 0, bandwidth_channel* chan5 = 0);
+    // chan holds num_channels channels, which may be 0
+    int request_bandwidth(bandwidth_socket* peer, int blk, int priority, bandwidth_channel* const* chan,
+                          int num_channels);
+
+    // drops the request of a peer going away, together with
+    // the quota it holds back on its channels
+    void cancel(const bandwidth_socket* peer);
 
 #ifdef LIBED2K_DEBUG
     void check_invariant() const;
 #endif
 
+    // refills the channels and runs the slices elapsed in dt
     void update_quotas(time_duration const& dt);
 
-    // these are the consumers that want bandwidth
+   private:
     typedef std::vector<bw_request> queue_t;
-    queue_t m_queue;
+
+    void enqueue(const bw_request& r);
+    void dequeue(const bw_request& r);
+    void park(bw_request& r, int slices, bool drained);
+    bool cancel(queue_t& q, const bandwidth_socket* peer);
+
+    // runs the requests of a slot, granted ones are
+    // appended to granted
+    void run_slot(queue_t& slot, queue_t& granted);
+
+    // the requests waiting for bandwidth, by the slice they are due in
+    std::vector<queue_t> m_wheel;
+    // the requests that found their channels drained, served first in their slice
+    std::vector<queue_t> m_drained;
+    int m_wheel_pos;
+    // the number of slices run so far
+    int m_now;
+
+    // the channels with queued requests, refilled every update
+    std::vector<bandwidth_channel*> m_channels;
+
+    int m_slice;
+    // milliseconds not making up a whole slice yet
+    int m_elapsed;
+
+    int m_queue_size;
+
     // the number of bytes all the requests in queue are for
     int m_queued_bytes;
 
@@ -33,17 +33,23 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef LIBED2K_BANDWIDTH_QUEUE_ENTRY_HPP_INCLUDED
 #define LIBED2K_BANDWIDTH_QUEUE_ENTRY_HPP_INCLUDED
 
-#include <boost/intrusive_ptr.hpp>
 #include "libed2k/bandwidth_limit.hpp"
+#include "libed2k/bandwidth_socket.hpp"
 
 namespace libed2k {
 
-class peer_connection;
-
 struct LIBED2K_EXTRA_EXPORT bw_request {
-    bw_request(boost::intrusive_ptr<peer_connection> const& pe, int blk, int prio);
+    // global, transfer and peer channels and the
+    // channels of the bandwidth classes
+    enum { max_channels = 10 };
+
+    bw_request(bandwidth_socket* pe, int blk, int prio);
+    bw_request(bw_request const& r);
+    ~bw_request();
+    bw_request& operator=(bw_request const& r);
 
-    boost::intrusive_ptr<peer_connection> peer;
+    // referenced as long as the request exists
+    bandwidth_socket* peer;
     // 1 is normal prio
     int priority;
     // the number of bytes assigned to this request so far
@@ -51,17 +57,22 @@ struct LIBED2K_EXTRA_EXPORT bw_request {
     // once assigned reaches this, we dispatch the request function
     int request_size;
 
-    // the max number of rounds for this request to survive
-    // this ensures that requests gets responses at very low
-    // rate limits, when the requested size would take a long
-    // time to satisfy
-    int ttl;
+    // bytes the request has earned in the deficit round robin
+    // but not been handed out yet
+    int deficit;
+
+    // the quota this request holds back on its channels
+    int reserved;
+
+    // the slice the request last earned its quantum in
+    int since;
 
-    // loops over the bandwidth channels and assigns bandwidth
-    // from the most limiting one
-    int assign_bandwidth();
+    // the bytes this request earns in ms milliseconds. It's the
+    // share of the most limiting channel, split among the sibling
+    // classes by weight and among the requests of a class by priority
+    int quantum(int ms) const;
 
-    bandwidth_channel* channel[5];
+    bandwidth_channel* channel[max_channels];
 };
 }
 
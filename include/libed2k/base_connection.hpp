@@ -18,6 +18,7 @@
 #include "libed2k/config.hpp"
 #include "libed2k/size_type.hpp"
 #include "libed2k/socket.hpp"
+#include "libed2k/socket_type.hpp"
 #include "libed2k/chained_buffer.hpp"
 #include "libed2k/log.hpp"
 #include "libed2k/archive.hpp"
@@ -38,7 +39,7 @@ class base_connection : public intrusive_ptr_base<base_connection>, public boost
 
    public:
     base_connection(aux::session_impl& ses);
-    base_connection(aux::session_impl& ses, boost::shared_ptr<tcp::socket> s, const tcp::endpoint& remote);
+    base_connection(aux::session_impl& ses, boost::shared_ptr<socket_type> s, const tcp::endpoint& remote);
     virtual ~base_connection();
 
     virtual void disconnect(const error_code& ec, int error = 0);
@@ -47,7 +48,7 @@ class base_connection : public intrusive_ptr_base<base_connection>, public boost
     /** connection closed when his socket is not opened */
     bool is_closed() const { return !m_socket || !m_socket->is_open(); }
     const tcp::endpoint& remote() const { return m_remote; }
-    boost::shared_ptr<tcp::socket> socket() { return m_socket; }
+    boost::shared_ptr<socket_type> socket() { return m_socket; }
 
     const stat& statistics() const { return m_statistics; }
 
@@ -147,7 +148,8 @@ class base_connection : public intrusive_ptr_base<base_connection>, public boost
     void add_handler(std::pair<proto_type, proto_type> ptype, packet_handler handler);
 
     aux::session_impl& m_ses;
-    boost::shared_ptr<tcp::socket> m_socket;
+    // a TCP or, between libed2k peers, a uTP stream
+    boost::shared_ptr<socket_type> m_socket;
     deadline_timer m_deadline;          //!< deadline timer for reading operations
     libed2k_header m_in_header;         //!< incoming message header
     socket_buffer m_in_container;       //!< buffer for incoming messages
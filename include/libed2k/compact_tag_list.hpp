@@ -0,0 +1,148 @@
+#ifndef __LIBED2K_COMPACT_TAG_LIST__
+#define __LIBED2K_COMPACT_TAG_LIST__
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include "libed2k/ctag.hpp"
+
+namespace libed2k {
+
+/**
+  * storage of compact_tag_list independent of the list size type
+  * each tag is one fixed size entry, tag names, strings, blobs and hashes
+  * live in a single arena buffer referenced by offset
+ */
+class compact_tag_storage {
+   public:
+    typedef boost::shared_ptr<base_tag> value_type;
+    static const size_t npos = size_t(-1);
+
+    /**
+      * tag type, name and numeric value or arena position of value
+     */
+    struct entry {
+        tg_type type;  //!< type as on the wire, compressed string types keep their length
+        tg_nid_type name_id;
+        bool new_ed2k;  //!< save name id in the short form
+        boost::uint16_t name_size;
+        boost::uint32_t name_offset;
+        union {
+            boost::uint64_t int_value;
+            float float_value;
+            bool bool_value;
+            struct {
+                boost::uint32_t offset;
+                boost::uint32_t size;
+            } data;  //!< strings, blobs and hashes
+        };
+    };
+
+    void clear();
+    void reserve(size_t tags, size_t bytes);
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+
+    tg_nid_type getTagNameId(size_t n) const {
+        LIBED2K_ASSERT(n < m_entries.size());
+        return m_entries[n].name_id;
+    }
+
+    tg_type getTagType(size_t n) const {
+        LIBED2K_ASSERT(n < m_entries.size());
+        return m_entries[n].type;
+    }
+
+    std::string getTagName(size_t n) const;
+
+    /**
+      * index of first tag with name id or name, npos when list has no such tag
+     */
+    size_t find(tg_nid_type nId) const;
+    size_t find(const std::string& strName) const;
+
+    /**
+      * tag values, throw incompatible_tag_getter when tag has other type
+     */
+    boost::uint64_t asInt(size_t n) const;
+    std::string asString(size_t n) const;
+    bool asBool(size_t n) const;
+    float asFloat(size_t n) const;
+    std::vector<char> asBlob(size_t n) const;
+    md4_hash asHash(size_t n) const;
+
+    /**
+      * tag objects built on demand for code working with tag_list
+     */
+    const value_type operator[](size_t n) const;
+    const value_type getTagByNameId(tg_nid_type nId) const;
+    const value_type getTagByName(const std::string& strName) const;
+
+    /**
+      * return special tag as string or int
+      * if tag not exists or his type is not string returns empty string or zero int
+     */
+    std::string getStringTagByNameId(tg_nid_type nId) const;
+    std::string getStringTagByName(const std::string& strName) const;
+    boost::uint64_t getIntTagByNameId(tg_nid_type nId) const;
+    boost::uint64_t getIntTagByName(const std::string& strName) const;
+
+    /**
+      * copy tag value into storage
+     */
+    void add_tag(value_type ptag);
+    void push_back(value_type ptag) { add_tag(ptag); }
+
+    void dump() const;
+
+    friend bool operator==(const compact_tag_storage& t1, const compact_tag_storage& t2);
+
+   protected:
+    void load_tags(archive::ed2k_iarchive& ar, size_t count);
+    void save_tags(archive::ed2k_oarchive& ar) const;
+
+   private:
+    boost::uint32_t append(const char* p, size_t n);
+    boost::uint32_t allocate(size_t n);
+    const char* data(boost::uint32_t offset) const { return &m_arena[0] + offset; }
+    bool is_int(size_t n) const;
+    bool is_string(size_t n) const;
+
+    std::vector<entry> m_entries;
+    std::vector<char> m_arena;
+};
+
+/**
+  * tag list with the same wire format and getters as tag_list
+  * without a heap object per tag, used where many lists are decoded
+ */
+template <typename size_type>
+class compact_tag_list : public compact_tag_storage {
+   public:
+    compact_tag_list() {}
+
+    template <typename U>
+    explicit compact_tag_list(const tag_list<U>& list) {
+        for (typename tag_list<U>::const_iterator i = list.begin(); i != list.end(); ++i) add_tag(*i);
+    }
+
+    void save(archive::ed2k_oarchive& ar) {
+        size_type nSize = static_cast<size_type>(size());
+        ar& nSize;
+        save_tags(ar);
+    }
+
+    void load(archive::ed2k_iarchive& ar) {
+        size_type nSize;
+        ar& nSize;
+        load_tags(ar, nSize);
+    }
+
+    LIBED2K_SERIALIZATION_SPLIT_MEMBER()
+};
+
+inline bool operator!=(const compact_tag_storage& t1, const compact_tag_storage& t2) { return !(t1 == t2); }
+}
+
+#endif  //__LIBED2K_COMPACT_TAG_LIST__
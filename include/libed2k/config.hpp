@@ -207,6 +207,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_USE_NETLINK 1
 #define LIBED2K_USE_IFCONF 1
 #define LIBED2K_HAS_SALEN 0
+#define LIBED2K_USE_HUGE_PAGES 1
 
 // ==== MINGW ===
 #elif defined __MINGW32__
@@ -455,6 +456,20 @@ inline int snprintf(char* buf, int len, char const* fmt, ...) {
 #define LIBED2K_USE_I2P 0
 #endif
 
+#ifndef LIBED2K_USE_HUGE_PAGES
+#define LIBED2K_USE_HUGE_PAGES 0
+#endif
+
+// storage class of plain thread local variables, disk buffer
+// pool keeps per thread buffer caches only when it is available
+#ifndef LIBED2K_THREAD_LOCAL
+#if defined _MSC_VER
+#define LIBED2K_THREAD_LOCAL __declspec(thread)
+#elif defined __GNUC__ && !defined LIBED2K_AMIGA && !defined LIBED2K_BEOS
+#define LIBED2K_THREAD_LOCAL __thread
+#endif
+#endif
+
 #ifndef LIBED2K_HAS_STRDUP
 #define LIBED2K_HAS_STRDUP 1
 #endif
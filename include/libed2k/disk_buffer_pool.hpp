@@ -39,10 +39,22 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/session_settings.hpp>
 #include <libed2k/allocator.hpp>
 
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/detail/atomic_count.hpp>
+
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+#include <map>
 #include <boost/pool/pool.hpp>
 #endif
 
+// buffers are cached per thread unless every allocation
+// has to be accounted for under the pool lock
+#if defined LIBED2K_THREAD_LOCAL && !defined LIBED2K_DISABLE_POOL_ALLOCATOR && !defined LIBED2K_DISK_STATS
+#define LIBED2K_DISK_BUFFER_CACHE
+#include <boost/thread/tss.hpp>
+#endif
+
 #ifdef LIBED2K_DISK_STATS
 #include <fstream>
 #endif
@@ -54,9 +66,7 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace libed2k {
 struct LIBED2K_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable {
     disk_buffer_pool(int block_size);
-#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
     ~disk_buffer_pool();
-#endif
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
     bool is_disk_buffer(char* buffer, mutex::scoped_lock& l) const;
@@ -77,10 +87,14 @@ struct LIBED2K_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable {
     std::ofstream m_disk_access_log;
 #endif
 
+    // also hands back the buffers cached by every thread
     void release_memory();
 
     int in_use() const { return m_in_use; }
 
+    // number of free buffers held by thread caches
+    int cached() const;
+
    protected:
     void free_buffer_impl(char* buf, mutex::scoped_lock& l);
 
@@ -88,22 +102,70 @@ struct LIBED2K_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable {
     // protocol defines the block size to BLOCK_SIZE.
     const int m_block_size;
 
-    // number of disk buffers currently allocated
-    int m_in_use;
+    // number of disk buffers currently allocated,
+    // buffers in the thread caches are not counted
+    boost::detail::atomic_count m_in_use;
 
     session_settings m_settings;
 
    private:
+    char* pool_malloc(mutex::scoped_lock& l);
+    void pool_free(char* buf, mutex::scoped_lock& l);
+    void lock_buffer(char* buf);
+    void unlock_buffer(char* buf);
+
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    enum { max_thread_cache = 64 };
+
+    /**
+      * free buffers owned by one thread. The lock is only contended when
+      * another thread flushes the cache
+     */
+    struct buffer_cache {
+        mutex cache_mutex;
+        disk_buffer_pool* pool;  //!< 0 once the pool is destructed
+        int count;
+        char* buffers[max_thread_cache];
+    };
+
+    int thread_cache_size() const;
+    buffer_cache& thread_cache();
+
+    // hands buffers back to the pool until keep are left,
+    // the cache lock is held
+    void flush_thread_cache(buffer_cache& c, int keep);
+
+    // cleanup of m_thread_cache, runs in the exiting thread
+    static void thread_exit(buffer_cache* c);
+
+    // unique for every pool, never reused
+    const long m_id;
+
+    // caches of all threads that used this pool, guarded
+    // by the cache registry lock
+    std::vector<buffer_cache*> m_thread_caches;
+    boost::thread_specific_ptr<buffer_cache> m_thread_cache;
+#endif
+
     mutable mutex m_pool_mutex;
 
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
     // memory pool for read and write operations
     // and disk cache
     boost::pool<page_aligned_allocator> m_pool;
+
+    // used instead when disk_cache_huge_pages is set
+    boost::pool<huge_page_allocator> m_huge_pool;
+    bool m_huge_pages;  //!< m_huge_pool has ever been used
+
+    // start -> end of the chunks of m_huge_pool, buffers are
+    // freed to the pool whose chunk they fall in
+    std::map<char*, char*> m_huge_chunks;
+    bool is_huge_buffer(char* buf) const;
 #endif
 
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
-    int m_allocations;
+    boost::detail::atomic_count m_allocations;
 #endif
 #ifdef LIBED2K_DISK_STATS
    public:
@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/allocator.hpp>
 #include <libed2k/io_service.hpp>
 #include <libed2k/sliding_average.hpp>
+#include <libed2k/metrics.hpp>
 
 #include <boost/function/function0.hpp>
 #include <boost/function/function2.hpp>
@@ -44,16 +45,19 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/shared_array.hpp>
 #include <boost/optional.hpp>
 #include <deque>
+#include <map>
 #include <list>
 
 #include <libed2k/config.hpp>
 #include <libed2k/thread.hpp>
 #include <libed2k/disk_buffer_pool.hpp>
+#include <libed2k/hash_pool.hpp>
 #include <libed2k/constants.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 
 namespace libed2k {
@@ -63,6 +67,7 @@ using boost::multi_index::ordered_unique;
 using boost::multi_index::indexed_by;
 using boost::multi_index::member;
 using boost::multi_index::const_mem_fun;
+using boost::multi_index::sequenced;
 
 struct cached_piece_info {
     int piece;
@@ -73,9 +78,24 @@ struct cached_piece_info {
     kind_t kind;
 };
 
+// part of a read cache block handed out without copying it
+struct cached_block_ref {
+    cached_block_ref() : buf(0), offset(0), size(0) {}
+    char* buf;  //!< the cache block, pinned until released
+    int offset;
+    int size;
+};
+
 struct disk_io_job {
     disk_io_job()
-        : action(read), buffer(0), buffer_size(0), piece(0), offset(0), max_cache_line(0), cache_min_time(0) {}
+        : action(read),
+          buffer(0),
+          buffer_size(0),
+          piece(0),
+          offset(0),
+          max_cache_line(0),
+          cache_min_time(0),
+          flags(0) {}
 
     enum action_t {
         read,
@@ -94,7 +114,8 @@ struct disk_io_job {
         update_settings,
         read_and_hash,
         cache_piece,
-        finalize_file
+        finalize_file,
+        read_ahead
     };
 
     action_t action;
@@ -121,6 +142,17 @@ struct disk_io_job {
     // line caused by this operation stays in the cache
     int cache_min_time;
 
+    enum flags_t {
+        // a read may be answered with references to the read cache
+        // blocks in refs instead of a copy in buffer
+        reference_cache = 1
+    };
+    int flags;
+
+    // for reads with reference_cache, the cache blocks holding the
+    // data if buffer is 0. A read crosses at most one block boundary
+    cached_block_ref refs[2];
+
     boost::shared_ptr<entry> resume_data;
 
     // the error code from the file operation
@@ -148,6 +180,8 @@ struct cache_status {
           writes(0),
           blocks_read(0),
           blocks_read_hit(0),
+          blocks_read_miss(0),
+          ghost_hits(0),
           reads(0),
           queued_bytes(0),
           cache_size(0),
@@ -180,6 +214,11 @@ struct cache_status {
     size_type blocks_read;
     // the number of blocks that was just copied from the read cache
     size_type blocks_read_hit;
+    // the number of blocks the read cache had to read from disk
+    size_type blocks_read_miss;
+    // the number of pieces protected by read_2q cache because
+    // they were read again shortly after they were evicted
+    size_type ghost_hits;
     // the number of read operations used
     size_type reads;
 
@@ -237,10 +276,17 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     size_type queue_buffer_size() const;
     bool can_write() const;
 
+    // drops a reference to a read cache block handed out
+    // in disk_io_job::refs
+    void release_block(char* buf);
+
     void get_cache_info(md4_hash const& ih, std::vector<cached_piece_info>& ret) const;
 
     cache_status status() const;
 
+    // adds the queue times of the jobs to m
+    void metrics(session_metrics& m) const;
+
     void thread_fun();
 
 #ifdef LIBED2K_DEBUG
@@ -257,6 +303,10 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
         boost::function<void(int, disk_io_job const&)> callback;
     };
 
+    // read cache keeps pieces in probation_queue, read_2q moves
+    // a piece to protected_queue on a ghost hit
+    enum read_queue_t { probation_queue, protected_queue };
+
     struct cached_piece_entry {
         int piece;
         // storage this piece belongs to
@@ -276,20 +326,44 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
         // is used to determine if flushing a range would force us
         // to read it back later when hashing
         int next_block_to_hash;
+        // read_queue_t of a read cache piece, write cache
+        // pieces are always in probation_queue
+        int queue;
 
         std::pair<void*, int> storage_piece_pair() const { return std::pair<void*, int>(storage.get(), piece); }
+        // eviction order, oldest piece of probation queue first
+        std::pair<int, libed2k::ptime> queue_expire_pair() const {
+            return std::pair<int, libed2k::ptime>(queue, expire);
+        }
     };
 
     typedef multi_index_container<
         cached_piece_entry,
         indexed_by<ordered_unique<const_mem_fun<cached_piece_entry, std::pair<void*, int>,
                                                 &cached_piece_entry::storage_piece_pair> >,
-                   ordered_non_unique<member<cached_piece_entry, libed2k::ptime, &cached_piece_entry::expire> > > >
+                   ordered_non_unique<const_mem_fun<cached_piece_entry, std::pair<int, libed2k::ptime>,
+                                                    &cached_piece_entry::queue_expire_pair> > > >
         cache_t;
 
     typedef cache_t::nth_index<0>::type cache_piece_index_t;
     typedef cache_t::nth_index<1>::type cache_lru_index_t;
 
+    // piece recently evicted from probation queue and the
+    // blocks it held
+    struct ghost_entry {
+        void* storage;
+        int piece;
+        int start_block;
+        int end_block;
+
+        std::pair<void*, int> storage_piece_pair() const { return std::pair<void*, int>(storage, piece); }
+    };
+
+    typedef multi_index_container<
+        ghost_entry, indexed_by<sequenced<>, ordered_unique<const_mem_fun<ghost_entry, std::pair<void*, int>,
+                                                                          &ghost_entry::storage_piece_pair> > > >
+        ghost_t;
+
    private:
     int add_job(disk_io_job const& j, mutex::scoped_lock& l, boost::function<void(int, disk_io_job const&)> const& f =
                                                                  boost::function<void(int, disk_io_job const&)>());
@@ -325,6 +399,16 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     int cache_read_block(disk_io_job const& j, mutex::scoped_lock& l);
     int free_piece(cached_piece_entry& p, mutex::scoped_lock& l);
     int drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf, mutex::scoped_lock& l);
+    // adds the buffer of a block leaving the read cache to buf,
+    // unless peers still reference it
+    void evict_block(char* block, std::vector<char*>& buf, mutex::scoped_lock& l);
+    cache_piece_index_t::iterator insert_read_piece(cached_piece_entry const& p, int start_block);
+    void touch_read_piece(cache_piece_index_t::iterator p, int cache_min_time);
+    cache_piece_index_t::iterator erase_read_piece(cache_piece_index_t::iterator p);
+    void add_ghost_piece(cached_piece_entry const& p);
+    // ghosts are keyed by the storage address, which a new
+    // storage may reuse once this one is released
+    void purge_ghost_pieces(void* storage, mutex::scoped_lock& l);
 
     enum cache_flags_t { cache_only = 1 };
     int try_read_from_cache(disk_io_job const& j, bool& hit, int flags = 0);
@@ -332,8 +416,14 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     int cache_piece(disk_io_job const& j, cache_piece_index_t::iterator& p, bool& hit, int options,
                     mutex::scoped_lock& l);
 
-    // this mutex only protects m_jobs, m_queue_buffer_size,
-    // m_exceeded_write_queue and m_abort
+    // sequential read ahead
+    void read_ahead(disk_io_job const& j);
+    int read_ahead_piece(disk_io_job const& j, int piece, int start_block, int num_blocks, mutex::scoped_lock& l);
+    // forgets the read streams and pending read ahead of a storage
+    void purge_read_streams(void* storage);
+
+    // this mutex only protects m_jobs, m_read_ahead_jobs,
+    // m_queue_buffer_size, m_exceeded_write_queue and m_abort
     mutable mutex m_queue_mutex;
     event m_signal;
     bool m_abort;
@@ -341,8 +431,16 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     std::deque<disk_io_job> m_jobs;
     size_type m_queue_buffer_size;
 
+    // read ahead jobs, only picked when there's nothing else to do
+    std::deque<disk_io_job> m_read_ahead_jobs;
+
     libed2k::ptime m_last_file_check;
 
+    // bytes file checks may read before file_checks_rate_limit
+    // is exceeded, refilled as time passes
+    size_type m_check_quota;
+    libed2k::ptime m_last_check_quota;
+
     // this protects the piece cache and related members
     mutable mutex m_piece_mutex;
     // write cache
@@ -351,6 +449,39 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     // read cache
     cache_t m_read_pieces;
 
+    // number of read cache pieces in probation_queue
+    int m_probation_pieces;
+
+    // pieces recently evicted from the read cache probation queue
+    ghost_t m_ghost_pieces;
+
+    // a peer reading a file sequentially, matched by the
+    // offset its next read is expected at
+    struct read_stream {
+        void* storage;
+        // file offset following the last read
+        size_type next;
+        // end of the range read ahead
+        size_type ahead;
+        // bytes read sequentially since start
+        size_type bytes;
+        int reads;
+        libed2k::ptime start;
+        libed2k::ptime last;
+    };
+
+    // only used by the disk thread
+    std::vector<read_stream> m_read_streams;
+
+    // read cache blocks referenced by send buffers. An evicted
+    // block is freed when its last reference is released
+    struct pinned_block {
+        pinned_block() : refs(0), evicted(false) {}
+        int refs;
+        bool evicted;
+    };
+    std::map<char*, pinned_block> m_pinned_blocks;
+
     void flip_stats(libed2k::ptime now);
 
     // total number of blocks in use by both the read
@@ -377,6 +508,11 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     // and insert into queue
     average_accumulator m_sort_time;
 
+    // queue time distribution of every job type, unlike the averages
+    // above these are read by the network thread
+    mutable mutex m_metrics_mutex;
+    latency_histogram m_job_queue_time[session_metrics::disk_job_types];
+
     // the last time we reset the average time and store the
     // latest value in m_cache_stats
     libed2k::ptime m_last_stats_flip;
@@ -420,6 +556,10 @@ struct LIBED2K_EXTRA_EXPORT disk_io_thread : disk_buffer_pool {
     // in this list
     std::list<std::pair<disk_io_job, int> > m_queued_completions;
 
+    // hashes pieces read by file checks, it is used by the
+    // disk thread and has to be constructed before it
+    hash_pool m_hash_pool;
+
     // thread for performing blocking disk io operations
     thread m_disk_io_thread;
 };
@@ -129,6 +129,7 @@ enum error_code_enum {
     failed_hash_check,
     invalid_escaped_string,
     file_params_making_was_cancelled,
+    invalid_resume_journal,
     num_errors
 };
 }
@@ -0,0 +1,108 @@
+#ifndef __LIBED2K_EVENT_LOG__
+#define __LIBED2K_EVENT_LOG__
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/error_code.hpp"
+
+namespace libed2k {
+
+/**
+  * binary event log for production builds. Every thread writes fixed records
+  * into a ring of its own without locking, a background thread drains the
+  * rings into the log file. Records of disabled categories cost one load and
+  * a branch, so the calls stay in release builds. test/eventlog decodes the file
+ */
+enum event_category {
+    session_events = 1 << 0,
+    peer_events = 1 << 1,
+    bandwidth_events = 1 << 2,
+    disk_events = 1 << 3,
+    transfer_events = 1 << 4,
+    all_events = 0xff
+};
+
+/**
+  * the upper byte of an id is the bit of its category. Ids are stored in
+  * log files, so they are never reused or renumbered
+ */
+enum event_id {
+    ev_log_opened = 0x000,     //!< version
+    ev_events_dropped,         //!< thread, count
+    ev_peer_connect = 0x100,   //!< ip, port
+    ev_peer_connected,         //!< ip, port
+    ev_peer_disconnect,        //!< ip, port, error
+    ev_peer_send_block,        //!< ip, piece, start, length
+    ev_peer_receive_block,     //!< ip, piece, start, length
+    ev_bw_request = 0x200,     //!< channel, bytes, priority, queued requests
+    ev_bw_grant,               //!< channel, bytes, queued requests
+    ev_disk_job = 0x300,       //!< action, piece, offset, result
+    ev_piece_passed = 0x400,   //!< piece
+    ev_piece_failed,           //!< piece
+    ev_transfer_finished       //!< pieces
+};
+
+/**
+  * on disk record, in host byte order
+ */
+struct event_record {
+    boost::uint64_t time;    //!< microseconds since the log was opened
+    boost::uint16_t id;
+    boost::uint16_t thread;  //!< ring of the thread that wrote it
+    boost::int32_t arg[5];
+};
+
+struct event_log_header {
+    char magic[4];
+    boost::uint8_t version;
+    boost::uint8_t record_size;
+    boost::uint16_t reserved;
+    boost::uint32_t byte_order;  //!< event_log_byte_order as written by the host
+    boost::uint32_t reserved2;
+    boost::uint64_t start;  //!< seconds since epoch when the log was opened
+};
+
+const boost::uint32_t event_log_byte_order = 0x01020304;
+
+struct event_info {
+    const char* name;
+    const char* args[5];
+};
+
+/**
+  * name and argument names of event id, 0 when the id is unknown
+ */
+LIBED2K_EXPORT const event_info* describe_event(int id);
+
+/**
+  * start writing events of categories to a new log file at path,
+  * session events are always written
+ */
+LIBED2K_EXPORT bool open_event_log(const std::string& path, int categories, error_code& ec);
+
+/**
+  * stop logging and write the events still in the rings
+ */
+LIBED2K_EXPORT void close_event_log();
+
+/**
+  * change the logged categories of the open log
+ */
+LIBED2K_EXPORT void set_event_categories(int categories);
+
+namespace aux {
+extern LIBED2K_EXPORT volatile int g_event_categories;
+LIBED2K_EXPORT void write_event(int id, int a0, int a1, int a2, int a3, int a4);
+}
+
+inline int event_category_of(int id) { return 1 << (id >> 8); }
+
+inline void log_event(event_id id, int a0 = 0, int a1 = 0, int a2 = 0, int a3 = 0, int a4 = 0) {
+    if ((aux::g_event_categories & event_category_of(id)) == 0) return;
+    aux::write_event(id, a0, a1, a2, a3, a4);
+}
+}
+
+#endif  //__LIBED2K_EVENT_LOG__
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <queue>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
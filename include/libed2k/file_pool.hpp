@@ -43,13 +43,22 @@ POSSIBILITY OF SUCH DAMAGE.
 #pragma warning(pop)
 #endif
 
-#include <map>
+#include <list>
+#include <boost/unordered_map.hpp>
+#include <boost/detail/atomic_count.hpp>
 #include <libed2k/filesystem.hpp>
 #include <libed2k/time.hpp>
 #include <libed2k/thread.hpp>
 #include <libed2k/file_storage.hpp>
 
 namespace libed2k {
+/**
+  * cache of open file handles. Files are looked up in a hash table and kept
+  * in least recently used order, so opening and evicting a file doesn't
+  * depend on the number of open files. The files of a storage all live in
+  * one of num_shards shards with a mutex of its own, different storages
+  * rarely wait for each other
+ */
 struct LIBED2K_EXPORT file_pool : boost::noncopyable {
     file_pool(int size = 40);
     ~file_pool();
@@ -60,28 +69,59 @@ struct LIBED2K_EXPORT file_pool : boost::noncopyable {
     void release(void* st, int file_index);
     void resize(int size);
     int size_limit() const { return m_size; }
+    int num_open_files() const { return m_num_files; }
     void set_low_prio_io(bool b) { m_low_prio_io = b; }
 
-   private:
-    void remove_oldest();
+    /**
+      * when set, a file opened read only serves every read request as it is,
+      * even if it asks for other buffer or access flags, so all read jobs
+      * of a seed share the same handle instead of reopening it
+     */
+    void set_share_read_only(bool b) { m_share_read_only = b; }
 
-    int m_size;
-    bool m_low_prio_io;
+   private:
+    enum { num_shards = 16 };
 
     struct lru_file_entry {
         lru_file_entry() : key(0), last_use(libed2k::time_now()), mode(0) {}
         mutable boost::intrusive_ptr<file> file_ptr;
         void* key;
+        std::pair<void*, int> id;  //!< storage pointer and file index
         libed2k::ptime last_use;
         int mode;
     };
 
+    // most recently used first
+    typedef std::list<lru_file_entry> lru_list;
+
     // maps storage pointer, file index pairs to the
     // lru entry for the file
-    typedef std::map<std::pair<void*, int>, lru_file_entry> file_set;
+    typedef boost::unordered_map<std::pair<void*, int>, lru_list::iterator> file_set;
+
+    struct shard {
+        mutex lock;
+        lru_list lru;
+        file_set files;
+    };
+
+    shard& shard_of(void* st);
+
+    // closes the least recently used file of a shard holding more than
+    // its share of the pool, or of any shard when none does. The most
+    // recent file of fresh was just opened and stays open
+    bool remove_oldest(shard* fresh);
+
+    // the caller holds the lock of s
+    void remove_oldest(shard& s);
+    void erase(shard& s, lru_list::iterator i);
+
+    int m_size;
+    bool m_low_prio_io;
+    bool m_share_read_only;
 
-    file_set m_files;
-    mutex m_mutex;
+    shard m_shards[num_shards];
+    boost::detail::atomic_count m_num_files;
+    boost::detail::atomic_count m_next_shard;  //!< where remove_oldest starts to look
 
 #if LIBED2K_CLOSE_MAY_BLOCK
     void closer_thread_fun();
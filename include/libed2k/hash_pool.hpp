@@ -0,0 +1,64 @@
+#ifndef __LIBED2K_HASH_POOL__
+#define __LIBED2K_HASH_POOL__
+
+#include <deque>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libed2k/thread.hpp"
+#include "libed2k/hasher.hpp"
+
+namespace libed2k {
+
+/**
+  * one piece buffer to hash, posted by the disk thread
+ */
+struct hash_job {
+    hash_job() : data(0), size(0), small_size(0), done(false) {}
+
+    const char* data;
+    int size;
+    int small_size;        //!< when > 0 small_hash is digest of first small_size bytes
+    md4_hash hash;
+    md4_hash small_hash;
+    bool done;             //!< protected by the pool mutex
+};
+
+/**
+  * worker threads hashing piece buffers of file checks, shared
+  * by all storages so pieces of any transfer are hashed in parallel
+ */
+class hash_pool : boost::noncopyable {
+   public:
+    hash_pool();
+    ~hash_pool();
+
+    /**
+      * 0 means one thread per cpu core
+     */
+    void set_num_threads(int threads);
+    void stop();
+
+    /**
+      * job must stay alive until wait returned for it
+     */
+    void post(hash_job* j);
+    void wait(hash_job* j);
+    bool done(hash_job* j) const;
+
+   private:
+    void thread_fun();
+    static void hash(hash_job& j);
+
+    mutable mutex m_mutex;
+    condition m_job_cond;   //!< new jobs or stop
+    condition m_done_cond;  //!< finished jobs
+    std::deque<hash_job*> m_jobs;
+    std::vector<boost::shared_ptr<thread> > m_threads;
+    bool m_abort;
+};
+}
+
+#endif  //__LIBED2K_HASH_POOL__
@@ -92,6 +92,8 @@ struct dht_tracker {
 
     entry state() const;
     kad_state estate() const;
+    // the routing table contacts as written to dht_settings::state_file
+    kad_snapshot snapshot() const;
 
     void announce(md4_hash const& ih, int listen_port, boost::function<void(kad_id const&)> f);
 
@@ -100,6 +102,7 @@ struct dht_tracker {
     void search_sources(const md4_hash& ih, int listen_port, size_type size, boost::function<void(kad_id const&)> f);
 
     void dht_status(session_status& s);
+    void metrics(session_metrics& m);
     void network_stats(int& sent, int& received);
 
     // translate bittorrent kademlia message into the generic kademlia message
@@ -120,6 +123,15 @@ struct dht_tracker {
 
     bool send_packet(const udp_message& e, udp::endpoint const& addr, int send_flags);
 
+    // pings the next contacts of the loaded snapshot, returns
+    // the number of pings sent
+    int ping_snapshot();
+    void save_snapshot();
+
+    // read from dht_settings::state_file before the node is created, since
+    // the node id comes from it, and released once all its contacts are pinged
+    kad_snapshot m_snapshot;
+
     node_impl m_dht;
     libed2k::aux::session_impl& m_ses;
     rate_limited_udp_socket& m_sock;
@@ -127,6 +139,7 @@ struct dht_tracker {
     std::vector<char> m_send_buf;
 
     ptime m_last_new_key;
+    ptime m_last_snapshot;
     deadline_timer m_timer;
     deadline_timer m_connection_timer;
     deadline_timer m_refresh_timer;
@@ -70,17 +70,21 @@ class find_data : public traversal_algorithm {
 
     node_id const target() const { return m_target; }
 
+    // attaches the callbacks of another search for the same
+    // target to this one, which must not have completed yet.
+    // Returns false if the search can't be shared
+    bool join(uint8_t search_type, data_callback const& dcallback, nodes_callback const& ncallback);
+
    protected:
     void done();
     observer_ptr new_observer(void* ptr, udp::endpoint const& ep, node_id const& id);
     virtual bool invoke(observer_ptr o);
 
    private:
-    data_callback m_data_callback;
-    nodes_callback m_nodes_callback;
+    std::vector<data_callback> m_data_callbacks;
+    std::vector<nodes_callback> m_nodes_callbacks;
     node_id const m_target;
     node_id const m_id;
-    bool m_done : 1;
     bool m_got_peers : 1;
     uint8_t m_search_type;
 };
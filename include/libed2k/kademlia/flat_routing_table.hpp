@@ -0,0 +1,115 @@
+#ifndef KADEMLIA_FLAT_ROUTING_TABLE_HPP
+#define KADEMLIA_FLAT_ROUTING_TABLE_HPP
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/socket.hpp"
+#include "libed2k/kademlia/node_id.hpp"
+#include "libed2k/kademlia/node_entry.hpp"
+
+namespace libed2k {
+namespace dht {
+
+/**
+  * packed representation of a routing table contact, this is the part touched
+  * by searches. Instead of the id we keep its XOR distance to our own id as two
+  * big-endian 64 bit halves, so comparing (hi, lo) pairs gives the byte order
+ */
+struct flat_node {
+    boost::uint64_t dist_hi;
+    boost::uint64_t dist_lo;
+    boost::uint32_t ip;
+    boost::uint16_t port;
+    boost::uint16_t timeout_count;
+
+    bool confirmed() const { return timeout_count == 0; }
+};
+
+/**
+  * flat index over the nodes of routing_table, which keeps its k-bucket layout;
+  * this structure answers the hot queries only.
+  * Live nodes are kept in one array sorted by distance to our id, which makes every
+  * subtree of the id space (and so every k-bucket) a contiguous range. The nodes
+  * closest to a target are found by a binary search for the target followed by
+  * widening the range one subtree at a time until it holds enough nodes, usually a
+  * bucket or two. A full node_entry is kept in a parallel array for the results.
+  * Endpoints of live and replacement nodes are mapped to their distance by an open
+  * addressing hash, so churn in the replacement cache never moves the array
+ */
+class LIBED2K_EXTRA_EXPORT flat_routing_table {
+   public:
+    flat_routing_table(node_id const& id);
+
+    // inserts the node or refreshes id, failure counter and live state of the
+    // node already registered on this endpoint
+    void update(node_entry const& e, bool live);
+
+    void erase(udp::endpoint const& ep);
+    void clear();
+
+    // returns false when no node is registered on this endpoint
+    bool find(udp::endpoint const& ep, node_id& id, bool& live) const;
+
+    // smoothed round trip time of the node on this endpoint in
+    // milliseconds, 0xffff when it's unknown or not in the table
+    int rtt(udp::endpoint const& ep) const;
+
+    // fills the vector with up to count live nodes ordered by XOR distance to target
+    void find_closest(node_id const& target, std::vector<node_entry>& l, int count, bool include_failed) const;
+
+    // number of live nodes
+    int size() const { return int(m_nodes.size()); }
+    // number of live and replacement nodes
+    int num_endpoints() const { return m_num_endpoints; }
+
+   private:
+    struct index_entry {
+        // endpoint key, 0 marks an empty bucket
+        boost::uint64_t key;
+        boost::uint64_t dist_hi;
+        boost::uint64_t dist_lo;
+        boost::uint16_t rtt;
+        bool live;
+    };
+
+    static boost::uint64_t endpoint_key(udp::endpoint const& ep);
+
+    // returns the bucket of m_index holding key or the empty bucket where it goes
+    int probe(boost::uint64_t key) const;
+    void erase_index(int bucket);
+    void rehash(int buckets);
+
+    void insert_live(node_entry const& e, boost::uint64_t dist_hi, boost::uint64_t dist_lo);
+
+    // position of the live node with this distance and endpoint in m_nodes
+    int slot(boost::uint64_t dist_hi, boost::uint64_t dist_lo, boost::uint64_t key) const;
+    // first node whose distance is not less than (hi, lo)
+    int lower_bound(boost::uint64_t hi, boost::uint64_t lo) const;
+    // first node whose distance is greater than (hi, lo)
+    int upper_bound(boost::uint64_t hi, boost::uint64_t lo) const;
+
+    boost::uint64_t m_id_hi;
+    boost::uint64_t m_id_lo;
+
+    std::vector<flat_node> m_nodes;
+    // m_entries[i] is the full entry of m_nodes[i]
+    std::vector<node_entry> m_entries;
+
+    // linear probing, size is a power of two
+    std::vector<index_entry> m_index;
+    int m_num_endpoints;
+
+    struct ranked {
+        boost::uint64_t hi;
+        boost::uint64_t lo;
+        int slot;
+    };
+    // scratch space reused by find_closest to avoid allocations per query
+    mutable std::vector<ranked> m_ranking;
+};
+}
+}  // namespace libed2k::dht
+
+#endif  // KADEMLIA_FLAT_ROUTING_TABLE_HPP
@@ -99,6 +99,53 @@ struct kad_state {
     }
 };
 
+/**
+  * routing table contact as stored in the snapshot file of the dht tracker
+  *
+*/
+struct kad_snapshot_entry {
+    enum { verified = 1 };
+
+    net_identifier point;  //!< network byte order address and udp port
+    kad_id pid;
+    uint16_t rtt;        //!< smoothed round trip time in milliseconds, 0xffff when unknown
+    uint32_t last_seen;  //!< seconds since the epoch of the last reply, 0 for never
+    uint8_t flags;
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar& point& pid& rtt& last_seen& flags;
+    }
+};
+
+/**
+  * compact binary snapshot of the routing table, the dht tracker writes it
+  * to dht_settings::state_file and restarts from it without a bootstrap
+  *
+*/
+struct kad_snapshot {
+    enum { current_version = 1 };
+
+    kad_id self_id;
+    container_holder<uint32_t, std::vector<kad_snapshot_entry> > entries;
+
+    template <typename Archive>
+    void save(Archive& ar) {
+        uint32_t version = current_version;
+        ar& version& self_id& entries;
+    }
+
+    template <typename Archive>
+    void load(Archive& ar) {
+        uint32_t version;
+        ar& version;
+        if (version != current_version) throw libed2k_exception(errors::decode_packet_error);
+        ar& self_id& entries;
+    }
+
+    LIBED2K_SERIALIZATION_SPLIT_MEMBER()
+};
+
 struct kad_net_identifier {
     client_id_type address;
     uint16_t udp_port;
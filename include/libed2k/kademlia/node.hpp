@@ -225,7 +225,8 @@ class LIBED2K_EXTRA_EXPORT node_impl : boost::noncopyable {
     // pings the given node, and adds it to
     // the routing table if it respons and if the
     // bucket is not full.
-    void add_node(udp::endpoint node, node_id id);
+    // returns false if the ping could not be sent
+    bool add_node(udp::endpoint node, node_id id);
 
     void replacement_cache(bucket_t& nodes) const { m_table.replacement_cache(nodes); }
 
@@ -242,10 +243,17 @@ class LIBED2K_EXTRA_EXPORT node_impl : boost::noncopyable {
     }
 
     void status(libed2k::session_status& s);
+    void metrics(libed2k::session_metrics& m);
 
     dht_settings const& settings() const { return m_settings; }
 
    protected:
+    // a search for a target that is already being looked up with the
+    // same search type doesn't start another traversal, it gets the
+    // result of the running one. Returns false if there is none
+    bool join_search(node_id const& target, uint8_t search_type, find_data::data_callback const& dcallback,
+                     find_data::nodes_callback const& ncallback);
+
     dht_settings const& m_settings;
 
    private:
@@ -36,25 +36,32 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/kademlia/node_id.hpp"
 #include "libed2k/socket.hpp"
 #include "libed2k/address.hpp"
+#include "libed2k/time.hpp"
 
 namespace libed2k {
 namespace dht {
 
 struct node_entry {
-    node_entry(node_id const& id_, udp::endpoint ep, bool pinged = false)
-        : addr(ep.address()), port(ep.port()), timeout_count(pinged ? 0 : 0xffff), id(id_) {
+    node_entry(node_id const& id_, udp::endpoint ep, bool pinged = false, int roundtriptime = 0xffff)
+        : addr(ep.address()),
+          port(ep.port()),
+          timeout_count(pinged ? 0 : 0xffff),
+          rtt(roundtriptime),
+          id(id_),
+          last_seen(pinged ? time_now() : min_time()) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         first_seen = time_now();
 #endif
     }
 
-    node_entry(udp::endpoint ep) : addr(ep.address()), port(ep.port()), timeout_count(0xffff), id(0) {
+    node_entry(udp::endpoint ep)
+        : addr(ep.address()), port(ep.port()), timeout_count(0xffff), rtt(0xffff), id(0), last_seen(min_time()) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         first_seen = time_now();
 #endif
     }
 
-    node_entry() : timeout_count(0xffff), id(0) {
+    node_entry() : timeout_count(0xffff), rtt(0xffff), id(0), last_seen(min_time()) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         first_seen = time_now();
 #endif
@@ -73,6 +80,13 @@ struct node_entry {
     }
     udp::endpoint ep() const { return udp::endpoint(addr, port); }
     bool confirmed() const { return timeout_count == 0; }
+    void update_rtt(int new_rtt) {
+        if (new_rtt == 0xffff) return;
+        if (rtt == 0xffff)
+            rtt = new_rtt;
+        else
+            rtt = int(rtt) * 2 / 3 + new_rtt / 3;
+    }
 
     // TODO: replace with a union of address_v4 and address_v6
     address addr;
@@ -80,7 +94,13 @@ struct node_entry {
     // the number of times this node has failed to
     // respond in a row
     boost::uint16_t timeout_count;
+    // smoothed round trip time in milliseconds,
+    // 0xffff means it's not known yet
+    boost::uint16_t rtt;
     node_id id;
+    // the last time the node replied to us, min_time()
+    // if it never did
+    ptime last_seen;
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     ptime first_seen;
 #endif
@@ -51,6 +51,10 @@ struct traversal_algorithm;
 LIBED2K_EXTRA_EXPORT void intrusive_ptr_add_ref(observer const*);
 LIBED2K_EXTRA_EXPORT void intrusive_ptr_release(observer const*);
 
+// clock of request send times, round trip times and timeouts. It is
+// time_now_hires(), a simulation replaces it with its own clock
+LIBED2K_EXTRA_EXPORT extern ptime (*rtt_clock)();
+
 // intended struct layout (on 32 bit architectures)
 // offset size  alignment field
 // 0      8     8         sent
@@ -67,7 +71,14 @@ struct observer : boost::noncopyable {
     friend LIBED2K_EXTRA_EXPORT void intrusive_ptr_release(observer const*);
 
     observer(boost::intrusive_ptr<traversal_algorithm> const& a, udp::endpoint const& ep, node_id const& id)
-        : m_sent(), m_refs(0), m_algorithm(a), m_id(id), m_port(0), m_transaction_id(), flags(0) {
+        : m_sent(),
+          m_refs(0),
+          m_algorithm(a),
+          m_id(id),
+          m_port(0),
+          m_transaction_id(),
+          m_short_timeout(0),
+          flags(0) {
         LIBED2K_ASSERT(a);
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
         m_in_constructor = true;
@@ -115,6 +126,11 @@ struct observer : boost::noncopyable {
 
     boost::uint16_t transaction_id() const { return m_transaction_id; }
 
+    // the number of milliseconds after which the request counts
+    // as stalled, derived from the round trip time of the node
+    void set_short_timeout_ms(int ms) { m_short_timeout = boost::uint16_t(ms); }
+    int short_timeout_ms() const { return m_short_timeout; }
+
     enum {
         flag_queried = 1,
         flag_initial = 2,
@@ -155,6 +171,9 @@ struct observer : boost::noncopyable {
     // the transaction ID for this call
     boost::uint16_t m_transaction_id;
 
+    // in milliseconds
+    boost::uint16_t m_short_timeout;
+
    public:
     unsigned char flags;
 
@@ -46,6 +46,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <libed2k/kademlia/node_id.hpp>
 #include <libed2k/kademlia/node_entry.hpp>
+#include <libed2k/kademlia/flat_routing_table.hpp>
 #include <libed2k/session_settings.hpp>
 #include <libed2k/size_type.hpp>
 #include <libed2k/assert.hpp>
@@ -104,8 +105,13 @@ class LIBED2K_EXTRA_EXPORT routing_table {
     // this function is called every time the node sees
     // a sign of a node being alive. This node will either
     // be inserted in the k-buckets or be moved to the top
-    // of its bucket.
-    bool node_seen(node_id const& id, udp::endpoint ep);
+    // of its bucket. rtt is the round trip time of the
+    // request the node answered, in milliseconds
+    bool node_seen(node_id const& id, udp::endpoint ep, int rtt = 0xffff);
+
+    // the smoothed round trip time of the node on this endpoint
+    // in milliseconds, or 0xffff if we don't know
+    int node_rtt(udp::endpoint const& ep) const { return m_flat.rtt(ep); }
 
     // this may add a node to the routing table and mark it as
     // not pinged. If the bucket the node falls into is full,
@@ -200,6 +206,10 @@ class LIBED2K_EXTRA_EXPORT routing_table {
     // per IP in the whole table. Currently only for
     // IPv4
     std::multiset<address_v4::bytes_type> m_ips;
+
+    // packed copy of every node in m_buckets, live and replacement.
+    // endpoint lookups and closest-node queries are served from here
+    flat_routing_table m_flat;
 };
 }
 }  // namespace libed2k::dht
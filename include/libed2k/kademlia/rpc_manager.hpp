@@ -45,6 +45,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/kademlia/logging.hpp"
 #include "libed2k/kademlia/observer.hpp"
 #include "libed2k/ptime.hpp"
+#include "libed2k/metrics.hpp"
 #include "libed2k/packet_struct.hpp"
 
 namespace libed2k {
@@ -134,7 +135,13 @@ class LIBED2K_EXTRA_EXPORT rpc_manager {
 
     int num_allocated_observers() const { return m_allocated_observers; }
 
+    // adds the round trip times and request counters to m
+    void metrics(session_metrics& m) const;
+
    private:
+    // milliseconds until a request to this endpoint counts as stalled
+    int short_timeout(udp::endpoint const& ep) const;
+
     mutable boost::pool<> m_pool_allocator;
 
     typedef std::list<observer_ptr> transactions_t;
@@ -147,6 +154,12 @@ class LIBED2K_EXTRA_EXPORT rpc_manager {
     ptime m_timer;
     node_id m_random_number;
     int m_allocated_observers;
+    // smoothed round trip time of all replies in milliseconds, used
+    // for nodes that aren't in the routing table. -1 until we have one
+    int m_rtt_estimate;
+    latency_histogram m_rtt;
+    boost::uint64_t m_requests;
+    boost::uint64_t m_timeouts;
     bool m_destructing;
     uint16_t m_port;
 };
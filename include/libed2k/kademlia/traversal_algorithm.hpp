@@ -86,6 +86,11 @@ struct traversal_algorithm : boost::noncopyable {
     void add_router_entries();
     void init();
 
+    // true when the m_quorum closest nodes that haven't failed or
+    // stalled have all replied, the outstanding requests can't
+    // improve the result anymore
+    bool quorum_reached() const;
+
     virtual void done();
     // should construct an algorithm dependent
     // observer in ptr.
@@ -109,6 +114,10 @@ struct traversal_algorithm : boost::noncopyable {
     int m_responses;
     int m_timeouts;
     int m_num_target_nodes;
+    int m_quorum;
+    // set once done() has run. Requests still outstanding at that
+    // point are only accounted for when they complete
+    bool m_done;
 };
 }
 }  // namespace libed2k::dht
@@ -0,0 +1,133 @@
+#ifndef __LIBED2K_METRICS__
+#define __LIBED2K_METRICS__
+
+#include <map>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+
+namespace libed2k {
+
+/**
+  * log-linear histogram of durations in microseconds. Every power of two is
+  * split into sub_buckets linear buckets, so a recorded value is off by at
+  * most 1/sub_buckets of itself whatever its magnitude. Values above
+  * 2^max_bits - 1 (about 71 minutes) are counted in the last bucket.
+  * Adding a sample is a few shifts and an increment
+ */
+class LIBED2K_EXPORT latency_histogram {
+   public:
+    enum {
+        sub_bits = 4,
+        sub_buckets = 1 << sub_bits,
+        max_bits = 32,
+        num_buckets = (max_bits - sub_bits + 1) * sub_buckets
+    };
+
+    latency_histogram();
+
+    void add(boost::uint64_t us) {
+        ++m_counts[bucket(us)];
+        ++m_count;
+        m_sum += us;
+        if (us > m_max) m_max = us;
+    }
+
+    void merge(const latency_histogram& h);
+    void clear();
+
+    boost::uint64_t count() const { return m_count; }
+    boost::uint64_t sum() const { return m_sum; }
+    boost::uint64_t maximum() const { return m_max; }
+    boost::uint64_t mean() const { return m_count ? m_sum / m_count : 0; }
+
+    /**
+      * smallest value that p percent of the samples do not exceed,
+      * rounded up to the end of its bucket. 0 when there are no samples
+     */
+    boost::uint64_t percentile(double p) const;
+
+    static int bucket(boost::uint64_t us) {
+        if (us < sub_buckets) return int(us);
+        if (us >> max_bits) us = (boost::uint64_t(1) << max_bits) - 1;
+
+        // position of the highest bit above the sub bucket bits
+        boost::uint32_t m = boost::uint32_t(us >> sub_bits);
+        int shift = 0;
+        if (m >> 16) {
+            m >>= 16;
+            shift += 16;
+        }
+        if (m >> 8) {
+            m >>= 8;
+            shift += 8;
+        }
+        if (m >> 4) {
+            m >>= 4;
+            shift += 4;
+        }
+        if (m >> 2) {
+            m >>= 2;
+            shift += 2;
+        }
+        if (m >> 1) shift += 1;
+
+        return (shift + 1) * sub_buckets + int(us >> shift) - sub_buckets;
+    }
+
+    /**
+      * largest value counted in bucket b
+     */
+    static boost::uint64_t bucket_limit(int b);
+
+   private:
+    boost::uint64_t m_count;
+    boost::uint64_t m_sum;
+    boost::uint64_t m_max;
+    boost::uint64_t m_counts[num_buckets];
+};
+
+/**
+  * latency distributions and counters of the session, see session::get_metrics.
+  * Histograms and counters only grow, rates and windows are left to the reader
+  * who takes the difference of two snapshots
+ */
+struct LIBED2K_EXPORT session_metrics {
+    enum counter_t {
+        unhandled_packets,  //!< peer and server packets without a handler
+        downloads_started,  //!< transfers that switched to downloading
+        server_searches,    //!< search requests sent to the server
+        kad_requests,       //!< Kad requests sent
+        kad_timeouts,       //!< Kad requests that never got one
+        num_counters
+    };
+
+    enum { disk_job_types = 18 };
+
+    session_metrics();
+
+    latency_histogram& peer_dispatch(int protocol, int opcode) { return peer_dispatch_time[(protocol << 8) | opcode]; }
+    latency_histogram& server_dispatch(int protocol, int opcode) {
+        return server_dispatch_time[(protocol << 8) | opcode];
+    }
+
+    boost::uint64_t counters[num_counters];
+
+    // time disk jobs wait in the queue, indexed by disk_io_job::action_t
+    latency_histogram disk_queue_time[disk_job_types];
+
+    // time spent in the handler of a packet, keyed by protocol << 8 | opcode
+    std::map<int, latency_histogram> peer_dispatch_time;
+    std::map<int, latency_histogram> server_dispatch_time;
+
+    // from the time a transfer starts downloading to its first payload
+    latency_histogram time_to_first_byte;
+
+    latency_histogram kad_rpc_time;
+
+    // from a search request to the first page of results
+    latency_histogram server_search_time;
+};
+}
+
+#endif  //__LIBED2K_METRICS__
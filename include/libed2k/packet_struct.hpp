@@ -7,12 +7,14 @@
 #include <boost/cstdint.hpp>
 #include <boost/optional.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/function.hpp>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/stream.hpp>
 
 #include "libed2k/bitfield.hpp"
 #include "libed2k/ctag.hpp"
+#include "libed2k/compact_tag_list.hpp"
 #include "libed2k/util.hpp"
 #include "libed2k/assert.hpp"
 #include "libed2k/hasher.hpp"
@@ -764,6 +766,64 @@ struct search_result {
     LIBED2K_SERIALIZATION_SPLIT_MEMBER()
 };
 
+/**
+  * shared file item with all tags in one buffer, see compact_tag_list
+ */
+struct compact_file_entry {
+    md4_hash m_hFile;
+    net_identifier m_network_point;
+    compact_tag_list<boost::uint32_t> m_list;
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar& m_hFile& m_network_point& m_list;
+    }
+
+    void to_shared_file_entry(shared_file_entry& entry) const;
+};
+
+/**
+  * called for each decoded search result entry on the network thread,
+  * returns false when entry must not be reported in the search result alert
+ */
+typedef boost::function<bool(const compact_file_entry&)> search_result_sink;
+
+/**
+  * decodes search result packet entry by entry instead of loading whole
+  * search_result, entry object and its buffers are reused for all entries
+ */
+class search_result_decoder {
+   public:
+    search_result_decoder(archive::ed2k_iarchive& ar);
+
+    /**
+      * decode next entry, returns false when all entries were decoded
+     */
+    bool next();
+
+    /**
+      * decode next entry straight into entry, entry() is not updated
+     */
+    bool next(shared_file_entry& entry);
+
+    const compact_file_entry& entry() const { return m_entry; }
+    boost::uint32_t size() const { return m_count; }
+
+    /**
+      * valid after next() returned false
+     */
+    bool more_results_available() const { return m_more != 0; }
+
+   private:
+    bool finished();
+
+    archive::ed2k_iarchive& m_ar;
+    boost::uint32_t m_count;
+    boost::uint32_t m_decoded;
+    char m_more;
+    compact_file_entry m_entry;
+};
+
 /**
   * request sources for file
  */
@@ -1758,6 +1818,9 @@ struct misc_options {
 #define MULTIP_OFFSET 5
 #define SRC_EXT_OFFSET 10
 #define CAPTHA_OFFSET 11
+// not an eMule bit, libed2k clients accepting uTP on the UDP
+// port numbered like their TCP listen port set it
+#define UTP_OFFSET 24
 
 /**
   * peer connection internal structure
@@ -1775,11 +1838,13 @@ struct misc_options2 {
     bool support_source_ext2() const;
     bool support_ext_multipacket() const;
     bool support_large_files() const;
+    bool support_utp() const;
 
     void set_captcha();
     void set_source_ext2();
     void set_ext_multipacket();
     void set_large_files();
+    void set_utp();
 
     boost::uint32_t generate() const;
 };
@@ -1,40 +1,25 @@
 #ifndef __LIBED2K_PEER__
 #define __LIBED2K_PEER__
 
+#include "libed2k/config.hpp"
 #include "libed2k/socket.hpp"
 
 namespace libed2k {
 
 class peer_connection;
 
-// Now it's only ipv4_peer
+/**
+  * entry of transfer peer list, allocated from session pools as ipv4_peer
+  * or ipv6_peer so the address takes only as many bytes as it needs
+ */
 class peer {
    public:
-    peer(const tcp::endpoint& ep, bool conn, int src)
-        : endpoint(ep),
-          connection(NULL),
-          last_connected(0),
-          next_connect(0),
-          connectable(conn),
-          seed(false),
-          failcount(0),
-          fast_reconnects(0),
-          trust_points(0),
-          source(src)
-#ifndef LIBED2K_DISABLE_DHT
-          ,
-          added_to_dht(false)
-#endif
-    {
-    }
-
-    ip::address address() const { return endpoint.address(); }
-    boost::uint16_t port() const { return endpoint.port(); }
+    ip::address address() const;
+    boost::uint16_t port() const { return m_port; }
+    tcp::endpoint ip() const { return tcp::endpoint(address(), m_port); }
 
     void set_failcount(peer* p, int f);
 
-    tcp::endpoint endpoint;
-
     // if the peer is connected now, this
     // will refer to a valid peer_connection
     peer_connection* connection;
@@ -47,20 +32,12 @@ class peer {
     // the next time to connect this peer
     boost::uint16_t next_connect;
 
-    // incoming peers (that don't advertize their listen port)
-    // will not be considered connectable. Peers that
-    // we have a listen port for will be assumed to be.
-    bool connectable;
-
-    // this is true if the peer is a seed
-    bool seed;
-
     // the number of failed connection attempts this peer has
-    unsigned failcount;
+    unsigned failcount : 5;
 
     // the number of times we have allowed a fast
     // reconnect for this peer.
-    unsigned fast_reconnects;
+    unsigned fast_reconnects : 4;
 
     // for every valid piece we receive where this
     // peer was one of the participants, we increase
@@ -68,19 +45,55 @@ class peer {
     // where this peer was a participant, we decrease
     // this value. If it sinks below a threshold, its
     // considered a bad peer and will be banned.
-    signed trust_points;  // [-7, 8]
+    signed trust_points : 4;  // [-7, 8]
 
     // a bitmap combining the peer_source flags
     // from peer_info.
-    unsigned source;
+    unsigned source : 6;
+
+    // incoming peers (that don't advertize their listen port)
+    // will not be considered connectable. Peers that
+    // we have a listen port for will be assumed to be.
+    bool connectable : 1;
+
+    // this is true if the peer is a seed
+    bool seed : 1;
+
+    // set when the peer announced uTP support in its hello, the next
+    // connection to it is made over uTP. Cleared again when a uTP
+    // connection attempt fails, so we fall back to TCP
+    bool supports_utp : 1;
+
+#if LIBED2K_USE_IPV6
+    // the peer is ipv6_peer
+    bool is_v6_addr : 1;
+#endif
 
 #ifndef LIBED2K_DISABLE_DHT
     // this is set to true when this peer as been
     // pinged by the DHT
-    bool added_to_dht;
+    bool added_to_dht : 1;
 #endif
+
+   protected:
+    peer(boost::uint16_t port, bool conn, int src);
+
+   private:
+    boost::uint16_t m_port;
+};
+
+struct ipv4_peer : peer {
+    ipv4_peer(const tcp::endpoint& ep, bool conn, int src);
+    ip::address_v4::bytes_type addr;
 };
 
+#if LIBED2K_USE_IPV6
+struct ipv6_peer : peer {
+    ipv6_peer(const tcp::endpoint& ep, bool conn, int src);
+    ip::address_v6::bytes_type addr;
+};
+#endif
+
 class peer_entry {
    public:
     peer_entry(const std::string& _ip, int _port) : ip(_ip), port(_port) {}
@@ -11,6 +11,7 @@
 #include "libed2k/bitfield.hpp"
 #include "libed2k/disk_buffer_holder.hpp"
 #include "libed2k/base_connection.hpp"
+#include "libed2k/bandwidth_socket.hpp"
 #include "libed2k/error_code.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/peer_request.hpp"
@@ -80,17 +81,17 @@ struct has_block {
     bool operator()(const pending_block& pb) const { return pb.block == block; }
 };
 
-class peer_connection : public base_connection {
+class peer_connection : public base_connection, public bandwidth_socket {
    public:
     // this is the constructor where the we are the active part.
     // The peer_conenction should handshake and verify that the
     // other end has the correct id
-    peer_connection(aux::session_impl& ses, boost::weak_ptr<transfer>, boost::shared_ptr<tcp::socket> s,
+    peer_connection(aux::session_impl& ses, boost::weak_ptr<transfer>, boost::shared_ptr<socket_type> s,
                     const tcp::endpoint& remote, peer* peerinfo);
 
     // with this constructor we have been contacted and we still don't
     // know which transfer the connection belongs to
-    peer_connection(aux::session_impl& ses, boost::shared_ptr<tcp::socket> s, const tcp::endpoint& remote,
+    peer_connection(aux::session_impl& ses, boost::shared_ptr<socket_type> s, const tcp::endpoint& remote,
                     peer* peerinfo);
 
     ~peer_connection();
@@ -207,7 +208,12 @@ class peer_connection : public base_connection {
     void send_block_requests();
     void cancel_all_requests();
 
+    // bandwidth_socket
     void assign_bandwidth(int channel, int amount);
+    bool is_disconnecting() const { return m_disconnecting; }
+    void add_ref() { intrusive_ptr_add_ref(this); }
+    void release() { intrusive_ptr_release(this); }
+
     int bandwidth_throttle(int channel) const { return m_bandwidth_channel[channel].throttle(); }
 
     void set_upload_limit(int limit);
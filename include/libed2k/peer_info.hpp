@@ -57,7 +57,8 @@ struct LIBED2K_EXPORT peer_info {
         snubbed = 0x1000,
         upload_only = 0x2000,
         endgame_mode = 0x4000,
-        holepunched = 0x8000
+        holepunched = 0x8000,
+        utp_socket = 0x20000
 #ifndef LIBED2K_DISABLE_ENCRYPTION
         ,
         rc4_encrypted = 0x100000,
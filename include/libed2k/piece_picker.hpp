@@ -51,12 +51,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/peer_id.hpp"
 #include "libed2k/config.hpp"
 #include "libed2k/assert.hpp"
+#include "libed2k/bitfield.hpp"
 #include "libed2k/time.hpp"
 
 namespace libed2k {
 class transfer;
 class peer_connection;
-struct bitfield;
 
 struct LIBED2K_EXTRA_EXPORT piece_block {
     const static piece_block invalid;
@@ -188,17 +188,33 @@ class LIBED2K_EXTRA_EXPORT piece_picker {
 
     // sets all pieces to dont-have
     void init(int blocks_per_piece, int blocks_in_last_piece, int total_num_pieces);
-    int num_pieces() const { return int(m_piece_map.size()); }
+    int num_pieces() const { return m_compact ? int(m_have.size()) : int(m_piece_map.size()); }
 
     bool have_piece(int index) const {
         LIBED2K_ASSERT(index >= 0);
-        LIBED2K_ASSERT(index < int(m_piece_map.size()));
+        LIBED2K_ASSERT(index < num_pieces());
+        if (m_compact) return m_have.get_bit(index);
         return m_piece_map[index].index == piece_pos::we_have_index;
     }
 
+    /**
+      * drop piece map, priority buckets and availability of a finished transfer
+      * and keep have and filter state in bitfields, requires no downloading pieces
+      * all non-filtered pieces are reported with priority 1 until expand()
+     */
+    void compact();
+
+    /**
+      * restore full picker, availability starts from zero and has to be
+      * added again from the peers
+     */
+    void expand();
+    bool is_compact() const { return m_compact; }
+
     // sets the priority of a piece.
     // returns true if the priority was changed from 0 to non-0
-    // or vice versa
+    // or vice versa. A compact picker doesn't unfilter pieces
+    // we don't have and returns false, expand() it first
     bool set_piece_priority(int index, int prio);
 
     // returns the priority for the piece at 'index'
@@ -480,6 +496,7 @@ class LIBED2K_EXTRA_EXPORT piece_picker {
     std::vector<downloading_piece>::iterator find_dl_piece(int index);
 
     void update_full(downloading_piece& dp);
+    void update_sparse_regions(int index);
 
     // some compilers (e.g. gcc 2.95, does not inherit access
     // privileges to nested classes)
@@ -557,6 +574,12 @@ class LIBED2K_EXTRA_EXPORT piece_picker {
     // has to be called before accessing m_pieces.
     mutable bool m_dirty;
 
+    // when set the piece map is empty and the pieces
+    // state is kept in m_have and m_filtered only
+    bool m_compact;
+    bitfield m_have;
+    bitfield m_filtered;
+
    public:
 #if LIBED2K_COMPACT_PICKER
     enum { max_pieces = piece_pos::we_have_index - 1 };
@@ -1,9 +1,10 @@
 #ifndef __LIBED2K_POLICY__
 #define __LIBED2K_POLICY__
 
-#include <deque>
+#include <set>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
 #include "libed2k/peer.hpp"
 
 namespace libed2k {
@@ -31,10 +32,19 @@ class policy {
 
     bool connect_one_peer(int session_time);
 
-    int num_connect_candidates() const { return m_num_connect_candidates; }
+    int num_connect_candidates() const { return int(m_candidates.size()); }
     void recalculate_connect_candidates();
 
-    typedef std::deque<peer*> peers_t;
+    /**
+      * allow fast reconnect to all peers
+     */
+    void reset_last_connected();
+
+    /**
+      * peers in no particular order, erase moves the last peer into the hole
+      * lookup by address goes through the hash index
+     */
+    typedef std::vector<peer*> peers_t;
 
     peers_t::iterator begin_peer() { return m_peers.begin(); }
     peers_t::iterator end_peer() { return m_peers.end(); }
@@ -45,25 +55,46 @@ class policy {
     void erase_peer(peers_t::iterator i);
 
    private:
-    struct peer_address_compare {
-        bool operator()(const peer* lhs, const ip::address& rhs) const { return lhs->address() < rhs; }
+    // address key to the position of the peer in m_peers
+    typedef boost::unordered_multimap<size_t, int> peer_index;
 
-        bool operator()(const ip::address& lhs, const peer* rhs) const { return lhs < rhs->address(); }
+    static size_t address_key(const ip::address& a);
 
-        bool operator()(const peer* lhs, const peer* rhs) const { return lhs->address() < rhs->address(); }
-    };
+    peer* find_peer(const tcp::endpoint& ep) const;
+    peer* find_peer(const ip::address& a) const;
+    peer_index::iterator find_index(const peer* p);
 
-    std::pair<peers_t::iterator, peers_t::iterator> find_peers(const ip::address& a) {
-        return std::equal_range(m_peers.begin(), m_peers.end(), a, peer_address_compare());
-    }
+    peer* allocate_peer(const tcp::endpoint& ep, bool connectable, int source);
+    void free_peer(peer* p);
 
     void update_peer(peer* p, int src, int flags, tcp::endpoint const& remote, char const* destination);
-    bool insert_peer(peer* p, peers_t::iterator iter, int flags);
+    bool insert_peer(peer* p, int flags);
+    void add_to_list(peer* p);
+
+    /**
+      * connect candidate with its ordering key, key fields of peer must not
+      * change while it is in the candidate set, so every change goes through
+      * remove_candidate and add_candidate
+     */
+    struct candidate {
+        int ready;  //!< session time when the peer may be connected
+        int failcount;
+        bool local;
+        int rank;  //!< source rank
+        peer* p;
+        bool operator<(const candidate& c) const;
+    };
+
+    typedef std::set<candidate> candidate_set;
+
+    candidate make_candidate(peer* p) const;
+    void add_candidate(peer* p);
+    void remove_candidate(peer* p);
+    void rebuild_candidates();
 
     bool compare_peer_erase(peer const& lhs, peer const& rhs) const;
-    bool compare_peer(peer const& lhs, peer const& rhs /*, address const& external_ip*/) const;
 
-    peers_t::iterator find_connect_candidate(int session_time);
+    peer* find_connect_candidate(int session_time);
 
     bool is_connect_candidate(peer const& p, bool finished) const;
     bool is_erase_candidate(peer const& p, bool finished) const;
@@ -74,19 +105,22 @@ class policy {
     void erase_peers(int flags = 0);
 
     peers_t m_peers;
+    peer_index m_index;  //!< address key to positions of peers with that address
     transfer* m_transfer;
 
-    // since the peer list can grow too large
-    // to scan all of it, start at this iterator
-    int m_round_robin;
-
-    // The number of peers in our peer list
-    // that are connect candidates. i.e. they're
-    // not already connected and they have not
-    // yet reached their max try count and they
-    // have the connectable state (we have a listen
+    // The peers in our peer list that are connect
+    // candidates. i.e. they're not already connected
+    // and they have not yet reached their max try count
+    // and they have the connectable state (we have a listen
     // port for them).
-    int m_num_connect_candidates;
+    candidate_set m_candidates;
+
+    // min_reconnect_time the candidate keys were computed with
+    int m_reconnect_time;
+
+    // max_failcount the candidate set was built with, peers over it were
+    // left out of the set
+    int m_max_failcount;
 
     // the number of seeds in the peer list
     int m_num_seeds;
@@ -0,0 +1,84 @@
+#ifndef __LIBED2K_RESUME_JOURNAL__
+#define __LIBED2K_RESUME_JOURNAL__
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/file.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/thread.hpp"
+
+namespace libed2k {
+
+/**
+  * append-only log of resume data of all transfers
+  * a transfer is written once as full snapshot, after that only small records
+  * of completed pieces, piece priorities and moves are appended
+  * the writer thread rewrites the journal with one snapshot per transfer when
+  * it holds too many records
+ */
+class resume_journal : boost::noncopyable {
+   public:
+    enum record_type { snapshot_record = 1, have_piece_record, piece_priority_record, file_path_record, remove_record };
+
+    resume_journal();
+    ~resume_journal();
+
+    /**
+      * open or create journal and restore transfers in one sequential pass
+      * a record cut by crash is dropped
+     */
+    void open(const std::string& path, std::vector<transfer_resume_data>& transfers, error_code& ec);
+
+    /**
+      * write pending records and stop the writer thread
+     */
+    void close();
+    bool is_open() const { return m_thread.get() != 0; }
+
+    /**
+      * true when journal has snapshot of transfer
+     */
+    bool has_transfer(const md4_hash& t) const;
+
+    void add_transfer(const transfer_resume_data& trd);
+    void have_piece(const md4_hash& t, int piece);
+    void piece_priority(const md4_hash& t, int piece, int priority);
+    void file_path(const md4_hash& t, const std::string& path);
+    void remove_transfer(const md4_hash& t);
+
+    /**
+      * fold journal image into transfers, returns bytes of complete records
+     */
+    static size_t load(const char* begin, const char* end, std::vector<transfer_resume_data>& transfers,
+                       size_t& records);
+
+   private:
+    void append(record_type type, const md4_hash& t, const std::string& payload);
+    void writer();
+    void write(const std::vector<char>& buffer);
+
+    // returns false when the journal was left as is
+    bool compact();
+
+    std::string m_path;
+    file m_file;      //!< owned by writer thread once it started
+    size_type m_size;  //!< bytes written to file
+
+    mutable mutex m_mutex;
+    condition m_cond;
+    std::vector<char> m_pending;       //!< records not written yet
+    std::set<md4_hash> m_transfers;    //!< transfers with snapshot
+    size_t m_records;                  //!< records in file and pending
+    size_t m_compact_records;          //!< records before compaction is tried
+    bool m_compact;
+    bool m_abort;
+    boost::shared_ptr<thread> m_thread;
+};
+}
+
+#endif  //__LIBED2K_RESUME_JOURNAL__
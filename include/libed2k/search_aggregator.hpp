@@ -0,0 +1,154 @@
+#ifndef __LIBED2K_SEARCH_AGGREGATOR__
+#define __LIBED2K_SEARCH_AGGREGATOR__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <boost/unordered_map.hpp>
+#include "libed2k/hasher.hpp"
+#include "libed2k/size_type.hpp"
+#include "libed2k/ctag.hpp"
+#include "libed2k/ptime.hpp"
+
+namespace libed2k {
+
+/**
+  * one file of an aggregated search
+ */
+struct search_file_info {
+    search_file_info() : m_size(0), m_sources(0), m_complete_sources(0), m_reports(0), m_rank(0) {}
+
+    md4_hash m_hFile;
+    std::string m_name;                //!< name reported first
+    std::vector<std::string> m_names;  //!< other distinct names, limited to a few
+    size_type m_size;
+    int m_sources;
+    int m_complete_sources;
+    int m_reports;  //!< how many results were merged into this file
+    int m_rank;     //!< position in top K, 0 is the best
+};
+
+/**
+  * changes of top K of one search since the previous delta
+ */
+struct search_results_delta {
+    md4_hash m_search;
+    std::vector<search_file_info> m_updated;  //!< new, changed or moved files in rank order
+    std::vector<md4_hash> m_removed;          //!< files which left top K
+    int m_files;                              //!< distinct files known for the search
+};
+
+/**
+  * merges search results of servers and Kad by file hash and keeps
+  * incremental top K ranking by sources and complete sources
+  * searches are identified by hash: Kad keyword hash or server_search()
+ */
+class search_aggregator {
+   public:
+    search_aggregator();
+
+    /**
+      * key of the server search, all servers answer the same search
+     */
+    static md4_hash server_search() { return md4_hash(); }
+
+    void set_limits(int top_k, int max_files, int max_searches);
+
+    /**
+      * forget old results and start collecting new ones
+      * the oldest search is dropped when max_searches are collected already
+     */
+    void start(const md4_hash& search);
+    void stop(const md4_hash& search);
+
+    /**
+      * the search sent all its requests, answers are still merged until
+      * expires, then it is dropped once its last delta was flushed
+     */
+    void finish(const md4_hash& search, const ptime& expires);
+
+    bool active(const md4_hash& search) const { return m_searches.find(search) != m_searches.end(); }
+    int num_searches() const { return int(m_searches.size()); }
+
+    /**
+      * merge one result, additive results count sources of distinct origins,
+      * others report the same sources and only the maximum is kept
+      * results of searches not started are ignored
+     */
+    void add(const md4_hash& search, const md4_hash& file, const std::string& name, size_type size, int sources,
+             int complete_sources, bool additive);
+
+    template <typename List>
+    void add(const md4_hash& search, const md4_hash& file, const List& tags, bool additive) {
+        if (!active(search)) return;
+        size_type size = tags.getIntTagByNameId(FT_FILESIZE) + (tags.getIntTagByNameId(FT_FILESIZE_HI) << 32);
+        add(search, file, tags.getStringTagByNameId(FT_FILENAME), size, int(tags.getIntTagByNameId(FT_SOURCES)),
+            int(tags.getIntTagByNameId(FT_COMPLETE_SOURCES)), additive);
+    }
+
+    /**
+      * append deltas of all searches changed since previous call
+      * and drop the finished searches expired at now
+     */
+    void flush(std::vector<search_results_delta>& deltas, const ptime& now);
+
+    /**
+      * current top K of the search in rank order
+     */
+    void top(const md4_hash& search, std::vector<search_file_info>& files) const;
+
+   private:
+    struct file_hash {
+        size_t operator()(const md4_hash& h) const {
+            // md4 is uniform enough to use its leading bytes
+            size_t v;
+            std::memcpy(&v, &h[0], sizeof(v));
+            return v;
+        }
+    };
+
+    struct rank_key {
+        int sources;
+        int complete_sources;
+        md4_hash file;
+
+        bool operator<(const rank_key& k) const {
+            if (sources != k.sources) return sources > k.sources;
+            if (complete_sources != k.complete_sources) return complete_sources > k.complete_sources;
+            return file < k.file;
+        }
+    };
+
+    struct file_state {
+        file_state() : changed(false), last_rank(-1) {}
+        search_file_info info;
+        bool changed;
+        int last_rank;  //!< rank in last delta, -1 when not in top K
+        rank_key key() const;
+    };
+
+    typedef boost::unordered_map<md4_hash, file_state, file_hash> file_map;
+
+    struct search_state {
+        file_map files;
+        std::set<rank_key> ranking;
+        std::vector<md4_hash> top;  //!< top K of last delta
+        bool dirty;
+        bool finished;
+        ptime expires;  //!< when a finished search is dropped
+        int order;      //!< sequence number of start
+    };
+
+    typedef std::map<md4_hash, search_state> search_map;
+    search_map m_searches;
+    int m_top_k;
+    int m_max_files;
+    int m_max_searches;
+    int m_next_order;
+};
+}
+
+#endif  //__LIBED2K_SEARCH_AGGREGATOR__
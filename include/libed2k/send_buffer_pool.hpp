@@ -0,0 +1,98 @@
+#ifndef __LIBED2K_SEND_BUFFER_POOL__
+#define __LIBED2K_SEND_BUFFER_POOL__
+
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/detail/atomic_count.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/thread.hpp"
+
+#ifdef LIBED2K_THREAD_LOCAL
+#include <boost/thread/tss.hpp>
+#endif
+
+namespace libed2k {
+
+/**
+  * allocator of send buffers with power of two size classes
+  * every class keeps a free list of its buffers, threads cache some free
+  * buffers of each class and move them from and to the shared lists in batches
+  * buffers larger than the biggest class come from the heap
+ */
+class send_buffer_pool : boost::noncopyable {
+   public:
+    enum {
+        min_buffer_size = 128,  //!< size of the smallest class
+        num_classes = 14        //!< the biggest class holds 1 MiB
+    };
+
+    struct class_usage {
+        int buffer_size;
+        int in_use;     //!< buffers handed out
+        int allocated;  //!< buffers carved from the heap
+        int free;       //!< buffers in the shared free list
+    };
+
+    send_buffer_pool();
+    ~send_buffer_pool();
+
+    /**
+      * returns buffer of at least size bytes and its capacity
+     */
+    std::pair<char*, int> allocate(int size);
+
+    /**
+      * size is the capacity returned by allocate
+     */
+    void free(char* buf, int size);
+
+    void usage(std::vector<class_usage>& classes) const;
+
+   private:
+    struct size_class {
+        size_class() : free_list(0), free_count(0), in_use(0), allocated(0) {}
+
+        mutex list_mutex;
+        char* free_list;  //!< free buffers linked through their first bytes
+        int free_count;
+        boost::detail::atomic_count in_use;
+        int allocated;
+        std::vector<char*> slabs;
+    };
+
+    struct thread_cache {
+        mutex cache_mutex;
+        send_buffer_pool* pool;  //!< 0 once the pool is gone
+        char* free_list[num_classes];
+        int count[num_classes];
+    };
+
+    static int size_class_of(int size);
+    static int cache_limit(int c);
+
+    // takes num buffers of class c from the shared list
+    char* pop_buffers(int c, int num, int& popped);
+    void push_buffers(int c, char* head, char* tail, int num);
+
+#ifdef LIBED2K_THREAD_LOCAL
+    thread_cache& local_cache();
+    void flush_cache(thread_cache& tc, int c, int keep);
+
+    // cleanup of m_thread_cache, runs in the exiting thread
+    static void thread_exit(thread_cache* tc);
+
+    // unique for every pool, never reused
+    const long m_id;
+
+    std::vector<thread_cache*> m_caches;
+    boost::thread_specific_ptr<thread_cache> m_thread_cache;
+#endif
+
+    size_class m_classes[num_classes];
+};
+}
+
+#endif  //__LIBED2K_SEND_BUFFER_POOL__
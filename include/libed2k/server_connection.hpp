@@ -120,6 +120,7 @@ class server_connection : public intrusive_ptr_base<server_connection>, public b
     std::deque<message> m_write_order;  //!< outgoing messages order
     sc_state current_operation;
     ptime last_action_time;
+    ptime m_search_start;  //!< when the last search was sent, min_time() once it's answered
     server_connection_parameters params;
     size_t announced_transfers_count;
     error_code last_close_result;
@@ -14,15 +14,18 @@
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/kad_packet_struct.hpp"
 #include "libed2k/session_status.hpp"
+#include "libed2k/metrics.hpp"
 #include "libed2k/filesystem.hpp"
 #include "libed2k/session_settings.hpp"
 #include "libed2k/entry.hpp"
+#include "libed2k/bandwidth_class.hpp"
 
 namespace libed2k {
 
 class session_settings;
 struct transfer_handle;
 class add_transfer_params;
+struct transfer_resume_data;
 struct ip_filter;
 class upnp;
 class natpmp;
@@ -47,6 +50,11 @@ class session {
 
     session_status status() const;
 
+    /**
+      * snapshot of the latency histograms and counters, see session_metrics
+     */
+    session_metrics get_metrics() const;
+
     // all transfer_handles must be destructed before the session is destructed!
     transfer_handle add_transfer(const add_transfer_params& params);
     void post_transfer(const add_transfer_params& params);
@@ -55,11 +63,24 @@ class session {
     std::vector<transfer_handle> get_active_transfers() const;
     void remove_transfer(const transfer_handle& h, int options = none);
 
+    /**
+      * keep resume data of all transfers in one append-only journal instead of saving
+      * it per transfer, transfers restored from the journal are returned to be added
+      * throws libed2k_exception when the journal can't be opened
+     */
+    void open_resume_journal(const std::string& path, std::vector<transfer_resume_data>& transfers);
+
     peer_connection_handle add_peer_connection(const net_identifier& np);
     peer_connection_handle find_peer_connection(const net_identifier& np) const;
     peer_connection_handle find_peer_connection(const md4_hash& hash) const;
 
     std::auto_ptr<alert> pop_alert();
+
+    /**
+      * take all pending alerts at once, pointers stay valid until the next call
+      * alert::type() allows to dispatch them without casts
+     */
+    void pop_alerts(std::vector<alert*>& alerts);
     size_t set_alert_queue_size_limit(size_t queue_size_limit_);
     void set_alert_mask(boost::uint32_t m);
     alert const* wait_for_alert(time_duration max_wait);
@@ -69,6 +90,12 @@ class session {
     void post_search_request(search_request& sr);
     void post_search_more_result_request();
     void post_cancel_search();
+
+    /**
+      * sink gets server search result entries one by one while the packet is decoded,
+      * only entries it returns true for are reported in shared_files_alert
+     */
+    void set_search_result_sink(const search_result_sink& sink);
     void listen_on(int port, const char* net_interface = 0);
     bool is_listening() const;
     unsigned short listen_port() const;
@@ -78,6 +105,20 @@ class session {
     void set_ip_filter(const ip_filter& f);
     const ip_filter& get_ip_filter() const;
 
+    /**
+      * add bandwidth class, returns its index. The parent has to be added before
+      * its children
+     */
+    int add_bandwidth_class(const bandwidth_class& c);
+    void set_bandwidth_class(int index, const bandwidth_class& c);
+    std::vector<bandwidth_class> bandwidth_classes() const;
+
+    /**
+      * peers with the access flags n in the filter are in the bandwidth class n - 1,
+      * flags 0 is no class
+     */
+    void set_bandwidth_class_filter(const ip_filter& f);
+
     /** search sources for file */
     void post_sources_request(const md4_hash& hFile, boost::uint64_t nSize);
 
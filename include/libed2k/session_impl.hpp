@@ -5,8 +5,9 @@
 #include <string>
 #include <map>
 #include <set>
+#include <deque>
 
-#include <boost/pool/object_pool.hpp>
+#include <boost/pool/pool.hpp>
 
 #include "libed2k/socket.hpp"
 #include "libed2k/stat.hpp"
@@ -19,14 +20,21 @@
 #include "libed2k/util.hpp"
 #include "libed2k/alert.hpp"
 #include "libed2k/packet_struct.hpp"
+#include "libed2k/search_aggregator.hpp"
 #include "libed2k/file.hpp"
+#include "libed2k/resume_journal.hpp"
+#include "libed2k/send_buffer_pool.hpp"
 #include "libed2k/disk_io_thread.hpp"
 #include "libed2k/file_pool.hpp"
 #include "libed2k/bandwidth_manager.hpp"
+#include "libed2k/bandwidth_class.hpp"
 #include "libed2k/connection_queue.hpp"
 #include "libed2k/session_status.hpp"
+#include "libed2k/metrics.hpp"
 #include "libed2k/io_service.hpp"
 #include "libed2k/udp_socket.hpp"
+#include "libed2k/socket_type.hpp"
+#include "libed2k/utp_socket_manager.hpp"
 #include "libed2k/bloom_filter.hpp"
 #include "libed2k/kademlia/dht_tracker.hpp"
 
@@ -96,6 +104,7 @@ class session_impl_base : boost::noncopyable, initialize_timer {
 
     /** alerts */
     std::auto_ptr<alert> pop_alert();
+    void pop_alerts(std::vector<alert*>& alerts);
     void set_alert_mask(boost::uint32_t m);
     size_t set_alert_queue_size_limit(size_t queue_size_limit_);
     void set_alert_dispatch(boost::function<void(alert const&)> const&);
@@ -129,11 +138,17 @@ class session_impl_base : boost::noncopyable, initialize_timer {
     // statistics gathered from all transfers.
     stat m_stat;
 
+    // latency histograms and counters kept by the network thread
+    session_metrics m_metrics;
+
     // handles delayed alerts
     alert_manager m_alerts;
 
     /** file hasher closed in self thread */
     transfer_params_maker m_tpm;
+
+    /** resume data log, open when client uses it */
+    resume_journal m_resume_journal;
     lowid_callbacks_map lowid_conn_dict;
 };
 
@@ -143,8 +158,6 @@ class session_impl : public session_impl_base {
     std::ofstream m_upnp_log;
 #endif
    public:
-    // the size of each allocation that is chained in the send buffer
-    enum { send_buffer_size = 128 };
     typedef std::set<boost::intrusive_ptr<peer_connection> > connection_map;
 
     session_impl(const fingerprint& id, const char* listen_interface, const session_settings& settings);
@@ -161,6 +174,18 @@ class session_impl : public session_impl_base {
     void set_ip_filter(const ip_filter& f);
     const ip_filter& get_ip_filter() const;
 
+    int add_bandwidth_class(const bandwidth_class& c);
+    void set_bandwidth_class(int index, const bandwidth_class& c);
+    std::vector<bandwidth_class> bandwidth_classes() const;
+    void set_bandwidth_class_filter(const ip_filter& f);
+
+    /**
+      * channels of the class of the address and of the transfer class with all their
+      * parents, at most size of them are stored in chan. returns their number
+     */
+    int bandwidth_class_channels(const address& a, int transfer_class, int channel, bandwidth_channel** chan,
+                                 int size);
+
     bool listen_on(int port, const char* net_interface);
     bool is_listening() const;
     boost::uint16_t listen_port() const;
@@ -169,10 +194,11 @@ class session_impl : public session_impl_base {
     void update_disk_thread_settings();
 
     void async_accept(boost::shared_ptr<tcp::acceptor> const& listener);
-    void on_accept_connection(boost::shared_ptr<tcp::socket> const& s, boost::weak_ptr<tcp::acceptor> listener,
+    void on_accept_connection(boost::shared_ptr<socket_type> const& s, boost::weak_ptr<tcp::acceptor> listener,
                               error_code const& e);
 
-    void incoming_connection(boost::shared_ptr<tcp::socket> const& s);
+    // accepted TCP connections and uTP connections of the socket manager
+    void incoming_connection(boost::shared_ptr<socket_type> const& s);
 
     void on_port_map_log(char const* msg, int map_transport);
 
@@ -204,6 +230,7 @@ class session_impl : public session_impl_base {
     void close_connection(const peer_connection* p, const error_code& ec);
 
     session_status status() const;
+    session_metrics get_metrics() const;
     const tcp::endpoint& server() const;
 
     virtual void abort();
@@ -217,6 +244,7 @@ class session_impl : public session_impl_base {
     /** add/remove transfer from current thread directly */
     virtual transfer_handle add_transfer(add_transfer_params const&, error_code& ec);
     virtual void remove_transfer(const transfer_handle& h, int options);
+    void open_resume_journal(const std::string& path, std::vector<transfer_resume_data>& transfers, error_code& ec);
     /** add/remove active transfer for this session */
     bool add_active_transfer(const boost::shared_ptr<transfer>& t);
     bool remove_active_transfer(const boost::shared_ptr<transfer>& t);
@@ -251,6 +279,7 @@ class session_impl : public session_impl_base {
 
     char* allocate_disk_buffer(char const* category);
     void free_disk_buffer(char* buf);
+    void release_cache_block(char* buf);
 
     char* allocate_z_buffer();
     void free_z_buffer(char* buf);
@@ -263,6 +292,12 @@ class session_impl : public session_impl_base {
 
     void on_tick(error_code const& e);
 
+    // hands out bandwidth quota in slices shorter than the tick
+    // while peers wait for it
+    void update_bandwidth(const ptime& now);
+    void arm_bandwidth_timer();
+    void on_bandwidth_tick(error_code const& e);
+
     // let transfers connect to peers if they want to
     // if there are any trasfers and any free slots
     void connect_new_peers();
@@ -271,7 +306,7 @@ class session_impl : public session_impl_base {
     typedef boost::mutex mutex_t;
     mutable mutex_t m_mutex;
 
-    void setup_socket_buffers(tcp::socket& s);
+    void setup_socket_buffers(socket_type& s);
 
     /** search file on server */
     void post_search_request(search_request& sr);
@@ -282,6 +317,8 @@ class session_impl : public session_impl_base {
     /** this method simple send information packet to server and break search order */
     void post_cancel_search();
 
+    void set_search_result_sink(search_result_sink sink) { m_search_result_sink = sink; }
+
     /** offer file to server */
     void post_announce(shared_files_list& sl);
 
@@ -390,12 +427,16 @@ class session_impl : public session_impl_base {
     // boost::uint16_t m_socks_listen_port;
 
     tcp::resolver m_host_resolver;
-    boost::object_pool<peer> m_peer_pool;
 
     int add_port_mapping(int t, int external_port, int local_port);
     void delete_port_mapping(int handle);
 
-    boost::object_pool<peer> m_ipv4_peer_pool;
+    // peer list entries of all transfers, policy constructs and
+    // destroys the entries in place
+    boost::pool<> m_ipv4_peer_pool;
+#if LIBED2K_USE_IPV6
+    boost::pool<> m_ipv6_peer_pool;
+#endif
 
     // this vector is used to store the block_info
     // objects pointed to by partial_piece_info returned
@@ -404,8 +445,7 @@ class session_impl : public session_impl_base {
 
     // this pool is used to allocate and recycle send
     // buffers from.
-    boost::pool<> m_send_buffers;
-    boost::mutex m_send_buffer_mutex;
+    send_buffer_pool m_send_buffers;
 
     // this pool is used to allocate and recycle compressed data buffers
     boost::pool<> m_z_buffers;
@@ -450,11 +490,30 @@ class session_impl : public session_impl_base {
 
     bandwidth_channel* m_bandwidth_channel[2];
 
+    struct bandwidth_class_entry {
+        bandwidth_class settings;
+        bandwidth_channel channel[2];
+    };
+
+    // the deque keeps the channels in place, children point to their parents
+    std::deque<bandwidth_class_entry> m_bandwidth_classes;
+
+    // access flags of n put addresses in the bandwidth class n - 1
+    ip_filter m_bandwidth_class_filter;
+
     // ed2k server connection
     typedef std::map<std::string, boost::intrusive_ptr<server_connection> >::value_type slave_sc_vale;
     boost::intrusive_ptr<server_connection> m_server_connection;
     std::map<std::string, boost::intrusive_ptr<server_connection> > m_slave_sc;
 
+    // filters search results of server connections while they are decoded
+    search_result_sink m_search_result_sink;
+
+    // merged results of server and Kad keyword searches
+    search_aggregator m_search_aggregator;
+    ptime m_last_search_flush;
+    void post_search_results();
+
     // the index of the transfers that will be offered to
     // connect to a peer next time on_tick is called.
     // This implements a round robin.
@@ -495,6 +554,10 @@ class session_impl : public session_impl_base {
     // the timer used to fire the tick
     deadline_timer m_timer;
     ptime m_last_tick;
+
+    deadline_timer m_bandwidth_timer;
+    ptime m_last_bandwidth_tick;
+    bool m_bandwidth_timer_armed;
     // total redundant and failed bytes
     size_type m_total_failed_bytes;
     size_type m_total_redundant_bytes;
@@ -506,6 +569,10 @@ class session_impl : public session_impl_base {
 
     rate_limited_udp_socket m_udp_socket;
 
+    // uTP streams of peer connections, they share the UDP socket
+    // and port with Kad
+    utp_socket_manager m_utp_socket_manager;
+
     boost::intrusive_ptr<natpmp> m_natpmp;
     boost::intrusive_ptr<upnp> m_upnp;
 
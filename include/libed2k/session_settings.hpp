@@ -72,13 +72,14 @@ class session_settings {
           max_peerlist_size(4000),
           max_paused_peerlist_size(4000),
           tick_interval(100),
+          bandwidth_slice(10),
           download_rate_limit(-1),
           upload_rate_limit(-1),
           unchoke_slots_limit(8),
           half_open_limit(0),
           connections_limit(200),
-          enable_outgoing_utp(true),
-          enable_incoming_utp(true),
+          enable_outgoing_utp(false),
+          enable_incoming_utp(false),
           utp_target_delay(100)  // milliseconds
           ,
           utp_gain_factor(1500)  // bytes per rtt
@@ -110,7 +111,12 @@ class session_settings {
           ignore_resume_timestamps(false),
           no_recheck_incomplete_resume(false),
           seeding_outgoing_connections(false),
-          alert_queue_size(1000)
+          alert_queue_size(1000),
+          aggregate_search_results(false),
+          search_results_top_k(100),
+          search_results_max_files(5000),
+          search_results_max_searches(16),
+          search_results_interval(1000)
           // Disk IO settings
           ,
           file_pool_size(40),
@@ -118,6 +124,8 @@ class session_settings {
           max_queued_disk_bytes_low_watermark(0),
           cache_size((16 * 1024 * 1024) / BLOCK_SIZE),
           cache_buffer_chunk_size((16 * 16 * 1024) / BLOCK_SIZE),
+          disk_buffer_thread_cache(8),
+          disk_cache_huge_pages(false),
           cache_expiry(5 * 60),
           use_read_cache(true),
           explicit_read_cache(false),
@@ -127,7 +135,11 @@ class session_settings {
           coalesce_writes(false),
           optimize_hashing_for_speed(true),
           file_checks_delay_per_block(0),
+          hashing_threads(0),
+          file_checks_read_ahead(4),
+          file_checks_rate_limit(0),
           disk_cache_algorithm(avoid_readback),
+          read_cache_algorithm(read_lru),
           read_cache_line_size((32 * 16 * 1024) / BLOCK_SIZE),
           write_cache_line_size((32 * 16 * 1024) / BLOCK_SIZE),
           optimistic_disk_retry(10 * 60),
@@ -139,14 +151,19 @@ class session_settings {
 #endif
           ,
           volatile_read_cache(false),
+          zero_copy_upload(true),
           default_cache_min_age(1),
           no_atime_storage(true),
           read_job_every(10),
           use_disk_read_ahead(true),
+          max_read_ahead(128),
+          read_ahead_time(4),
           lock_files(false),
           low_prio_disk(true),
           peer_tos(0),
-          upnp_ignore_nonrouters(false) {
+          upnp_ignore_nonrouters(false),
+          dormant_seeds(false),
+          read_only_seed_files(false) {
     }
 
     // the number of seconds to wait for any activity on
@@ -211,6 +228,10 @@ class session_settings {
     // more than one second (i.e. 1000).
     int tick_interval;
 
+    // the number of milliseconds between rounds of the bandwidth
+    // scheduler while peers wait for quota. 0 runs it on the tick
+    int bandwidth_slice;
+
     /**
       * session rate limits
       * -1 unlimits
@@ -228,10 +249,12 @@ class session_settings {
     // the max number of connections in the session
     int connections_limit;
 
-    // when set to true, libtorrent will try to make outgoing utp connections
+    // when set to true, libed2k will try to make outgoing utp connections
+    // to peers which announced utp support in their hello answer
     bool enable_outgoing_utp;
 
-    // if set to false, libtorrent will reject incoming utp connections
+    // when set to true, libed2k announces utp support to peers and accepts
+    // incoming utp connections on the udp port
     bool enable_incoming_utp;
 
     // target delay, milliseconds
@@ -332,6 +355,25 @@ class session_settings {
     // the max alert queue size
     int alert_queue_size;
 
+    // when true, results of server and Kad keyword searches are merged
+    // by file hash in the session and reported as search_results_alert
+    bool aggregate_search_results;
+
+    // the number of best ranked files reported for each search
+    int search_results_top_k;
+
+    // the max number of distinct files kept for each search, worst
+    // ranked files are dropped first
+    int search_results_max_files;
+
+    // the max number of searches collected at once, starting another one
+    // drops the oldest search
+    int search_results_max_searches;
+
+    // the minimum number of milliseconds between two search_results_alert
+    // for the same search
+    int search_results_interval;
+
     /********************
      * Disk IO settings *
      ********************/
@@ -381,6 +423,17 @@ class session_settings {
     // of more heap allocations
     int cache_buffer_chunk_size;
 
+    // the number of free disk buffers every thread keeps
+    // for itself. Buffers are moved between these caches and
+    // the shared pool in batches of half the size, to take the
+    // pool lock less often. 0 disables the thread caches
+    int disk_buffer_thread_cache;
+
+    // allocate the disk cache in chunks backed by huge pages
+    // to save TLB misses when the cache is large. Chunks are
+    // then at least one huge page in size
+    bool disk_cache_huge_pages;
+
     // the number of seconds a write cache entry sits
     // idle in the cache before it's forcefully flushed
     // to disk. Default is 5 minutes.
@@ -417,10 +470,33 @@ class session_settings {
     // the checking rate to 1.6 MiB per second
     int file_checks_delay_per_block;
 
+    // threads hashing pieces of file checks in parallel,
+    // 0 means one thread per cpu core
+    int hashing_threads;
+
+    // the number of pieces read ahead of the piece being
+    // checked and hashed by the hashing threads, 0 checks
+    // one piece at a time on the disk thread
+    int file_checks_read_ahead;
+
+    // limit of file checks in bytes per second, 0 is
+    // unlimited. When the limit is reached other disk
+    // jobs are served first
+    int file_checks_rate_limit;
+
     enum disk_cache_algo_t { lru, largest_contiguous, avoid_readback };
 
     disk_cache_algo_t disk_cache_algorithm;
 
+    enum read_cache_algo_t { read_lru, read_2q };
+
+    // eviction policy of the read cache. read_2q keeps pieces
+    // read once in a probation queue and protects a piece only
+    // when it is read again after it was evicted, so a single
+    // peer streaming a file doesn't flush the pieces other
+    // peers read repeatedly
+    read_cache_algo_t read_cache_algorithm;
+
     // the number of blocks that will be read ahead
     // when reading a block into the read cache
     int read_cache_line_size;
@@ -465,6 +541,12 @@ class session_settings {
     // expected to be hit again. It would save some memory
     bool volatile_read_cache;
 
+    // when set, uploaded blocks are sent straight from the
+    // read cache. The cache blocks are referenced by the send
+    // buffers of the peers and freed when the last one has been
+    // sent, instead of being copied into a send buffer
+    bool zero_copy_upload;
+
     // this is the default minimum time any read cache line
     // is kept in the cache.
     int default_cache_min_age;
@@ -482,6 +564,13 @@ class session_settings {
     // ahead of time
     bool use_disk_read_ahead;
 
+    // the number of blocks read into the read cache ahead
+    // of a peer reading a file sequentially, 0 disables it.
+    // The read ahead covers about read_ahead_time seconds
+    // of the rate the peer reads at
+    int max_read_ahead;
+    int read_ahead_time;
+
     // if set to true, files will be locked when opened.
     // preventing any other process from modifying them
     bool lock_files;
@@ -504,6 +593,18 @@ class session_settings {
     // any upnp devices that don't have an address that matches
     // our currently configured router.
     bool upnp_ignore_nonrouters;
+
+    // when true seeds don't hold storage and file handles
+    // until a peer requests the file or a user action needs
+    // them, and release them again once they are idle long
+    // enough to leave the active transfers
+    bool dormant_seeds;
+
+    // finished transfers close their write handles, so seeds read
+    // through files opened read only. When this is true all read jobs
+    // of a file share the handle that's open, instead of reopening it
+    // when they ask for other buffer or access flags
+    bool read_only_seed_files;
 };
 
 #ifndef LIBED2K_DISABLE_DHT
@@ -521,7 +622,10 @@ struct dht_settings {
           max_dht_items(700),
           max_torrent_search_reply(20),
           restrict_routing_ips(true),
-          restrict_search_ips(true) {
+          restrict_search_ips(true),
+          max_search_branching(16),
+          search_quorum(10),
+          state_save_interval(600) {
     }
 
     // the maximum number of peers to send in a
@@ -563,6 +667,26 @@ struct dht_settings {
     // applies the same IP restrictions on nodes
     // received during a DHT search (traversal algorithm)
     bool restrict_search_ips;
+
+    // requests that don't get a reply within a few round
+    // trip times of the node open up a slot for another
+    // request. This is the upper limit of simultanous
+    // requests a single search may grow to that way
+    int max_search_branching;
+
+    // a search completes as soon as this many of the
+    // closest nodes have replied, without waiting for
+    // the requests still outstanding to nodes that are
+    // farther away or slow. 0 means searches wait for
+    // every request to complete or time out
+    int search_quorum;
+
+    // path of the routing table snapshot. When set, the dht
+    // writes its contacts there every state_save_interval
+    // seconds and when it stops, and on start pings all
+    // contacts of the file instead of bootstrapping
+    std::string state_file;
+    int state_save_interval;
 };
 #endif
 
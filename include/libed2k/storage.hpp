@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_STORAGE_HPP_INCLUDE
 
 #include <vector>
+#include <deque>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -52,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include "libed2k/hasher.hpp"
+#include "libed2k/hash_pool.hpp"
 #include "libed2k/transfer_info.hpp"
 #include "libed2k/piece_picker.hpp"
 #include "libed2k/intrusive_ptr_base.hpp"
@@ -299,7 +301,7 @@ class LIBED2K_EXTRA_EXPORT piece_manager : public intrusive_ptr_base<piece_manag
                            boost::function<void(int, disk_io_job const&)> const& handler);
 
     void async_read(peer_request const& r, boost::function<void(int, disk_io_job const&)> const& handler,
-                    int cache_line_size = 0, int cache_expiry = 0);
+                    int cache_line_size = 0, int cache_expiry = 0, int flags = 0);
 
     void async_read_and_hash(peer_request const& r, boost::function<void(int, disk_io_job const&)> const& handler,
                              int cache_expiry = 0);
@@ -365,7 +367,8 @@ class LIBED2K_EXTRA_EXPORT piece_manager : public intrusive_ptr_base<piece_manag
     int check_fastresume(lazy_entry const& rd, error_code& error);
 
     // this function returns true if the checking is complete
-    int check_files(int& current_slot, int& have_piece, error_code& error);
+    // with a hash pool pieces are read ahead and hashed in parallel
+    int check_files(int& current_slot, int& have_piece, error_code& error, hash_pool* pool = 0);
 
 #ifndef LIBED2K_NO_DEPRECATE
     bool compact_allocation() const { return m_storage_mode == storage_mode_compact; }
@@ -397,6 +400,14 @@ class LIBED2K_EXTRA_EXPORT piece_manager : public intrusive_ptr_base<piece_manag
     int skip_file() const;
     // -1=error 0=ok >0=skip this many pieces
     int check_one_piece(int& have_piece);
+    int check_one_piece(int& have_piece, hash_pool& pool, int read_ahead);
+    int check_piece_hash(md4_hash const& large_hash, md4_hash const& small_hash, int& have_piece);
+    int skip_unreadable() const;
+    void init_hash_to_piece();
+
+    // reads slots following the checked ones and posts them to the pool
+    void fill_check_window(hash_pool& pool, int read_ahead);
+    void clear_check_window();
     int identify_data(md4_hash const& large_hash, md4_hash const& small_hash, int current_slot);
 
     void switch_to_full_mode();
@@ -480,6 +491,22 @@ class LIBED2K_EXTRA_EXPORT piece_manager : public intrusive_ptr_base<piece_manag
     // storage (osed when remapping files)
     storage_constructor_type m_storage_constructor;
 
+    // slot read ahead during the full check
+    struct check_slot {
+        check_slot(int s, int size) : slot(s), read(0), buffer(size) {}
+        int slot;
+        int read;  //!< less than piece size when slot could not be read
+        error_code error;  //!< read error kept until slot is checked
+        std::string error_file;
+        aligned_holder buffer;
+        hash_job job;
+    };
+
+    // slots following m_current_slot which are read and hashed,
+    // the window ends at the first slot which could not be read
+    std::deque<check_slot*> m_check_window;
+    hash_pool* m_check_pool;
+
     // this maps a piece hash to piece index. It will be
     // build the first time it is used (to save time if it
     // isn't needed)
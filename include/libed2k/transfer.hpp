@@ -126,6 +126,10 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     void set_download_limit(int limit);
     int download_limit() const;
 
+    // index of the session bandwidth class of the transfer, -1 is none
+    void set_bandwidth_class(int c) { m_bandwidth_class = c; }
+    int bandwidth_class() const { return m_bandwidth_class; }
+
     void piece_availability(std::vector<int>& avail) const;
 
     void set_piece_priority(int index, int priority);
@@ -156,6 +160,10 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     stat statistics() const { return m_stat; }
     void add_stats(const stat& s);
 
+    // called when peers receive payload, the first one after the
+    // download started gives the time to first byte
+    void payload_received();
+
     void ip_filter_updated() { m_policy.ip_filter_updated(); }
 
     void set_upload_mode(bool b);
@@ -251,6 +259,14 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     void activate(bool a);
     boost::uint16_t last_active() const { return m_last_active; }
 
+    /**
+      * dormant seed keeps hashes, path and announce state only, storage
+      * and file handles are created on first file request or user action
+     */
+    bool is_dormant() const { return m_dormant; }
+    void wake_up();
+    void go_dormant();
+
     // --------------------------------------------
     // SERVER MANAGEMENT
     // --------------------------------------------
@@ -267,7 +283,8 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     void on_storage_moved(int ret, disk_io_job const& j);
     void on_transfer_aborted(int ret, disk_io_job const& j);
     void on_transfer_paused(int ret, disk_io_job const& j);
-    void on_save_resume_data(int ret, disk_io_job const& j);
+    void on_save_resume_data(int ret, disk_io_job const& j, int flags);
+    void journal_resume_data(entry const& rd);
     void on_resume_data_checked(int ret, disk_io_job const& j);
     void on_piece_checked(int ret, disk_io_job const& j);
     void on_piece_verified(int ret, disk_io_job const& j, boost::function<void(int)> f);
@@ -279,6 +296,7 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     // BANDWIDTH MANAGEMENT
     // --------------------------------------------
     bandwidth_channel m_bandwidth_channel[2];
+    int m_bandwidth_class;
 // int bandwidth_throttle(int channel) const;
 
 #ifndef LIBED2K_DISABLE_DHT
@@ -292,6 +310,9 @@ class transfer : public boost::enable_shared_from_this<transfer> {
    private:
     // will initialize the storage and the piece-picker
     void init();
+    void create_storage();
+    // restores full piece picker of a finished transfer
+    void expand_picker();
     void bytes_done(transfer_status& st) const;
     void add_failed_bytes(int b);
     int block_bytes_wanted(const piece_block& p) const { return BLOCK_SIZE; }
@@ -336,6 +357,9 @@ class transfer : public boost::enable_shared_from_this<transfer> {
     // haven't
     bool m_seed_mode;
 
+    // seed without storage, see wake_up()
+    bool m_dormant;
+
     // set to true when this transfer may not download anything
     bool m_upload_mode;
 
@@ -402,6 +426,10 @@ class transfer : public boost::enable_shared_from_this<transfer> {
 
     duration_timer m_minute_timer;
 
+    // when the transfer switched to downloading, min_time() once
+    // the first payload arrived or while it's paused
+    ptime m_download_start;
+
     /** previously saved resume data */
     std::vector<char> m_resume_data;
     lazy_entry m_resume_entry;
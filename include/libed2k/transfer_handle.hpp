@@ -289,6 +289,8 @@ struct transfer_handle {
     int upload_limit() const;
     void set_download_limit(int limit) const;
     int download_limit() const;
+    void set_bandwidth_class(int c) const;
+    int bandwidth_class() const;
     void set_upload_mode(bool b) const;
     void set_eager_mode(bool b) const;
 
@@ -299,7 +301,8 @@ struct transfer_handle {
     int num_peers() const;
     int num_seeds() const;
 
-    enum save_resume_flags_t { flush_disk_cache = 1, save_info_dict = 2 };
+    // journal_only updates the session's resume journal and posts no save_resume_data_alert
+    enum save_resume_flags_t { flush_disk_cache = 1, save_info_dict = 2, journal_only = 4 };
     void save_resume_data(int flags = 0) const;
     bool need_save_resume_data() const;
 
@@ -44,20 +44,58 @@ alert::alert() : m_timestamp(time_now()) {}
 alert::~alert() {}
 ptime alert::timestamp() const { return m_timestamp; }
 
+alert_arena::alert_arena() : m_block(0), m_used(0) {}
+
+alert_arena::~alert_arena() {
+    reset();
+    for (std::vector<char*>::iterator i = m_blocks.begin(); i != m_blocks.end(); ++i) delete[] *i;
+}
+
+void* alert_arena::allocate(size_t bytes) {
+    bytes = (bytes + alignment - 1) & ~size_t(alignment - 1);
+
+    if (bytes > block_size) {
+        m_large.push_back(new char[bytes]);
+        return m_large.back();
+    }
+
+    if (m_blocks.empty() || m_used + bytes > block_size) {
+        if (!m_blocks.empty()) ++m_block;
+        if (m_block == m_blocks.size()) m_blocks.push_back(new char[block_size]);
+        m_used = 0;
+    }
+
+    void* ret = m_blocks[m_block] + m_used;
+    m_used += bytes;
+    return ret;
+}
+
+void alert_arena::reset() {
+    for (std::vector<char*>::iterator i = m_large.begin(); i != m_large.end(); ++i) delete[] *i;
+    m_large.clear();
+    m_block = 0;
+    m_used = 0;
+}
+
 alert_manager::alert_manager(io_service& ios)
-    : m_alert_mask(alert::error_notification), m_queue_size_limit(queue_size_limit_default), m_ios(ios) {}
+    : m_current(0), m_alert_mask(alert::error_notification), m_queue_size_limit(queue_size_limit_default), m_ios(ios) {}
 
 alert_manager::~alert_manager() {
-    while (!m_alerts.empty()) {
-        delete m_alerts.front();
-        m_alerts.pop();
-    }
+    release(m_batches[0]);
+    release(m_batches[1]);
+}
+
+void alert_manager::release(alert_batch& batch) {
+    for (size_t i = batch.head; i < batch.alerts.size(); ++i) batch.alerts[i]->~alert();
+    batch.alerts.clear();
+    batch.head = 0;
+    batch.arena.reset();
 }
 
 alert const* alert_manager::wait_for_alert(time_duration max_wait) {
     boost::mutex::scoped_lock lock(m_mutex);
 
-    if (!m_alerts.empty()) return m_alerts.front();
+    if (queued() != 0) return m_batches[m_current].alerts[m_batches[m_current].head];
 
     //              system_time end = get_system_time()
     //                      + boost::posix_time::microseconds(total_microseconds(max_wait));
@@ -70,14 +108,14 @@ alert const* alert_manager::wait_for_alert(time_duration max_wait) {
     ptime start = time_now_hires();
 
     // TODO: change this to use an asio timer instead
-    while (m_alerts.empty()) {
+    while (queued() == 0) {
         lock.unlock();
         sleep(50);
         lock.lock();
         if (time_now_hires() - start >= max_wait) return 0;
     }
 
-    return m_alerts.front();
+    return m_batches[m_current].alerts[m_batches[m_current].head];
 }
 
 void alert_manager::set_dispatch_function(boost::function<void(alert const&)> const& fun) {
@@ -85,14 +123,17 @@ void alert_manager::set_dispatch_function(boost::function<void(alert const&)> co
 
     m_dispatch = fun;
 
-    std::queue<alert*> alerts = m_alerts;
-    while (!m_alerts.empty()) m_alerts.pop();
+    // queued alerts live in arena, so dispatcher gets copies
+    alert_batch& b = m_batches[m_current];
+    std::vector<alert*> alerts;
+    alerts.reserve(queued());
+    for (size_t i = b.head; i < b.alerts.size(); ++i) alerts.push_back(b.alerts[i]->clone().release());
+    release(b);
     lock.unlock();
 
-    while (!alerts.empty()) {
-        m_dispatch(*alerts.front());
-        delete alerts.front();
-        alerts.pop();
+    for (std::vector<alert*>::iterator i = alerts.begin(); i != alerts.end(); ++i) {
+        std::auto_ptr<alert> holder(*i);
+        m_dispatch(**i);
     }
 }
 
@@ -101,35 +142,43 @@ void dispatch_alert(boost::function<void(alert const&)> dispatcher, alert* alert
     dispatcher(*alert_);
 }
 
-bool alert_manager::post_alert(const alert& alert_) {
+void alert_manager::dispatch(const alert& alert_) {
+    // LIBED2K_ASSERT(queued() == 0);
+    m_ios.post(boost::bind(&dispatch_alert, m_dispatch, alert_.clone().release()));
+}
+
+std::auto_ptr<alert> alert_manager::get() {
     boost::mutex::scoped_lock lock(m_mutex);
 
-    if (m_dispatch) {
-        // LIBED2K_ASSERT(m_alerts.empty());
-        m_ios.post(boost::bind(&dispatch_alert, m_dispatch, alert_.clone().release()));
-        return true;
-    }
+    if (queued() == 0) return std::auto_ptr<alert>(0);
 
-    if (m_alerts.size() >= m_queue_size_limit) return false;
-    m_alerts.push(alert_.clone().release());
-    m_condition.notify_all();
-    return true;
+    alert_batch& b = m_batches[m_current];
+    alert* a = b.alerts[b.head];
+    std::auto_ptr<alert> result(a->clone());
+    a->~alert();
+    ++b.head;
+
+    // whole batch was taken one by one, reuse its memory
+    if (b.head == b.alerts.size()) release(b);
+    return result;
 }
 
-std::auto_ptr<alert> alert_manager::get() {
+void alert_manager::pop_alerts(std::vector<alert*>& alerts) {
     boost::mutex::scoped_lock lock(m_mutex);
 
-    // LIBED2K_ASSERT(!m_alerts.empty());
+    // caller is done with alerts of previous call
+    alert_batch& previous = m_batches[m_current ^ 1];
+    release(previous);
 
-    alert* result = m_alerts.front();
-    m_alerts.pop();
-    return std::auto_ptr<alert>(result);
+    alert_batch& b = m_batches[m_current];
+    alerts.assign(b.alerts.begin() + b.head, b.alerts.end());
+    m_current ^= 1;
 }
 
 bool alert_manager::pending() const {
     boost::mutex::scoped_lock lock(m_mutex);
 
-    return !m_alerts.empty();
+    return queued() != 0;
 }
 
 size_t alert_manager::set_alert_queue_size_limit(size_t queue_size_limit_) {
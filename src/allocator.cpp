@@ -44,6 +44,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>  // _SC_PAGESIZE
 #endif
 
+#include <map>
+#include <libed2k/thread.hpp>
+
+#if LIBED2K_USE_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
 #if LIBED2K_USE_MEMALIGN || LIBED2K_USE_POSIX_MEMALIGN
 #include <malloc.h>  // memalign
 #endif
@@ -154,4 +161,90 @@ void page_aligned_allocator::free(char* const block) {
     ::free(block);
 #endif
 }
+
+namespace {
+struct huge_mapping {
+    std::size_t size;
+    bool mapped;  //!< false for the page aligned fallback
+};
+
+// munmap needs the length of the mapping, and the disk
+// buffer pool tells its huge page buffers by the range
+mutex huge_mutex;
+std::map<char*, huge_mapping> huge_mappings;
+
+char* add_mapping(char* p, std::size_t size, bool mapped) {
+    if (p == 0) return p;
+    huge_mapping m = {size, mapped};
+    mutex::scoped_lock l(huge_mutex);
+    huge_mappings[p] = m;
+    return p;
+}
+}
+
+std::pair<char*, char*> huge_page_allocator::mapping(char const* p) {
+    mutex::scoped_lock l(huge_mutex);
+    std::map<char*, huge_mapping>::iterator i = huge_mappings.upper_bound(const_cast<char*>(p));
+    if (i == huge_mappings.begin()) return std::pair<char*, char*>(0, 0);
+    --i;
+    if (p >= i->first + i->second.size) return std::pair<char*, char*>(0, 0);
+    return std::pair<char*, char*>(i->first, i->first + i->second.size);
+}
+
+#if LIBED2K_USE_HUGE_PAGES
+int huge_page_allocator::huge_page_size() { return 2 * 1024 * 1024; }
+
+char* huge_page_allocator::malloc(size_type bytes) {
+    const std::size_t huge = huge_page_size();
+    const std::size_t size = (bytes + huge - 1) & ~(huge - 1);
+    char* ret = 0;
+
+#ifdef MAP_HUGETLB
+    void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) ret = (char*)p;
+#endif
+
+    if (ret == 0) {
+        // no reserved huge pages, map with room to align the start
+        // and let the kernel back it with transparent huge pages
+        void* p = mmap(0, size + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return add_mapping(page_aligned_allocator::malloc(bytes), bytes, false);
+        char* base = (char*)p;
+        ret = (char*)((std::size_t(base) + huge - 1) & ~(huge - 1));
+        if (ret > base) munmap(base, ret - base);
+        if (base + huge > ret) munmap(ret + size, base + huge - ret);
+#ifdef MADV_HUGEPAGE
+        madvise(ret, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    return add_mapping(ret, size, true);
+}
+
+void huge_page_allocator::free(char* const block) {
+    mutex::scoped_lock l(huge_mutex);
+    std::map<char*, huge_mapping>::iterator i = huge_mappings.find(block);
+    LIBED2K_ASSERT(i != huge_mappings.end());
+    huge_mapping m = i->second;
+    huge_mappings.erase(i);
+    l.unlock();
+    if (m.mapped)
+        munmap(block, m.size);
+    else
+        page_aligned_allocator::free(block);
+}
+#else
+int huge_page_allocator::huge_page_size() { return page_size(); }
+
+char* huge_page_allocator::malloc(size_type bytes) {
+    return add_mapping(page_aligned_allocator::malloc(bytes), bytes, false);
+}
+
+void huge_page_allocator::free(char* const block) {
+    mutex::scoped_lock l(huge_mutex);
+    huge_mappings.erase(block);
+    l.unlock();
+    page_aligned_allocator::free(block);
+}
+#endif
 }
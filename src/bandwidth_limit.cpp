@@ -34,7 +34,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/bandwidth_limit.hpp"
 
 namespace libed2k {
-bandwidth_channel::bandwidth_channel() : tmp(0), distribute_quota(0), m_quota_left(0), m_limit(0) {}
+bandwidth_channel::bandwidth_channel()
+    : tmp(0), parent(0), weight(1), tmp_weight(0), reserved(0), m_quota_left(0), m_limit(0), m_burst(0) {}
 
 // 0 means infinite
 void bandwidth_channel::throttle(int limit) {
@@ -44,6 +45,11 @@ void bandwidth_channel::throttle(int limit) {
     m_limit = limit;
 }
 
+void bandwidth_channel::burst(int bytes) {
+    LIBED2K_ASSERT(bytes >= 0);
+    m_burst = bytes;
+}
+
 int bandwidth_channel::quota_left() const {
     if (m_limit == 0) return inf;
     return (std::max)(int(m_quota_left), 0);
@@ -52,8 +58,8 @@ int bandwidth_channel::quota_left() const {
 void bandwidth_channel::update_quota(int dt_milliseconds) {
     if (m_limit == 0) return;
     m_quota_left += (m_limit * dt_milliseconds + 500) / 1000;
-    if (m_quota_left > m_limit * 3) m_quota_left = m_limit * 3;
-    distribute_quota = int((std::max)(m_quota_left, boost::int64_t(0)));
+    boost::int64_t max_quota = m_limit + (m_burst > 0 ? m_burst : m_limit * 2);
+    if (m_quota_left > max_quota) m_quota_left = max_quota;
 }
 
 // this is used when connections disconnect with
@@ -30,142 +30,283 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <algorithm>
+
 #include "libed2k/bandwidth_manager.hpp"
-#include "libed2k/peer_connection.hpp"
 #include "libed2k/time.hpp"
+#include "libed2k/util.hpp"
+#include "libed2k/event_log.hpp"
 #include "libed2k/invariant_check.hpp"
 
 namespace libed2k {
 
-bandwidth_manager::bandwidth_manager(int channel) : m_queued_bytes(0), m_channel(channel), m_abort(false) {}
+bandwidth_manager::bandwidth_manager(int channel)
+    : m_wheel(wheel_size),
+      m_drained(wheel_size),
+      m_wheel_pos(0),
+      m_now(0),
+      m_slice(100),
+      m_elapsed(0),
+      m_queue_size(0),
+      m_queued_bytes(0),
+      m_channel(channel),
+      m_abort(false) {}
 
 void bandwidth_manager::close() {
     m_abort = true;
-    m_queue.clear();
+    for (int i = 0; i < wheel_size; ++i) {
+        m_wheel[i].clear();
+        m_drained[i].clear();
+    }
+    for (std::vector<bandwidth_channel*>::iterator i = m_channels.begin(), end(m_channels.end()); i != end; ++i) {
+        (*i)->tmp = 0;
+        (*i)->tmp_weight = 0;
+        (*i)->reserved = 0;
+    }
+    m_channels.clear();
+    m_queue_size = 0;
     m_queued_bytes = 0;
 }
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
-bool bandwidth_manager::is_queued(const peer_connection* peer) const {
-    for (queue_t::const_iterator i = m_queue.begin(), end(m_queue.end()); i != end; ++i) {
-        if (i->peer.get() == peer) return true;
+bool bandwidth_manager::is_queued(const bandwidth_socket* peer) const {
+    for (int s = 0; s < wheel_size; ++s) {
+        for (queue_t::const_iterator i = m_wheel[s].begin(), end(m_wheel[s].end()); i != end; ++i) {
+            if (i->peer == peer) return true;
+        }
+        for (queue_t::const_iterator i = m_drained[s].begin(), end(m_drained[s].end()); i != end; ++i) {
+            if (i->peer == peer) return true;
+        }
     }
     return false;
 }
 #endif
 
-int bandwidth_manager::queue_size() const { return m_queue.size(); }
+int bandwidth_manager::queue_size() const { return m_queue_size; }
 
 int bandwidth_manager::queued_bytes() const { return m_queued_bytes; }
 
-// non prioritized means that, if there's a line for bandwidth,
-// others will cut in front of the non-prioritized peers.
-// this is used by web seeds
-int bandwidth_manager::request_bandwidth(const boost::intrusive_ptr<peer_connection>& peer, int blk, int priority,
-                                         bandwidth_channel* chan1, bandwidth_channel* chan2, bandwidth_channel* chan3,
-                                         bandwidth_channel* chan4, bandwidth_channel* chan5) {
+void bandwidth_manager::set_slice(int ms) { m_slice = (std::max)(ms, 1); }
+
+int bandwidth_manager::request_bandwidth(bandwidth_socket* peer, int blk, int priority, bandwidth_channel* const* chan,
+                                         int num_channels) {
     LIBED2K_INVARIANT_CHECK;
     if (m_abort) return 0;
 
     LIBED2K_ASSERT(blk > 0);
     LIBED2K_ASSERT(priority > 0);
-    LIBED2K_ASSERT(!is_queued(peer.get()));
+    LIBED2K_ASSERT(!is_queued(peer));
 
     bw_request bwr(peer, blk, priority);
+    bwr.since = m_now;
+    LIBED2K_ASSERT(num_channels <= bw_request::max_channels);
     int i = 0;
-    if (chan1 && chan1->throttle() > 0) bwr.channel[i++] = chan1;
-    if (chan2 && chan2->throttle() > 0) bwr.channel[i++] = chan2;
-    if (chan3 && chan3->throttle() > 0) bwr.channel[i++] = chan3;
-    if (chan4 && chan4->throttle() > 0) bwr.channel[i++] = chan4;
-    if (chan5 && chan5->throttle() > 0) bwr.channel[i++] = chan5;
-    if (i == 0) {
+    bool limited = false;
+    for (int c = 0; c < num_channels; ++c) {
+        // unlimited class channels still split the bandwidth of their parent
+        if (chan[c] == 0 || (chan[c]->throttle() == 0 && chan[c]->parent == 0)) continue;
+        bwr.channel[i++] = chan[c];
+        limited = limited || chan[c]->throttle() > 0;
+    }
+    if (!limited) {
         // the connection is not rate limited by any of its
         // bandwidth channels, or it doesn't belong to any
         // channels. There's no point in adding it to
         // the queue, just satisfy the request immediately
         return blk;
     }
-    m_queued_bytes += blk;
-    m_queue.push_back(bwr);
+
+    enqueue(bwr);
+    log_event(ev_bw_request, m_channel, blk, priority, m_queue_size);
+    // the first grant is due in the next slice at the earliest
+    park(bwr, 1, false);
     return 0;
 }
 
+void bandwidth_manager::cancel(const bandwidth_socket* peer) {
+    LIBED2K_INVARIANT_CHECK;
+    for (int s = 0; s < wheel_size; ++s) {
+        if (cancel(m_wheel[s], peer) || cancel(m_drained[s], peer)) return;
+    }
+}
+
+bool bandwidth_manager::cancel(queue_t& q, const bandwidth_socket* peer) {
+    for (queue_t::iterator i = q.begin(), end(q.end()); i != end; ++i) {
+        if (i->peer != peer) continue;
+        dequeue(*i);
+        q.erase(i);
+        return true;
+    }
+    return false;
+}
+
+void bandwidth_manager::enqueue(const bw_request& r) {
+    ++m_queue_size;
+    m_queued_bytes += r.request_size - r.assigned;
+    for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) {
+        bandwidth_channel* bwc = r.channel[j];
+        if (bwc->tmp == 0) m_channels.push_back(bwc);
+        LIBED2K_ASSERT(INT_MAX - bwc->tmp > r.priority);
+        bwc->tmp += r.priority;
+    }
+}
+
+void bandwidth_manager::dequeue(const bw_request& r) {
+    --m_queue_size;
+    m_queued_bytes -= r.request_size - r.assigned;
+    for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) {
+        bandwidth_channel* bwc = r.channel[j];
+        bwc->reserved -= r.reserved;
+        bwc->tmp -= r.priority;
+        LIBED2K_ASSERT(bwc->tmp >= 0);
+        if (bwc->tmp > 0) continue;
+        std::vector<bandwidth_channel*>::iterator i = std::find(m_channels.begin(), m_channels.end(), bwc);
+        LIBED2K_ASSERT(i != m_channels.end());
+        if (i != m_channels.end()) m_channels.erase(i);
+    }
+}
+
+void bandwidth_manager::park(bw_request& r, int slices, bool drained) {
+    slices = (std::min)((std::max)(slices, 1), int(wheel_size) - 1);
+    int slot = (m_wheel_pos + slices) % wheel_size;
+    (drained ? m_drained : m_wheel)[slot].push_back(r);
+}
+
 #ifdef LIBED2K_DEBUG
 void bandwidth_manager::check_invariant() const {
     int queued = 0;
-    for (queue_t::const_iterator i = m_queue.begin(), end(m_queue.end()); i != end; ++i) {
-        queued += i->request_size - i->assigned;
+    int size = 0;
+    for (int s = 0; s < wheel_size; ++s) {
+        for (queue_t::const_iterator i = m_wheel[s].begin(), end(m_wheel[s].end()); i != end; ++i) {
+            queued += i->request_size - i->assigned;
+            ++size;
+        }
+        for (queue_t::const_iterator i = m_drained[s].begin(), end(m_drained[s].end()); i != end; ++i) {
+            queued += i->request_size - i->assigned;
+            ++size;
+        }
     }
     LIBED2K_ASSERT(queued == m_queued_bytes);
+    LIBED2K_ASSERT(size == m_queue_size);
 }
 #endif
 
 void bandwidth_manager::update_quotas(time_duration const& dt) {
     if (m_abort) return;
-    if (m_queue.empty()) return;
+    if (m_queue_size == 0) {
+        m_elapsed = 0;
+        return;
+    }
 
     LIBED2K_INVARIANT_CHECK;
 
     int dt_milliseconds = total_milliseconds(dt);
     if (dt_milliseconds > 3000) dt_milliseconds = 3000;
+    if (dt_milliseconds < 0) dt_milliseconds = 0;
 
-    // for each bandwidth channel, call update_quota(dt)
+    // class weights may change while requests wait, so the
+    // weights of the active children are summed up again
+    for (std::vector<bandwidth_channel*>::iterator i = m_channels.begin(), end(m_channels.end()); i != end; ++i) {
+        if ((*i)->parent) (*i)->parent->tmp_weight = 0;
+    }
 
-    std::vector<bandwidth_channel*> channels;
+    for (std::vector<bandwidth_channel*>::iterator i = m_channels.begin(), end(m_channels.end()); i != end; ++i) {
+        (*i)->update_quota(dt_milliseconds);
+        if ((*i)->parent) (*i)->parent->tmp_weight += (*i)->weight;
+    }
 
-    for (queue_t::iterator i = m_queue.begin(); i != m_queue.end();) {
-        if (i->peer->is_disconnecting()) {
-            m_queued_bytes -= i->request_size - i->assigned;
+    m_elapsed += dt_milliseconds;
+    int slices = (std::min)(m_elapsed / m_slice, int(wheel_size));
+    m_elapsed %= m_slice;
 
-            // return all assigned quota to all the
-            // bandwidth channels this peer belongs to
-            for (int j = 0; j < 5 && i->channel[j]; ++j) {
-                bandwidth_channel* bwc = i->channel[j];
-                bwc->return_quota(i->assigned);
-            }
+    queue_t granted;
 
-            i = m_queue.erase(i);
-            continue;
-        }
-        for (int j = 0; j < 5 && i->channel[j]; ++j) {
-            bandwidth_channel* bwc = i->channel[j];
-            bwc->tmp = 0;
-        }
-        ++i;
+    for (int s = 0; s < slices; ++s) {
+        m_wheel_pos = (m_wheel_pos + 1) % wheel_size;
+        ++m_now;
+        // requests that found their channels drained go first,
+        // otherwise they would be behind the others again
+        queue_t due;
+        due.swap(m_drained[m_wheel_pos]);
+        run_slot(due, granted);
+        due.clear();
+        due.swap(m_wheel[m_wheel_pos]);
+        run_slot(due, granted);
     }
 
-    for (queue_t::iterator i = m_queue.begin(), end(m_queue.end()); i != end; ++i) {
-        for (int j = 0; j < 5 && i->channel[j]; ++j) {
-            bandwidth_channel* bwc = i->channel[j];
-            if (bwc->tmp == 0) channels.push_back(bwc);
-            LIBED2K_ASSERT(INT_MAX - bwc->tmp > i->priority);
-            bwc->tmp += i->priority;
-        }
+    // the granted requests counted on their channels until now, so
+    // the ones due after them earned the same share as before
+    for (queue_t::iterator i = granted.begin(), end(granted.end()); i != end; ++i) {
+        dequeue(*i);
+        log_event(ev_bw_grant, m_channel, i->assigned, m_queue_size);
     }
 
-    for (std::vector<bandwidth_channel *>::iterator i = channels.begin(), end(channels.end()); i != end; ++i) {
-        (*i)->update_quota(dt_milliseconds);
+    // the peers are called last, they may request
+    // bandwidth again right away
+    for (queue_t::iterator i = granted.begin(), end(granted.end()); i != end; ++i) {
+        i->peer->assign_bandwidth(m_channel, i->assigned);
     }
+}
 
-    queue_t tm;
+void bandwidth_manager::run_slot(queue_t& slot, queue_t& granted) {
+    for (queue_t::iterator i = slot.begin(), end(slot.end()); i != end; ++i) {
+        bw_request& r = *i;
 
-    for (queue_t::iterator i = m_queue.begin(); i != m_queue.end();) {
-        int a = i->assign_bandwidth();
-        if (i->assigned == i->request_size || (i->ttl <= 0 && i->assigned > 0)) {
-            a += i->request_size - i->assigned;
-            LIBED2K_ASSERT(i->assigned <= i->request_size);
-            tm.push_back(*i);
-            i = m_queue.erase(i);
-        } else {
-            ++i;
+        if (r.peer->is_disconnecting()) {
+            dequeue(r);
+            continue;
         }
-        m_queued_bytes -= a;
-    }
 
-    while (!tm.empty()) {
-        bw_request& bwr = tm.back();
-        bwr.peer->assign_bandwidth(m_channel, bwr.assigned);
-        tm.pop_back();
+        for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) r.channel[j]->reserved -= r.reserved;
+        r.reserved = 0;
+
+        // the request earns its share of the time it waited
+        int left = r.request_size - r.assigned;
+        boost::int64_t deficit = boost::int64_t(r.deficit) + r.quantum((m_now - r.since) * m_slice);
+        r.deficit = int((std::min)(deficit, boost::int64_t(left)));
+        r.since = m_now;
+
+        // slow requests don't wait for a full grant longer than max_wait
+        int want = (std::min)((std::min)(left, int(min_grant)), r.quantum(max_wait));
+
+        // the quota of the most limiting channel, which is not
+        // held back for requests that found it drained before
+        int quota = left;
+        bandwidth_channel* tight = 0;
+        for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) {
+            bandwidth_channel* bwc = r.channel[j];
+            if (bwc->throttle() == 0) continue;
+            int q = (std::max)(bwc->quota_left() - bwc->reserved, 0);
+            if (q >= quota) continue;
+            quota = q;
+            tight = bwc;
+        }
+
+        int grant = (std::min)(r.deficit, quota);
+        if (grant >= want) {
+            for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) r.channel[j]->use_quota(grant);
+            // the rest leaves the queue once the slots are run
+            m_queued_bytes -= grant;
+            r.assigned += grant;
+            r.deficit -= grant;
+            granted.push_back(r);
+            continue;
+        }
+
+        // wait until both the deficit and the quota of
+        // the tightest channel cover the grant
+        boost::int64_t wait = 0;
+        if (r.deficit < want) wait = boost::int64_t(want - r.deficit) * 1000 / r.quantum(1000);
+        bool drained = tight && quota < want && r.deficit >= want;
+        if (drained) {
+            // hold back what the request needs, so the requests
+            // running before it wakes up don't take it again
+            wait = (std::max)(wait, boost::int64_t(want - quota) * 1000 / tight->throttle());
+            r.reserved = want;
+            for (int j = 0; j < bw_request::max_channels && r.channel[j]; ++j) r.channel[j]->reserved += want;
+        }
+        wait = (std::min)(wait, boost::int64_t(max_wait));
+        park(r, div_ceil(int(wait), m_slice), drained);
     }
 }
 }
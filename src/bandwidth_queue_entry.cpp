@@ -35,30 +35,59 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 
 #include "libed2k/bandwidth_queue_entry.hpp"
-#include "libed2k/peer_connection.hpp"
 
 namespace libed2k {
-bw_request::bw_request(const boost::intrusive_ptr<peer_connection>& pe, int blk, int prio)
-    : peer(pe), priority(prio), assigned(0), request_size(blk), ttl(20) {
+bw_request::bw_request(bandwidth_socket* pe, int blk, int prio)
+    : peer(pe), priority(prio), assigned(0), request_size(blk), deficit(0), reserved(0), since(0) {
     LIBED2K_ASSERT(priority > 0);
     std::memset(channel, 0, sizeof(channel));
+    if (peer) peer->add_ref();
 }
 
-int bw_request::assign_bandwidth() {
-    LIBED2K_ASSERT(assigned < request_size);
-    int quota = request_size - assigned;
-    LIBED2K_ASSERT(quota >= 0);
-    --ttl;
-    if (quota == 0) return quota;
+bw_request::bw_request(const bw_request& r) : peer(0) { *this = r; }
 
-    for (int j = 0; j < 5 && channel[j]; ++j) {
-        if (channel[j]->throttle() == 0) continue;
-        if (channel[j]->tmp == 0) continue;
-        quota = (std::min)(int(boost::int64_t(channel[j]->distribute_quota) * priority / channel[j]->tmp), quota);
+bw_request::~bw_request() {
+    if (peer) peer->release();
+}
+
+bw_request& bw_request::operator=(const bw_request& r) {
+    if (r.peer) r.peer->add_ref();
+    if (peer) peer->release();
+    peer = r.peer;
+    priority = r.priority;
+    assigned = r.assigned;
+    request_size = r.request_size;
+    deficit = r.deficit;
+    reserved = r.reserved;
+    since = r.since;
+    std::memcpy(channel, r.channel, sizeof(channel));
+    return *this;
+}
+
+int bw_request::quantum(int ms) const {
+    boost::int64_t quantum = bandwidth_channel::inf;
+
+    for (int j = 0; j < max_channels && channel[j]; ++j) {
+        bandwidth_channel* c = channel[j];
+        if (c->throttle() == 0) continue;
+        if (c->tmp == 0) continue;
+
+        // a class borrowing from this channel gets its weighted share,
+        // which is split among the requests of the class by priority
+        bandwidth_channel* child = 0;
+        for (int k = 0; k < max_channels && channel[k]; ++k) {
+            if (channel[k]->parent != c) continue;
+            child = channel[k];
+            break;
+        }
+
+        boost::int64_t share = boost::int64_t(c->throttle()) * ms / 1000;
+        if (child && c->tmp_weight > 0 && child->tmp > 0)
+            share = share * child->weight / c->tmp_weight * priority / child->tmp;
+        else
+            share = share * priority / c->tmp;
+        quantum = (std::min)(share, quantum);
     }
-    assigned += quota;
-    for (int j = 0; j < 5 && channel[j]; ++j) channel[j]->use_quota(quota);
-    LIBED2K_ASSERT(assigned <= request_size);
-    return quota;
+    return int((std::max)(quantum, boost::int64_t(1)));
 }
 }
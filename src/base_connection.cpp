@@ -6,11 +6,12 @@
 
 namespace libed2k {
 base_connection::base_connection(aux::session_impl& ses)
-    : m_ses(ses), m_socket(new tcp::socket(ses.m_io_service)), m_deadline(ses.m_io_service) {
+    : m_ses(ses), m_socket(new socket_type(ses.m_io_service)), m_deadline(ses.m_io_service) {
+    m_socket->instantiate<stream_socket>(ses.m_io_service);
     reset();
 }
 
-base_connection::base_connection(aux::session_impl& ses, boost::shared_ptr<tcp::socket> s, const tcp::endpoint& remote)
+base_connection::base_connection(aux::session_impl& ses, boost::shared_ptr<socket_type> s, const tcp::endpoint& remote)
     : m_ses(ses), m_socket(s), m_deadline(ses.m_io_service), m_remote(remote) {
     reset();
 }
@@ -167,8 +168,12 @@ void base_connection::on_read_packet(const error_code& error, size_t nSize) {
         handler_map::iterator itr = m_handlers.find(std::make_pair(m_in_header.m_type, m_in_header.m_protocol));
 
         if (rc == Z_OK && itr != m_handlers.end()) {
+            ptime start = time_now_hires();
             itr->second(error);
+            m_ses.m_metrics.peer_dispatch(m_in_header.m_protocol, m_in_header.m_type)
+                .add(total_microseconds(time_now_hires() - start));
         } else {
+            ++m_ses.m_metrics.counters[session_metrics::unhandled_packets];
             DBG("ignore unhandled packet: " << std::hex << int(m_in_header.m_type) << " <<< " << m_remote);
         }
 
@@ -0,0 +1,499 @@
+#include <cstring>
+
+#include "libed2k/compact_tag_list.hpp"
+#include "libed2k/util.hpp"
+
+namespace libed2k {
+
+namespace {
+void skip(archive::ed2k_iarchive& ar, size_t n) {
+#ifdef WIN32
+    // windows generates exceptions independent by exceptions flags in stream
+    try {
+        ar.container().seekg(n, std::ios::cur);
+    } catch (std::ios_base::failure&) {
+        throw libed2k::libed2k_exception(libed2k::errors::unexpected_istream_error);
+    }
+#else
+    ar.container().seekg(n, std::ios::cur);
+#endif
+
+    // check status
+    if (!ar.container().good()) {
+        throw libed2k::libed2k_exception(libed2k::errors::unexpected_istream_error);
+    }
+}
+
+// same objects as tag_list creates, named tags by name and others by id
+template <typename T>
+compact_tag_storage::value_type make_tag(T v, const std::string& strName, tg_nid_type nNameId, bool bNewED2K) {
+    if (strName.empty()) return compact_tag_storage::value_type(new typed_tag<T>(v, nNameId, bNewED2K));
+    return compact_tag_storage::value_type(new typed_tag<T>(v, strName, bNewED2K));
+}
+
+template <typename T>
+void save_value(archive::ed2k_oarchive& ar, boost::uint64_t v) {
+    T t = static_cast<T>(v);
+    ar& t;
+}
+}
+
+const size_t compact_tag_storage::npos;
+
+void compact_tag_storage::clear() {
+    m_entries.clear();
+    m_arena.clear();
+}
+
+void compact_tag_storage::reserve(size_t tags, size_t bytes) {
+    m_entries.reserve(tags);
+    m_arena.reserve(bytes);
+}
+
+std::string compact_tag_storage::getTagName(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    const entry& e = m_entries[n];
+    return e.name_size ? std::string(data(e.name_offset), e.name_size) : std::string();
+}
+
+size_t compact_tag_storage::find(tg_nid_type nId) const {
+    if (nId == TAGTYPE_UNDEFINED) return npos;
+
+    for (size_t n = 0; n < m_entries.size(); ++n) {
+        if (m_entries[n].name_id == nId) return n;
+    }
+
+    return npos;
+}
+
+size_t compact_tag_storage::find(const std::string& strName) const {
+    if (strName.empty()) return npos;
+
+    for (size_t n = 0; n < m_entries.size(); ++n) {
+        const entry& e = m_entries[n];
+        if (e.name_size == strName.size() && std::memcmp(data(e.name_offset), strName.c_str(), e.name_size) == 0)
+            return n;
+    }
+
+    return npos;
+}
+
+bool compact_tag_storage::is_int(size_t n) const {
+    tg_type t = m_entries[n].type;
+    return t == TAGTYPE_UINT8 || t == TAGTYPE_UINT16 || t == TAGTYPE_UINT32 || t == TAGTYPE_UINT64;
+}
+
+bool compact_tag_storage::is_string(size_t n) const {
+    tg_type t = m_entries[n].type;
+    return t == TAGTYPE_STRING || (t >= TAGTYPE_STR1 && t <= TAGTYPE_STR22);
+}
+
+boost::uint64_t compact_tag_storage::asInt(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE(is_int(n));
+    return m_entries[n].int_value;
+}
+
+std::string compact_tag_storage::asString(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE(is_string(n));
+    const entry& e = m_entries[n];
+    return e.data.size ? std::string(data(e.data.offset), e.data.size) : std::string();
+}
+
+bool compact_tag_storage::asBool(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE((m_entries[n].type == TAGTYPE_BOOL));
+    return m_entries[n].bool_value;
+}
+
+float compact_tag_storage::asFloat(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE((m_entries[n].type == TAGTYPE_FLOAT32));
+    return m_entries[n].float_value;
+}
+
+std::vector<char> compact_tag_storage::asBlob(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE((m_entries[n].type == TAGTYPE_BLOB));
+    const entry& e = m_entries[n];
+    return e.data.size ? std::vector<char>(data(e.data.offset), data(e.data.offset) + e.data.size)
+                       : std::vector<char>();
+}
+
+md4_hash compact_tag_storage::asHash(size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    CHECK_TAG_TYPE((m_entries[n].type == TAGTYPE_HASH16));
+    return md4_hash(reinterpret_cast<const md4_hash::md4hash_container&>(*data(m_entries[n].data.offset)));
+}
+
+const compact_tag_storage::value_type compact_tag_storage::operator[](size_t n) const {
+    LIBED2K_ASSERT(n < m_entries.size());
+    const entry& e = m_entries[n];
+    std::string strName = getTagName(n);
+
+    switch (e.type) {
+        case TAGTYPE_UINT64:
+            return make_tag<boost::uint64_t>(e.int_value, strName, e.name_id, e.new_ed2k);
+        case TAGTYPE_UINT32:
+            return make_tag<boost::uint32_t>(static_cast<boost::uint32_t>(e.int_value), strName, e.name_id,
+                                            e.new_ed2k);
+        case TAGTYPE_UINT16:
+            return make_tag<boost::uint16_t>(static_cast<boost::uint16_t>(e.int_value), strName, e.name_id,
+                                            e.new_ed2k);
+        case TAGTYPE_UINT8:
+            return make_tag<boost::uint8_t>(static_cast<boost::uint8_t>(e.int_value), strName, e.name_id,
+                                           e.new_ed2k);
+        case TAGTYPE_FLOAT32:
+            return make_tag<float>(e.float_value, strName, e.name_id, e.new_ed2k);
+        case TAGTYPE_BOOL:
+            return make_tag<bool>(e.bool_value, strName, e.name_id, e.new_ed2k);
+        case TAGTYPE_HASH16:
+            return make_tag<md4_hash>(asHash(n), strName, e.name_id, e.new_ed2k);
+        case TAGTYPE_BLOB:
+            return strName.empty() ? value_type(new array_tag(asBlob(n), e.name_id, e.new_ed2k))
+                                   : value_type(new array_tag(asBlob(n), strName, e.new_ed2k));
+        default:
+            return strName.empty() ? value_type(new string_tag(asString(n), e.type, e.name_id, e.new_ed2k))
+                                   : value_type(new string_tag(asString(n), e.type, strName, e.new_ed2k));
+    }
+}
+
+const compact_tag_storage::value_type compact_tag_storage::getTagByNameId(tg_nid_type nId) const {
+    size_t n = find(nId);
+    return (n == npos) ? value_type() : (*this)[n];
+}
+
+const compact_tag_storage::value_type compact_tag_storage::getTagByName(const std::string& strName) const {
+    size_t n = find(strName);
+    return (n == npos) ? value_type() : (*this)[n];
+}
+
+std::string compact_tag_storage::getStringTagByNameId(tg_nid_type nId) const {
+    size_t n = find(nId);
+    if (n == npos) return std::string("");
+    if (!is_string(n)) {
+        ERR("Incorrect to string conversion: " << tagTypetoString(m_entries[n].type));
+        return std::string("");
+    }
+    return asString(n);
+}
+
+std::string compact_tag_storage::getStringTagByName(const std::string& strName) const {
+    size_t n = find(strName);
+    if (n == npos) return std::string("");
+    if (!is_string(n)) {
+        ERR("Incorrect to string conversion: " << tagTypetoString(m_entries[n].type));
+        return std::string("");
+    }
+    return asString(n);
+}
+
+boost::uint64_t compact_tag_storage::getIntTagByNameId(tg_nid_type nId) const {
+    size_t n = find(nId);
+    if (n == npos) return 0;
+    if (!is_int(n)) {
+        ERR("Incorrect to int conversion: " << tagTypetoString(m_entries[n].type));
+        return 0;
+    }
+    return m_entries[n].int_value;
+}
+
+boost::uint64_t compact_tag_storage::getIntTagByName(const std::string& strName) const {
+    size_t n = find(strName);
+    if (n == npos) return 0;
+    if (!is_int(n)) {
+        ERR("Incorrect to int conversion: " << tagTypetoString(m_entries[n].type));
+        return 0;
+    }
+    return m_entries[n].int_value;
+}
+
+boost::uint32_t compact_tag_storage::allocate(size_t n) {
+    boost::uint32_t offset = static_cast<boost::uint32_t>(m_arena.size());
+    m_arena.resize(m_arena.size() + n);
+    return offset;
+}
+
+boost::uint32_t compact_tag_storage::append(const char* p, size_t n) {
+    boost::uint32_t offset = static_cast<boost::uint32_t>(m_arena.size());
+    m_arena.insert(m_arena.end(), p, p + n);
+    return offset;
+}
+
+void compact_tag_storage::add_tag(value_type ptag) {
+    entry e;
+    std::memset(&e, 0, sizeof(e));
+    e.type = ptag->getType();
+    e.name_id = ptag->getNameId();
+    e.new_ed2k = ptag->isNewED2K();
+    std::string strName = ptag->getName();
+    e.name_size = static_cast<boost::uint16_t>(strName.size());
+    e.name_offset = append(strName.c_str(), strName.size());
+
+    switch (e.type) {
+        case TAGTYPE_UINT64:
+        case TAGTYPE_UINT32:
+        case TAGTYPE_UINT16:
+        case TAGTYPE_UINT8:
+            e.int_value = ptag->asInt();
+            break;
+        case TAGTYPE_FLOAT32:
+            e.float_value = ptag->asFloat();
+            break;
+        case TAGTYPE_BOOL:
+            e.bool_value = ptag->asBool();
+            break;
+        case TAGTYPE_HASH16: {
+            md4_hash hash = ptag->asHash();
+            e.data.size = md4_hash::size;
+            e.data.offset = append(reinterpret_cast<const char*>(hash.getContainer()), md4_hash::size);
+            break;
+        }
+        case TAGTYPE_BLOB: {
+            const std::vector<char>& v = ptag->asBlob();
+            e.data.size = static_cast<boost::uint32_t>(v.size());
+            e.data.offset = v.empty() ? 0 : append(&v[0], v.size());
+            break;
+        }
+        default: {
+            const std::string& s = ptag->asString();
+            e.data.size = static_cast<boost::uint32_t>(s.size());
+            e.data.offset = append(s.c_str(), s.size());
+            break;
+        }
+    }
+
+    m_entries.push_back(e);
+}
+
+void compact_tag_storage::load_tags(archive::ed2k_iarchive& ar, size_t count) {
+    // the count comes from the wire, don't let it reserve unbounded memory
+    m_entries.reserve(m_entries.size() + std::min<size_t>(count, 64));
+
+    for (size_t n = 0; n < count; n++) {
+        entry e;
+        std::memset(&e, 0, sizeof(e));
+
+        // read tag header
+        tg_type nType = 0;
+        ar& nType;
+        if (nType & 0x80) {
+            nType &= 0x7F;
+            ar& e.name_id;
+        } else {
+            boost::uint16_t nLength;
+            ar& nLength;
+
+            if (nLength == 1) {
+                ar& e.name_id;
+            } else if (nLength > 0) {
+                e.name_size = nLength;
+                e.name_offset = allocate(nLength);
+                ar.raw_read(&m_arena[e.name_offset], nLength);
+            }
+        }
+
+        e.type = nType;
+
+        switch (nType) {
+            case TAGTYPE_BOOLARRAY: {
+                // don't process bool arrays, this tag must been passed
+                boost::uint16_t nLength;
+                ar& nLength;
+                skip(ar, (nLength / 8) + 1);
+                m_arena.resize(m_arena.size() - e.name_size);
+                continue;
+            }
+            case TAGTYPE_BSOB: {
+                boost::uint8_t nLength;
+                ar& nLength;
+                skip(ar, nLength);
+                m_arena.resize(m_arena.size() - e.name_size);
+                continue;
+            }
+            case TAGTYPE_UINT64: {
+                boost::uint64_t v;
+                ar& v;
+                e.int_value = v;
+                break;
+            }
+            case TAGTYPE_UINT32: {
+                boost::uint32_t v;
+                ar& v;
+                e.int_value = v;
+                break;
+            }
+            case TAGTYPE_UINT16: {
+                boost::uint16_t v;
+                ar& v;
+                e.int_value = v;
+                break;
+            }
+            case TAGTYPE_UINT8: {
+                boost::uint8_t v;
+                ar& v;
+                e.int_value = v;
+                break;
+            }
+            case TAGTYPE_FLOAT32:
+                ar& e.float_value;
+                break;
+            case TAGTYPE_BOOL:
+                ar& e.bool_value;
+                break;
+            case TAGTYPE_HASH16:
+                e.data.size = md4_hash::size;
+                e.data.offset = allocate(md4_hash::size);
+                ar.raw_read(&m_arena[e.data.offset], md4_hash::size);
+                break;
+            case TAGTYPE_BLOB: {
+                boost::uint32_t nSize;
+                ar& nSize;
+
+                // avoid huge memory allocation on incorrect tags
+                if (nSize > ar.bytes_left()) throw libed2k::libed2k_exception(libed2k::errors::blob_tag_too_long);
+
+                e.data.size = nSize;
+                e.data.offset = allocate(nSize);
+                if (nSize > 0) ar.raw_read(&m_arena[e.data.offset], nSize);
+                break;
+            }
+            case TAGTYPE_STRING:
+            case TAGTYPE_STR1:
+            case TAGTYPE_STR2:
+            case TAGTYPE_STR3:
+            case TAGTYPE_STR4:
+            case TAGTYPE_STR5:
+            case TAGTYPE_STR6:
+            case TAGTYPE_STR7:
+            case TAGTYPE_STR8:
+            case TAGTYPE_STR9:
+            case TAGTYPE_STR10:
+            case TAGTYPE_STR11:
+            case TAGTYPE_STR12:
+            case TAGTYPE_STR13:
+            case TAGTYPE_STR14:
+            case TAGTYPE_STR15:
+            case TAGTYPE_STR16: {
+                boost::uint16_t nLength;
+
+                if (nType >= TAGTYPE_STR1) {
+                    nLength = static_cast<boost::uint16_t>(nType - TAGTYPE_STR1 + 1);
+                } else {
+                    ar& nLength;
+                }
+
+                e.data.size = nLength;
+                e.data.offset = allocate(nLength);
+                if (nLength > 0) ar.raw_read(&m_arena[e.data.offset], nLength);
+
+                // same as string_tag - drop utf-8 byte order mark, but keep the
+                // compressed type in line with the length for saving
+                if (CHECK_BOM(e.data.size, data(e.data.offset))) {
+                    e.data.offset += 3;
+                    e.data.size -= 3;
+                    if (e.type != TAGTYPE_STRING)
+                        e.type = e.data.size ? static_cast<tg_type>(TAGTYPE_STR1 + e.data.size - 1) : TAGTYPE_STRING;
+                }
+                break;
+            }
+            default:
+                throw libed2k_exception(errors::invalid_tag_type);
+                break;
+        }
+
+        m_entries.push_back(e);
+    }
+}
+
+void compact_tag_storage::save_tags(archive::ed2k_oarchive& ar) const {
+    for (size_t n = 0; n < m_entries.size(); ++n) {
+        const entry& e = m_entries[n];
+        tg_type nType = e.type;
+
+        // tag header, same as base_tag::save
+        if (e.name_size == 0) {
+            if (e.new_ed2k) {
+                nType |= 0x80;
+                ar& nType;
+            } else {
+                boost::uint16_t nLength = 1;
+                ar& nType;
+                ar& nLength;
+            }
+
+            tg_nid_type nNameId = e.name_id;
+            ar& nNameId;
+        } else {
+            boost::uint16_t nLength = e.name_size;
+            ar& nType;
+            ar& nLength;
+            ar.raw_write(data(e.name_offset), e.name_size);
+        }
+
+        switch (e.type) {
+            case TAGTYPE_UINT64:
+                save_value<boost::uint64_t>(ar, e.int_value);
+                break;
+            case TAGTYPE_UINT32:
+                save_value<boost::uint32_t>(ar, e.int_value);
+                break;
+            case TAGTYPE_UINT16:
+                save_value<boost::uint16_t>(ar, e.int_value);
+                break;
+            case TAGTYPE_UINT8:
+                save_value<boost::uint8_t>(ar, e.int_value);
+                break;
+            case TAGTYPE_FLOAT32: {
+                float v = e.float_value;
+                ar& v;
+                break;
+            }
+            case TAGTYPE_BOOL: {
+                bool v = e.bool_value;
+                ar& v;
+                break;
+            }
+            case TAGTYPE_BLOB: {
+                boost::uint32_t nSize = e.data.size;
+                ar& nSize;
+                if (nSize > 0) ar.raw_write(data(e.data.offset), nSize);
+                break;
+            }
+            default: {
+                if (e.type == TAGTYPE_STRING) {
+                    boost::uint16_t nLength = static_cast<boost::uint16_t>(e.data.size);
+                    ar& nLength;
+                }
+
+                if (e.data.size > 0) ar.raw_write(data(e.data.offset), e.data.size);
+                break;
+            }
+        }
+    }
+}
+
+void compact_tag_storage::dump() const {
+    DBG("count: " << m_entries.size() << " arena: " << m_arena.size());
+    for (size_t n = 0; n < m_entries.size(); ++n) (*this)[n]->dump();
+}
+
+bool operator==(const compact_tag_storage& t1, const compact_tag_storage& t2) {
+    if (t1.size() != t2.size()) return (false);
+
+    // order independent like tag_list, compare tags by uniform type
+    for (size_t n = 0; n < t1.size(); ++n) {
+        compact_tag_storage::value_type p1 = t1[n];
+        bool found = false;
+
+        for (size_t m = 0; m < t2.size() && !found; ++m) {
+            found = t2[m]->is_equal(p1.get());
+        }
+
+        if (!found) return (false);
+    }
+
+    return (true);
+}
+}
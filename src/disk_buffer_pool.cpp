@@ -43,17 +43,42 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 namespace libed2k {
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+namespace {
+boost::detail::atomic_count pool_ids(0);
+
+// the cache of the pool the thread used last
+LIBED2K_THREAD_LOCAL long thread_pool_id = 0;
+LIBED2K_THREAD_LOCAL void* thread_pool_cache = 0;
+
+// guards the cache lists of the pools and which pool a cache belongs
+// to. Lives until the process exits, threads may exit after the pools
+mutex& cache_registry_mutex() {
+    static mutex* m = new mutex;
+    return *m;
+}
+}
+#endif
+
 disk_buffer_pool::disk_buffer_pool(int block_size)
     : m_block_size(block_size),
       m_in_use(0)
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+      ,
+      m_id(++pool_ids),
+      m_thread_cache(&disk_buffer_pool::thread_exit)
+#endif
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
       ,
-      m_pool(block_size, m_settings.cache_buffer_chunk_size)
+      m_pool(block_size, m_settings.cache_buffer_chunk_size),
+      m_huge_pool(block_size, m_settings.cache_buffer_chunk_size),
+      m_huge_pages(false)
 #endif
-{
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
-    m_allocations = 0;
+      ,
+      m_allocations(0)
 #endif
+{
 #ifdef LIBED2K_DISK_STATS
     m_log.open("disk_buffers.log", std::ios::trunc);
     m_categories["read cache"] = 0;
@@ -66,12 +91,23 @@ disk_buffer_pool::disk_buffer_pool(int block_size)
 #endif
 }
 
-#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 disk_buffer_pool::~disk_buffer_pool() {
+#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
     LIBED2K_ASSERT(m_magic == 0x1337);
     m_magic = 0;
-}
 #endif
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    // the cached buffers go away with the pools. The caches are
+    // deleted when their threads exit
+    mutex::scoped_lock l(cache_registry_mutex());
+    for (std::vector<buffer_cache*>::iterator i = m_thread_caches.begin(); i != m_thread_caches.end(); ++i) {
+        mutex::scoped_lock cl((*i)->cache_mutex);
+        (*i)->pool = 0;
+        (*i)->count = 0;
+    }
+    m_thread_caches.clear();
+#endif
+}
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS || defined LIBED2K_DISK_STATS
 bool disk_buffer_pool::is_disk_buffer(char* buffer, mutex::scoped_lock& l) const {
@@ -82,7 +118,7 @@ bool disk_buffer_pool::is_disk_buffer(char* buffer, mutex::scoped_lock& l) const
 #ifdef LIBED2K_DISABLE_POOL_ALLOCATOR
     return true;
 #else
-    return m_pool.is_from(buffer);
+    return m_pool.is_from(buffer) || (m_huge_pages && is_huge_buffer(buffer));
 #endif
 }
 
@@ -92,35 +128,176 @@ bool disk_buffer_pool::is_disk_buffer(char* buffer) const {
 }
 #endif
 
-char* disk_buffer_pool::allocate_buffer(char const* category) {
-    mutex::scoped_lock l(m_pool_mutex);
-    LIBED2K_ASSERT(m_magic == 0x1337);
+char* disk_buffer_pool::pool_malloc(mutex::scoped_lock& l) {
 #ifdef LIBED2K_DISABLE_POOL_ALLOCATOR
-    char* ret = page_aligned_allocator::malloc(m_block_size);
+    return page_aligned_allocator::malloc(m_block_size);
 #else
+    if (m_settings.disk_cache_huge_pages) {
+        // every chunk carries a small footer of the pool, so a chunk
+        // of whole huge pages holds one block less than would fit
+        int page_blocks = huge_page_allocator::huge_page_size() / m_block_size;
+        int chunk = (std::max)(m_settings.cache_buffer_chunk_size, 16 * page_blocks);
+        if (page_blocks > 1) chunk = (chunk + page_blocks - 1) / page_blocks * page_blocks - 1;
+
+        m_huge_pages = true;
+        char* ret = (char*)m_huge_pool.malloc();
+        m_huge_pool.set_next_size(chunk);
+        if (ret && !is_huge_buffer(ret)) {
+            // first buffer of a new chunk
+            std::pair<char*, char*> r = huge_page_allocator::mapping(ret);
+            LIBED2K_ASSERT(r.first);
+            m_huge_chunks[r.first] = r.second;
+        }
+        return ret;
+    }
     char* ret = (char*)m_pool.malloc();
     m_pool.set_next_size(m_settings.cache_buffer_chunk_size);
+    return ret;
 #endif
-    ++m_in_use;
+}
+
+void disk_buffer_pool::pool_free(char* buf, mutex::scoped_lock& l) {
+#ifdef LIBED2K_DISABLE_POOL_ALLOCATOR
+    page_aligned_allocator::free(buf);
+#else
+    if (m_huge_pages && is_huge_buffer(buf))
+        m_huge_pool.free(buf);
+    else
+        m_pool.free(buf);
+#endif
+}
+
+#ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+bool disk_buffer_pool::is_huge_buffer(char* buf) const {
+    std::map<char*, char*>::const_iterator i = m_huge_chunks.upper_bound(buf);
+    if (i == m_huge_chunks.begin()) return false;
+    --i;
+    return buf < i->second;
+}
+#endif
+
+void disk_buffer_pool::lock_buffer(char* buf) {
 #if LIBED2K_USE_MLOCK
     if (m_settings.lock_disk_cache) {
 #ifdef LIBED2K_WINDOWS
-        VirtualLock(ret, m_block_size);
+        VirtualLock(buf, m_block_size);
 #else
-        mlock(ret, m_block_size);
+        mlock(buf, m_block_size);
 #endif
     }
 #endif
+}
 
-#if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
-    ++m_allocations;
+void disk_buffer_pool::unlock_buffer(char* buf) {
+#if LIBED2K_USE_MLOCK
+    if (m_settings.lock_disk_cache) {
+#ifdef LIBED2K_WINDOWS
+        VirtualUnlock(buf, m_block_size);
+#else
+        munlock(buf, m_block_size);
+#endif
+    }
+#endif
+}
+
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+int disk_buffer_pool::thread_cache_size() const {
+    return (std::min)(int(m_settings.disk_buffer_thread_cache), int(max_thread_cache));
+}
+
+disk_buffer_pool::buffer_cache& disk_buffer_pool::thread_cache() {
+    if (thread_pool_id == m_id) return *static_cast<buffer_cache*>(thread_pool_cache);
+
+    buffer_cache* c = m_thread_cache.get();
+    if (c == 0 || c->pool != this) {
+        // first buffer of this pool in this thread. A pool destructed
+        // at the same address may have left its emptied cache
+        mutex::scoped_lock l(cache_registry_mutex());
+        if (c == 0) {
+            c = new buffer_cache;
+            c->count = 0;
+            m_thread_cache.reset(c);
+        }
+        LIBED2K_ASSERT(c->count == 0);
+        c->pool = this;
+        m_thread_caches.push_back(c);
+    }
+    thread_pool_id = m_id;
+    thread_pool_cache = c;
+    return *c;
+}
+
+void disk_buffer_pool::flush_thread_cache(buffer_cache& c, int keep) {
+    if (c.count <= keep) return;
+    mutex::scoped_lock l(m_pool_mutex);
+    while (c.count > keep) pool_free(c.buffers[--c.count], l);
+}
+
+void disk_buffer_pool::thread_exit(buffer_cache* c) {
+    mutex::scoped_lock l(cache_registry_mutex());
+    if (c->pool) {
+        disk_buffer_pool& p = *c->pool;
+        mutex::scoped_lock cl(c->cache_mutex);
+        p.flush_thread_cache(*c, 0);
+        cl.unlock();
+        p.m_thread_caches.erase(std::find(p.m_thread_caches.begin(), p.m_thread_caches.end(), c));
+    }
+    if (thread_pool_cache == c) {
+        thread_pool_id = 0;
+        thread_pool_cache = 0;
+    }
+    delete c;
+}
+#endif
+
+int disk_buffer_pool::cached() const {
+    int ret = 0;
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    mutex::scoped_lock l(cache_registry_mutex());
+    for (std::vector<buffer_cache*>::const_iterator i = m_thread_caches.begin(); i != m_thread_caches.end(); ++i) {
+        mutex::scoped_lock cl((*i)->cache_mutex);
+        ret += (*i)->count;
+    }
+#endif
+    return ret;
+}
+
+char* disk_buffer_pool::allocate_buffer(char const* category) {
+    LIBED2K_ASSERT(m_magic == 0x1337);
+    char* ret = 0;
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    int cache_size = thread_cache_size();
+    if (cache_size > 0) {
+        buffer_cache& c = thread_cache();
+        mutex::scoped_lock cl(c.cache_mutex);
+        if (c.count == 0) {
+            // refill half of the cache under one lock
+            mutex::scoped_lock l(m_pool_mutex);
+            while (c.count < (cache_size + 1) / 2) {
+                char* buf = pool_malloc(l);
+                if (buf == 0) break;
+                c.buffers[c.count++] = buf;
+            }
+        }
+        if (c.count > 0) ret = c.buffers[--c.count];
+    } else
 #endif
+    {
+        mutex::scoped_lock l(m_pool_mutex);
+        ret = pool_malloc(l);
 #ifdef LIBED2K_DISK_STATS
-    ++m_categories[category];
-    m_buf_to_category[ret] = category;
-    m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
+        ++m_categories[category];
+        m_buf_to_category[ret] = category;
+        m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
 #endif
-    LIBED2K_ASSERT(ret == 0 || is_disk_buffer(ret, l));
+    }
+    ++m_in_use;
+    lock_buffer(ret);
+
+#if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
+    ++m_allocations;
+#endif
+    LIBED2K_ASSERT(ret == 0 || is_disk_buffer(ret));
     return ret;
 }
 
@@ -145,19 +322,37 @@ void disk_buffer_pool::free_multiple_buffers(char** bufvec, int numbufs) {
     // sort the pointers in order to maximize cache hits
     std::sort(bufvec, end);
 
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    int cache_size = thread_cache_size();
+    if (cache_size > 0) {
+        buffer_cache& c = thread_cache();
+        mutex::scoped_lock cl(c.cache_mutex);
+        for (; bufvec != end; ++bufvec) {
+            char* buf = *bufvec;
+            LIBED2K_ASSERT(buf);
+            LIBED2K_ASSERT(is_disk_buffer(buf));
+            unlock_buffer(buf);
+            // a full cache gives half of it back under one lock
+            if (c.count >= cache_size) flush_thread_cache(c, cache_size / 2);
+            c.buffers[c.count++] = buf;
+            --m_in_use;
+#if defined LIBED2K_STATS
+            --m_allocations;
+#endif
+        }
+        return;
+    }
+#endif
+
     mutex::scoped_lock l(m_pool_mutex);
     for (; bufvec != end; ++bufvec) {
         char* buf = *bufvec;
         LIBED2K_ASSERT(buf);
         free_buffer_impl(buf, l);
-        ;
     }
 }
 
-void disk_buffer_pool::free_buffer(char* buf) {
-    mutex::scoped_lock l(m_pool_mutex);
-    free_buffer_impl(buf, l);
-}
+void disk_buffer_pool::free_buffer(char* buf) { free_multiple_buffers(&buf, 1); }
 
 void disk_buffer_pool::free_buffer_impl(char* buf, mutex::scoped_lock& l) {
     LIBED2K_ASSERT(buf);
@@ -173,28 +368,34 @@ void disk_buffer_pool::free_buffer_impl(char* buf, mutex::scoped_lock& l) {
     m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
     m_buf_to_category.erase(buf);
 #endif
-#if LIBED2K_USE_MLOCK
-    if (m_settings.lock_disk_cache) {
-#ifdef LIBED2K_WINDOWS
-        VirtualUnlock(buf, m_block_size);
-#else
-        munlock(buf, m_block_size);
-#endif
-    }
-#endif
-#ifdef LIBED2K_DISABLE_POOL_ALLOCATOR
-    page_aligned_allocator::free(buf);
-#else
-    m_pool.free(buf);
-#endif
+    unlock_buffer(buf);
+    pool_free(buf, l);
     --m_in_use;
 }
 
 void disk_buffer_pool::release_memory() {
     LIBED2K_ASSERT(m_magic == 0x1337);
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+#ifdef LIBED2K_DISK_BUFFER_CACHE
+    {
+        mutex::scoped_lock rl(cache_registry_mutex());
+        for (std::vector<buffer_cache*>::iterator i = m_thread_caches.begin(); i != m_thread_caches.end(); ++i) {
+            mutex::scoped_lock cl((*i)->cache_mutex);
+            flush_thread_cache(**i, 0);
+        }
+    }
+#endif
     mutex::scoped_lock l(m_pool_mutex);
     m_pool.release_memory();
+    m_huge_pool.release_memory();
+
+    // forget the chunks that were unmapped
+    for (std::map<char*, char*>::iterator i = m_huge_chunks.begin(); i != m_huge_chunks.end();) {
+        if (huge_page_allocator::mapping(i->first).first != i->first)
+            m_huge_chunks.erase(i++);
+        else
+            ++i;
+    }
 #endif
 }
 }
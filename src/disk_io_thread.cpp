@@ -42,8 +42,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/file_pool.hpp>
 #include <boost/scoped_array.hpp>
 #include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 
 #include <libed2k/time.hpp>
+#include <libed2k/event_log.hpp>
 
 #if LIBED2K_USE_MLOCK && !defined LIBED2K_WINDOWS
 #include <sys/mman.h>
@@ -62,6 +64,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 namespace libed2k {
+BOOST_STATIC_ASSERT(disk_io_job::read_ahead + 1 == session_metrics::disk_job_types);
+
 bool should_cancel_on_abort(disk_io_job const& j);
 bool is_read_operation(disk_io_job const& j);
 bool operation_has_buffer(disk_io_job const& j);
@@ -75,6 +79,9 @@ disk_io_thread::disk_io_thread(io_service& ios, boost::function<void()> const& q
       m_waiting_to_shutdown(false),
       m_queue_buffer_size(0),
       m_last_file_check(libed2k::time_now_hires()),
+      m_check_quota(0),
+      m_last_check_quota(libed2k::time_now_hires()),
+      m_probation_pieces(0),
       m_last_stats_flip(libed2k::time_now()),
       m_physical_ram(0),
       m_exceeded_write_queue(false),
@@ -105,6 +112,7 @@ void disk_io_thread::join() {
     mutex::scoped_lock l(m_queue_mutex);
     LIBED2K_ASSERT(m_abort == true);
     m_jobs.clear();
+    m_read_ahead_jobs.clear();
 }
 
 bool disk_io_thread::can_write() const {
@@ -171,6 +179,11 @@ cache_status disk_io_thread::status() const {
     return ret;
 }
 
+void disk_io_thread::metrics(session_metrics& m) const {
+    mutex::scoped_lock l(m_metrics_mutex);
+    for (int i = 0; i < session_metrics::disk_job_types; ++i) m.disk_queue_time[i].merge(m_job_queue_time[i]);
+}
+
 // aborts read operations
 void disk_io_thread::stop(boost::intrusive_ptr<piece_manager> s) {
     mutex::scoped_lock l(m_queue_mutex);
@@ -250,17 +263,85 @@ void disk_io_thread::flush_expired_pieces() {
 
     if (m_settings.explicit_read_cache) return;
 
-    // flush read cache
+    // flush read cache, each queue is ordered by expiry
     std::vector<char*> bufs;
     cache_lru_index_t& ridx = m_read_pieces.get<1>();
-    i = ridx.begin();
-    while (i != ridx.end() && now - i->expire > cut_off) {
-        drain_piece_bufs(const_cast<cached_piece_entry&>(*i), bufs, l);
-        ridx.erase(i++);
+    for (int queue = probation_queue; queue <= protected_queue; ++queue) {
+        i = ridx.lower_bound(std::pair<int, libed2k::ptime>(queue, libed2k::min_time()));
+        while (i != ridx.end() && i->queue == queue && now - i->expire > cut_off) {
+            add_ghost_piece(*i);
+            drain_piece_bufs(const_cast<cached_piece_entry&>(*i), bufs, l);
+            erase_read_piece(m_read_pieces.project<0>(i++));
+        }
     }
     if (!bufs.empty()) free_multiple_buffers(&bufs[0], bufs.size());
 }
 
+disk_io_thread::cache_piece_index_t::iterator disk_io_thread::insert_read_piece(cached_piece_entry const& p,
+                                                                                int start_block) {
+    cached_piece_entry pe = p;
+    pe.queue = probation_queue;
+
+    if (m_settings.read_cache_algorithm == session_settings::read_2q) {
+        ghost_t::nth_index<1>::type& gidx = m_ghost_pieces.get<1>();
+        ghost_t::nth_index<1>::type::iterator g = gidx.find(p.storage_piece_pair());
+        if (g != gidx.end()) {
+            // blocks read again after they were evicted. A peer reading
+            // past them continues a sequential read and stays on probation
+            if (start_block >= g->start_block && start_block < g->end_block) {
+                pe.queue = protected_queue;
+                ++m_cache_stats.ghost_hits;
+            }
+            gidx.erase(g);
+        }
+    }
+
+    if (pe.queue == probation_queue) ++m_probation_pieces;
+    return m_read_pieces.get<0>().insert(pe).first;
+}
+
+void disk_io_thread::touch_read_piece(cache_piece_index_t::iterator p, int cache_min_time) {
+    // probation queue is a fifo, repeated reads of a sequential
+    // reader don't keep the piece
+    if (m_settings.read_cache_algorithm == session_settings::read_2q && p->queue == probation_queue) return;
+    m_read_pieces.get<0>().modify(p, update_last_use(cache_min_time));
+}
+
+disk_io_thread::cache_piece_index_t::iterator disk_io_thread::erase_read_piece(cache_piece_index_t::iterator p) {
+    if (p->queue == probation_queue) --m_probation_pieces;
+    LIBED2K_ASSERT(m_probation_pieces >= 0);
+    return m_read_pieces.get<0>().erase(p);
+}
+
+void disk_io_thread::add_ghost_piece(cached_piece_entry const& p) {
+    if (m_settings.read_cache_algorithm != session_settings::read_2q || p.queue != probation_queue) return;
+
+    int blocks_in_piece = (p.storage->info()->piece_size(p.piece) + m_block_size - 1) / m_block_size;
+    ghost_entry g;
+    g.storage = p.storage.get();
+    g.piece = p.piece;
+    g.start_block = 0;
+    while (g.start_block < blocks_in_piece && p.blocks[g.start_block].buf == 0) ++g.start_block;
+    g.end_block = blocks_in_piece;
+    while (g.end_block > g.start_block && p.blocks[g.end_block - 1].buf == 0) --g.end_block;
+    if (g.start_block == g.end_block) return;
+
+    // remember about as many pieces as the read cache holds
+    size_t limit = (std::max)(m_settings.cache_size / (std::max)(m_settings.read_cache_line_size, 1), 16);
+    std::pair<ghost_t::iterator, bool> r = m_ghost_pieces.push_back(g);
+    if (!r.second) {
+        m_ghost_pieces.replace(r.first, g);
+        m_ghost_pieces.relocate(m_ghost_pieces.end(), r.first);
+    }
+    while (m_ghost_pieces.size() > limit) m_ghost_pieces.pop_front();
+}
+
+void disk_io_thread::purge_ghost_pieces(void* storage, mutex::scoped_lock& l) {
+    ghost_t::nth_index<1>::type& gidx = m_ghost_pieces.get<1>();
+    gidx.erase(gidx.lower_bound(std::pair<void*, int>(storage, 0)),
+               gidx.upper_bound(std::pair<void*, int>(storage, INT_MAX)));
+}
+
 int disk_io_thread::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf, mutex::scoped_lock& l) {
     int piece_size = p.storage->info()->piece_size(p.piece);
     int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
@@ -268,7 +349,7 @@ int disk_io_thread::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>&
 
     for (int i = 0; i < blocks_in_piece; ++i) {
         if (p.blocks[i].buf == 0) continue;
-        buf.push_back(p.blocks[i].buf);
+        evict_block(p.blocks[i].buf, buf, l);
         ++ret;
         p.blocks[i].buf = 0;
         --p.num_blocks;
@@ -289,7 +370,7 @@ int disk_io_thread::free_piece(cached_piece_entry& p, mutex::scoped_lock& l) {
     std::vector<char*> buffers;
     for (int i = 0; i < blocks_in_piece; ++i) {
         if (p.blocks[i].buf == 0) continue;
-        buffers.push_back(p.blocks[i].buf);
+        evict_block(p.blocks[i].buf, buffers, l);
         ++ret;
         p.blocks[i].buf = 0;
         --p.num_blocks;
@@ -300,6 +381,25 @@ int disk_io_thread::free_piece(cached_piece_entry& p, mutex::scoped_lock& l) {
     return ret;
 }
 
+void disk_io_thread::evict_block(char* block, std::vector<char*>& buf, mutex::scoped_lock& l) {
+    std::map<char*, pinned_block>::iterator i = m_pinned_blocks.find(block);
+    if (i == m_pinned_blocks.end())
+        buf.push_back(block);
+    else
+        i->second.evicted = true;
+}
+
+void disk_io_thread::release_block(char* buf) {
+    mutex::scoped_lock l(m_piece_mutex);
+    std::map<char*, pinned_block>::iterator i = m_pinned_blocks.find(buf);
+    LIBED2K_ASSERT(i != m_pinned_blocks.end());
+    if (i == m_pinned_blocks.end() || --i->second.refs > 0) return;
+    bool evicted = i->second.evicted;
+    m_pinned_blocks.erase(i);
+    l.unlock();
+    if (evicted) free_buffer(buf);
+}
+
 // returns the number of blocks that were freed
 int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mutex::scoped_lock& l) {
     LIBED2K_INVARIANT_CHECK;
@@ -308,6 +408,15 @@ int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mut
     if (idx.empty()) return 0;
 
     cache_lru_index_t::iterator i = idx.begin();
+    if (m_settings.read_cache_algorithm == session_settings::read_2q &&
+        m_probation_pieces <= int(m_read_pieces.size()) / 4) {
+        // probation queue is within its share of the cache,
+        // evict the least recently used protected piece instead
+        cache_lru_index_t::iterator p =
+            idx.lower_bound(std::pair<int, libed2k::ptime>(protected_queue, libed2k::min_time()));
+        if (p != idx.end() && libed2k::time_now() >= p->expire) i = p;
+    }
+
     if (i->piece == ignore.piece && i->storage == ignore.storage) {
         ++i;
         if (i == idx.end()) return 0;
@@ -321,6 +430,7 @@ int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mut
     // and free them all in one go
     std::vector<char*> buffers;
     if (num_blocks >= i->num_blocks) {
+        add_ghost_piece(*i);
         blocks = drain_piece_bufs(const_cast<cached_piece_entry&>(*i), buffers, l);
     } else {
         // delete blocks from the start and from the end
@@ -335,7 +445,7 @@ int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mut
             if (!m_settings.volatile_read_cache) {
                 while (i->blocks[start].buf == 0 && start <= end) ++start;
                 if (start > end) break;
-                buffers.push_back(i->blocks[start].buf);
+                evict_block(i->blocks[start].buf, buffers, l);
                 i->blocks[start].buf = 0;
                 ++blocks;
                 --const_cast<cached_piece_entry&>(*i).num_blocks;
@@ -347,7 +457,7 @@ int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mut
 
             while (i->blocks[end].buf == 0 && start <= end) --end;
             if (start > end) break;
-            buffers.push_back(i->blocks[end].buf);
+            evict_block(i->blocks[end].buf, buffers, l);
             i->blocks[end].buf = 0;
             ++blocks;
             --const_cast<cached_piece_entry&>(*i).num_blocks;
@@ -356,7 +466,7 @@ int disk_io_thread::clear_oldest_read_piece(int num_blocks, ignore_t ignore, mut
             --num_blocks;
         }
     }
-    if (i->num_blocks == 0) idx.erase(i);
+    if (i->num_blocks == 0) erase_read_piece(m_read_pieces.project<0>(i));
 
     if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
     return blocks;
@@ -636,6 +746,7 @@ int disk_io_thread::cache_block(disk_io_job& j, boost::function<void(int, disk_i
     p.num_blocks = 1;
     p.num_contiguous_blocks = 1;
     p.next_block_to_hash = 0;
+    p.queue = probation_queue;
     p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
     if (!p.blocks) return -1;
     int block = j.offset / m_block_size;
@@ -807,14 +918,171 @@ int disk_io_thread::cache_read_block(disk_io_job const& j, mutex::scoped_lock& l
     p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
     if (!p.blocks) return -1;
 
+    p.queue = probation_queue;
+
     int ret = read_into_piece(p, start_block, 0, blocks_to_read, l);
 
     LIBED2K_ASSERT(p.storage);
-    if (ret >= 0) idx.insert(p);
+    if (ret >= 0) insert_read_piece(p, start_block);
 
     return ret;
 }
 
+void disk_io_thread::read_ahead(disk_io_job const& j) {
+    if (m_settings.max_read_ahead <= 0 || !m_settings.use_read_cache || m_settings.explicit_read_cache) return;
+
+    const int piece_length = j.storage->info()->piece_length();
+    const size_type offset = size_type(j.piece) * piece_length + j.offset;
+    const size_type total_size = j.storage->info()->total_size();
+    libed2k::ptime now = libed2k::time_now();
+
+    // a read continues the stream if it starts about where the last
+    // one ended, reads may be reordered by the elevator
+    std::vector<read_stream>::iterator s = m_read_streams.begin();
+    for (; s != m_read_streams.end(); ++s) {
+        if (s->storage == j.storage.get() && offset + m_block_size >= s->next && offset <= s->next + m_block_size)
+            break;
+    }
+
+    if (s == m_read_streams.end()) {
+        read_stream rs;
+        rs.storage = j.storage.get();
+        rs.next = offset + j.buffer_size;
+        rs.ahead = rs.next;
+        rs.bytes = 0;
+        rs.reads = 0;
+        rs.start = now;
+        rs.last = now;
+
+        // replace the stream that has been idle the longest
+        const size_t max_streams = 64;
+        if (m_read_streams.size() < max_streams) {
+            m_read_streams.push_back(rs);
+        } else {
+            std::vector<read_stream>::iterator oldest = m_read_streams.begin();
+            for (s = m_read_streams.begin(); s != m_read_streams.end(); ++s)
+                if (s->last < oldest->last) oldest = s;
+            *oldest = rs;
+        }
+        return;
+    }
+
+    s->next = (std::max)(s->next, offset + j.buffer_size);
+    s->bytes += j.buffer_size;
+    s->last = now;
+    if (++s->reads < 2) return;
+
+    // read ahead what the peer consumes in read_ahead_time seconds
+    int seconds = (std::max)(int(total_seconds(now - s->start)), 1);
+    size_type depth = s->bytes / seconds * m_settings.read_ahead_time;
+    depth = (std::max)(depth, size_type(m_settings.read_cache_line_size) * m_block_size);
+    depth = (std::min)(depth, size_type(m_settings.max_read_ahead) * m_block_size);
+
+    // refill once half of the read ahead window is consumed
+    if (s->ahead > s->next + depth / 2) return;
+
+    size_type start = (std::max)(s->ahead, s->next);
+    size_type end = (std::min)(s->next + depth, total_size);
+    if (start >= end) return;
+
+    // refill a few blocks at a time, within one piece. Later reads
+    // of the stream pick up where this one stops
+    const int refill_blocks = 4;
+    int piece = int(start / piece_length);
+    int piece_offset = int(start - size_type(piece) * piece_length);
+    int len = int((std::min)(end - start, size_type(j.storage->info()->piece_size(piece) - piece_offset)));
+    int start_block = piece_offset / m_block_size;
+    int num_blocks = (std::min)((piece_offset + len + m_block_size - 1) / m_block_size - start_block, refill_blocks);
+    s->ahead = (std::min)(size_type(piece) * piece_length + size_type(start_block + num_blocks) * m_block_size,
+                          total_size);
+
+    // the blocks are read by a job of their own once the triggering
+    // job has completed and the queues are empty
+    disk_io_job ra;
+    ra.action = disk_io_job::read_ahead;
+    ra.storage = j.storage;
+    ra.piece = piece;
+    ra.offset = start_block * m_block_size;
+    ra.max_cache_line = num_blocks;
+    ra.cache_min_time = j.cache_min_time;
+    ra.start_time = libed2k::time_now_hires();
+    mutex::scoped_lock jl(m_queue_mutex);
+    m_read_ahead_jobs.push_back(ra);
+    jl.unlock();
+
+    // let the drive fetch the window after this one meanwhile
+    if (m_settings.use_disk_read_ahead && s->ahead < total_size) {
+        piece = int(s->ahead / piece_length);
+        piece_offset = int(s->ahead - size_type(piece) * piece_length);
+        len = int((std::min)(depth, size_type(j.storage->info()->piece_size(piece) - piece_offset)));
+        j.storage->hint_read_impl(piece, piece_offset, len);
+    }
+}
+
+void disk_io_thread::purge_read_streams(void* storage) {
+    for (std::vector<read_stream>::iterator i = m_read_streams.begin(); i != m_read_streams.end();) {
+        if (i->storage == storage)
+            i = m_read_streams.erase(i);
+        else
+            ++i;
+    }
+
+    mutex::scoped_lock jl(m_queue_mutex);
+    for (std::deque<disk_io_job>::iterator i = m_read_ahead_jobs.begin(); i != m_read_ahead_jobs.end();) {
+        if (i->storage.get() == storage)
+            i = m_read_ahead_jobs.erase(i);
+        else
+            ++i;
+    }
+}
+
+// returns -1 on read error, -2 if there isn't any space in the
+// cache or the number of bytes read
+int disk_io_thread::read_ahead_piece(disk_io_job const& j, int piece, int start_block, int num_blocks,
+                                     mutex::scoped_lock& l) {
+    disk_io_job pj;
+    pj.storage = j.storage;
+    pj.piece = piece;
+    cache_piece_index_t::iterator p = find_cached_piece(m_read_pieces, pj, l);
+
+    int piece_size = j.storage->info()->piece_size(piece);
+    int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
+    int end_block = (std::min)(start_block + num_blocks, blocks_in_piece);
+
+    // only read the blocks missing in the cache
+    if (p != m_read_pieces.end()) {
+        while (start_block < end_block && p->blocks[start_block].buf) ++start_block;
+        int block = start_block;
+        while (block < end_block && p->blocks[block].buf == 0) ++block;
+        end_block = block;
+    }
+    num_blocks = end_block - start_block;
+    if (num_blocks <= 0) return 0;
+
+    if (in_use() + num_blocks > m_settings.cache_size) {
+        int clear = in_use() + num_blocks - m_settings.cache_size;
+        if (flush_cache_blocks(l, clear, ignore_t(piece, j.storage.get()), dont_flush_write_blocks) < clear) return -2;
+    }
+
+    if (p != m_read_pieces.end())
+        return read_into_piece(const_cast<cached_piece_entry&>(*p), start_block, 0, num_blocks, l);
+
+    cached_piece_entry pe;
+    pe.piece = piece;
+    pe.storage = j.storage;
+    pe.expire = libed2k::time_now() + libed2k::seconds(j.cache_min_time);
+    pe.num_blocks = 0;
+    pe.num_contiguous_blocks = 0;
+    pe.next_block_to_hash = 0;
+    pe.queue = probation_queue;
+    pe.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
+    if (!pe.blocks) return -1;
+
+    int ret = read_into_piece(pe, start_block, 0, num_blocks, l);
+    if (ret >= 0) insert_read_piece(pe, start_block);
+    return ret;
+}
+
 #ifdef LIBED2K_DEBUG
 void disk_io_thread::check_invariant() const {
     int cached_write_blocks = 0;
@@ -885,7 +1153,6 @@ int disk_io_thread::cache_piece(disk_io_job const& j, cache_piece_index_t::itera
 
     LIBED2K_ASSERT(j.cache_min_time >= 0);
 
-    cache_piece_index_t& idx = m_read_pieces.get<0>();
     p = find_cached_piece(m_read_pieces, j, l);
 
     hit = true;
@@ -900,7 +1167,7 @@ int disk_io_thread::cache_piece(disk_io_job const& j, cache_piece_index_t::itera
         ret = read_into_piece(const_cast<cached_piece_entry&>(*p), 0, options, blocks_in_piece, l);
         hit = false;
         if (ret < 0) return ret;
-        idx.modify(p, update_last_use(j.cache_min_time));
+        touch_read_piece(p, j.cache_min_time);
     } else if (p == m_read_pieces.end()) {
         LIBED2K_INVARIANT_CHECK;
         // if the piece cannot be found in the cache,
@@ -914,6 +1181,7 @@ int disk_io_thread::cache_piece(disk_io_job const& j, cache_piece_index_t::itera
         pe.num_blocks = 0;
         pe.num_contiguous_blocks = 0;
         pe.next_block_to_hash = 0;
+        pe.queue = probation_queue;
         pe.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
         if (!pe.blocks) return -1;
         ret = read_into_piece(pe, 0, options, INT_MAX, l);
@@ -921,9 +1189,9 @@ int disk_io_thread::cache_piece(disk_io_job const& j, cache_piece_index_t::itera
         hit = false;
         if (ret < 0) return ret;
         LIBED2K_ASSERT(pe.storage);
-        p = idx.insert(pe).first;
+        p = insert_read_piece(pe, 0);
     } else {
-        idx.modify(p, update_last_use(j.cache_min_time));
+        touch_read_piece(p, j.cache_min_time);
     }
     LIBED2K_ASSERT(!m_read_pieces.empty());
     LIBED2K_ASSERT(p->piece == j.piece);
@@ -965,30 +1233,31 @@ int disk_io_thread::read_piece_from_cache_and_hash(disk_io_job const& j, md4_has
     ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, j, l);
     LIBED2K_ASSERT(ret > 0);
     if (ret < 0) return ret;
-    cache_piece_index_t& idx = m_read_pieces.get<0>();
-    if (p->num_blocks == 0)
-        idx.erase(p);
-    else
-        idx.modify(p, update_last_use(j.cache_min_time));
-
-    // if read cache is disabled or we exceeded the
-    // limit, remove this piece from the cache
-    // also, if the piece wasn't in the cache when
-    // the function was called, and we're using an
-    // explicit read cache, remove it again
-    if (in_use() >= m_settings.cache_size || !m_settings.use_read_cache || (m_settings.explicit_read_cache && !hit)) {
-        LIBED2K_ASSERT(!m_read_pieces.empty());
-        LIBED2K_ASSERT(p->piece == j.piece);
-        LIBED2K_ASSERT(p->storage == j.storage);
-        if (p != m_read_pieces.end()) {
+    if (p->num_blocks == 0) {
+        erase_read_piece(p);
+    } else {
+        touch_read_piece(p, j.cache_min_time);
+
+        // if read cache is disabled or we exceeded the
+        // limit, remove this piece from the cache
+        // also, if the piece wasn't in the cache when
+        // the function was called, and we're using an
+        // explicit read cache, remove it again
+        if (in_use() >= m_settings.cache_size || !m_settings.use_read_cache ||
+            (m_settings.explicit_read_cache && !hit)) {
+            LIBED2K_ASSERT(p->piece == j.piece);
+            LIBED2K_ASSERT(p->storage == j.storage);
             free_piece(const_cast<cached_piece_entry&>(*p), l);
-            m_read_pieces.erase(p);
+            erase_read_piece(p);
         }
     }
 
     ret = j.buffer_size;
     ++m_cache_stats.blocks_read;
-    if (hit) ++m_cache_stats.blocks_read_hit;
+    if (hit)
+        ++m_cache_stats.blocks_read_hit;
+    else
+        ++m_cache_stats.blocks_read_miss;
     return ret;
 }
 
@@ -1020,7 +1289,7 @@ bool disk_io_thread::is_cache_hit(cached_piece_entry& p, disk_io_job const& j, m
 }
 
 int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit, disk_io_job const& j, mutex::scoped_lock& l) {
-    LIBED2K_ASSERT(j.buffer);
+    LIBED2K_ASSERT(j.buffer || (j.flags & disk_io_job::reference_cache));
 
     // copy from the cache and update the last use timestamp
     int block = j.offset / m_block_size;
@@ -1071,10 +1340,21 @@ int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit, disk_io_jo
     // build a vector of all the buffers we need to free
     // and free them all in one go
     std::vector<char*> buffers;
+    cached_block_ref* ref = const_cast<disk_io_job&>(j).refs;
     while (size > 0) {
         LIBED2K_ASSERT(p.blocks[block].buf);
         int to_copy = (std::min)(m_block_size - block_offset, size);
-        std::memcpy(j.buffer + buffer_offset, p.blocks[block].buf + block_offset, to_copy);
+        if (j.buffer) {
+            std::memcpy(j.buffer + buffer_offset, p.blocks[block].buf + block_offset, to_copy);
+        } else {
+            // hand out the block itself, it stays allocated
+            // until the reference is released
+            ref->buf = p.blocks[block].buf;
+            ref->offset = block_offset;
+            ref->size = to_copy;
+            ++m_pinned_blocks[ref->buf].refs;
+            ++ref;
+        }
         size -= to_copy;
         block_offset = 0;
         buffer_offset += to_copy;
@@ -1085,7 +1365,7 @@ int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit, disk_io_jo
             // we clear the block that was requested and any blocks
             // the peer skipped
             for (int i = block; i >= 0 && p.blocks[i].buf; --i) {
-                buffers.push_back(p.blocks[i].buf);
+                evict_block(p.blocks[i].buf, buffers, l);
                 p.blocks[i].buf = 0;
                 --p.num_blocks;
                 --m_cache_stats.cache_size;
@@ -1099,7 +1379,7 @@ int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit, disk_io_jo
 }
 
 int disk_io_thread::try_read_from_cache(disk_io_job const& j, bool& hit, int flags) {
-    LIBED2K_ASSERT(j.buffer);
+    LIBED2K_ASSERT(j.buffer || (j.flags & disk_io_job::reference_cache));
     LIBED2K_ASSERT(j.cache_min_time >= 0);
 
     mutex::scoped_lock l(m_piece_mutex);
@@ -1138,13 +1418,16 @@ int disk_io_thread::try_read_from_cache(disk_io_job const& j, bool& hit, int fla
     ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, j, l);
     if (ret < 0) return ret;
     if (p->num_blocks == 0)
-        idx.erase(p);
+        erase_read_piece(p);
     else
-        idx.modify(p, update_last_use(j.cache_min_time));
+        touch_read_piece(p, j.cache_min_time);
 
     ret = j.buffer_size;
     ++m_cache_stats.blocks_read;
-    if (hit) ++m_cache_stats.blocks_read_hit;
+    if (hit)
+        ++m_cache_stats.blocks_read_hit;
+    else
+        ++m_cache_stats.blocks_read_miss;
     return ret;
 }
 
@@ -1233,6 +1516,7 @@ bool disk_io_thread::test_error(disk_io_job& j) {
 }
 
 void disk_io_thread::post_callback(disk_io_job const& j, int ret) {
+    log_event(ev_disk_job, j.action, j.piece, j.offset, ret);
     if (!j.callback) return;
     m_queued_completions.push_back(std::make_pair(j, ret));
 }
@@ -1273,6 +1557,8 @@ static const boost::uint8_t action_flags[] = {
     read_operation + cancel_on_abort  // cache_piece
     ,
     0  // finalize_file
+    ,
+    cancel_on_abort  // read_ahead
 };
 
 bool should_cancel_on_abort(disk_io_job const& j) {
@@ -1332,6 +1618,10 @@ void disk_io_thread::thread_fun() {
         }
     }
 #endif
+    // file checks hash in parallel from the start, not
+    // only once the settings are changed
+    m_hash_pool.set_num_threads(m_settings.hashing_threads);
+
     // 1 = forward in list, -1 = backwards in list
     int elevator_direction = 1;
 
@@ -1354,7 +1644,7 @@ void disk_io_thread::thread_fun() {
         }
 
         libed2k::ptime job_start;
-        while (m_jobs.empty() && m_sorted_read_jobs.empty() && !m_abort) {
+        while (m_jobs.empty() && m_sorted_read_jobs.empty() && m_read_ahead_jobs.empty() && !m_abort) {
             // if there hasn't been an event in one second
             // see if we should flush the cache
             //              if (!m_signal.timed_wait(jl, boost::posix_time::seconds(1)))
@@ -1388,6 +1678,8 @@ void disk_io_thread::thread_fun() {
 
             m_pieces.clear();
             m_read_pieces.clear();
+            m_ghost_pieces.clear();
+            m_probation_pieces = 0;
             // release the io_service to allow the run() call to return
             // we do this once we stop posting new callbacks to it.
             m_work.reset();
@@ -1418,7 +1710,13 @@ void disk_io_thread::thread_fun() {
 
         bool pick_read_job = m_jobs.empty() || (immediate_jobs_in_row >= read_job_every && !m_sorted_read_jobs.empty());
 
-        if (!pick_read_job) {
+        if (m_jobs.empty() && m_sorted_read_jobs.empty()) {
+            // nothing else to do, read ahead
+            LIBED2K_ASSERT(!m_read_ahead_jobs.empty());
+            j = m_read_ahead_jobs.front();
+            m_read_ahead_jobs.pop_front();
+            jl.unlock();
+        } else if (!pick_read_job) {
             // we have a job in the job queue. If it's
             // a read operation and we are allowed to
             // reorder jobs, sort it into the read job
@@ -1544,6 +1842,10 @@ void disk_io_thread::thread_fun() {
         }
 
         m_queue_time.add_sample(total_microseconds(now - j.start_time));
+        {
+            mutex::scoped_lock l(m_metrics_mutex);
+            m_job_queue_time[j.action].add((std::max)(total_microseconds(now - j.start_time), boost::int64_t(0)));
+        }
 
         // if there's a buffer in this job, it will be freed
         // when this holder is destructed, unless it has been
@@ -1589,6 +1891,8 @@ void disk_io_thread::thread_fun() {
                     delete s;
 
                     m_file_pool.resize(m_settings.file_pool_size);
+                    m_file_pool.set_share_read_only(m_settings.read_only_seed_files);
+                    m_hash_pool.set_num_threads(m_settings.hashing_threads);
 #if defined __APPLE__ && defined __MACH__ && MAC_OS_X_VERSION_MIN_REQUIRED >= 1050
                     setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD,
                                    m_settings.low_prio_disk ? IOPOL_THROTTLE : IOPOL_DEFAULT);
@@ -1650,14 +1954,16 @@ void disk_io_thread::thread_fun() {
                     for (cache_t::iterator i = m_read_pieces.begin(); i != m_read_pieces.end();) {
                         if (i->storage == j.storage) {
                             drain_piece_bufs(const_cast<cached_piece_entry&>(*i), buffers, l);
-                            i = m_read_pieces.erase(i);
+                            i = erase_read_piece(i);
                         } else {
                             ++i;
                         }
                     }
+                    purge_ghost_pieces(j.storage.get(), l);
                     l.unlock();
                     if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
                     release_memory();
+                    purge_read_streams(j.storage.get());
                     break;
                 }
                 case disk_io_job::abort_thread: {
@@ -1679,6 +1985,7 @@ void disk_io_thread::thread_fun() {
                         }
                         ++i;
                     }
+                    m_read_ahead_jobs.clear();
                     jl.unlock();
 
                     for (read_jobs_t::iterator i = m_sorted_read_jobs.begin(); i != m_sorted_read_jobs.end();) {
@@ -1691,6 +1998,7 @@ void disk_io_thread::thread_fun() {
                         m_sorted_read_jobs.erase(i++);
                     }
 
+                    m_hash_pool.stop();
                     m_abort = true;
                     break;
                 }
@@ -1763,8 +2071,32 @@ void disk_io_thread::thread_fun() {
                     m_log << log_time();
 #endif
                     LIBED2K_INVARIANT_CHECK;
-                    if (j.buffer == 0) j.buffer = allocate_buffer("send buffer");
                     LIBED2K_ASSERT(j.buffer_size <= m_block_size);
+
+                    // answer with references to the cache blocks. Blocks
+                    // missing in the cache are read into it first, so
+                    // cold reads aren't copied either
+                    if ((j.flags & disk_io_job::reference_cache) && j.buffer == 0 && m_settings.zero_copy_upload &&
+                        m_settings.use_read_cache && !m_settings.explicit_read_cache) {
+                        bool hit;
+                        ret = try_read_from_cache(j, hit);
+                        if (ret == -1) {
+                            test_error(j);
+                            break;
+                        }
+                        if (ret >= 0) {
+                            if (!hit) {
+                                libed2k::ptime now = libed2k::time_now_hires();
+                                m_read_time.add_sample(total_microseconds(now - operation_start));
+                                m_cache_stats.cumulative_read_time += total_milliseconds(now - operation_start);
+                            }
+                            read_ahead(j);
+                            break;
+                        }
+                        // no room in the cache, copy into a buffer instead
+                    }
+
+                    if (j.buffer == 0) j.buffer = allocate_buffer("send buffer");
                     if (j.buffer == 0) {
 #ifdef LIBED2K_DISK_STATS
                         m_log << " read 0" << std::endl;
@@ -1819,6 +2151,7 @@ void disk_io_thread::thread_fun() {
                         m_read_time.add_sample(total_microseconds(now - operation_start));
                         m_cache_stats.cumulative_read_time += total_milliseconds(now - operation_start);
                     }
+                    read_ahead(j);
                     LIBED2K_ASSERT(j.buffer == read_holder.get());
                     read_holder.release();
 #if LIBED2K_DISK_STATS
@@ -1826,6 +2159,17 @@ void disk_io_thread::thread_fun() {
 #endif
                     break;
                 }
+                case disk_io_job::read_ahead: {
+#ifdef LIBED2K_DISK_STATS
+                    m_log << log_time() << " read_ahead " << j.max_cache_line << std::endl;
+#endif
+                    mutex::scoped_lock l(m_piece_mutex);
+                    LIBED2K_INVARIANT_CHECK;
+                    ret = read_ahead_piece(j, j.piece, j.offset / m_block_size, j.max_cache_line, l);
+                    l.unlock();
+                    if (ret == -1) test_error(j);
+                    break;
+                }
                 case disk_io_job::write: {
 #ifdef LIBED2K_DISK_STATS
                     m_log << log_time() << " write " << j.buffer_size << std::endl;
@@ -2018,8 +2362,10 @@ void disk_io_thread::thread_fun() {
                             ++i;
                         }
                     }
+                    purge_ghost_pieces(j.storage.get(), l);
                     l.unlock();
                     release_memory();
+                    purge_read_streams(j.storage.get());
 
                     ret = j.storage->release_files_impl();
                     if (ret != 0) test_error(j);
@@ -2037,7 +2383,7 @@ void disk_io_thread::thread_fun() {
                     for (cache_t::iterator i = m_read_pieces.begin(); i != m_read_pieces.end();) {
                         if (i->storage == j.storage) {
                             free_piece(const_cast<cached_piece_entry&>(*i), l);
-                            i = m_read_pieces.erase(i);
+                            i = erase_read_piece(i);
                         } else {
                             ++i;
                         }
@@ -2080,9 +2426,11 @@ void disk_io_thread::thread_fun() {
                         LIBED2K_ASSERT(i->num_blocks == 0);
                     }
                     idx.erase(start, end);
+                    purge_ghost_pieces(j.storage.get(), l);
                     l.unlock();
                     if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
                     release_memory();
+                    purge_read_streams(j.storage.get());
 
                     ret = j.storage->delete_files_impl();
                     if (ret != 0) test_error(j);
@@ -2121,10 +2469,30 @@ void disk_io_thread::thread_fun() {
                         m_last_file_check = libed2k::time_now_hires();
 #endif
 
+                        if (m_settings.file_checks_rate_limit > 0) {
+                            size_type rate = m_settings.file_checks_rate_limit;
+                            m_check_quota += rate * total_microseconds(now - m_last_check_quota) / 1000000;
+                            m_check_quota = (std::min)(m_check_quota, rate);
+                            m_last_check_quota = now;
+
+                            if (m_check_quota < 0) {
+                                // out of quota, let other jobs run and continue
+                                // the check when it's picked from the queue again
+                                mutex::scoped_lock jl(m_queue_mutex);
+                                bool idle = m_jobs.empty() && m_sorted_read_jobs.empty();
+                                jl.unlock();
+                                if (idle)
+                                    sleep((std::min)(int(-m_check_quota * 1000 / rate), 100));
+                                ret = piece_manager::need_full_check;
+                                break;
+                            }
+                            m_check_quota -= piece_size;
+                        }
+
                         libed2k::ptime hash_start = libed2k::time_now_hires();
                         if (m_waiting_to_shutdown) break;
 
-                        ret = j.storage->check_files(j.piece, j.offset, j.error);
+                        ret = j.storage->check_files(j.piece, j.offset, j.error, &m_hash_pool);
 
                         libed2k::ptime done = libed2k::time_now_hires();
                         m_hash_time.add_sample(total_microseconds(done - hash_start));
@@ -42,7 +42,7 @@ std::string libed2k_error_category::message(int ev) const {
         "met file invalid header byte", "input string too large", "search expression too complex",
         "pending file entry in transform", "fast resume parse error", "invalid file tag", "missing transfer hash",
         "mismatching transfer hash", "hashes dont match pieces", "failed hash check", "invalid escaped string",
-        "file parameters making was cancelled"};
+        "file parameters making was cancelled", "invalid resume journal"};
 
     if (ev < 0 || ev >= static_cast<int>(sizeof(msgs) / sizeof(msgs[0]))) {
         return ("unknown error");
@@ -0,0 +1,280 @@
+#include <ctime>
+#include <cstring>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "libed2k/event_log.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/thread.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/log.hpp"
+
+namespace libed2k {
+
+namespace aux {
+volatile int g_event_categories = 0;
+}
+
+namespace {
+
+const char log_magic[] = {'L', '2', 'K', 'E'};
+const boost::uint8_t log_version = 1;
+const int drain_interval = 100;  // milliseconds
+
+const event_info events[] = {
+    {"log_opened", {"version"}},
+    {"events_dropped", {"thread", "count"}},
+    {"peer_connect", {"ip", "port"}},
+    {"peer_connected", {"ip", "port"}},
+    {"peer_disconnect", {"ip", "port", "error"}},
+    {"peer_send_block", {"ip", "piece", "start", "length"}},
+    {"peer_receive_block", {"ip", "piece", "start", "length"}},
+    {"bw_request", {"channel", "bytes", "priority", "queued"}},
+    {"bw_grant", {"channel", "bytes", "queued"}},
+    {"disk_job", {"action", "piece", "offset", "result"}},
+    {"piece_passed", {"piece"}},
+    {"piece_failed", {"piece"}},
+    {"transfer_finished", {"pieces"}}};
+
+const int event_ids[] = {ev_log_opened,         ev_events_dropped, ev_peer_connect,      ev_peer_connected,
+                         ev_peer_disconnect,    ev_peer_send_block, ev_peer_receive_block, ev_bw_request,
+                         ev_bw_grant,           ev_disk_job,       ev_piece_passed,      ev_piece_failed,
+                         ev_transfer_finished};
+
+/**
+  * single producer single consumer ring. The owning thread moves head after
+  * it filled a record, the drainer moves tail after it copied one. Both
+  * counters only grow, their difference is the number of records in the ring
+ */
+struct event_ring {
+    enum { size = 4096 };
+
+    event_ring(int i) : head(0), tail(0), dropped(0), index(i), owned(true), reported(0) {}
+
+    boost::detail::atomic_count head;
+    boost::detail::atomic_count tail;
+    boost::detail::atomic_count dropped;  //!< records lost because the ring was full
+    const int index;
+    volatile bool owned;  //!< false once the owning thread exited
+    long reported;        //!< drops already logged, drainer only
+    event_record records[size];
+};
+
+void release_ring(event_ring* r) { r->owned = false; }
+
+struct event_log_state {
+    event_log_state() : owner(&release_ring), abort(false) {}
+
+    mutex rings_mutex;
+    std::vector<event_ring*> rings;  //!< never freed, threads that exit leave theirs for new ones
+    boost::thread_specific_ptr<event_ring> owner;
+
+    mutex log_mutex;  //!< open and close
+    file log;
+    size_type size;
+    ptime start;
+    volatile bool abort;
+    boost::shared_ptr<thread> drainer;
+};
+
+// lives until the process exits, threads may log while statics are destroyed
+event_log_state& state() {
+    static event_log_state* s = new event_log_state;
+    return *s;
+}
+
+#ifdef LIBED2K_THREAD_LOCAL
+LIBED2K_THREAD_LOCAL event_ring* thread_ring = 0;
+#endif
+
+event_ring* claim_ring() {
+    event_log_state& s = state();
+    mutex::scoped_lock l(s.rings_mutex);
+
+    event_ring* r = 0;
+    for (std::vector<event_ring*>::iterator i = s.rings.begin(), end(s.rings.end()); i != end; ++i) {
+        // the ring of an exited thread is taken over once it's drained
+        if ((*i)->owned || long((*i)->head) != long((*i)->tail)) continue;
+        r = *i;
+        r->owned = true;
+        break;
+    }
+
+    if (!r) {
+        r = new event_ring(int(s.rings.size()));
+        s.rings.push_back(r);
+    }
+
+    s.owner.reset(r);
+    return r;
+}
+
+event_ring* current_ring() {
+#ifdef LIBED2K_THREAD_LOCAL
+    if (thread_ring) return thread_ring;
+    thread_ring = state().owner.get();
+    if (!thread_ring) thread_ring = claim_ring();
+    return thread_ring;
+#else
+    event_ring* r = state().owner.get();
+    return r ? r : claim_ring();
+#endif
+}
+
+void drain(std::vector<event_record>& out) {
+    event_log_state& s = state();
+    std::vector<event_ring*> rings;
+    {
+        mutex::scoped_lock l(s.rings_mutex);
+        rings = s.rings;
+    }
+
+    for (std::vector<event_ring*>::iterator i = rings.begin(), end(rings.end()); i != end; ++i) {
+        event_ring& r = **i;
+        long head = r.head;
+        for (long t = r.tail; t != head; ++t) {
+            out.push_back(r.records[t & (event_ring::size - 1)]);
+            ++r.tail;
+        }
+
+        long dropped = r.dropped;
+        if (dropped == r.reported) continue;
+
+        event_record e;
+        std::memset(&e, 0, sizeof(e));
+        e.time = total_microseconds(time_now_hires() - s.start);
+        e.id = ev_events_dropped;
+        e.thread = boost::uint16_t(r.index);
+        e.arg[0] = r.index;
+        e.arg[1] = boost::int32_t(dropped - r.reported);
+        out.push_back(e);
+        r.reported = dropped;
+    }
+}
+
+void write_records(const std::vector<event_record>& records) {
+    if (records.empty()) return;
+
+    event_log_state& s = state();
+    error_code ec;
+    file::iovec_t b = {const_cast<event_record*>(&records[0]), records.size() * sizeof(event_record)};
+    size_type written = s.log.writev(s.size, &b, 1, ec);
+    if (ec) {
+        ERR("event log write failed: " << ec.message());
+        return;
+    }
+    s.size += written;
+}
+
+void drainer() {
+    event_log_state& s = state();
+    std::vector<event_record> records;
+
+    while (!s.abort) {
+        libed2k::sleep(drain_interval);
+        drain(records);
+        write_records(records);
+        records.clear();
+    }
+}
+}
+
+const event_info* describe_event(int id) {
+    for (size_t i = 0; i < sizeof(event_ids) / sizeof(event_ids[0]); ++i)
+        if (event_ids[i] == id) return &events[i];
+    return 0;
+}
+
+bool open_event_log(const std::string& path, int categories, error_code& ec) {
+    close_event_log();
+
+    event_log_state& s = state();
+    mutex::scoped_lock l(s.log_mutex);
+
+    if (!s.log.open(path, file::write_only, ec)) return false;
+    s.log.set_size(0, ec);
+    if (ec) {
+        s.log.close();
+        return false;
+    }
+
+    event_log_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, log_magic, sizeof(log_magic));
+    h.version = log_version;
+    h.record_size = sizeof(event_record);
+    h.byte_order = event_log_byte_order;
+    h.start = boost::uint64_t(std::time(0));
+
+    file::iovec_t b = {&h, sizeof(h)};
+    s.size = s.log.writev(0, &b, 1, ec);
+    if (ec) {
+        s.log.close();
+        return false;
+    }
+
+    // records left from an earlier log are dropped
+    std::vector<event_record> stale;
+    drain(stale);
+
+    s.start = time_now_hires();
+    s.abort = false;
+    s.drainer.reset(new thread(&drainer));
+    aux::g_event_categories = categories | session_events;
+    log_event(ev_log_opened, log_version);
+    return true;
+}
+
+void close_event_log() {
+    event_log_state& s = state();
+    mutex::scoped_lock l(s.log_mutex);
+    if (!s.drainer) return;
+
+    aux::g_event_categories = 0;
+    s.abort = true;
+    s.drainer->join();
+    s.drainer.reset();
+
+    std::vector<event_record> records;
+    drain(records);
+    write_records(records);
+    s.log.close();
+}
+
+void set_event_categories(int categories) {
+    event_log_state& s = state();
+    mutex::scoped_lock l(s.log_mutex);
+    if (!s.drainer) return;
+    aux::g_event_categories = categories | session_events;
+}
+
+namespace aux {
+void write_event(int id, int a0, int a1, int a2, int a3, int a4) {
+    event_ring* r = current_ring();
+
+    long head = r->head;
+    if (head - long(r->tail) >= event_ring::size) {
+        ++r->dropped;
+        return;
+    }
+
+    event_record& e = r->records[head & (event_ring::size - 1)];
+    e.time = total_microseconds(time_now_hires() - state().start);
+    e.id = boost::uint16_t(id);
+    e.thread = boost::uint16_t(r->index);
+    e.arg[0] = a0;
+    e.arg[1] = a1;
+    e.arg[2] = a2;
+    e.arg[3] = a3;
+    e.arg[4] = a4;
+
+    // the increment is a full barrier, the drainer sees the record
+    // before it sees the new head
+    ++r->head;
+}
+}
+}
@@ -32,6 +32,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/version.hpp>
 #include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
 
 #include <libed2k/pch.hpp>
 #include <libed2k/assert.hpp>
@@ -43,7 +44,10 @@ namespace libed2k {
 
 file_pool::file_pool(int size)
     : m_size(size),
-      m_low_prio_io(true)
+      m_low_prio_io(true),
+      m_share_read_only(false),
+      m_num_files(0),
+      m_next_shard(0)
 #if LIBED2K_CLOSE_MAY_BLOCK
       ,
       m_stop_thread(false),
@@ -96,16 +100,21 @@ void file_pool::closer_thread_fun() {
 }
 #endif
 
+file_pool::shard& file_pool::shard_of(void* st) { return m_shards[boost::hash_value(st) % num_shards]; }
+
 boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p, file_storage::iterator fe,
                                                 file_storage const& fs, int m, error_code& ec) {
     LIBED2K_ASSERT(st != 0);
     LIBED2K_ASSERT(is_complete(p));
     LIBED2K_ASSERT((m & file::rw_mask) == file::read_only || (m & file::rw_mask) == file::read_write);
-    mutex::scoped_lock l(m_mutex);
-    file_set::iterator i = m_files.find(std::make_pair(st, fs.file_index(*fe)));
-    if (i != m_files.end()) {
-        lru_file_entry& e = i->second;
+    shard& s = shard_of(st);
+    std::pair<void*, int> id(st, fs.file_index(*fe));
+    mutex::scoped_lock l(s.lock);
+    file_set::iterator i = s.files.find(id);
+    if (i != s.files.end()) {
+        lru_file_entry& e = *i->second;
         e.last_use = libed2k::time_now();
+        s.lru.splice(s.lru.begin(), s.lru, i->second);
 
         if (e.key != st && ((e.mode & file::rw_mask) != file::read_only || (m & file::rw_mask) != file::read_only)) {
 // this means that another instance of the storage
@@ -117,6 +126,11 @@ boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p,
         }
 
         e.key = st;
+
+        // any open file can be read from, readers check the
+        // flags it was actually opened with
+        if (m_share_read_only && (m & file::rw_mask) == file::read_only) return e.file_ptr;
+
         // if we asked for a file in write mode,
         // and the cached file is is not opened in
         // write mode, re-open it
@@ -137,7 +151,7 @@ boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p,
 #endif
             std::string full_path = combine_path(p, fs.file_path(*fe));
             if (!e.file_ptr->open(full_path, m, ec)) {
-                m_files.erase(i);
+                erase(s, i->second);
                 return boost::intrusive_ptr<file>();
             }
 #ifdef LIBED2K_WINDOWS
@@ -158,12 +172,16 @@ boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p,
         LIBED2K_ASSERT((e.mode & file::no_buffer) == (m & file::no_buffer));
         return e.file_ptr;
     }
-    // the file is not in our cache
-    if ((int)m_files.size() >= m_size) {
-        // the file cache is at its maximum size, close
-        // the least recently used (lru) file from it
-        remove_oldest();
+
+    // the file is not in our cache. When the pool is full the least
+    // recently used file is closed, of this shard if it holds more
+    // than its share, otherwise of another one once we let go of ours
+    bool full = m_num_files >= m_size;
+    if (full && int(s.files.size()) > (std::max)(m_size / num_shards, 1)) {
+        remove_oldest(s);
+        full = false;
     }
+
     lru_file_entry e;
     e.file_ptr.reset(new (std::nothrow) file);
     if (!e.file_ptr) {
@@ -174,51 +192,81 @@ boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p,
     if (!e.file_ptr->open(full_path, m, ec)) return boost::intrusive_ptr<file>();
     e.mode = m;
     e.key = st;
-    m_files.insert(std::make_pair(std::make_pair(st, fs.file_index(*fe)), e));
+    e.id = id;
+    s.lru.push_front(e);
+    s.files.insert(std::make_pair(id, s.lru.begin()));
+    ++m_num_files;
     LIBED2K_ASSERT(e.file_ptr->is_open());
+    l.unlock();
+
+    if (full) {
+        while (m_num_files > m_size) {
+            if (!remove_oldest(&s)) break;
+        }
+    }
     return e.file_ptr;
 }
 
-void file_pool::remove_oldest() {
-    file_set::iterator i =
-        std::min_element(m_files.begin(), m_files.end(),
-                         boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _1)) <
-                             boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _2)));
-    if (i == m_files.end()) return;
-
+void file_pool::erase(shard& s, lru_list::iterator i) {
 #if LIBED2K_CLOSE_MAY_BLOCK
     mutex::scoped_lock l(m_closer_mutex);
-    m_queued_for_close.push_back(i->second.file_ptr);
+    m_queued_for_close.push_back(i->file_ptr);
     l.unlock();
 #endif
-    m_files.erase(i);
+    s.files.erase(i->id);
+    s.lru.erase(i);
+    --m_num_files;
 }
 
-void file_pool::release(void* st, int file_index) {
-    mutex::scoped_lock l(m_mutex);
-    file_set::iterator i = m_files.find(std::make_pair(st, file_index));
-    if (i == m_files.end()) return;
+void file_pool::remove_oldest(shard& s) {
+    LIBED2K_ASSERT(!s.lru.empty());
+    erase(s, --s.lru.end());
+}
 
-#if LIBED2K_CLOSE_MAY_BLOCK
-    mutex::scoped_lock l2(m_closer_mutex);
-    m_queued_for_close.push_back(i->second.file_ptr);
-    l2.unlock();
-#endif
-    m_files.erase(i);
+bool file_pool::remove_oldest(shard* fresh) {
+    int share = (std::max)(m_size / num_shards, 1);
+    int start = ++m_next_shard;
+
+    // first look for a shard holding more files than its share,
+    // then take any file that's not the one just opened
+    for (int pass = 0; pass < 2; ++pass) {
+        int limit = pass == 0 ? share : 0;
+        for (int k = 0; k < num_shards; ++k) {
+            shard& s = m_shards[(start + k) % num_shards];
+            mutex::scoped_lock l(s.lock);
+            if (int(s.files.size()) <= (&s == fresh ? (std::max)(limit, 1) : limit)) continue;
+            remove_oldest(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+void file_pool::release(void* st, int file_index) {
+    shard& s = shard_of(st);
+    mutex::scoped_lock l(s.lock);
+    file_set::iterator i = s.files.find(std::make_pair(st, file_index));
+    if (i == s.files.end()) return;
+    erase(s, i->second);
 }
 
 // closes files belonging to the specified
 // storage. If 0 is passed, all files are closed
 void file_pool::release(void* st) {
-    mutex::scoped_lock l(m_mutex);
     if (st == 0) {
-        m_files.clear();
+        for (int k = 0; k < num_shards; ++k) {
+            shard& s = m_shards[k];
+            mutex::scoped_lock l(s.lock);
+            while (!s.lru.empty()) remove_oldest(s);
+        }
         return;
     }
 
-    for (file_set::iterator i = m_files.begin(); i != m_files.end();) {
-        if (i->second.key == st)
-            m_files.erase(i++);
+    shard& s = shard_of(st);
+    mutex::scoped_lock l(s.lock);
+    for (lru_list::iterator i = s.lru.begin(); i != s.lru.end();) {
+        if (i->key == st)
+            erase(s, i++);
         else
             ++i;
     }
@@ -227,11 +275,11 @@ void file_pool::release(void* st) {
 void file_pool::resize(int size) {
     LIBED2K_ASSERT(size > 0);
     if (size == m_size) return;
-    mutex::scoped_lock l(m_mutex);
     m_size = size;
-    if (int(m_files.size()) <= m_size) return;
 
     // close the least recently used files
-    while (int(m_files.size()) > m_size) remove_oldest();
+    while (m_num_files > m_size) {
+        if (!remove_oldest(0)) break;
+    }
 }
 }
@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "libed2k/hash_pool.hpp"
+
+namespace libed2k {
+
+hash_pool::hash_pool() : m_abort(false) {}
+
+hash_pool::~hash_pool() { stop(); }
+
+void hash_pool::set_num_threads(int threads) {
+    if (threads <= 0) threads = (std::max)(int(boost::thread::hardware_concurrency()), 1);
+    if (threads == int(m_threads.size())) return;
+
+    stop();
+
+    mutex::scoped_lock l(m_mutex);
+    m_abort = false;
+    for (int i = 0; i < threads; ++i)
+        m_threads.push_back(boost::shared_ptr<thread>(new thread(boost::bind(&hash_pool::thread_fun, this))));
+}
+
+void hash_pool::stop() {
+    mutex::scoped_lock l(m_mutex);
+    m_abort = true;
+    m_job_cond.signal_all(l);
+    // waiters of queued jobs hash them themselves
+    m_done_cond.signal_all(l);
+    std::vector<boost::shared_ptr<thread> > threads;
+    threads.swap(m_threads);
+    l.unlock();
+
+    for (std::vector<boost::shared_ptr<thread> >::iterator i = threads.begin(); i != threads.end(); ++i) (*i)->join();
+}
+
+void hash_pool::post(hash_job* j) {
+    mutex::scoped_lock l(m_mutex);
+    j->done = false;
+    m_jobs.push_back(j);
+    m_job_cond.signal_all(l);
+}
+
+void hash_pool::wait(hash_job* j) {
+    mutex::scoped_lock l(m_mutex);
+
+    while (!j->done) {
+        std::deque<hash_job*>::iterator i = std::find(m_jobs.begin(), m_jobs.end(), j);
+        if (i != m_jobs.end() && m_threads.empty()) {
+            // nobody would pick it up, hash it here
+            m_jobs.erase(i);
+            l.unlock();
+            hash(*j);
+            l.lock();
+            j->done = true;
+            break;
+        }
+
+        m_done_cond.wait(l);
+    }
+}
+
+bool hash_pool::done(hash_job* j) const {
+    mutex::scoped_lock l(m_mutex);
+    return j->done;
+}
+
+void hash_pool::thread_fun() {
+    mutex::scoped_lock l(m_mutex);
+
+    for (;;) {
+        while (m_jobs.empty() && !m_abort) m_job_cond.wait(l);
+        if (m_abort) return;
+
+        hash_job* j = m_jobs.front();
+        m_jobs.pop_front();
+        l.unlock();
+
+        hash(*j);
+
+        l.lock();
+        j->done = true;
+        m_done_cond.signal_all(l);
+    }
+}
+
+void hash_pool::hash(hash_job& j) {
+    hasher h;
+    int offset = 0;
+
+    if (j.small_size > 0 && j.small_size <= j.size) {
+        h.update(j.data, j.small_size);
+        j.small_hash = hasher(h).final();
+        offset = j.small_size;
+    }
+
+    if (j.size > offset) h.update(j.data + offset, j.size - offset);
+    j.hash = h.final();
+}
+}
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <set>
 #include <numeric>
+#include <ctime>
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
 
@@ -54,6 +55,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/io.hpp"
 #include "libed2k/version.hpp"
 #include "libed2k/escape_string.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/archive.hpp"
 
 #define MINIZ_HEADER_FILE_ONLY
 #include "../miniz.c"
@@ -70,7 +73,8 @@ enum {
 };
 
 namespace {
-const int tick_period = 1;  // minutes
+const int tick_period = 1;     // minutes
+const int snapshot_pings = 16;  // contacts of the snapshot pinged per tick
 
 template <class EndpointType>
 void read_endpoint_list(libed2k::entry const* n, std::vector<EndpointType>& epl) {
@@ -137,6 +141,59 @@ node_id extract_node_id(entry const* e) {
     return node_id(node_id(nid->string().c_str()));
 }
 
+namespace {
+kad_snapshot load_snapshot(std::string const& path) {
+    kad_snapshot ret;
+    if (path.empty()) return ret;
+
+    std::ifstream fs(path.c_str(), std::ios_base::binary);
+    if (!fs) return ret;
+
+    LIBED2K_TRY {
+        archive::ed2k_iarchive ia(fs);
+        ia >> ret;
+    }
+    LIBED2K_CATCH(libed2k_exception&) { ret = kad_snapshot(); }
+    return ret;
+}
+
+// an id in the state entry wins over the one of the snapshot
+node_id startup_id(entry const* state, kad_snapshot const& snapshot) {
+    node_id ret = extract_node_id(state);
+    if (ret == (node_id::min)() && !snapshot.entries.m_collection.empty()) ret = snapshot.self_id;
+    return ret;
+}
+
+// verified contacts first, then the ones that replied last
+bool ping_before(kad_snapshot_entry const& lhs, kad_snapshot_entry const& rhs) {
+    int lv = lhs.flags & kad_snapshot_entry::verified;
+    int rv = rhs.flags & kad_snapshot_entry::verified;
+    if (lv != rv) return lv > rv;
+    return lhs.last_seen > rhs.last_seen;
+}
+
+struct snapshot_builder {
+    kad_snapshot* snapshot;
+    ptime now;
+    std::time_t unix_now;
+};
+
+void add_snapshot_fun(void* userdata, node_entry const& e) {
+    snapshot_builder* b = (snapshot_builder*)userdata;
+    if (!e.addr.is_v4()) return;
+
+    kad_snapshot_entry se;
+    se.point.m_nIP = address2int(e.addr);
+    se.point.m_nPort = e.port;
+    se.pid = e.id;
+    se.rtt = e.rtt;
+    se.last_seen = 0;
+    if (e.last_seen != min_time()) se.last_seen = boost::uint32_t(b->unix_now - total_seconds(b->now - e.last_seen));
+    se.flags = e.confirmed() ? kad_snapshot_entry::verified : 0;
+    b->snapshot->entries.m_collection.push_back(se);
+}
+}
+
 bool send_callback(void* userdata, const udp_message& e, udp::endpoint const& addr, int flags) {
     dht_tracker* self = (dht_tracker*)userdata;
     return self->send_packet(e, addr, flags);
@@ -146,11 +203,13 @@ bool send_callback(void* userdata, const udp_message& e, udp::endpoint const& ad
 // unit and connecting them together.
 dht_tracker::dht_tracker(libed2k::aux::session_impl& ses, rate_limited_udp_socket& sock, dht_settings const& settings,
                          entry const* state)
-    : m_dht(ses.m_alerts, &send_callback, settings, extract_node_id(state), ses.external_address(), ses.listen_port(),
-            boost::bind(&aux::session_impl::set_external_address, &ses, _1, _2, _3), this),
+    : m_snapshot(load_snapshot(settings.state_file)),
+      m_dht(ses.m_alerts, &send_callback, settings, startup_id(state, m_snapshot), ses.external_address(),
+            ses.listen_port(), boost::bind(&aux::session_impl::set_external_address, &ses, _1, _2, _3), this),
       m_ses(ses),
       m_sock(sock),
       m_last_new_key(time_now() - minutes(key_refresh)),
+      m_last_snapshot(time_now()),
       m_timer(sock.get_io_service()),
       m_connection_timer(sock.get_io_service()),
       m_refresh_timer(sock.get_io_service()),
@@ -209,11 +268,84 @@ void dht_tracker::start(entry const& bootstrap) {
 
     m_refresh_timer.expires_from_now(seconds(5), ec);
     m_refresh_timer.async_wait(boost::bind(&dht_tracker::refresh_timeout, self(), _1));
-    m_dht.bootstrap(initial_nodes, boost::bind(&libed2k::dht::nop));
+
+    // the socket is rate limited, the best contacts go first
+    std::sort(m_snapshot.entries.m_collection.begin(), m_snapshot.entries.m_collection.end(), &ping_before);
+
+    // the contacts that answer the pings fill the routing table within a
+    // round trip, which makes the bootstrap through the routers unnecessary.
+    // If no ping went out, the routers are asked all the same
+    int pinged = ping_snapshot();
+    if (pinged == 0 || !initial_nodes.empty()) m_dht.bootstrap(initial_nodes, boost::bind(&libed2k::dht::nop));
+}
+
+int dht_tracker::ping_snapshot() {
+    std::vector<kad_snapshot_entry>& contacts = m_snapshot.entries.m_collection;
+
+    // a burst of pings would overrun the rate limit of the
+    // socket, the contacts are pinged a few at a time
+    int ret = 0;
+    std::vector<kad_snapshot_entry>::iterator i = contacts.begin();
+    for (; i != contacts.end() && ret < snapshot_pings; ++i) {
+        if (i->point.empty()) continue;
+        // not sent, the contact waits for the next tick
+        if (!m_dht.add_node(udp::endpoint(address_v4(ntohl(i->point.m_nIP)), i->point.m_nPort), i->pid)) break;
+        ++ret;
+    }
+    contacts.erase(contacts.begin(), i);
+
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+    LIBED2K_LOG(dht_tracker) << "pinged " << ret << " contacts of the routing table snapshot, " << contacts.size()
+                             << " left";
+#endif
+
+    if (contacts.empty()) m_snapshot = kad_snapshot();
+    return ret;
+}
+
+kad_snapshot dht_tracker::snapshot() const {
+    kad_snapshot ret;
+    ret.self_id = m_dht.nid();
+
+    snapshot_builder b;
+    b.snapshot = &ret;
+    b.now = time_now();
+    b.unix_now = std::time(0);
+    m_dht.m_table.for_each_node(&add_snapshot_fun, &add_snapshot_fun, &b);
+    return ret;
+}
+
+void dht_tracker::save_snapshot() {
+    m_last_snapshot = time_now();
+    if (m_settings.state_file.empty()) return;
+
+    kad_snapshot s = snapshot();
+    // a stopped node that never got a reply keeps the file it started from
+    if (s.entries.m_collection.empty()) return;
+
+    // written aside and moved over the old file, an interrupted
+    // write never leaves a truncated snapshot behind
+    std::string tmp = m_settings.state_file + ".tmp";
+    {
+        std::ofstream fs(tmp.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!fs) return;
+        LIBED2K_TRY {
+            archive::ed2k_oarchive oa(fs);
+            oa << s;
+        }
+        LIBED2K_CATCH(libed2k_exception&) { return; }
+    }
+
+    error_code ec;
+#ifdef LIBED2K_WINDOWS
+    libed2k::remove(m_settings.state_file, ec);
+#endif
+    libed2k::rename(tmp, m_settings.state_file, ec);
 }
 
 void dht_tracker::stop() {
     LIBED2K_ASSERT(m_ses.is_network_thread());
+    if (!m_abort) save_snapshot();
     m_abort = true;
     error_code ec;
     m_timer.cancel(ec);
@@ -227,6 +359,8 @@ void dht_tracker::dht_status(session_status& s) {
     m_dht.status(s);
 }
 
+void dht_tracker::metrics(session_metrics& m) { m_dht.metrics(m); }
+
 void dht_tracker::network_stats(int& sent, int& received) {
     LIBED2K_ASSERT(m_ses.is_network_thread());
     sent = m_sent_bytes;
@@ -240,6 +374,7 @@ void dht_tracker::connection_timeout(error_code const& e) {
     if (e || m_abort) return;
 
     time_duration d = m_dht.connection_timeout();
+    if (!m_snapshot.entries.m_collection.empty()) ping_snapshot();
     error_code ec;
     m_connection_timer.expires_from_now(d, ec);
     m_connection_timer.async_wait(boost::bind(&dht_tracker::connection_timeout, self(), _1));
@@ -268,6 +403,8 @@ void dht_tracker::tick(error_code const& e) {
         m_last_new_key = now;
     }
 
+    if (now - m_last_snapshot >= seconds(m_settings.state_save_interval)) save_snapshot();
+
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     static bool first = true;
 
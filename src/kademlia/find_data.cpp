@@ -107,16 +107,26 @@ void add_entry_fun(void* userdata, node_entry const& e) {
 find_data::find_data(node_impl& node, node_id target, data_callback const& dcallback, nodes_callback const& ncallback,
                      uint8_t search_type)
     : traversal_algorithm(node, target),
-      m_data_callback(dcallback),
-      m_nodes_callback(ncallback),
       m_target(target),
       m_id(node.nid()),
-      m_done(false),
       m_got_peers(false),
       m_search_type(search_type) {
+    m_nodes_callbacks.push_back(ncallback);
+    if (!dcallback.empty()) m_data_callbacks.push_back(dcallback);
     node.m_table.for_each_node(&add_entry_fun, 0, (traversal_algorithm*)this);
 }
 
+bool find_data::join(uint8_t search_type, data_callback const& dcallback, nodes_callback const& ncallback) {
+    if (m_done || search_type != m_search_type) return false;
+
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+    LIBED2K_LOG(traversal) << "[" << this << "] joining running search for " << m_target;
+#endif
+    m_nodes_callbacks.push_back(ncallback);
+    if (!dcallback.empty()) m_data_callbacks.push_back(dcallback);
+    return true;
+}
+
 observer_ptr find_data::new_observer(void* ptr, udp::endpoint const& ep, node_id const& id) {
     observer_ptr o(new (ptr) find_data_observer(this, ep, id));
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
@@ -141,9 +151,8 @@ bool find_data::invoke(observer_ptr o) {
 }
 
 void find_data::done() {
-    if (m_invoke_count != 0) return;
-
-    m_done = true;
+    if (m_done) return;
+    if (m_invoke_count != 0 && !quorum_reached()) return;
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     LIBED2K_LOG(traversal) << time_now_string() << "[" << this << "] get_peers DONE";
@@ -167,8 +176,19 @@ void find_data::done() {
         --num_results;
     }
 
-    m_nodes_callback(results, m_got_peers);
-    if (!m_data_callback.empty()) m_data_callback(m_target);
+    // the callbacks may start new searches for the same target,
+    // which must not join this one anymore
+    m_done = true;
+    std::vector<nodes_callback> nodes_callbacks;
+    std::vector<data_callback> data_callbacks;
+    nodes_callbacks.swap(m_nodes_callbacks);
+    data_callbacks.swap(m_data_callbacks);
+
+    for (std::vector<nodes_callback>::iterator i = nodes_callbacks.begin(), end(nodes_callbacks.end()); i != end;
+         ++i)
+        (*i)(results, m_got_peers);
+    for (std::vector<data_callback>::iterator i = data_callbacks.begin(), end(data_callbacks.end()); i != end; ++i)
+        (*i)(m_target);
     traversal_algorithm::done();
 }
 }
@@ -0,0 +1,299 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+
+#include "libed2k/kademlia/flat_routing_table.hpp"
+#include "libed2k/assert.hpp"
+#include "libed2k/io.hpp"
+
+namespace libed2k {
+namespace dht {
+
+namespace {
+void split_id(node_id const& id, boost::uint64_t& hi, boost::uint64_t& lo) {
+    unsigned char const* p = id.begin();
+    hi = detail::read_uint64(p);
+    lo = detail::read_uint64(p);
+}
+
+inline int count_leading_zeros(boost::uint64_t v) {
+    LIBED2K_ASSERT(v != 0);
+#if defined __GNUC__
+    return __builtin_clzll(v);
+#else
+    int ret = 0;
+    for (boost::uint64_t mask = boost::uint64_t(1) << 63; (v & mask) == 0; mask >>= 1) ++ret;
+    return ret;
+#endif
+}
+
+// number of leading bits two distances have in common, 128 when equal
+inline int common_prefix(boost::uint64_t hi1, boost::uint64_t lo1, boost::uint64_t hi2, boost::uint64_t lo2) {
+    if (hi1 != hi2) return count_leading_zeros(hi1 ^ hi2);
+    if (lo1 != lo2) return 64 + count_leading_zeros(lo1 ^ lo2);
+    return 128;
+}
+
+// mask keeping the first bits bits of a 64 bit half
+inline boost::uint64_t prefix_mask(int bits) {
+    if (bits <= 0) return 0;
+    if (bits >= 64) return ~boost::uint64_t(0);
+    return ~boost::uint64_t(0) << (64 - bits);
+}
+
+inline bool less(boost::uint64_t hi1, boost::uint64_t lo1, boost::uint64_t hi2, boost::uint64_t lo2) {
+    return hi1 < hi2 || (hi1 == hi2 && lo1 < lo2);
+}
+
+inline int hash_key(boost::uint64_t key, int mask) {
+    // fibonacci hashing, spreads consecutive addresses over the table
+    return int((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+const int initial_index_size = 64;
+}
+
+flat_routing_table::flat_routing_table(node_id const& id) : m_index(initial_index_size), m_num_endpoints(0) {
+    split_id(id, m_id_hi, m_id_lo);
+}
+
+boost::uint64_t flat_routing_table::endpoint_key(udp::endpoint const& ep) {
+    // kad works over IPv4 only, same assumption as routing_table::m_ips
+    return (boost::uint64_t(ep.address().to_v4().to_ulong()) << 16) | ep.port();
+}
+
+int flat_routing_table::probe(boost::uint64_t key) const {
+    int mask = int(m_index.size()) - 1;
+    int i = hash_key(key, mask);
+    while (m_index[i].key != 0 && m_index[i].key != key) i = (i + 1) & mask;
+    return i;
+}
+
+void flat_routing_table::erase_index(int i) {
+    // backward shift deletion, move up any entry of the probe
+    // run that would not be reachable through the hole
+    int mask = int(m_index.size()) - 1;
+    m_index[i].key = 0;
+    for (int j = (i + 1) & mask; m_index[j].key != 0; j = (j + 1) & mask) {
+        int home = hash_key(m_index[j].key, mask);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m_index[i] = m_index[j];
+            m_index[j].key = 0;
+            i = j;
+        }
+    }
+}
+
+void flat_routing_table::rehash(int buckets) {
+    std::vector<index_entry> old(buckets);
+    old.swap(m_index);
+    for (std::vector<index_entry>::const_iterator i = old.begin(), end(old.end()); i != end; ++i) {
+        if (i->key != 0) m_index[probe(i->key)] = *i;
+    }
+}
+
+int flat_routing_table::lower_bound(boost::uint64_t hi, boost::uint64_t lo) const {
+    int first = 0;
+    int len = int(m_nodes.size());
+    while (len > 0) {
+        int half = len / 2;
+        flat_node const& n = m_nodes[first + half];
+        if (less(n.dist_hi, n.dist_lo, hi, lo)) {
+            first += half + 1;
+            len -= half + 1;
+        } else
+            len = half;
+    }
+    return first;
+}
+
+int flat_routing_table::upper_bound(boost::uint64_t hi, boost::uint64_t lo) const {
+    int first = 0;
+    int len = int(m_nodes.size());
+    while (len > 0) {
+        int half = len / 2;
+        flat_node const& n = m_nodes[first + half];
+        if (!less(hi, lo, n.dist_hi, n.dist_lo)) {
+            first += half + 1;
+            len -= half + 1;
+        } else
+            len = half;
+    }
+    return first;
+}
+
+int flat_routing_table::slot(boost::uint64_t dist_hi, boost::uint64_t dist_lo, boost::uint64_t key) const {
+    for (int i = lower_bound(dist_hi, dist_lo); i < int(m_nodes.size()); ++i) {
+        flat_node const& n = m_nodes[i];
+        if (n.dist_hi != dist_hi || n.dist_lo != dist_lo) break;
+        if (((boost::uint64_t(n.ip) << 16) | n.port) == key) return i;
+    }
+    LIBED2K_ASSERT(false);
+    return -1;
+}
+
+void flat_routing_table::insert_live(node_entry const& e, boost::uint64_t dist_hi, boost::uint64_t dist_lo) {
+    flat_node n;
+    n.dist_hi = dist_hi;
+    n.dist_lo = dist_lo;
+    n.ip = e.addr.to_v4().to_ulong();
+    n.port = e.port;
+    n.timeout_count = e.timeout_count;
+
+    int pos = lower_bound(dist_hi, dist_lo);
+    m_nodes.insert(m_nodes.begin() + pos, n);
+    m_entries.insert(m_entries.begin() + pos, e);
+}
+
+void flat_routing_table::update(node_entry const& e, bool live) {
+    boost::uint64_t key = endpoint_key(e.ep());
+    boost::uint64_t hi, lo;
+    split_id(e.id, hi, lo);
+    hi ^= m_id_hi;
+    lo ^= m_id_lo;
+
+    int b = probe(key);
+    index_entry& ie = m_index[b];
+
+    if (ie.key == 0) {
+        ie.key = key;
+        ++m_num_endpoints;
+    } else if (ie.live) {
+        int s = slot(ie.dist_hi, ie.dist_lo, key);
+        if (live && ie.dist_hi == hi && ie.dist_lo == lo) {
+            ie.rtt = e.rtt;
+            m_nodes[s].timeout_count = e.timeout_count;
+            m_entries[s] = e;
+            return;
+        }
+
+        // the node left the live set or the endpoint
+        // changed its id and moves in the ordering
+        m_nodes.erase(m_nodes.begin() + s);
+        m_entries.erase(m_entries.begin() + s);
+    }
+
+    ie.dist_hi = hi;
+    ie.dist_lo = lo;
+    ie.rtt = e.rtt;
+    ie.live = live;
+    if (live) insert_live(e, hi, lo);
+
+    // keep the load factor under one half
+    if (m_num_endpoints * 2 > int(m_index.size())) rehash(int(m_index.size()) * 2);
+}
+
+void flat_routing_table::erase(udp::endpoint const& ep) {
+    boost::uint64_t key = endpoint_key(ep);
+    int b = probe(key);
+    index_entry const& ie = m_index[b];
+    if (ie.key == 0) return;
+
+    if (ie.live) {
+        int s = slot(ie.dist_hi, ie.dist_lo, key);
+        m_nodes.erase(m_nodes.begin() + s);
+        m_entries.erase(m_entries.begin() + s);
+    }
+
+    erase_index(b);
+    --m_num_endpoints;
+}
+
+void flat_routing_table::clear() {
+    m_nodes.clear();
+    m_entries.clear();
+    m_index.assign(initial_index_size, index_entry());
+    m_num_endpoints = 0;
+}
+
+bool flat_routing_table::find(udp::endpoint const& ep, node_id& id, bool& live) const {
+    if (!ep.address().is_v4()) return false;
+    index_entry const& ie = m_index[probe(endpoint_key(ep))];
+    if (ie.key == 0) return false;
+
+    unsigned char* p = id.begin();
+    detail::write_uint64(ie.dist_hi ^ m_id_hi, p);
+    detail::write_uint64(ie.dist_lo ^ m_id_lo, p);
+    live = ie.live;
+    return true;
+}
+
+int flat_routing_table::rtt(udp::endpoint const& ep) const {
+    if (!ep.address().is_v4()) return 0xffff;
+    index_entry const& ie = m_index[probe(endpoint_key(ep))];
+    return ie.key == 0 ? 0xffff : ie.rtt;
+}
+
+void flat_routing_table::find_closest(node_id const& target, std::vector<node_entry>& l, int count,
+                                      bool include_failed) const {
+    int size = int(m_nodes.size());
+    if (count <= 0 || size == 0) return;
+
+    // distances to the target are distances to us XOR'ed with
+    // the target's distance to us
+    boost::uint64_t thi, tlo;
+    split_id(target, thi, tlo);
+    thi ^= m_id_hi;
+    tlo ^= m_id_lo;
+
+    // [first, last) is always a subtree around the target. Every node in it is
+    // closer to the target than any node outside of it, so widen it until it
+    // has count candidates, then only rank what is inside
+    int first = lower_bound(thi, tlo);
+    int last = first;
+    int candidates = 0;
+
+    while (candidates < count && (first > 0 || last < size)) {
+        // the next subtree to take is the one shared with the nearest outside node
+        int bits = -1;
+        if (first > 0)
+            bits = common_prefix(thi, tlo, m_nodes[first - 1].dist_hi, m_nodes[first - 1].dist_lo);
+        if (last < size)
+            bits = (std::max)(bits, common_prefix(thi, tlo, m_nodes[last].dist_hi, m_nodes[last].dist_lo));
+
+        boost::uint64_t mask_hi = prefix_mask(bits);
+        boost::uint64_t mask_lo = prefix_mask(bits - 64);
+        int new_first = lower_bound(thi & mask_hi, tlo & mask_lo);
+        int new_last = upper_bound(thi | ~mask_hi, tlo | ~mask_lo);
+        LIBED2K_ASSERT(new_first <= first && new_last >= last);
+
+        for (int i = new_first; i < first; ++i)
+            if (include_failed || m_nodes[i].confirmed()) ++candidates;
+        for (int i = last; i < new_last; ++i)
+            if (include_failed || m_nodes[i].confirmed()) ++candidates;
+
+        first = new_first;
+        last = new_last;
+    }
+
+    // m_ranking[0, ranked) holds the best nodes seen so far, sorted by distance
+    if (int(m_ranking.size()) < count) m_ranking.resize(count);
+    ranked* best = &m_ranking[0];
+    int num_ranked = 0;
+
+    for (int i = first; i < last; ++i) {
+        flat_node const& n = m_nodes[i];
+        if (!include_failed && !n.confirmed()) continue;
+
+        boost::uint64_t hi = n.dist_hi ^ thi;
+        boost::uint64_t lo = n.dist_lo ^ tlo;
+
+        if (num_ranked == count) {
+            if (!less(hi, lo, best[count - 1].hi, best[count - 1].lo)) continue;
+            --num_ranked;
+        }
+
+        // insertion into the sorted array, count is k so this stays short
+        int pos = num_ranked;
+        for (; pos > 0 && less(hi, lo, best[pos - 1].hi, best[pos - 1].lo); --pos) best[pos] = best[pos - 1];
+        best[pos].hi = hi;
+        best[pos].lo = lo;
+        best[pos].slot = i;
+        ++num_ranked;
+    }
+
+    l.reserve(l.size() + num_ranked);
+    for (int i = 0; i < num_ranked; ++i) l.push_back(m_entries[best[i].slot]);
+}
+}
+}  // namespace libed2k::dht
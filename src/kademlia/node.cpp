@@ -200,11 +200,11 @@ void node_impl::add_router_node(udp::endpoint router) {
     m_table.add_router_node(router);
 }
 
-void node_impl::add_node(udp::endpoint node, node_id id) {
+bool node_impl::add_node(udp::endpoint node, node_id id) {
     // ping the node, and if we get a reply, it
     // will be added to the routing table
     void* ptr = m_rpc.allocate_observer();
-    if (ptr == 0) return;
+    if (ptr == 0) return false;
 
     // create a dummy traversal_algorithm
     // this is unfortunately necessary for the observer
@@ -215,18 +215,19 @@ void node_impl::add_node(udp::endpoint node, node_id id) {
     o->m_in_constructor = false;
 #endif
     kad2_ping packet;
-    m_rpc.invoke(packet, node, o);
+    return m_rpc.invoke(packet, node, o);
 }
 
 void node_impl::announce(node_id const& info_hash, int listen_port, boost::function<void(kad_id const&)> f) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     LIBED2K_LOG(node) << "announcing [ ih: " << info_hash << " p: " << listen_port << " ]";
 #endif
+    find_data::nodes_callback ncallback = boost::bind(&announce_fun, _1, boost::ref(*this), listen_port, info_hash);
+    if (join_search(info_hash, KADEMLIA_STORE, f, ncallback)) return;
+
     // search for nodes with ids close to id or with peers
     // for info-hash id. then send announce_peer to them.
-    boost::intrusive_ptr<find_data> ta(
-        new find_data(*this, info_hash, f, boost::bind(&announce_fun, _1, boost::ref(*this), listen_port, info_hash),
-                      KADEMLIA_STORE));
+    boost::intrusive_ptr<find_data> ta(new find_data(*this, info_hash, f, ncallback, KADEMLIA_STORE));
     ta->start();
 }
 
@@ -234,11 +235,13 @@ void node_impl::search_keywords(node_id const& info_hash, int listen_port, boost
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     LIBED2K_LOG(node) << "search keywords [ ih: " << info_hash << " p: " << listen_port << " ]";
 #endif
+    find_data::nodes_callback ncallback =
+        boost::bind(&search_keywords_fun, _1, boost::ref(*this), listen_port, info_hash);
+    if (join_search(info_hash, KADEMLIA_FIND_VALUE, f, ncallback)) return;
+
     // search for nodes with ids close to id or with peers
     // for info-hash id. then send announce_peer to them.
-    boost::intrusive_ptr<find_data> ta(new find_data(
-        *this, info_hash, f, boost::bind(&search_keywords_fun, _1, boost::ref(*this), listen_port, info_hash),
-        KADEMLIA_FIND_VALUE));
+    boost::intrusive_ptr<find_data> ta(new find_data(*this, info_hash, f, ncallback, KADEMLIA_FIND_VALUE));
     ta->start();
 }
 
@@ -248,14 +251,33 @@ void node_impl::search_sources(node_id const& info_hash, int listen_port, size_t
     LIBED2K_LOG(node) << "search sources [ ih: " << info_hash << " p: " << listen_port << " ]";
 #endif
 
+    find_data::nodes_callback ncallback =
+        boost::bind(&search_sources_fun, _1, boost::ref(*this), listen_port, size, info_hash);
+    if (join_search(info_hash, KADEMLIA_FIND_NODE, f, ncallback)) return;
+
     // search for nodes with ids close to id or with peers
     // for info-hash id. then send announce_peer to them.
-    boost::intrusive_ptr<find_data> ta(new find_data(
-        *this, info_hash, f, boost::bind(&search_sources_fun, _1, boost::ref(*this), listen_port, size, info_hash),
-        KADEMLIA_FIND_NODE));
+    boost::intrusive_ptr<find_data> ta(new find_data(*this, info_hash, f, ncallback, KADEMLIA_FIND_NODE));
     ta->start();
 }
 
+bool node_impl::join_search(node_id const& target, uint8_t search_type, find_data::data_callback const& dcallback,
+                            find_data::nodes_callback const& ncallback) {
+    mutex_t::scoped_lock l(m_mutex);
+    for (std::set<traversal_algorithm *>::iterator i = m_running_requests.begin(), end(m_running_requests.end());
+         i != end; ++i) {
+        if ((*i)->target() != target) continue;
+        find_data* f = dynamic_cast<find_data*>(*i);
+        if (f && f->join(search_type, dcallback, ncallback)) {
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+            LIBED2K_LOG(node) << "joined running search [ target: " << target << " ]";
+#endif
+            return true;
+        }
+    }
+    return false;
+}
+
 void node_impl::tick() {
     node_id target;
     if (m_table.need_refresh(target)) refresh(target, boost::bind(&nop));
@@ -293,6 +315,11 @@ time_duration node_impl::connection_timeout() {
     return d;
 }
 
+void node_impl::metrics(session_metrics& m) {
+    mutex_t::scoped_lock l(m_mutex);
+    m_rpc.metrics(m);
+}
+
 void node_impl::status(session_status& s) {
     mutex_t::scoped_lock l(m_mutex);
 
@@ -368,6 +395,8 @@ kad_entry entry_to_emule(const node_entry& e) {
 template <>
 void node_impl::incoming_request(const kademlia2_req& req, udp::endpoint target) {
     kademlia2_res p;
+    // the requester matches the reply to its request by the target
+    p.kid_target = req.kid_target;
     int count = req.search_type;
     std::vector<node_entry> res;
     m_table.find_node(req.kid_target, res, routing_table::include_failed, count);
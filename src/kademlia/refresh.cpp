@@ -67,6 +67,7 @@ bootstrap::bootstrap(node_impl& node, node_id target, done_callback const& callb
     // make it more resilient to nodes not responding.
     // we don't want to terminate early when we're bootstrapping
     m_num_target_nodes *= 2;
+    m_quorum = 0;
 }
 
 char const* bootstrap::name() const { return "bootstrap"; }
@@ -63,7 +63,8 @@ routing_table::routing_table(node_id const& id, int bucket_size, dht_settings co
       m_id(id),
       m_last_bootstrap(min_time()),
       m_last_refresh(min_time()),
-      m_last_self_refresh(min_time()) {}
+      m_last_self_refresh(min_time()),
+      m_flat(id) {}
 
 void routing_table::status(session_status& s) const {
     boost::tie(s.dht_nodes, s.dht_node_cache) = size();
@@ -250,20 +251,25 @@ bool compare_ip_cidr(node_entry const& lhs, node_entry const& rhs) {
 }
 
 node_entry* routing_table::find_node(udp::endpoint const& ep, routing_table::table_t::iterator* bucket) {
-    for (table_t::iterator i = m_buckets.begin(), end(m_buckets.end()); i != end; ++i) {
-        for (bucket_t::iterator j = i->replacements.begin(); j != i->replacements.end(); ++j) {
-            if (j->addr != ep.address()) continue;
-            if (j->port != ep.port()) continue;
-            *bucket = i;
-            return &*j;
-        }
-        for (bucket_t::iterator j = i->live_nodes.begin(); j != i->live_nodes.end(); ++j) {
-            if (j->addr != ep.address()) continue;
-            if (j->port != ep.port()) continue;
-            *bucket = i;
-            return &*j;
-        }
+    // the flat index gives us the node id, which in turn gives the
+    // bucket. Only that bucket has to be searched
+    node_id id;
+    bool live = false;
+    if (!m_flat.find(ep, id, live)) {
+        *bucket = m_buckets.end();
+        return 0;
+    }
+
+    table_t::iterator i = find_bucket(id);
+    bucket_t& b = live ? i->live_nodes : i->replacements;
+    for (bucket_t::iterator j = b.begin(); j != b.end(); ++j) {
+        if (j->addr != ep.address()) continue;
+        if (j->port != ep.port()) continue;
+        *bucket = i;
+        return &*j;
     }
+
+    LIBED2K_ASSERT(false);
     *bucket = m_buckets.end();
     return 0;
 }
@@ -274,6 +280,7 @@ void routing_table::remove_node(node_entry* n, routing_table::table_t::iterator
         int idx = n - &bucket->replacements[0];
         LIBED2K_ASSERT(m_ips.count(n->addr.to_v4().to_bytes()) > 0);
         m_ips.erase(n->addr.to_v4().to_bytes());
+        m_flat.erase(n->ep());
         bucket->replacements.erase(bucket->replacements.begin() + idx);
     }
 
@@ -282,6 +289,7 @@ void routing_table::remove_node(node_entry* n, routing_table::table_t::iterator
         int idx = n - &bucket->live_nodes[0];
         LIBED2K_ASSERT(m_ips.count(n->addr.to_v4().to_bytes()) > 0);
         m_ips.erase(n->addr.to_v4().to_bytes());
+        m_flat.erase(n->ep());
         bucket->live_nodes.erase(bucket->live_nodes.begin() + idx);
     }
 }
@@ -306,6 +314,10 @@ bool routing_table::add_node(node_entry const& e) {
 
         table_t::iterator existing_bucket;
         node_entry* existing = find_node(e.ep(), &existing_bucket);
+        // an endpoint maps to a single node, an unverified claim of a
+        // different id on a known endpoint is never taken
+        if (existing && !e.pinged() && existing->id != e.id) return ret;
+
         if (!e.pinged() || existing == 0) {
             // the new node is not pinged, or it's not an existing node
             // we should ignore it, unless we allow duplicate IPs in our
@@ -320,6 +332,12 @@ bool routing_table::add_node(node_entry const& e) {
             // if the node ID is the same, just update the failcount
             // and be done with it
             existing->timeout_count = 0;
+            existing->update_rtt(e.rtt);
+            existing->last_seen = e.last_seen;
+            node_id existing_id;
+            bool live = false;
+            m_flat.find(e.ep(), existing_id, live);
+            m_flat.update(*existing, live);
             return ret;
         } else if (existing) {
             LIBED2K_ASSERT(existing->id != e.id);
@@ -350,6 +368,9 @@ bool routing_table::add_node(node_entry const& e) {
         // in this bucket
         LIBED2K_ASSERT(j->id == e.id && j->ep() == e.ep());
         j->timeout_count = 0;
+        j->update_rtt(e.rtt);
+        j->last_seen = (std::max)(j->last_seen, e.last_seen);
+        m_flat.update(*j, true);
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         LIBED2K_LOG(table) << "updating node: " << j->id << " " << j->addr;
 #endif
@@ -391,6 +412,7 @@ bool routing_table::add_node(node_entry const& e) {
         if (b->empty()) b->reserve(m_bucket_size);
         b->push_back(e);
         m_ips.insert(e.addr.to_v4().to_bytes());
+        m_flat.update(e, true);
         //		LIBED2K_LOG(table) << "inserting node: " << e.id << " " << e.addr;
         return ret;
     }
@@ -418,9 +440,11 @@ bool routing_table::add_node(node_entry const& e) {
             // j points to a node that has not been pinged.
             // Replace it with this new one
             m_ips.erase(j->addr.to_v4().to_bytes());
+            m_flat.erase(j->ep());
             b->erase(j);
             b->push_back(e);
             m_ips.insert(e.addr.to_v4().to_bytes());
+            m_flat.update(e, true);
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
             LIBED2K_LOG(table) << "replacing unpinged node: " << e.id << " " << e.addr;
 #endif
@@ -440,9 +464,11 @@ bool routing_table::add_node(node_entry const& e) {
             // i points to a node that has been marked
             // as stale. Replace it with this new one
             m_ips.erase(j->addr.to_v4().to_bytes());
+            m_flat.erase(j->ep());
             b->erase(j);
             b->push_back(e);
             m_ips.insert(e.addr.to_v4().to_bytes());
+            m_flat.update(e, true);
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
             LIBED2K_LOG(table) << "replacing stale node: " << e.id << " " << e.addr;
 #endif
@@ -465,7 +491,12 @@ bool routing_table::add_node(node_entry const& e) {
         if (j != rb->end()) {
             // if the IP address matches, it's the same node
             // make sure it's marked as pinged
-            if (j->ep() == e.ep()) j->set_pinged();
+            if (j->ep() == e.ep()) {
+                j->set_pinged();
+                j->update_rtt(e.rtt);
+                j->last_seen = (std::max)(j->last_seen, e.last_seen);
+                m_flat.update(*j, false);
+            }
             return ret;
         }
 
@@ -476,12 +507,14 @@ bool routing_table::add_node(node_entry const& e) {
             j = std::find_if(rb->begin(), rb->end(), boost::bind(&node_entry::pinged, _1) == false);
             if (j == rb->end()) j = rb->begin();
             m_ips.erase(j->addr.to_v4().to_bytes());
+            m_flat.erase(j->ep());
             rb->erase(j);
         }
 
         if (rb->empty()) rb->reserve(m_bucket_size);
         rb->push_back(e);
         m_ips.insert(e.addr.to_v4().to_bytes());
+        m_flat.update(e, false);
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         LIBED2K_LOG(table) << "inserting node in replacement cache: " << e.id << " " << e.addr;
 #endif
@@ -528,22 +561,25 @@ bool routing_table::add_node(node_entry const& e) {
                 continue;
             }
             b->push_back(*j);
+            m_flat.update(*j, true);
         } else {
             // this entry belongs in the new bucket
-            if (int(new_bucket.size()) < m_bucket_size)
+            if (int(new_bucket.size()) < m_bucket_size) {
                 new_bucket.push_back(*j);
-            else
+                m_flat.update(*j, true);
+            } else
                 new_replacement_bucket.push_back(*j);
         }
         j = rb->erase(j);
     }
 
     bool added = false;
+    bool live = false;
     // now insert the new node in the appropriate bucket
     if (distance_exp(m_id, e.id) >= kad_id::kad_total_bits - 1 - bucket_index) {
         if (int(b->size()) < m_bucket_size) {
             b->push_back(e);
-            added = true;
+            added = live = true;
         } else if (int(rb->size()) < m_bucket_size) {
             rb->push_back(e);
             added = true;
@@ -551,14 +587,17 @@ bool routing_table::add_node(node_entry const& e) {
     } else {
         if (int(new_bucket.size()) < m_bucket_size) {
             new_bucket.push_back(e);
-            added = true;
+            added = live = true;
         } else if (int(new_replacement_bucket.size()) < m_bucket_size) {
             new_replacement_bucket.push_back(e);
             added = true;
         }
     }
 
-    if (added) m_ips.insert(e.addr.to_v4().to_bytes());
+    if (added) {
+        m_ips.insert(e.addr.to_v4().to_bytes());
+        m_flat.update(e, live);
+    }
     return ret;
 }
 
@@ -595,6 +634,7 @@ void routing_table::node_failed(node_id const& id, udp::endpoint const& ep) {
 
     if (rb.empty()) {
         j->timed_out();
+        m_flat.update(*j, true);
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         LIBED2K_LOG(table) << " NODE FAILED"
@@ -607,17 +647,20 @@ void routing_table::node_failed(node_id const& id, udp::endpoint const& ep) {
         // has never responded at all, remove it
         if (j->fail_count() >= m_settings.max_fail_count || !j->pinged()) {
             m_ips.erase(j->addr.to_v4().to_bytes());
+            m_flat.erase(j->ep());
             b.erase(j);
         }
         return;
     }
 
     m_ips.erase(j->addr.to_v4().to_bytes());
+    m_flat.erase(j->ep());
     b.erase(j);
 
     j = std::find_if(rb.begin(), rb.end(), boost::bind(&node_entry::pinged, _1) == true);
     if (j == rb.end()) j = rb.begin();
     b.push_back(*j);
+    m_flat.update(*j, true);
     rb.erase(j);
 }
 
@@ -634,7 +677,9 @@ void routing_table::heard_about(node_id const& id, udp::endpoint const& ep) { ad
 // the return value indicates if the table needs a refresh.
 // if true, the node should refresh the table (i.e. do a find_node
 // on its own id)
-bool routing_table::node_seen(node_id const& id, udp::endpoint ep) { return add_node(node_entry(id, ep, true)); }
+bool routing_table::node_seen(node_id const& id, udp::endpoint ep, int rtt) {
+    return add_node(node_entry(id, ep, true, rtt));
+}
 
 bool routing_table::need_bootstrap() const {
     ptime now = time_now();
@@ -649,85 +694,13 @@ bool routing_table::need_bootstrap() const {
     return true;
 }
 
-template <class SrcIter, class DstIter, class Pred>
-DstIter copy_if_n(SrcIter begin, SrcIter end, DstIter target, size_t n, Pred p) {
-    for (; n > 0 && begin != end; ++begin) {
-        if (!p(*begin)) continue;
-        *target = *begin;
-        --n;
-        ++target;
-    }
-    return target;
-}
-
-template <class SrcIter, class DstIter>
-DstIter copy_n(SrcIter begin, SrcIter end, DstIter target, size_t n) {
-    for (; n > 0 && begin != end; ++begin) {
-        *target = *begin;
-        --n;
-        ++target;
-    }
-    return target;
-}
-
 // fills the vector with the k nodes from our buckets that
 // are nearest to the given id.
 void routing_table::find_node(node_id const& target, std::vector<node_entry>& l, int options, int count) {
     l.clear();
     if (count == 0) count = m_bucket_size;
-    l.reserve(count);
-
-    table_t::iterator i = find_bucket(target);
-    bucket_t& b = i->live_nodes;
-
-    // copy all nodes that hasn't failed into the target
-    // vector.
-    if (options & include_failed) {
-        copy_n(b.begin(), b.end(), std::back_inserter(l), (std::min)(size_t(count), b.size()));
-    } else {
-        copy_if_n(b.begin(), b.end(), std::back_inserter(l), (std::min)(size_t(count), b.size()),
-                  boost::bind(&node_entry::confirmed, _1));
-    }
+    m_flat.find_closest(target, l, count, (options & include_failed) != 0);
     LIBED2K_ASSERT((int)l.size() <= count);
-
-    if (int(l.size()) >= count) return;
-
-    // if we didn't have enough nodes in that bucket
-    // we have to reply with nodes from buckets closer
-    // to us.
-    table_t::iterator j = i;
-    ++j;
-
-    for (; j != m_buckets.end() && int(l.size()) < count; ++j) {
-        bucket_t& b = j->live_nodes;
-        size_t to_copy = (std::min)(count - l.size(), b.size());
-        if (options & include_failed) {
-            copy(b.begin(), b.begin() + to_copy, std::back_inserter(l));
-        } else {
-            std::remove_copy_if(b.begin(), b.begin() + to_copy, std::back_inserter(l),
-                                !boost::bind(&node_entry::confirmed, _1));
-        }
-    }
-
-    if (int(l.size()) >= count) return;
-
-    // if we still don't have enough nodes, copy nodes
-    // further away from us
-
-    if (i == m_buckets.begin()) return;
-    j = i;
-
-    do {
-        --j;
-        bucket_t& b = j->live_nodes;
-
-        size_t to_copy = (std::min)(count - l.size(), b.size());
-        if (options & include_failed) {
-            copy_n(b.begin(), b.end(), std::back_inserter(l), to_copy);
-        } else {
-            copy_if_n(b.begin(), b.end(), std::back_inserter(l), to_copy, boost::bind(&node_entry::confirmed, _1));
-        }
-    } while (j != m_buckets.begin() && int(l.size()) < count);
 }
 /*
 routing_table::iterator routing_table::begin() const
@@ -51,7 +51,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/hasher.hpp>
 #include <libed2k/time.hpp>
 #include "libed2k/util.hpp"
-#include <time.h>  // time()
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
 #include <fstream>
@@ -82,13 +81,11 @@ void intrusive_ptr_release(observer const* o) {
     }
 }
 
+ptime (*rtt_clock)() = &time_now_hires;
+
 void observer::set_target(udp::endpoint const& ep) {
-#ifdef LIBED2K_DHT_VERBOSE_LOGGING
-    // use high resolution timers for logging
-    m_sent = time_now_hires();
-#else
-    m_sent = time_now();
-#endif
+    // the cached time_now() is only updated once per session tick
+    m_sent = rtt_clock();
 
     m_port = ep.port();
 #if LIBED2K_USE_IPV6
@@ -150,10 +147,11 @@ rpc_manager::rpc_manager(node_id const& our_id, routing_table& table, send_fun c
       m_timer(time_now()),
       m_random_number(generate_random_id()),
       m_allocated_observers(0),
+      m_rtt_estimate(-1),
+      m_requests(0),
+      m_timeouts(0),
       m_destructing(false),
       m_port(port) {
-    std::srand(time(0));
-
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     LIBED2K_LOG(rpc) << "Constructing";
 
@@ -202,6 +200,12 @@ void rpc_manager::free_observer(void* ptr) {
     m_pool_allocator.free(ptr);
 }
 
+void rpc_manager::metrics(session_metrics& m) const {
+    m.kad_rpc_time.merge(m_rtt);
+    m.counters[session_metrics::kad_requests] += m_requests;
+    m.counters[session_metrics::kad_timeouts] += m_timeouts;
+}
+
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 size_t rpc_manager::allocation_size() const { return observer_size; }
 #endif
@@ -230,6 +234,7 @@ void rpc_manager::unreachable(udp::endpoint const& ep) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         LIBED2K_LOG(rpc) << "  found transaction [ tid: " << ptr->transaction_id() << " ]";
 #endif
+        ++m_timeouts;
         ptr->timeout();
         break;
     }
@@ -263,9 +268,16 @@ bool rpc_manager::incoming(const T& t, udp::endpoint target, node_id* id) {
         return false;
     }
 
+    int rtt = (std::min)((std::max)(total_milliseconds(rtt_clock() - o->sent()), 0), 0xfffe);
+    m_rtt.add((std::max)(total_microseconds(rtt_clock() - o->sent()), boost::int64_t(0)));
+    if (m_rtt_estimate < 0)
+        m_rtt_estimate = rtt;
+    else
+        m_rtt_estimate = (m_rtt_estimate * 7 + rtt) / 8;
+
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     std::ofstream reply_stats("round_trip_ms.log", std::ios::app);
-    reply_stats << target.address() << "\t" << total_milliseconds(time_now_hires() - o->sent()) << std::endl;
+    reply_stats << target.address() << "\t" << rtt << std::endl;
 #endif
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
@@ -282,7 +294,7 @@ bool rpc_manager::incoming(const T& t, udp::endpoint target, node_id* id) {
 
     // we found an observer for this reply, hence the node is not spoofing
     // add it to the routing table
-    return m_table.node_seen(*id, target);
+    return m_table.node_seen(*id, target, rtt);
 }
 
 template bool rpc_manager::incoming<kad2_pong>(const kad2_pong& t, udp::endpoint target, node_id* id);
@@ -290,20 +302,36 @@ template bool rpc_manager::incoming<kad2_hello_res>(const kad2_hello_res& t, udp
 template bool rpc_manager::incoming<kad2_bootstrap_res>(const kad2_bootstrap_res& t, udp::endpoint target, node_id* id);
 template bool rpc_manager::incoming<kademlia2_res>(const kademlia2_res& t, udp::endpoint target, node_id* id);
 
+namespace {
+// bounds of the time a request may go unanswered before it counts as
+// stalled and another one is sent in its place. The upper bound was
+// the fixed short timeout before round trip times were tracked
+const int min_short_timeout = 250;
+const int max_short_timeout = 2000;
+const int timeout = 12;
+}
+
+int rpc_manager::short_timeout(udp::endpoint const& ep) const {
+    int rtt = m_table.node_rtt(ep);
+    if (rtt == 0xffff) rtt = m_rtt_estimate;
+    if (rtt < 0) return max_short_timeout;
+    return (std::min)((std::max)(rtt * 3, min_short_timeout), max_short_timeout);
+}
+
 time_duration rpc_manager::tick() {
     LIBED2K_INVARIANT_CHECK;
 
-    const static int short_timeout = 2;
-    const static int timeout = 12;
-
     //	look for observers that have timed out
 
-    if (m_transactions.empty()) return seconds(short_timeout);
+    // an idle node keeps the old interval, the first request is noticed
+    // stalled no later than the fixed short timeout used to. Requests in
+    // flight may have a short timeout as low as min_short_timeout
+    if (m_transactions.empty()) return milliseconds(max_short_timeout);
 
     std::list<observer_ptr> timeouts;
 
-    time_duration ret = seconds(short_timeout);
-    ptime now = time_now();
+    time_duration ret = milliseconds(min_short_timeout);
+    ptime now = rtt_clock();
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
     ptime last = min_time();
@@ -320,10 +348,7 @@ time_duration rpc_manager::tick() {
         // break, because every observer after this one will
         // also not have timed out yet
         time_duration diff = now - o->sent();
-        if (diff < seconds(timeout)) {
-            ret = seconds(timeout) - diff;
-            break;
-        }
+        if (diff < seconds(timeout)) break;
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
         LIBED2K_LOG(rpc) << "[" << o->m_algorithm.get() << "] Timing out transaction id: " << (*i)->transaction_id()
@@ -333,25 +358,22 @@ time_duration rpc_manager::tick() {
         timeouts.push_back(o);
     }
 
+    m_timeouts += timeouts.size();
     std::for_each(timeouts.begin(), timeouts.end(), boost::bind(&observer::timeout, _1));
     timeouts.clear();
 
+    // short timeouts differ per node, so the transactions
+    // are not ordered by them
     for (transactions_t::iterator i = m_transactions.begin(); i != m_transactions.end(); ++i) {
         observer_ptr o = *i;
+        if (o->has_short_timeout()) continue;
 
-        // if we reach an observer that hasn't timed out
-        // break, because every observer after this one will
-        // also not have timed out yet
-        time_duration diff = now - o->sent();
-        if (diff < seconds(short_timeout)) {
-            ret = seconds(short_timeout) - diff;
-            break;
+        time_duration left = milliseconds(o->short_timeout_ms()) - (now - o->sent());
+        if (left > milliseconds(0)) {
+            ret = (std::min)(ret, left);
+            continue;
         }
 
-        if (o->has_short_timeout()) continue;
-
-        // TODO: don't call short_timeout() again if we've
-        // already called it once
         timeouts.push_back(o);
     }
 
@@ -369,6 +391,7 @@ bool rpc_manager::invoke(T& t, udp::endpoint target, observer_ptr o) {
     if (o) {
         o->set_target(target);
         o->set_transaction_id(transaction_identifier<T>::id);
+        o->set_short_timeout_ms(short_timeout(target));
     }
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     if (o) {
@@ -382,7 +405,10 @@ bool rpc_manager::invoke(T& t, udp::endpoint target, observer_ptr o) {
     udp_message msg = make_udp_message(t);
 
     if (m_send(m_userdata, msg, target, 1)) {
-        if (o) m_transactions.push_back(o);
+        if (o) {
+            m_transactions.push_back(o);
+            ++m_requests;
+        }
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
         if (o) o->m_was_sent = true;
 #endif
@@ -65,7 +65,9 @@ traversal_algorithm::traversal_algorithm(node_impl& node, node_id target)
       m_branch_factor(3),
       m_responses(0),
       m_timeouts(0),
-      m_num_target_nodes(m_node.m_table.bucket_size() * 2) {
+      m_num_target_nodes(m_node.m_table.bucket_size() * 2),
+      m_quorum(m_node.settings().search_quorum),
+      m_done(false) {
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
     LIBED2K_LOG(traversal) << " [" << this << "] new traversal process. Target: " << target;
 #endif
@@ -85,6 +87,9 @@ bool compare_ip_cidr(observer_ptr const& lhs, observer_ptr const& rhs) {
 }
 
 void traversal_algorithm::add_entry(node_id const& id, udp::endpoint addr, unsigned char flags) {
+    // late replies may still carry nodes
+    if (m_done) return;
+
     LIBED2K_ASSERT(m_node.m_rpc.allocation_size() >= sizeof(find_data_observer));
     void* ptr = m_node.m_rpc.allocate_observer();
     if (ptr == 0) {
@@ -163,6 +168,14 @@ void traversal_algorithm::traverse(node_id const& id, udp::endpoint addr) {
 }
 
 void traversal_algorithm::finished(observer_ptr o) {
+    // the search reached its quorum before this reply came in
+    if (m_done) {
+        ++m_responses;
+        --m_invoke_count;
+        LIBED2K_ASSERT(m_invoke_count >= 0);
+        return;
+    }
+
 #ifdef LIBED2K_DEBUG
     std::vector<observer_ptr>::iterator i = std::find(m_results.begin(), m_results.end(), o);
 
@@ -180,7 +193,7 @@ void traversal_algorithm::finished(observer_ptr o) {
     --m_invoke_count;
     LIBED2K_ASSERT(m_invoke_count >= 0);
     add_requests();
-    if (m_invoke_count == 0) done();
+    if (m_invoke_count == 0 || quorum_reached()) done();
 }
 
 // prevent request means that the total number of requests has
@@ -193,8 +206,8 @@ void traversal_algorithm::failed(observer_ptr o, int flags) {
 
     LIBED2K_ASSERT(o->flags & observer::flag_queried);
     if (flags & short_timeout) {
-        // short timeout means that it has been more than
-        // two seconds since we sent the request, and that
+        // short timeout means that it has been a few round
+        // trip times since we sent the request, and that
         // we'll most likely not get a response. But, in case
         // we do get a late response, keep the handler
         // around for some more, but open up the slot
@@ -229,21 +242,44 @@ void traversal_algorithm::failed(observer_ptr o, int flags) {
         if (m_branch_factor <= 0) m_branch_factor = 1;
     }
     add_requests();
-    if (m_invoke_count == 0) done();
+    if (m_invoke_count == 0 || quorum_reached()) done();
 }
 
 void traversal_algorithm::done() {
+    m_done = true;
     // delete all our references to the observer objects so
     // they will in turn release the traversal algorithm
     m_results.clear();
 }
 
+bool traversal_algorithm::quorum_reached() const {
+    if (m_quorum <= 0) return false;
+
+    int replies = 0;
+    for (std::vector<observer_ptr>::const_iterator i = m_results.begin(), end(m_results.end()); i != end; ++i) {
+        unsigned char flags = (*i)->flags;
+        // router nodes have made up ids, they don't say
+        // anything about the distance to the target
+        if (flags & observer::flag_no_id) continue;
+        if (flags & observer::flag_alive) {
+            if (++replies == m_quorum) return true;
+            continue;
+        }
+        // a closer node may still tell us something new
+        if ((flags & (observer::flag_failed | observer::flag_short_timeout)) == 0) return false;
+    }
+    return false;
+}
+
 void traversal_algorithm::add_requests() {
     int results_target = m_num_target_nodes;
+    // stalled requests raise the branch factor,
+    // but only up to the configured limit
+    int branch_factor = (std::min)(m_branch_factor, (std::max)(m_node.settings().max_search_branching, 1));
 
     // Find the first node that hasn't already been queried.
     for (std::vector<observer_ptr>::iterator i = m_results.begin(), end(m_results.end());
-         i != end && results_target > 0 && m_invoke_count < m_branch_factor; ++i) {
+         i != end && results_target > 0 && m_invoke_count < branch_factor; ++i) {
         if ((*i)->flags & observer::flag_alive) --results_target;
         if ((*i)->flags & observer::flag_queried) continue;
 
@@ -293,7 +329,7 @@ void traversal_algorithm::status(dht_lookup& l) {
     l.first_timeout = 0;
 
     int last_sent = INT_MAX;
-    ptime now = time_now();
+    ptime now = rtt_clock();
     for (std::vector<observer_ptr>::iterator i = m_results.begin(), end(m_results.end()); i != end; ++i) {
         observer& o = **i;
         if (o.flags & observer::flag_queried) {
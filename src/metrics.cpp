@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "libed2k/metrics.hpp"
+
+namespace libed2k {
+
+latency_histogram::latency_histogram() { clear(); }
+
+void latency_histogram::clear() {
+    m_count = 0;
+    m_sum = 0;
+    m_max = 0;
+    std::memset(m_counts, 0, sizeof(m_counts));
+}
+
+void latency_histogram::merge(const latency_histogram& h) {
+    for (int i = 0; i < num_buckets; ++i) m_counts[i] += h.m_counts[i];
+    m_count += h.m_count;
+    m_sum += h.m_sum;
+    m_max = (std::max)(m_max, h.m_max);
+}
+
+boost::uint64_t latency_histogram::bucket_limit(int b) {
+    if (b < sub_buckets) return boost::uint64_t(b);
+    int shift = b / sub_buckets - 1;
+    boost::uint64_t m = sub_buckets + b % sub_buckets;
+    return ((m + 1) << shift) - 1;
+}
+
+boost::uint64_t latency_histogram::percentile(double p) const {
+    if (m_count == 0) return 0;
+
+    boost::uint64_t rank = boost::uint64_t(std::ceil(p / 100. * double(m_count)));
+    if (rank < 1) rank = 1;
+    if (rank > m_count) rank = m_count;
+
+    boost::uint64_t seen = 0;
+    for (int i = 0; i < num_buckets; ++i) {
+        seen += m_counts[i];
+        if (seen >= rank) return (std::min)(bucket_limit(i), m_max);
+    }
+    return m_max;
+}
+
+session_metrics::session_metrics() { std::memset(counters, 0, sizeof(counters)); }
+}
@@ -151,6 +151,43 @@ void search_result::dump() const {
     }
 }
 
+void compact_file_entry::to_shared_file_entry(shared_file_entry& entry) const {
+    entry.m_hFile = m_hFile;
+    entry.m_network_point = m_network_point;
+    entry.m_list.clear();
+    for (size_t n = 0; n < m_list.size(); ++n) entry.m_list.add_tag(m_list[n]);
+}
+
+search_result_decoder::search_result_decoder(archive::ed2k_iarchive& ar)
+    : m_ar(ar), m_count(0), m_decoded(0), m_more(0) {
+    m_ar >> m_count;
+}
+
+bool search_result_decoder::next() {
+    if (finished()) return false;
+
+    m_entry.m_list.clear();
+    m_ar >> m_entry;
+    ++m_decoded;
+    return true;
+}
+
+bool search_result_decoder::next(shared_file_entry& entry) {
+    if (finished()) return false;
+
+    entry.m_list.clear();
+    m_ar >> entry;
+    ++m_decoded;
+    return true;
+}
+
+bool search_result_decoder::finished() {
+    if (m_decoded != m_count) return false;
+    // same as search_result::load
+    if (m_ar.bytes_left() == 1) m_ar >> m_more;
+    return true;
+}
+
 shared_file_entry::shared_file_entry() {}
 
 shared_file_entry::shared_file_entry(const md4_hash& hFile, boost::uint32_t nFileId, boost::uint16_t nPort)
@@ -412,6 +449,8 @@ bool misc_options2::support_ext_multipacket() const { return ((m_options >> MULT
 
 bool misc_options2::support_large_files() const { return ((m_options >> LARGE_FILE_OFFSET) & 0x01); }
 
+bool misc_options2::support_utp() const { return ((m_options >> UTP_OFFSET) & 0x01); }
+
 void misc_options2::set_captcha() {
     boost::uint32_t n = 1;
     m_options |= n << CAPTHA_OFFSET;
@@ -432,6 +471,11 @@ void misc_options2::set_large_files() {
     m_options |= n << LARGE_FILE_OFFSET;
 }
 
+void misc_options2::set_utp() {
+    boost::uint32_t n = 1;
+    m_options |= n << UTP_OFFSET;
+}
+
 boost::uint32_t misc_options2::generate() const { return (m_options); }
 
 boost::uint32_t misc_options::generate() const {
@@ -1,4 +1,39 @@
-
 #include "libed2k/peer.hpp"
 
 using namespace libed2k;
+
+peer::peer(boost::uint16_t port, bool conn, int src)
+    : connection(NULL),
+      last_connected(0),
+      next_connect(0),
+      failcount(0),
+      fast_reconnects(0),
+      trust_points(0),
+      source(src),
+      connectable(conn),
+      seed(false),
+      supports_utp(false),
+#if LIBED2K_USE_IPV6
+      is_v6_addr(false),
+#endif
+#ifndef LIBED2K_DISABLE_DHT
+      added_to_dht(false),
+#endif
+      m_port(port) {}
+
+ip::address peer::address() const {
+#if LIBED2K_USE_IPV6
+    if (is_v6_addr) return ip::address_v6(static_cast<const ipv6_peer*>(this)->addr);
+#endif
+    return ip::address_v4(static_cast<const ipv4_peer*>(this)->addr);
+}
+
+ipv4_peer::ipv4_peer(const tcp::endpoint& ep, bool conn, int src)
+    : peer(ep.port(), conn, src), addr(ep.address().to_v4().to_bytes()) {}
+
+#if LIBED2K_USE_IPV6
+ipv6_peer::ipv6_peer(const tcp::endpoint& ep, bool conn, int src)
+    : peer(ep.port(), conn, src), addr(ep.address().to_v6().to_bytes()) {
+    is_v6_addr = true;
+}
+#endif
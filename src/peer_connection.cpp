@@ -11,6 +11,7 @@
 #include "libed2k/alert_types.hpp"
 #include "libed2k/server_connection.hpp"
 #include "libed2k/peer_info.hpp"
+#include "libed2k/event_log.hpp"
 
 #define MINIZ_HEADER_FILE_ONLY
 #include "miniz.c"
@@ -18,6 +19,11 @@
 using namespace libed2k;
 namespace ip = boost::asio::ip;
 
+namespace {
+// IPv4 address as event log argument, 0 for IPv6
+int event_address(const tcp::endpoint& ep) { return ep.address().is_v4() ? int(ep.address().to_v4().to_ulong()) : 0; }
+}
+
 peer_request mk_peer_request(size_type begin, size_type end) {
     peer_request r;
     r.piece = begin / PIECE_SIZE;
@@ -88,7 +94,7 @@ pending_block::pending_block(const piece_block& b, size_type fsize)
       buffer(NULL),
       create_time(time_now()) {}
 
-peer_connection::peer_connection(aux::session_impl& ses, boost::weak_ptr<transfer> t, boost::shared_ptr<tcp::socket> s,
+peer_connection::peer_connection(aux::session_impl& ses, boost::weak_ptr<transfer> t, boost::shared_ptr<socket_type> s,
                                  const ip::tcp::endpoint& remote, peer* peerinfo)
     : base_connection(ses, s, remote),
       m_work(ses.m_io_service),
@@ -102,7 +108,7 @@ peer_connection::peer_connection(aux::session_impl& ses, boost::weak_ptr<transfe
     reset();
 }
 
-peer_connection::peer_connection(aux::session_impl& ses, boost::shared_ptr<tcp::socket> s,
+peer_connection::peer_connection(aux::session_impl& ses, boost::shared_ptr<socket_type> s,
                                  const ip::tcp::endpoint& remote, peer* peerinfo)
     : base_connection(ses, s, remote),
       m_work(ses.m_io_service),
@@ -317,6 +323,7 @@ void peer_connection::get_peer_info(peer_info& p) const {
     // this will set the flags so that we can update them later
     p.flags = 0;
     p.flags |= is_seed() ? peer_info::seed : 0;
+    p.flags |= is_utp(*m_socket) ? peer_info::utp_socket : 0;
 
     p.source = m_peer ? m_peer->source : peer_info::incoming;
     p.failcount = 0;
@@ -475,10 +482,17 @@ int peer_connection::request_upload_bandwidth(bandwidth_channel* bwc1, bandwidth
     // peers that we are not interested in are non-prioritized
     LIBED2K_ASSERT((m_channel_state[upload_channel] & peer_info::bw_limit) == 0);
 
-    return m_ses.m_upload_rate.request_bandwidth(
-        self_as<peer_connection>(),
+    bandwidth_channel* chan[bw_request::max_channels] = {bwc1, bwc2, bwc3, bwc4};
+    int num = 4;
+    num += m_ses.bandwidth_class_channels(m_remote.address(), t ? t->bandwidth_class() : -1, upload_channel,
+                                          chan + num, bw_request::max_channels - num);
+
+    int ret = m_ses.m_upload_rate.request_bandwidth(
+        this,
         std::max(m_send_buffer.size(), m_statistics.upload_rate() * 2 / (1000 / m_ses.m_settings.tick_interval)),
-        priority, bwc1, bwc2, bwc3, bwc4);
+        priority, chan, num);
+    if (ret == 0) m_ses.arm_bandwidth_timer();
+    return ret;
 }
 
 int peer_connection::request_download_bandwidth(bandwidth_channel* bwc1, bandwidth_channel* bwc2,
@@ -491,11 +505,19 @@ int peer_connection::request_download_bandwidth(bandwidth_channel* bwc1, bandwid
 
     LIBED2K_ASSERT(outstanding >= 0);
     LIBED2K_ASSERT((m_channel_state[download_channel] & peer_info::bw_limit) == 0);
-    return m_ses.m_download_rate.request_bandwidth(
-        self_as<peer_connection>(),
+
+    bandwidth_channel* chan[bw_request::max_channels] = {bwc1, bwc2, bwc3, bwc4};
+    int num = 4;
+    num += m_ses.bandwidth_class_channels(m_remote.address(), t ? t->bandwidth_class() : -1, download_channel,
+                                          chan + num, bw_request::max_channels - num);
+
+    int ret = m_ses.m_download_rate.request_bandwidth(
+        this,
         std::max(std::max(outstanding, m_recv_req.length - m_recv_pos),
                  m_statistics.download_rate() * 2 / (1000 / m_ses.m_settings.tick_interval)),
-        priority, bwc1, bwc2, bwc3, bwc4);
+        priority, chan, num);
+    if (ret == 0) m_ses.arm_bandwidth_timer();
+    return ret;
 }
 
 bool peer_connection::has_download_bandwidth() {
@@ -900,6 +922,7 @@ void peer_connection::disconnect(error_code const& ec, int error) {
 
     if (error > 0) m_failed = true;
     boost::intrusive_ptr<peer_connection> me(this);
+    log_event(ev_peer_disconnect, event_address(m_remote), m_remote.port(), ec.value());
 
     if (m_connecting && m_connection_ticket >= 0) {
         m_ses.m_half_open.done(m_connection_ticket);
@@ -924,6 +947,16 @@ void peer_connection::disconnect(error_code const& ec, int error) {
          i != end; ++i)
         assert(!i->second->has_peer(this));
 
+    // the quota reserved for the waiting requests goes back to the others
+    if (m_channel_state[upload_channel] & peer_info::bw_limit) {
+        m_ses.m_upload_rate.cancel(this);
+        m_channel_state[upload_channel] &= ~peer_info::bw_limit;
+    }
+    if (m_channel_state[download_channel] & peer_info::bw_limit) {
+        m_ses.m_download_rate.cancel(this);
+        m_channel_state[download_channel] &= ~peer_info::bw_limit;
+    }
+
     base_connection::disconnect(ec);  // close transport
     m_ses.close_connection(this, ec);
     m_ses.m_alerts.post_alert_should(peer_disconnected_alert(get_network_point(), get_connection_hash(), ec));
@@ -939,6 +972,7 @@ void peer_connection::connect(int ticket) {
     m_connection_ticket = ticket;
 
     DBG("CONNECTING: " << m_remote);
+    log_event(ev_peer_connect, event_address(m_remote), m_remote.port());
 
     m_socket->async_connect(m_remote, boost::bind(&peer_connection::on_connect, self_as<peer_connection>(), _1));
 }
@@ -955,6 +989,15 @@ void peer_connection::on_connect(error_code const& e) {
     if (e) {
         DBG("CONNECTION FAILED: " << m_remote << ": " << e.message());
 
+        // the peer may not accept uTP on this port, try again
+        // over TCP right away and don't count it as a failure
+        if (m_peer && m_peer->supports_utp && is_utp(*m_socket)) {
+            m_peer->supports_utp = false;
+            fast_reconnect(true);
+            disconnect(e);
+            return;
+        }
+
         disconnect(e, 1);
         return;
     }
@@ -963,6 +1006,7 @@ void peer_connection::on_connect(error_code const& e) {
     m_last_receive = time_now();
 
     DBG("COMPLETED: " << m_remote);
+    log_event(ev_peer_connected, event_address(m_remote), m_remote.port());
 
     // connection is already established
     do_read();
@@ -1117,7 +1161,8 @@ void peer_connection::send_data(const peer_request& req) {
 
     if (r.length > 0) {
         t->filesystem().async_read(
-            r, boost::bind(&peer_connection::on_disk_read_complete, self_as<peer_connection>(), _1, _2, r, left));
+            r, boost::bind(&peer_connection::on_disk_read_complete, self_as<peer_connection>(), _1, _2, r, left), 0, 0,
+            disk_io_job::reference_cache);
         m_channel_state[upload_channel] |= peer_info::bw_seq;
     } else {
         m_channel_state[upload_channel] &= ~peer_info::bw_seq;
@@ -1144,11 +1189,20 @@ void peer_connection::on_disk_read_complete(int ret, disk_io_job const& j, peer_
         t->handle_disk_error(j, this);
         return;
     }
-    append_send_buffer(buffer.get(), r.length,
-                       boost::bind(&aux::session_impl::free_disk_buffer, boost::ref(m_ses), _1));
-    buffer.release();
+    if (buffer.get()) {
+        append_send_buffer(buffer.get(), r.length,
+                           boost::bind(&aux::session_impl::free_disk_buffer, boost::ref(m_ses), _1));
+        buffer.release();
+    } else {
+        // sent straight from the read cache
+        for (int i = 0; i < 2 && j.refs[i].buf; ++i) {
+            append_send_buffer(j.refs[i].buf + j.refs[i].offset, j.refs[i].size,
+                               boost::bind(&aux::session_impl::release_cache_block, boost::ref(m_ses), j.refs[i].buf));
+        }
+    }
 
     m_payloads.push_back(range(m_send_buffer.size() - r.length, r.length));
+    log_event(ev_peer_send_block, event_address(m_remote), r.piece, r.start, r.length);
     do_write();
     send_data(left);
 }
@@ -1157,6 +1211,7 @@ void peer_connection::receive_data(const peer_request& req, bool compressed) {
     LIBED2K_ASSERT((m_channel_state[download_channel] & (peer_info::bw_network | peer_info::bw_seq)) == 0);
     LIBED2K_ASSERT(req.length <= BLOCK_SIZE);
 
+    log_event(ev_peer_receive_block, event_address(m_remote), req.piece, req.start, req.length);
     m_recv_pos = 0;
     m_recv_req = req;
     m_recv_compressed = compressed;
@@ -1228,6 +1283,7 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
 
     boost::shared_ptr<transfer> t = m_transfer.lock();
     if (!t || t->is_seed()) return;
+    t->payload_received();
 
     piece_picker& picker = t->picker();
     piece_manager& fs = t->filesystem();
@@ -1355,6 +1411,7 @@ void peer_connection::append_misc_info(tag_list<boost::uint32_t>& t) {
     mo2.set_captcha();
     mo2.set_large_files();
     mo2.set_source_ext2();
+    if (m_ses.settings().enable_incoming_utp && m_ses.m_udp_socket.is_open()) mo2.set_utp();
 
     t.add_tag(make_string_tag(m_ses.settings().client_name, CT_NAME, true));
     t.add_tag(make_typed_tag(m_ses.settings().m_version, CT_VERSION, true));
@@ -1615,6 +1672,8 @@ void peer_connection::on_hello_answer(const error_code& error) {
     if (!error) {
         DECODE_PACKET(client_hello_answer, packet);
         parse_misc_info(packet.m_list);
+        // remembered for the next connection to this peer
+        if (m_peer) m_peer->supports_utp = m_misc_options2.support_utp();
 
         m_hClient = packet.m_hClient;
         DBG("hello answer {name: " << m_options.m_strName << " : mod name: " << m_options.m_strModVersion
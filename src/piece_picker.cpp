@@ -73,7 +73,8 @@ piece_picker::piece_picker()
       m_cursor(0),
       m_reverse_cursor(0),
       m_sparse_regions(1),
-      m_dirty(false) {
+      m_dirty(false),
+      m_compact(false) {
 #ifdef LIBED2K_PICKER_LOG
     std::cerr << "new piece_picker" << std::endl;
 #endif
@@ -89,6 +90,8 @@ void piece_picker::init(int blocks_per_piece, int blocks_in_last_piece, int tota
 #ifdef LIBED2K_PICKER_LOG
     std::cerr << "piece_picker::init()" << std::endl;
 #endif
+    if (m_compact) expand();
+
     // allocate the piece_map to cover all pieces
     // and make them invalid (as if we don't have a single piece)
     m_piece_map.resize(total_num_pieces, piece_pos(0, 0));
@@ -126,6 +129,50 @@ void piece_picker::init(int blocks_per_piece, int blocks_in_last_piece, int tota
     LIBED2K_ASSERT(m_blocks_in_last_piece <= m_blocks_per_piece);
 }
 
+void piece_picker::compact() {
+    if (m_compact || !m_downloads.empty() || num_want_left() != 0) return;
+
+#ifdef LIBED2K_PICKER_LOG
+    std::cerr << "piece_picker::compact()" << std::endl;
+#endif
+    const int num = int(m_piece_map.size());
+    m_have.resize(num, false);
+    m_filtered.resize(num, false);
+    for (int i = 0; i < num; ++i) {
+        if (m_piece_map[i].have()) m_have.set_bit(i);
+        if (m_piece_map[i].filtered()) m_filtered.set_bit(i);
+    }
+
+    std::vector<piece_pos>().swap(m_piece_map);
+    std::vector<int>().swap(m_pieces);
+    std::vector<int>().swap(m_priority_boundries);
+    std::vector<downloading_piece>().swap(m_downloads);
+    std::vector<block_info>().swap(m_block_info);
+    m_seeds = 0;
+    m_dirty = true;
+    m_compact = true;
+}
+
+void piece_picker::expand() {
+    if (!m_compact) return;
+
+#ifdef LIBED2K_PICKER_LOG
+    std::cerr << "piece_picker::expand()" << std::endl;
+#endif
+    const int num = int(m_have.size());
+    m_piece_map.resize(num, piece_pos(0, 0));
+    for (int i = 0; i < num; ++i) {
+        piece_pos& p = m_piece_map[i];
+        if (m_have.get_bit(i)) p.set_have();
+        if (m_filtered.get_bit(i)) p.piece_priority = piece_pos::filter_priority;
+    }
+
+    m_have = bitfield();
+    m_filtered = bitfield();
+    m_compact = false;
+    m_dirty = true;
+}
+
 void piece_picker::piece_info(int index, piece_picker::downloading_piece& st) const {
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
@@ -255,6 +302,13 @@ void piece_picker::check_invariant(const transfer* t) const {
     LIBED2K_ASSERT(m_num_filtered >= 0);
     LIBED2K_ASSERT(m_seeds >= 0);
 
+    if (m_compact) {
+        LIBED2K_ASSERT(m_piece_map.empty() && m_downloads.empty());
+        LIBED2K_ASSERT(m_have.count() == m_num_have);
+        LIBED2K_ASSERT(num_want_left() == 0);
+        return;
+    }
+
     if (!m_downloads.empty()) {
         for (std::vector<downloading_piece>::const_iterator i = m_downloads.begin(); i != m_downloads.end() - 1; ++i) {
             downloading_piece const& dp = *i;
@@ -432,6 +486,7 @@ std::pair<int, int> piece_picker::distributed_copies() const {
     LIBED2K_ASSERT(m_seeds >= 0);
     const int num_pieces = m_piece_map.size();
 
+    // compact picker keeps no availability, count our own copy only
     if (num_pieces == 0) return std::make_pair(1, 0);
     int min_availability = piece_pos::max_peer_count;
     // find the lowest availability count
@@ -759,6 +814,7 @@ void piece_picker::restore_piece(int index) {
 }
 
 void piece_picker::inc_refcount_all() {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -773,6 +829,7 @@ void piece_picker::inc_refcount_all() {
 }
 
 void piece_picker::dec_refcount_all() {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -798,6 +855,7 @@ void piece_picker::dec_refcount_all() {
 }
 
 void piece_picker::inc_refcount(int index) {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -816,6 +874,7 @@ void piece_picker::inc_refcount(int index) {
 }
 
 void piece_picker::dec_refcount(int index) {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -829,6 +888,7 @@ void piece_picker::dec_refcount(int index) {
 }
 
 void piece_picker::inc_refcount(bitfield const& bitmask) {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -847,6 +907,7 @@ void piece_picker::inc_refcount(bitfield const& bitmask) {
 }
 
 void piece_picker::dec_refcount(bitfield const& bitmask) {
+    if (m_compact) return;
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
@@ -923,6 +984,10 @@ void piece_picker::update_pieces() const {
 }
 
 void piece_picker::we_dont_have(int index) {
+    // transfer::expand_picker() restores the full picker together with the
+    // availability of the peers before a piece can be lost
+    LIBED2K_ASSERT(!m_compact);
+    expand();
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
     LIBED2K_ASSERT(index >= 0);
     LIBED2K_ASSERT(index < (int)m_piece_map.size());
@@ -964,11 +1029,23 @@ void piece_picker::we_have(int index) {
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 #endif
     LIBED2K_ASSERT(index >= 0);
-    LIBED2K_ASSERT(index < (int)m_piece_map.size());
+    LIBED2K_ASSERT(index < num_pieces());
 
 #ifdef LIBED2K_PICKER_LOG
     std::cerr << "piece_picker::we_have(" << index << ")" << std::endl;
 #endif
+    if (m_compact) {
+        if (m_have.get_bit(index)) return;
+        // only filtered pieces are missing in a compact picker
+        LIBED2K_ASSERT(m_filtered.get_bit(index));
+        update_sparse_regions(index);
+        --m_num_filtered;
+        ++m_num_have_filtered;
+        ++m_num_have;
+        m_have.set_bit(index);
+        return;
+    }
+
     piece_pos& p = m_piece_map[index];
     int info_index = p.index;
     int priority = p.priority(this);
@@ -984,19 +1061,7 @@ void piece_picker::we_have(int index) {
 
     if (p.have()) return;
 
-    // maintain sparse_regions
-    if (index == 0) {
-        if (index == int(m_piece_map.size()) - 1 || m_piece_map[index + 1].have()) --m_sparse_regions;
-    } else if (index == int(m_piece_map.size() - 1)) {
-        if (index == 0 || m_piece_map[index - 1].have()) --m_sparse_regions;
-    } else {
-        bool have_before = m_piece_map[index - 1].have();
-        bool have_after = m_piece_map[index + 1].have();
-        if (have_after && have_before)
-            --m_sparse_regions;
-        else if (!have_after && !have_before)
-            ++m_sparse_regions;
-    }
+    update_sparse_regions(index);
 
     if (p.filtered()) {
         --m_num_filtered;
@@ -1028,6 +1093,22 @@ void piece_picker::we_have(int index) {
     LIBED2K_ASSERT(p.priority(this) == -1);
 }
 
+void piece_picker::update_sparse_regions(int index) {
+    // maintain sparse_regions for a piece we're about to have
+    if (index == 0) {
+        if (index == num_pieces() - 1 || have_piece(index + 1)) --m_sparse_regions;
+    } else if (index == num_pieces() - 1) {
+        if (index == 0 || have_piece(index - 1)) --m_sparse_regions;
+    } else {
+        bool have_before = have_piece(index - 1);
+        bool have_after = have_piece(index + 1);
+        if (have_after && have_before)
+            --m_sparse_regions;
+        else if (!have_after && !have_before)
+            ++m_sparse_regions;
+    }
+}
+
 bool piece_picker::set_piece_priority(int index, int new_piece_priority) {
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
@@ -1035,7 +1116,28 @@ bool piece_picker::set_piece_priority(int index, int new_piece_priority) {
     LIBED2K_ASSERT(new_piece_priority >= 0);
     LIBED2K_ASSERT(new_piece_priority <= 7);
     LIBED2K_ASSERT(index >= 0);
-    LIBED2K_ASSERT(index < (int)m_piece_map.size());
+    LIBED2K_ASSERT(index < num_pieces());
+
+    if (m_compact) {
+        if (new_piece_priority == piece_pos::filter_priority) {
+            if (m_filtered.get_bit(index)) return false;
+            LIBED2K_ASSERT(m_have.get_bit(index));
+            m_filtered.set_bit(index);
+            ++m_num_have_filtered;
+            return true;
+        }
+
+        if (!m_filtered.get_bit(index)) return false;
+        if (m_have.get_bit(index)) {
+            m_filtered.clear_bit(index);
+            --m_num_have_filtered;
+            return true;
+        }
+
+        // the piece is wanted again and has to be picked, the owner
+        // expands the picker first to restore the availability
+        return false;
+    }
 
     piece_pos& p = m_piece_map[index];
 
@@ -1105,12 +1207,19 @@ bool piece_picker::set_piece_priority(int index, int new_piece_priority) {
 
 int piece_picker::piece_priority(int index) const {
     LIBED2K_ASSERT(index >= 0);
-    LIBED2K_ASSERT(index < (int)m_piece_map.size());
+    LIBED2K_ASSERT(index < num_pieces());
 
+    if (m_compact) return m_filtered.get_bit(index) ? piece_pos::filter_priority : 1;
     return m_piece_map[index].piece_priority;
 }
 
 void piece_picker::piece_priorities(std::vector<int>& pieces) const {
+    if (m_compact) {
+        pieces.resize(num_pieces());
+        for (int i = 0; i < num_pieces(); ++i) pieces[i] = piece_priority(i);
+        return;
+    }
+
     pieces.resize(m_piece_map.size());
     std::vector<int>::iterator j = pieces.begin();
     for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin(), end(m_piece_map.end()); i != end; ++i, ++j) {
@@ -1121,6 +1230,12 @@ void piece_picker::piece_priorities(std::vector<int>& pieces) const {
 // ============ start deprecation ==============
 
 void piece_picker::filtered_pieces(std::vector<bool>& mask) const {
+    if (m_compact) {
+        mask.resize(num_pieces());
+        for (int i = 0; i < num_pieces(); ++i) mask[i] = m_filtered.get_bit(i);
+        return;
+    }
+
     mask.resize(m_piece_map.size());
     std::vector<bool>::iterator j = mask.begin();
     for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin(), end(m_piece_map.end()); i != end; ++i, ++j) {
@@ -1189,6 +1304,9 @@ void piece_picker::pick_pieces(bitfield const& pieces, std::vector<piece_block>&
                                std::vector<int> const& suggested_pieces, int num_peers) const {
     // LIBED2K_ASSERT(peer == 0 || static_cast<policy::peer*>(peer)->in_use); // TODO enable after policy
 
+    // compact picker has nothing left to download
+    if (m_compact) return;
+
     // prevent the number of partial pieces to grow indefinitely
     // make this scale by the number of peers we have. For large
     // scale clients, we would have more peers, and allow a higher
@@ -1469,8 +1587,8 @@ void piece_picker::pick_pieces(bitfield const& pieces, std::vector<piece_block>&
 
 int piece_picker::blocks_in_piece(int index) const {
     LIBED2K_ASSERT(index >= 0);
-    LIBED2K_ASSERT(index < (int)m_piece_map.size());
-    if (index + 1 == (int)m_piece_map.size())
+    LIBED2K_ASSERT(index < num_pieces());
+    if (index + 1 == num_pieces())
         return m_blocks_in_last_piece;
     else
         return m_blocks_per_piece;
@@ -1685,9 +1803,11 @@ std::pair<int, int> piece_picker::expand_piece(int piece, int whole_pieces, bitf
 }
 
 bool piece_picker::is_piece_finished(int index) const {
-    LIBED2K_ASSERT(index < (int)m_piece_map.size());
+    LIBED2K_ASSERT(index < num_pieces());
     LIBED2K_ASSERT(index >= 0);
 
+    if (m_compact) return false;
+
     if (m_piece_map[index].downloading == 0) {
         LIBED2K_ASSERT(find_dl_piece(index) == m_downloads.end());
         return false;
@@ -1739,8 +1859,9 @@ void piece_picker::update_full(downloading_piece& dp) {
 bool piece_picker::is_requested(piece_block block) const {
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
 
+    if (m_compact) return false;
     if (m_piece_map[block.piece_index].downloading == 0) return false;
     std::vector<downloading_piece>::const_iterator i = find_dl_piece(block.piece_index);
 
@@ -1752,8 +1873,9 @@ bool piece_picker::is_requested(piece_block block) const {
 bool piece_picker::is_downloaded(piece_block block) const {
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
 
+    if (m_compact) return m_have.get_bit(block.piece_index);
     if (m_piece_map[block.piece_index].index == piece_pos::we_have_index) return true;
     if (m_piece_map[block.piece_index].downloading == 0) return false;
     std::vector<downloading_piece>::const_iterator i = find_dl_piece(block.piece_index);
@@ -1766,8 +1888,9 @@ bool piece_picker::is_downloaded(piece_block block) const {
 bool piece_picker::is_finished(piece_block block) const {
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
 
+    if (m_compact) return m_have.get_bit(block.piece_index);
     if (m_piece_map[block.piece_index].index == piece_pos::we_have_index) return true;
     if (m_piece_map[block.piece_index].downloading == 0) return false;
     std::vector<downloading_piece>::const_iterator i = find_dl_piece(block.piece_index);
@@ -1781,10 +1904,11 @@ bool piece_picker::mark_as_downloading(piece_block block, void* peer, piece_stat
     LIBED2K_ASSERT(state != piece_picker::none);
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
     LIBED2K_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
-    LIBED2K_ASSERT(!m_piece_map[block.piece_index].have());
+    LIBED2K_ASSERT(!have_piece(block.piece_index));
 
+    if (m_compact) return false;
     piece_pos& p = m_piece_map[block.piece_index];
     if (p.downloading == 0) {
 #ifdef LIBED2K_EXPENSIVE_INVARIANT_CHECKS
@@ -1830,9 +1954,10 @@ bool piece_picker::mark_as_downloading(piece_block block, void* peer, piece_stat
 int piece_picker::num_peers(piece_block block) const {
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
     LIBED2K_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
 
+    if (m_compact) return 0;
     piece_pos const& p = m_piece_map[block.piece_index];
     if (!p.downloading) return 0;
 
@@ -1848,6 +1973,11 @@ void piece_picker::get_availability(std::vector<int>& avail) const {
     LIBED2K_ASSERT(m_seeds >= 0);
     LIBED2K_PIECE_PICKER_INVARIANT_CHECK;
 
+    if (m_compact) {
+        avail.assign(num_pieces(), 0);
+        return;
+    }
+
     avail.resize(m_piece_map.size());
     std::vector<int>::iterator j = avail.begin();
     for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin(), end(m_piece_map.end()); i != end; ++i, ++j)
@@ -1863,9 +1993,10 @@ bool piece_picker::mark_as_writing(piece_block block, void* peer) {
 
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
     LIBED2K_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
 
+    if (m_compact) return false;
     piece_pos& p = m_piece_map[block.piece_index];
     if (p.downloading == 0) {
         // if we already have this piece, just ignore this
@@ -1966,9 +2097,11 @@ void piece_picker::mark_as_finished(piece_block block, void* peer) {
     // LIBED2K_ASSERT(peer == 0 || static_cast<policy::peer*>(peer)->in_use); // TODO enable after policy
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
     LIBED2K_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
 
+    // compact picker has all pieces that can be finished
+    if (m_compact) return;
     piece_pos& p = m_piece_map[block.piece_index];
 
     if (p.downloading == 0) {
@@ -2064,9 +2197,10 @@ void piece_picker::abort_download(piece_block block, void* peer) {
 
     LIBED2K_ASSERT(block.piece_index >= 0);
     LIBED2K_ASSERT(block.block_index >= 0);
-    LIBED2K_ASSERT(block.piece_index < m_piece_map.size());
+    LIBED2K_ASSERT(block.piece_index < num_pieces());
     LIBED2K_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
 
+    if (m_compact) return;
     if (m_piece_map[block.piece_index].downloading == 0) {
         LIBED2K_ASSERT(find_dl_piece(block.piece_index) == m_downloads.end());
         return;
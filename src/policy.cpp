@@ -11,14 +11,6 @@
 
 using namespace libed2k;
 
-struct match_peer_endpoint {
-    match_peer_endpoint(tcp::endpoint const& ep) : m_ep(ep) {}
-
-    bool operator()(const peer* p) const { return p->endpoint == m_ep; }
-
-    tcp::endpoint const& m_ep;
-};
-
 struct match_peer_connection {
     match_peer_connection(const peer_connection& c) : m_conn(c) {}
 
@@ -41,7 +33,7 @@ int libed2k::source_rank(int source_bitmask) {
 }
 
 policy::policy(transfer* t)
-    : m_transfer(t), m_round_robin(0), m_num_connect_candidates(0), m_num_seeds(0), m_finished(false) {}
+    : m_transfer(t), m_reconnect_time(0), m_max_failcount(0), m_num_seeds(0), m_finished(false) {}
 
 peer* policy::add_peer(const tcp::endpoint& ep, int source, char flags) {
     aux::session_impl& ses = m_transfer->session();
@@ -54,71 +46,124 @@ peer* policy::add_peer(const tcp::endpoint& ep, int source, char flags) {
         return NULL;
     }
 
-    peers_t::iterator iter;
-    peer* p = 0;
-
-    bool found = false;
-    if (ses.settings().allow_multiple_connections_per_ip) {
-        std::pair<peers_t::iterator, peers_t::iterator> range = find_peers(ep.address());
-        iter = std::find_if(range.first, range.second, match_peer_endpoint(ep));
-
-        if (iter != range.second) found = true;
-    } else {
-        iter = std::lower_bound(m_peers.begin(), m_peers.end(), ep.address(), peer_address_compare());
-
-        if (iter != m_peers.end() && (*iter)->address() == ep.address()) found = true;
-    }
+    peer* p = ses.settings().allow_multiple_connections_per_ip ? find_peer(ep) : find_peer(ep.address());
 
-    if (!found) {
+    if (p == 0) {
         // we don't have any info about this peer.
         // add a new entry
-
-        p = (peer*)ses.m_ipv4_peer_pool.malloc();
+        p = allocate_peer(ep, true, source);
         if (p == 0) return NULL;
-        ses.m_ipv4_peer_pool.set_next_size(500);
-        new (p) peer(ep, true, source);
 
-        if (!insert_peer(p, iter, flags)) {
-            m_transfer->session().m_ipv4_peer_pool.destroy(p);
+        if (!insert_peer(p, flags)) {
+            free_peer(p);
             return 0;
         }
     } else {
-        p = *iter;
         update_peer(p, source, flags, ep, 0);
     }
 
     return p;
 }
 
-bool policy::new_connection(peer_connection& c, int session_time) {
-    aux::session_impl& ses = m_transfer->session();
+size_t policy::address_key(const ip::address& a) {
+#if LIBED2K_USE_IPV6
+    if (a.is_v6()) {
+        ip::address_v6::bytes_type b = a.to_v6().to_bytes();
+        return boost::hash_range(b.begin(), b.end());
+    }
+#endif
+    return a.to_v4().to_ulong();
+}
 
-    // TODO: check for connection limits
+peer* policy::find_peer(const tcp::endpoint& ep) const {
+    std::pair<peer_index::const_iterator, peer_index::const_iterator> range =
+        m_index.equal_range(address_key(ep.address()));
+    for (; range.first != range.second; ++range.first) {
+        peer* p = m_peers[range.first->second];
+        if (p->port() == ep.port() && p->address() == ep.address()) return p;
+    }
 
-    peers_t::iterator iter;
-    peer* i = 0;
-    bool found = false;
+    return NULL;
+}
 
-    if (ses.settings().allow_multiple_connections_per_ip) {
-        tcp::endpoint remote = c.remote();
-        std::pair<peers_t::iterator, peers_t::iterator> range = find_peers(remote.address());
-        iter = std::find_if(range.first, range.second, match_peer_endpoint(remote));
+peer* policy::find_peer(const ip::address& a) const {
+    std::pair<peer_index::const_iterator, peer_index::const_iterator> range = m_index.equal_range(address_key(a));
+    for (; range.first != range.second; ++range.first) {
+        peer* p = m_peers[range.first->second];
+        if (p->address() == a) return p;
+    }
 
-        if (iter != range.second) found = true;
-    } else {
-        iter = std::lower_bound(m_peers.begin(), m_peers.end(), c.remote().address(), peer_address_compare());
+    return NULL;
+}
 
-        if (iter != m_peers.end() && (*iter)->address() == c.remote().address()) found = true;
+policy::peer_index::iterator policy::find_index(const peer* p) {
+    std::pair<peer_index::iterator, peer_index::iterator> range = m_index.equal_range(address_key(p->address()));
+    for (; range.first != range.second; ++range.first) {
+        if (m_peers[range.first->second] == p) return range.first;
     }
 
-    if (found) {
-        i = *iter;
+    return m_index.end();
+}
+
+peer* policy::allocate_peer(const tcp::endpoint& ep, bool connectable, int source) {
+    aux::session_impl& ses = m_transfer->session();
 
+#if LIBED2K_USE_IPV6
+    if (ep.address().is_v6()) {
+        void* p = ses.m_ipv6_peer_pool.malloc();
+        if (p == 0) return NULL;
+        ses.m_ipv6_peer_pool.set_next_size(500);
+        return new (p) ipv6_peer(ep, connectable, source);
+    }
+#else
+    if (!ep.address().is_v4()) return NULL;
+#endif
+
+    void* p = ses.m_ipv4_peer_pool.malloc();
+    if (p == 0) return NULL;
+    ses.m_ipv4_peer_pool.set_next_size(500);
+    return new (p) ipv4_peer(ep, connectable, source);
+}
+
+// unordered free, object_pool::destroy keeps the free list sorted and
+// walks it on every call
+void policy::free_peer(peer* p) {
+    aux::session_impl& ses = m_transfer->session();
+
+#if LIBED2K_USE_IPV6
+    if (p->is_v6_addr) {
+        ipv6_peer* p6 = static_cast<ipv6_peer*>(p);
+        LIBED2K_ASSERT(ses.m_ipv6_peer_pool.is_from(p6));
+        p6->~ipv6_peer();
+        ses.m_ipv6_peer_pool.free(p6);
+        return;
+    }
+#endif
+    ipv4_peer* p4 = static_cast<ipv4_peer*>(p);
+    LIBED2K_ASSERT(ses.m_ipv4_peer_pool.is_from(p4));
+    p4->~ipv4_peer();
+    ses.m_ipv4_peer_pool.free(p4);
+}
+
+void policy::add_to_list(peer* p) {
+    m_index.insert(std::make_pair(address_key(p->address()), int(m_peers.size())));
+    m_peers.push_back(p);
+}
+
+bool policy::new_connection(peer_connection& c, int session_time) {
+    aux::session_impl& ses = m_transfer->session();
+
+    // TODO: check for connection limits
+
+    tcp::endpoint remote = c.remote();
+    peer* i = ses.settings().allow_multiple_connections_per_ip ? find_peer(remote) : find_peer(remote.address());
+
+    if (i) {
         // TODO: check banned
 
         if (i->connection != 0) {
-            boost::shared_ptr<tcp::socket> other_socket = i->connection->socket();
-            boost::shared_ptr<tcp::socket> this_socket = c.socket();
+            boost::shared_ptr<socket_type> other_socket = i->connection->socket();
+            boost::shared_ptr<socket_type> this_socket = c.socket();
 
             error_code ec1;
             error_code ec2;
@@ -150,11 +195,7 @@ bool policy::new_connection(peer_connection& c, int session_time) {
             }
         }
 
-        if (is_connect_candidate(*i, m_finished)) {
-            m_num_connect_candidates--;
-            LIBED2K_ASSERT(m_num_connect_candidates >= 0);
-            if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-        }
+        remove_candidate(i);
     } else {
         // we don't have any info about this peer.
         // add a new entry
@@ -165,15 +206,9 @@ bool policy::new_connection(peer_connection& c, int session_time) {
             return false;
         }
 
-        peer* p = (peer*)ses.m_ipv4_peer_pool.malloc();
-        if (p == 0) return false;
-        ses.m_ipv4_peer_pool.set_next_size(500);
-        new (p) peer(c.remote(), false, 0);
-
-        iter = m_peers.insert(iter, p);
-        if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
-        i = *iter;
-        i->source = peer_info::incoming;
+        i = allocate_peer(remote, false, peer_info::incoming);
+        if (i == 0) return false;
+        add_to_list(i);
     }
 
     c.set_peer(i);
@@ -192,7 +227,7 @@ bool policy::new_connection(peer_connection& c, int session_time) {
     return true;
 }
 
-bool policy::insert_peer(peer* p, peers_t::iterator iter, int flags) {
+bool policy::insert_peer(peer* p, int flags) {
     LIBED2K_ASSERT(p);
     // LIBED2K_ASSERT(p->in_use);
 
@@ -204,20 +239,9 @@ bool policy::insert_peer(peer* p, peers_t::iterator iter, int flags) {
 
         erase_peers();
         if (int(m_peers.size()) >= max_peerlist_size) return 0;
-
-// since some peers were removed, we need to
-// update the iterator to make it valid again
-#if LIBED2K_USE_I2P
-        if (p->is_i2p_addr) {
-            iter = std::lower_bound(m_peers.begin(), m_peers.end(), p->dest(), peer_address_compare());
-        } else
-#endif
-            iter = std::lower_bound(m_peers.begin(), m_peers.end(), p->address(), peer_address_compare());
     }
 
-    iter = m_peers.insert(iter, p);
-
-    if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
+    add_to_list(p);
 
 #ifndef LIBED2K_DISABLE_ENCRYPTION
 // if (flags & 0x01) p->pe_support = true;
@@ -238,7 +262,7 @@ bool policy::insert_peer(peer* p, peers_t::iterator iter, int flags) {
 #endif
 // p->inet_as = m_transfer->session().lookup_as(as);
 #endif
-    if (is_connect_candidate(*p, m_finished)) ++m_num_connect_candidates;
+    add_candidate(p);
 
     m_transfer->state_updated();
 
@@ -246,7 +270,7 @@ bool policy::insert_peer(peer* p, peers_t::iterator iter, int flags) {
 }
 
 void policy::update_peer(peer* p, int src, int flags, const tcp::endpoint& remote, char const* destination) {
-    bool was_conn_cand = is_connect_candidate(*p, m_finished);
+    remove_candidate(p);
 
     p->connectable = true;
 
@@ -289,10 +313,7 @@ void policy::update_peer(peer* p, int src, int flags, const tcp::endpoint& remot
     }
 #endif
 
-    if (was_conn_cand != is_connect_candidate(*p, m_finished)) {
-        m_num_connect_candidates += was_conn_cand ? -1 : 1;
-        if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-    }
+    add_candidate(p);
 }
 
 // this is called whenever a peer connection is closed
@@ -327,7 +348,7 @@ void policy::connection_closed(const peer_connection& c, int session_time) {
         if (p->failcount < 31) ++p->failcount;
     }
 
-    if (is_connect_candidate(*p, m_finished)) ++m_num_connect_candidates;
+    add_candidate(p);
 
     // if we're already a seed, it's not as important
     // to keep all the possibly stale peers
@@ -357,13 +378,49 @@ void policy::recalculate_connect_candidates() {
     const bool is_finished = m_transfer->is_finished();
     if (is_finished == m_finished) return;
 
-    m_num_connect_candidates = 0;
     m_finished = is_finished;
-    for (peers_t::const_iterator i = m_peers.begin(); i != m_peers.end(); ++i) {
-        m_num_connect_candidates += is_connect_candidate(**i, m_finished);
-    }
+    rebuild_candidates();
+}
+
+void policy::rebuild_candidates() {
+    m_candidates.clear();
+    m_reconnect_time = m_transfer->settings().min_reconnect_time;
+    m_max_failcount = m_transfer->settings().max_failcount;
+    for (peers_t::const_iterator i = m_peers.begin(); i != m_peers.end(); ++i) add_candidate(*i);
+}
+
+void policy::reset_last_connected() {
+    for (peers_t::const_iterator i = m_peers.begin(); i != m_peers.end(); ++i) (*i)->last_connected = 0;
+    rebuild_candidates();
+}
+
+policy::candidate policy::make_candidate(peer* p) const {
+    candidate c;
+    c.ready = p->next_connect;
+    if (p->last_connected)
+        c.ready = (std::max)(c.ready, p->last_connected + (int(p->failcount) + 1) * m_reconnect_time);
+    c.failcount = p->failcount;
+    c.local = is_local(p->address());
+    c.rank = source_rank(p->source);
+    c.p = p;
+    return c;
 }
 
+bool policy::candidate::operator<(const candidate& c) const {
+    if (ready != c.ready) return ready < c.ready;
+    if (failcount != c.failcount) return failcount < c.failcount;
+    // local peers should always be tried first
+    if (local != c.local) return local > c.local;
+    if (rank != c.rank) return rank > c.rank;
+    return p < c.p;
+}
+
+void policy::add_candidate(peer* p) {
+    if (is_connect_candidate(*p, m_finished)) m_candidates.insert(make_candidate(p));
+}
+
+void policy::remove_candidate(peer* p) { m_candidates.erase(make_candidate(p)); }
+
 // disconnects [TODO: and removes] all peers that are now filtered
 void policy::ip_filter_updated() {
     aux::session_impl& ses = m_transfer->session();
@@ -408,10 +465,9 @@ void policy::ip_filter_updated() {
 }
 
 void policy::erase_peer(peer* p) {
-    std::pair<peers_t::iterator, peers_t::iterator> range = find_peers(p->address());
-    peers_t::iterator iter = std::find_if(range.first, range.second, match_peer_endpoint(p->endpoint));
-    if (iter == range.second) return;
-    erase_peer(iter);
+    peer_index::iterator i = find_index(p);
+    if (i == m_index.end()) return;
+    erase_peer(m_peers.begin() + i->second);
 }
 
 // any peer that is erased from m_peers will be
@@ -419,76 +475,65 @@ void policy::erase_peer(peer* p) {
 // sure that any references to the peer are removed
 // as well, such as in the piece picker.
 void policy::erase_peer(peers_t::iterator i) {
-    if (m_transfer->has_picker()) m_transfer->picker().clear_peer(*i);
-    if ((*i)->seed) --m_num_seeds;
-    if (is_connect_candidate(**i, m_finished)) {
-        LIBED2K_ASSERT(m_num_connect_candidates > 0);
-        --m_num_connect_candidates;
+    peer* p = *i;
+    if (m_transfer->has_picker()) m_transfer->picker().clear_peer(p);
+    if (p->seed) --m_num_seeds;
+    remove_candidate(p);
+
+    peer_index::iterator pos = find_index(p);
+    LIBED2K_ASSERT(pos != m_index.end());
+    m_index.erase(pos);
+
+    // the last peer takes the erased position
+    if (p != m_peers.back()) {
+        peer_index::iterator last = find_index(m_peers.back());
+        LIBED2K_ASSERT(last != m_index.end());
+        last->second = int(i - m_peers.begin());
+        *i = m_peers.back();
     }
-    LIBED2K_ASSERT(m_num_connect_candidates < int(m_peers.size()));
-    if (m_round_robin > i - m_peers.begin()) --m_round_robin;
-    if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+    m_peers.pop_back();
 
-#if LIBED2K_USE_IPV6
-    if ((*i)->is_v6_addr) {
-        LIBED2K_ASSERT(m_transfer->session().m_ipv6_peer_pool.is_from(static_cast<ipv6_peer*>(*i)));
-        m_transfer->session().m_ipv6_peer_pool.destroy(static_cast<ipv6_peer*>(*i));
-    } else
-#endif
-#if LIBED2K_USE_I2P
-        if ((*i)->is_i2p_addr) {
-        LIBED2K_ASSERT(m_transfer->session().m_i2p_peer_pool.is_from(static_cast<i2p_peer*>(*i)));
-        m_transfer->session().m_i2p_peer_pool.destroy(static_cast<i2p_peer*>(*i));
-    } else
-#endif
-    {
-        LIBED2K_ASSERT(m_transfer->session().m_ipv4_peer_pool.is_from(*i));
-        m_transfer->session().m_ipv4_peer_pool.destroy(*i);
-    }
-    m_peers.erase(i);
+    free_peer(p);
 }
 
 void policy::set_connection(peer* p, peer_connection* c) {
     LIBED2K_ASSERT(c);
 
-    const bool was_conn_cand = is_connect_candidate(*p, m_finished);
+    remove_candidate(p);
     p->connection = c;
-    if (was_conn_cand) --m_num_connect_candidates;
 }
 
 void policy::set_failcount(peer* p, int f) {
-    const bool was_conn_cand = is_connect_candidate(*p, m_finished);
+    remove_candidate(p);
     p->failcount = f;
-    if (was_conn_cand != is_connect_candidate(*p, m_finished)) {
-        if (was_conn_cand)
-            --m_num_connect_candidates;
-        else
-            ++m_num_connect_candidates;
-    }
+    add_candidate(p);
 }
 
 bool policy::connect_one_peer(int session_time) {
     LIBED2K_ASSERT(m_transfer->want_more_peers());
 
-    peers_t::iterator i = find_connect_candidate(session_time);
-    if (i == m_peers.end()) return false;
-    peer& p = **i;
+    peer* p = find_connect_candidate(session_time);
+    if (p == 0) return false;
 
-    // LIBED2K_ASSERT(!p.banned);
-    LIBED2K_ASSERT(!p.connection);
-    LIBED2K_ASSERT(p.connectable);
+    // LIBED2K_ASSERT(!p->banned);
+    LIBED2K_ASSERT(!p->connection);
+    LIBED2K_ASSERT(p->connectable);
 
     LIBED2K_ASSERT(m_finished == m_transfer->is_finished());
-    LIBED2K_ASSERT(is_connect_candidate(p, m_finished));
-    if (!m_transfer->connect_to_peer(&p)) {
+    LIBED2K_ASSERT(is_connect_candidate(*p, m_finished));
+
+    // connect_to_peer changes connect times the candidate is keyed by
+    remove_candidate(p);
+
+    if (!m_transfer->connect_to_peer(p)) {
         // failcount is a 5 bit value
-        const bool was_conn_cand = is_connect_candidate(p, m_finished);
-        if (p.failcount < 31) ++p.failcount;
-        if (was_conn_cand && !is_connect_candidate(p, m_finished)) --m_num_connect_candidates;
+        remove_candidate(p);
+        if (p->failcount < 31) ++p->failcount;
+        add_candidate(p);
         return false;
     }
-    LIBED2K_ASSERT(p.connection);
-    LIBED2K_ASSERT(!is_connect_candidate(p, m_finished));
+    LIBED2K_ASSERT(p->connection);
+    LIBED2K_ASSERT(!is_connect_candidate(*p, m_finished));
     return true;
 }
 
@@ -511,139 +556,43 @@ bool policy::compare_peer_erase(peer const& lhs, peer const& rhs) const {
     return lhs.trust_points < rhs.trust_points;
 }
 
-// this returns true if lhs is a better connect candidate than rhs
-bool policy::compare_peer(peer const& lhs, peer const& rhs /*, address const& external_ip*/) const {
-    // prefer peers with lower failcount
-    if (lhs.failcount != rhs.failcount) return lhs.failcount < rhs.failcount;
-
-    // Local peers should always be tried first
-    bool lhs_local = is_local(lhs.address());
-    bool rhs_local = is_local(rhs.address());
-    if (lhs_local != rhs_local) return lhs_local > rhs_local;
-
-    if (lhs.last_connected != rhs.last_connected) return lhs.last_connected < rhs.last_connected;
-
-    if (lhs.next_connect != rhs.next_connect) return lhs.next_connect < rhs.next_connect;
-
-    int lhs_rank = source_rank(lhs.source);
-    int rhs_rank = source_rank(rhs.source);
-    if (lhs_rank != rhs_rank) return lhs_rank > rhs_rank;
-
-#ifndef LIBED2K_DISABLE_GEO_IP
-// don't bias fast peers when seeding
-// if (!m_finished && m_transfer->session().has_asnum_db())
-//{
-//    int lhs_as = lhs.inet_as ? lhs.inet_as->second : 0;
-//    int rhs_as = rhs.inet_as ? rhs.inet_as->second : 0;
-//    if (lhs_as != rhs_as) return lhs_as > rhs_as;
-//}
-#endif
-    // int lhs_distance = cidr_distance(external_ip, lhs.address());
-    // int rhs_distance = cidr_distance(external_ip, rhs.address());
-    // if (lhs_distance < rhs_distance) return true;
-    return false;
-}
+peer* policy::find_connect_candidate(int session_time) {
+    LIBED2K_ASSERT(m_finished == m_transfer->is_finished());
 
-policy::peers_t::iterator policy::find_connect_candidate(int session_time) {
-    int candidate = -1;
-    int erase_candidate = -1;
+    const session_settings& settings = m_transfer->settings();
+    if (settings.min_reconnect_time != m_reconnect_time || settings.max_failcount != m_max_failcount)
+        rebuild_candidates();
 
-    LIBED2K_ASSERT(m_finished == m_transfer->is_finished());
+    // if the number of peers is growing large
+    // we need to start weeding.
+    int max_peerlist_size = m_transfer->is_paused() ? settings.max_paused_peerlist_size : settings.max_peerlist_size;
+    if (max_peerlist_size > 0 && int(m_peers.size()) >= max_peerlist_size * 0.95) erase_peers();
 
     aux::session_impl& ses = m_transfer->session();
-    int min_reconnect_time = ses.settings().min_reconnect_time;
-    // address external_ip = m_transfer->session().external_address();
-
-    // don't bias any particular peers when seeding
-    // if (m_finished || external_ip == address())
-    //{
-    //    // set external_ip to a random value, to
-    //    // radomize which peers we prefer
-    //    address_v4::bytes_type bytes;
-    //    std::generate(bytes.begin(), bytes.end(), &random);
-    //    external_ip = address_v4(bytes);
-    //}
-
-    if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
-
-#ifndef LIBED2K_DISABLE_DHT
-    bool pinged = false;
-#endif
-
-    int max_peerlist_size =
-        m_transfer->is_paused() ? ses.settings().max_paused_peerlist_size : ses.settings().max_peerlist_size;
 
-    for (int iterations = std::min(int(m_peers.size()), 300); iterations > 0; --iterations) {
-        if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+    // candidates are ordered by the time they may be connected again,
+    // then by failcount, locality and source rank
+    for (candidate_set::iterator i = m_candidates.begin(); i != m_candidates.end();) {
+        if (i->ready > session_time) return NULL;
 
-        peer& pe = *m_peers[m_round_robin];
-        // LIBED2K_ASSERT(pe.in_use);
-        int current = m_round_robin;
-
-#ifndef LIBED2K_DISABLE_DHT
-        // try to send a DHT ping to this peer
-        // as well, to figure out if it supports
-        // DHT (uTorrent and BitComet doesn't
-        // advertise support)
-        if (!pinged && !pe.added_to_dht) {
-            udp::endpoint node(pe.address(), pe.port());
-            // m_transfer->session().add_dht_node(node);
-            pe.added_to_dht = true;
-            pinged = true;
-        }
-#endif
-        // if the number of peers is growing large
-        // we need to start weeding.
-
-        if (int(m_peers.size()) >= max_peerlist_size * 0.95 && max_peerlist_size > 0) {
-            if (is_erase_candidate(pe, m_finished) &&
-                (erase_candidate == -1 || !compare_peer_erase(*m_peers[erase_candidate], pe))) {
-                if (should_erase_immediately(pe)) {
-                    if (erase_candidate > current) --erase_candidate;
-                    if (candidate > current) --candidate;
-                    erase_peer(m_peers.begin() + current);
-                    continue;
-                } else {
-                    erase_candidate = current;
-                }
-            }
+        peer* p = i->p;
+        if (!is_connect_candidate(*p, m_finished)) {
+            // the peer is added back on its next state change
+            m_candidates.erase(i++);
+            continue;
         }
 
-        ++m_round_robin;
-
-        if (!is_connect_candidate(pe, m_finished)) continue;
-
-        // compare peer returns true if lhs is better than rhs. In this
-        // case, it returns true if the current candidate is better than
-        // pe, which is the peer m_round_robin points to. If it is, just
-        // keep looking.
-        if (candidate != -1 && compare_peer(*m_peers[candidate], pe /*, external_ip*/)) continue;
-
-        if (pe.next_connect && session_time < pe.next_connect) continue;
-
-        if (pe.last_connected && session_time - pe.last_connected < (int(pe.failcount) + 1) * min_reconnect_time)
+        // the session has a connection to this endpoint which isn't attached
+        // to the peer yet, the peer stays a candidate for when it's gone
+        if (ses.find_peer_connection(p->ip())) {
+            ++i;
             continue;
+        }
 
-        candidate = current;
-    }
-
-    if (erase_candidate > -1) {
-        if (candidate > erase_candidate) --candidate;
-        erase_peer(m_peers.begin() + erase_candidate);
-    }
-
-#if defined LIBED2K_LOGGING || defined LIBED2K_VERBOSE_LOGGING
-    if (candidate != -1) {
-        (*m_transfer->session().m_logger)
-            << time_now_string() << " *** FOUND CONNECTION CANDIDATE ["
-                                    " ip: "
-            << m_peers[candidate]->ip() << " d: " << cidr_distance(external_ip, m_peers[candidate]->address())
-            << " external: " << external_ip << " t: " << (session_time - m_peers[candidate]->last_connected) << " ]\n";
+        return p;
     }
-#endif
 
-    if (candidate == -1) return m_peers.end();
-    return m_peers.begin() + candidate;
+    return NULL;
 }
 
 bool policy::is_connect_candidate(peer const& p, bool finished) const {
@@ -654,10 +603,6 @@ bool policy::is_connect_candidate(peer const& p, bool finished) const {
         || !p.connectable || (p.seed && finished) || int(p.failcount) >= ses.settings().max_failcount)
         return false;
 
-    // is there connection to this peer
-    boost::intrusive_ptr<peer_connection> c = ses.find_peer_connection(p.endpoint);
-    if (c) return false;
-
     // if (ses.m_port_filter.access(p.port) & port_filter::blocked)
     //    return false;
 
@@ -713,8 +658,10 @@ void policy::erase_peers(int flags) {
         if (is_erase_candidate(pe, m_finished) &&
             (erase_candidate == -1 || !compare_peer_erase(*m_peers[erase_candidate], pe))) {
             if (should_erase_immediately(pe)) {
-                if (erase_candidate > current) --erase_candidate;
-                if (force_erase_candidate > current) --force_erase_candidate;
+                // the last peer moves to current position
+                int last = int(m_peers.size()) - 1;
+                if (erase_candidate == last) erase_candidate = current;
+                if (force_erase_candidate == last) force_erase_candidate = current;
                 LIBED2K_ASSERT(current >= 0 && current < int(m_peers.size()));
                 erase_peer(m_peers.begin() + current);
                 continue;
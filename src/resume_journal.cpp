@@ -0,0 +1,424 @@
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <iterator>
+#include <cstring>
+
+#include <boost/bind.hpp>
+
+#include "libed2k/resume_journal.hpp"
+#include "libed2k/bencode.hpp"
+#include "libed2k/entry.hpp"
+#include "libed2k/lazy_entry.hpp"
+#include "libed2k/io.hpp"
+#include "libed2k/log.hpp"
+
+namespace libed2k {
+
+namespace {
+const char journal_magic[] = {'L', '2', 'K', 'J'};
+const boost::uint8_t journal_version = 1;
+const size_t file_header_size = sizeof(journal_magic) + 1;
+
+// type, transfer hash and payload size
+const size_t record_header_size = 1 + md4_hash::size + 4;
+
+// records beyond one per transfer which are kept before the journal is rewritten
+const size_t min_garbage_records = 4096;
+
+/**
+  * last snapshot of transfer and records appended after it
+ */
+struct folded_transfer {
+    folded_transfer() : snapshot(0), snapshot_size(0), has_path(false) {}
+
+    const char* snapshot;
+    size_t snapshot_size;
+    std::vector<int> pieces;
+    std::vector<std::pair<int, int> > priorities;
+    std::string path;
+    bool has_path;
+};
+
+void write_file_header(std::vector<char>& buf) {
+    buf.insert(buf.end(), journal_magic, journal_magic + sizeof(journal_magic));
+    buf.push_back(char(journal_version));
+}
+
+void write_record(std::vector<char>& buf, int type, const md4_hash& t, const std::string& payload) {
+    std::back_insert_iterator<std::vector<char> > out(buf);
+    detail::write_uint8(boost::uint8_t(type), out);
+    buf.insert(buf.end(), &t[0], &t[0] + md4_hash::size);
+    detail::write_uint32(boost::uint32_t(payload.size()), out);
+    buf.insert(buf.end(), payload.begin(), payload.end());
+}
+
+std::string save_snapshot(transfer_resume_data trd) {
+    std::ostringstream out(std::ios_base::binary);
+    archive::ed2k_oarchive ar(out);
+    ar << trd;
+    return out.str();
+}
+
+// applies records to snapshot, pieces and priorities go into the fast resume data
+bool restore(const md4_hash& hash, const folded_transfer& f, transfer_resume_data& trd) {
+    try {
+        std::istringstream in(std::string(f.snapshot, f.snapshot_size), std::ios_base::binary);
+        archive::ed2k_iarchive ar(in);
+        ar >> trd;
+    } catch (libed2k_exception&) {
+        return false;
+    }
+
+    if (trd.m_hash != hash) return false;
+    if (f.has_path) trd.m_filename.m_collection = f.path;
+    if (f.pieces.empty() && f.priorities.empty()) return true;
+
+    boost::shared_ptr<base_tag> tag = trd.m_fast_resume_data.getTagByNameId(FT_FAST_RESUME_DATA);
+    if (!tag) return true;
+
+    // pieces and priorities have fixed size and are patched in place
+    std::vector<char> data = tag->asBlob();
+    if (data.empty()) return true;
+
+    lazy_entry rd;
+    error_code ec;
+    if (lazy_bdecode(&data[0], &data[0] + data.size(), rd, ec) != 0 || rd.type() != lazy_entry::dict_t) return true;
+
+    bool unfinished_done = false;
+    if (lazy_entry const* pieces = rd.dict_find_string("pieces")) {
+        char* have = &data[0] + (pieces->string_ptr() - &data[0]);
+        for (std::vector<int>::const_iterator i = f.pieces.begin(); i != f.pieces.end(); ++i)
+            if (*i < pieces->string_length()) have[*i] = 1;
+
+        if (lazy_entry const* unfinished = rd.dict_find_list("unfinished")) {
+            for (int i = 0; i < unfinished->list_size(); ++i) {
+                int piece = int(unfinished->list_at(i)->dict_find_int_value("piece", -1));
+                if (piece >= 0 && piece < pieces->string_length() && (have[piece] & 1)) unfinished_done = true;
+            }
+        }
+    }
+
+    if (lazy_entry const* priority = rd.dict_find_string("piece_priority")) {
+        char* prio = &data[0] + (priority->string_ptr() - &data[0]);
+        for (std::vector<std::pair<int, int> >::const_iterator i = f.priorities.begin(); i != f.priorities.end(); ++i)
+            if (i->first < priority->string_length()) prio[i->first] = char(i->second);
+    }
+
+    // unfinished entries would reset pieces completed since the snapshot
+    if (unfinished_done) {
+        entry e = bdecode(data.begin(), data.end());
+        entry::string_type const& have = e["pieces"].string();
+        entry::list_type& l = e["unfinished"].list();
+        for (entry::list_type::iterator i = l.begin(); i != l.end();) {
+            entry const* piece = i->type() == entry::dictionary_t ? i->find_key("piece") : 0;
+            if (piece && piece->type() == entry::int_t && piece->integer() >= 0 &&
+                piece->integer() < size_type(have.size()) && (have[size_t(piece->integer())] & 1))
+                i = l.erase(i);
+            else
+                ++i;
+        }
+
+        data.clear();
+        bencode(std::back_inserter(data), e);
+    }
+
+    trd = transfer_resume_data(trd.m_hash, trd.m_filename.m_collection, trd.m_filesize, trd.m_seed, data);
+    return true;
+}
+}
+
+resume_journal::resume_journal() : m_size(0), m_records(0), m_compact_records(0), m_compact(false), m_abort(false) {}
+
+resume_journal::~resume_journal() { close(); }
+
+void resume_journal::open(const std::string& path, std::vector<transfer_resume_data>& transfers, error_code& ec) {
+    close();
+
+    if (!m_file.open(path, file::read_write, ec)) return;
+
+    size_type size = m_file.get_size(ec);
+    if (ec) return;
+
+    // the whole journal is read at once and parsed in one pass
+    std::vector<char> image(static_cast<size_t>(size) + 1);
+    if (size > 0) {
+        file::iovec_t b = {&image[0], size_t(size)};
+        if (m_file.readv(0, &b, 1, ec) != size) {
+            if (!ec) ec = errors::file_too_short;
+            m_file.close();
+            return;
+        }
+    }
+
+    size_t records = 0;
+    size_t parsed = size > 0 ? load(&image[0], &image[0] + size, transfers, records) : 0;
+
+    if (size > 0 && parsed == 0) {
+        ec = errors::invalid_resume_journal;
+        m_file.close();
+        return;
+    }
+
+    if (parsed == 0) {
+        std::vector<char> header;
+        write_file_header(header);
+        file::iovec_t b = {&header[0], header.size()};
+        m_file.writev(0, &b, 1, ec);
+        parsed = header.size();
+    } else if (size_type(parsed) < size) {
+        // drop record cut by crash, appends follow the last complete one
+        DBG("resume journal: drop " << (size - parsed) << " bytes of incomplete record");
+        m_file.set_size(parsed, ec);
+    }
+
+    if (ec) {
+        m_file.close();
+        return;
+    }
+
+    m_path = path;
+    m_size = parsed;
+    m_records = records;
+    m_transfers.clear();
+    for (std::vector<transfer_resume_data>::const_iterator i = transfers.begin(); i != transfers.end(); ++i)
+        m_transfers.insert(i->m_hash);
+
+    m_abort = false;
+    m_compact_records = 0;
+    m_compact = m_records > 2 * m_transfers.size() + min_garbage_records;
+    m_thread.reset(new thread(boost::bind(&resume_journal::writer, this)));
+}
+
+void resume_journal::close() {
+    if (!m_thread) return;
+
+    mutex::scoped_lock l(m_mutex);
+    m_abort = true;
+    m_cond.signal_all(l);
+    l.unlock();
+
+    m_thread->join();
+    m_thread.reset();
+    m_file.close();
+    m_transfers.clear();
+}
+
+bool resume_journal::has_transfer(const md4_hash& t) const {
+    mutex::scoped_lock l(m_mutex);
+    return m_transfers.count(t) > 0;
+}
+
+void resume_journal::add_transfer(const transfer_resume_data& trd) {
+    if (!is_open()) return;
+    append(snapshot_record, trd.m_hash, save_snapshot(trd));
+}
+
+void resume_journal::have_piece(const md4_hash& t, int piece) {
+    if (!is_open()) return;
+    std::string payload;
+    std::back_insert_iterator<std::string> out(payload);
+    detail::write_uint32(boost::uint32_t(piece), out);
+    append(have_piece_record, t, payload);
+}
+
+void resume_journal::piece_priority(const md4_hash& t, int piece, int priority) {
+    if (!is_open()) return;
+    std::string payload;
+    std::back_insert_iterator<std::string> out(payload);
+    detail::write_uint32(boost::uint32_t(piece), out);
+    detail::write_uint8(boost::uint8_t(priority), out);
+    append(piece_priority_record, t, payload);
+}
+
+void resume_journal::file_path(const md4_hash& t, const std::string& path) {
+    if (!is_open()) return;
+    append(file_path_record, t, path);
+}
+
+void resume_journal::remove_transfer(const md4_hash& t) {
+    if (!is_open()) return;
+    append(remove_record, t, std::string());
+}
+
+void resume_journal::append(record_type type, const md4_hash& t, const std::string& payload) {
+    mutex::scoped_lock l(m_mutex);
+
+    // records of transfers without snapshot have nothing to apply to
+    if (type == snapshot_record)
+        m_transfers.insert(t);
+    else if (m_transfers.count(t) == 0)
+        return;
+
+    if (type == remove_record) m_transfers.erase(t);
+
+    write_record(m_pending, type, t, payload);
+    ++m_records;
+
+    if (!m_compact && m_records > (std::max)(2 * m_transfers.size() + min_garbage_records, m_compact_records))
+        m_compact = true;
+    m_cond.signal_all(l);
+}
+
+void resume_journal::writer() {
+    mutex::scoped_lock l(m_mutex);
+
+    for (;;) {
+        while (!m_abort && !m_compact && m_pending.empty()) m_cond.wait(l);
+
+        bool compacting = m_compact && !m_abort;
+        bool abort = m_abort;
+        std::vector<char> buffer;
+        buffer.swap(m_pending);
+        l.unlock();
+
+        // compact first, records appended meanwhile go to the new journal
+        bool compacted = compacting && compact();
+        if (!buffer.empty()) write(buffer);
+
+        l.lock();
+        if (compacting) {
+            m_compact = false;
+            // after a failure wait for as much new garbage as a fresh
+            // journal collects, instead of retrying on every record
+            m_compact_records = compacted ? 0 : m_records + 2 * m_transfers.size() + min_garbage_records;
+        }
+        if (abort && m_pending.empty()) return;
+    }
+}
+
+void resume_journal::write(const std::vector<char>& buffer) {
+    error_code ec;
+    file::iovec_t b = {const_cast<char*>(&buffer[0]), buffer.size()};
+    size_type written = m_file.writev(m_size, &b, 1, ec);
+    if (ec) {
+        ERR("resume journal write failed: " << ec.message());
+        return;
+    }
+    m_size += written;
+}
+
+bool resume_journal::compact() {
+    error_code ec;
+    std::vector<char> image(static_cast<size_t>(m_size));
+    file::iovec_t b = {&image[0], image.size()};
+    if (m_file.readv(0, &b, 1, ec) != m_size) return false;
+
+    std::vector<transfer_resume_data> transfers;
+    size_t records = 0;
+    if (load(&image[0], &image[0] + image.size(), transfers, records) == 0) return false;
+
+    std::vector<char>().swap(image);
+    write_file_header(image);
+    for (std::vector<transfer_resume_data>::const_iterator i = transfers.begin(); i != transfers.end(); ++i)
+        write_record(image, snapshot_record, i->m_hash, save_snapshot(*i));
+
+    std::string tmp = m_path + ".tmp";
+    {
+        file f(tmp, file::write_only, ec);
+        if (!ec) {
+            file::iovec_t nb = {&image[0], image.size()};
+            f.set_size(0, ec);
+            if (!ec) f.writev(0, &nb, 1, ec);
+        }
+    }
+
+    if (ec) {
+        ERR("resume journal compaction failed: " << ec.message());
+        return false;
+    }
+
+    m_file.close();
+    rename(tmp, m_path, ec);
+    if (ec) {
+        // windows doesn't replace existing files on rename
+        ec.clear();
+        remove(m_path, ec);
+        ec.clear();
+        rename(tmp, m_path, ec);
+    }
+
+    m_file.open(m_path, file::read_write, ec);
+    if (ec) {
+        ERR("resume journal reopen failed: " << ec.message());
+        return false;
+    }
+
+    DBG("resume journal compacted: " << m_size << " -> " << image.size() << " bytes");
+    m_size = image.size();
+
+    mutex::scoped_lock l(m_mutex);
+    m_records -= records - transfers.size();
+    return true;
+}
+
+size_t resume_journal::load(const char* begin, const char* end, std::vector<transfer_resume_data>& transfers,
+                            size_t& records) {
+    records = 0;
+    if (size_t(end - begin) < file_header_size || std::memcmp(begin, journal_magic, sizeof(journal_magic)) != 0 ||
+        boost::uint8_t(begin[sizeof(journal_magic)]) != journal_version)
+        return 0;
+
+    typedef std::map<md4_hash, folded_transfer> folded_map;
+    folded_map folded;
+
+    const char* p = begin + file_header_size;
+    while (size_t(end - p) >= record_header_size) {
+        const char* r = p;
+        int type = detail::read_uint8(r);
+        md4_hash t;
+        std::memcpy(&t[0], r, md4_hash::size);
+        r += md4_hash::size;
+        boost::uint32_t size = detail::read_uint32(r);
+        if (size_t(end - r) < size) break;
+
+        p = r + size;
+        ++records;
+
+        if (type == snapshot_record) {
+            folded_transfer& f = folded[t];
+            f = folded_transfer();
+            f.snapshot = r;
+            f.snapshot_size = size;
+            continue;
+        }
+
+        folded_map::iterator i = folded.find(t);
+        if (i == folded.end()) continue;
+        folded_transfer& f = i->second;
+
+        switch (type) {
+            case have_piece_record:
+                if (size >= 4) f.pieces.push_back(int(detail::read_uint32(r)));
+                break;
+            case piece_priority_record:
+                if (size >= 5) {
+                    int piece = int(detail::read_uint32(r));
+                    f.priorities.push_back(std::make_pair(piece, int(detail::read_uint8(r))));
+                }
+                break;
+            case file_path_record:
+                f.path.assign(r, size);
+                f.has_path = true;
+                break;
+            case remove_record:
+                folded.erase(i);
+                break;
+            default:
+                // unknown records of newer versions are skipped
+                break;
+        }
+    }
+
+    transfers.reserve(transfers.size() + folded.size());
+    for (folded_map::const_iterator i = folded.begin(); i != folded.end(); ++i) {
+        transfer_resume_data trd;
+        if (restore(i->first, i->second, trd))
+            transfers.push_back(trd);
+        else
+            ERR("resume journal: invalid snapshot of " << i->first);
+    }
+
+    return p - begin;
+}
+}
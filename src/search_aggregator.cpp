@@ -0,0 +1,184 @@
+#include <algorithm>
+
+#include "libed2k/search_aggregator.hpp"
+
+namespace libed2k {
+
+namespace {
+// alternative names kept for a file besides the first one
+const size_t max_alt_names = 4;
+}
+
+search_aggregator::rank_key search_aggregator::file_state::key() const {
+    rank_key k;
+    k.sources = info.m_sources;
+    k.complete_sources = info.m_complete_sources;
+    k.file = info.m_hFile;
+    return k;
+}
+
+search_aggregator::search_aggregator() : m_top_k(100), m_max_files(5000), m_max_searches(16), m_next_order(0) {}
+
+void search_aggregator::set_limits(int top_k, int max_files, int max_searches) {
+    m_top_k = (std::max)(top_k, 1);
+    m_max_files = (std::max)(max_files, m_top_k);
+    m_max_searches = (std::max)(max_searches, 1);
+}
+
+void search_aggregator::start(const md4_hash& search) {
+    if (!active(search)) {
+        // a search that never finished is dropped to make room
+        while (int(m_searches.size()) >= m_max_searches) {
+            search_map::iterator oldest = m_searches.begin();
+            for (search_map::iterator i = m_searches.begin(); i != m_searches.end(); ++i)
+                if (i->second.order < oldest->second.order) oldest = i;
+            m_searches.erase(oldest);
+        }
+    }
+
+    search_state& s = m_searches[search];
+    s.files.clear();
+    s.ranking.clear();
+    s.top.clear();
+    s.dirty = false;
+    s.finished = false;
+    s.order = m_next_order++;
+}
+
+void search_aggregator::stop(const md4_hash& search) { m_searches.erase(search); }
+
+void search_aggregator::finish(const md4_hash& search, const ptime& expires) {
+    search_map::iterator si = m_searches.find(search);
+    if (si == m_searches.end()) return;
+    si->second.finished = true;
+    si->second.expires = expires;
+}
+
+void search_aggregator::add(const md4_hash& search, const md4_hash& file, const std::string& name, size_type size,
+                            int sources, int complete_sources, bool additive) {
+    search_map::iterator si = m_searches.find(search);
+    if (si == m_searches.end()) return;
+    search_state& s = si->second;
+
+    file_map::iterator i = s.files.find(file);
+
+    if (i == s.files.end()) {
+        file_state f;
+        f.info.m_hFile = file;
+        f.info.m_name = name;
+        f.info.m_size = size;
+        f.info.m_sources = sources;
+        f.info.m_complete_sources = complete_sources;
+        f.info.m_reports = 1;
+        f.changed = true;
+
+        // keep memory bounded on generic searches, a new file
+        // replaces the worst one only when it ranks better
+        if (int(s.files.size()) >= m_max_files) {
+            std::set<rank_key>::iterator worst = s.ranking.end();
+            --worst;
+            if (!(f.key() < *worst)) return;
+            s.files.erase(worst->file);
+            s.ranking.erase(worst);
+        }
+
+        s.ranking.insert(f.key());
+        s.files.insert(std::make_pair(file, f));
+    } else {
+        file_state& f = i->second;
+        s.ranking.erase(f.key());
+
+        if (additive) {
+            f.info.m_sources += sources;
+            f.info.m_complete_sources += complete_sources;
+        } else {
+            f.info.m_sources = (std::max)(f.info.m_sources, sources);
+            f.info.m_complete_sources = (std::max)(f.info.m_complete_sources, complete_sources);
+        }
+
+        if (f.info.m_size == 0) f.info.m_size = size;
+        ++f.info.m_reports;
+
+        if (f.info.m_name.empty()) {
+            f.info.m_name = name;
+        } else if (!name.empty() && name != f.info.m_name && f.info.m_names.size() < max_alt_names &&
+                   std::find(f.info.m_names.begin(), f.info.m_names.end(), name) == f.info.m_names.end()) {
+            f.info.m_names.push_back(name);
+        }
+
+        f.changed = true;
+        s.ranking.insert(f.key());
+    }
+
+    s.dirty = true;
+}
+
+void search_aggregator::flush(std::vector<search_results_delta>& deltas, const ptime& now) {
+    for (search_map::iterator si = m_searches.begin(); si != m_searches.end();) {
+        search_state& s = si->second;
+        bool expired = s.finished && s.expires <= now;
+        if (!s.dirty) {
+            if (expired)
+                m_searches.erase(si++);
+            else
+                ++si;
+            continue;
+        }
+        s.dirty = false;
+
+        search_results_delta d;
+        d.m_search = si->first;
+        d.m_files = int(s.files.size());
+
+        std::vector<md4_hash> top;
+        std::set<md4_hash> in_top;
+        int rank = 0;
+
+        // files which changed or moved inside top K
+        for (std::set<rank_key>::const_iterator i = s.ranking.begin(); i != s.ranking.end() && rank < m_top_k;
+             ++i, ++rank) {
+            file_state& f = s.files[i->file];
+            top.push_back(i->file);
+            in_top.insert(i->file);
+
+            if (f.changed || f.last_rank != rank) {
+                f.info.m_rank = rank;
+                d.m_updated.push_back(f.info);
+            }
+
+            f.changed = false;
+            f.last_rank = rank;
+        }
+
+        // files which were dropped or pushed out of top K
+        for (std::vector<md4_hash>::const_iterator i = s.top.begin(); i != s.top.end(); ++i) {
+            if (in_top.count(*i)) continue;
+            d.m_removed.push_back(*i);
+            file_map::iterator f = s.files.find(*i);
+            if (f != s.files.end()) f->second.last_rank = -1;
+        }
+
+        s.top.swap(top);
+        if (!d.m_updated.empty() || !d.m_removed.empty()) deltas.push_back(d);
+
+        if (expired)
+            m_searches.erase(si++);
+        else
+            ++si;
+    }
+}
+
+void search_aggregator::top(const md4_hash& search, std::vector<search_file_info>& files) const {
+    files.clear();
+    search_map::const_iterator si = m_searches.find(search);
+    if (si == m_searches.end()) return;
+
+    const search_state& s = si->second;
+    int rank = 0;
+    for (std::set<rank_key>::const_iterator i = s.ranking.begin(); i != s.ranking.end() && rank < m_top_k;
+         ++i, ++rank) {
+        files.push_back(s.files.find(i->file)->second.info);
+        files.back().m_rank = rank;
+    }
+}
+}
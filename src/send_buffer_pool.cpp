@@ -0,0 +1,220 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "libed2k/send_buffer_pool.hpp"
+#include "libed2k/assert.hpp"
+
+namespace libed2k {
+
+namespace {
+// heap allocation carved into buffers of one class
+const int slab_size = 64 * 1024;
+
+// bytes of every class a thread keeps for itself
+const int thread_cache_bytes = 64 * 1024;
+
+char*& next_buffer(char* buf) { return *reinterpret_cast<char**>(buf); }
+
+#ifdef LIBED2K_THREAD_LOCAL
+boost::detail::atomic_count pool_ids(0);
+
+// the cache of the pool the thread used last
+LIBED2K_THREAD_LOCAL long thread_pool_id = 0;
+LIBED2K_THREAD_LOCAL void* thread_pool_cache = 0;
+
+// guards the cache lists of the pools and which pool a cache belongs
+// to. Lives until the process exits, threads may exit after the pools
+mutex& cache_registry_mutex() {
+    static mutex* m = new mutex;
+    return *m;
+}
+#endif
+}
+
+send_buffer_pool::send_buffer_pool()
+#ifdef LIBED2K_THREAD_LOCAL
+    : m_id(++pool_ids),
+      m_thread_cache(&send_buffer_pool::thread_exit)
+#endif
+{
+}
+
+send_buffer_pool::~send_buffer_pool() {
+    for (int c = 0; c < num_classes; ++c) {
+        std::vector<char*>& slabs = m_classes[c].slabs;
+        for (std::vector<char*>::iterator i = slabs.begin(); i != slabs.end(); ++i) std::free(*i);
+    }
+#ifdef LIBED2K_THREAD_LOCAL
+    // the cached buffers go away with the slabs. The caches are
+    // deleted when their threads exit
+    mutex::scoped_lock l(cache_registry_mutex());
+    for (std::vector<thread_cache*>::iterator i = m_caches.begin(); i != m_caches.end(); ++i) {
+        mutex::scoped_lock cl((*i)->cache_mutex);
+        (*i)->pool = 0;
+        std::fill((*i)->free_list, (*i)->free_list + num_classes, static_cast<char*>(0));
+        std::fill((*i)->count, (*i)->count + num_classes, 0);
+    }
+    m_caches.clear();
+#endif
+}
+
+int send_buffer_pool::size_class_of(int size) {
+    int c = 0;
+    while (c < num_classes && (min_buffer_size << c) < size) ++c;
+    return c;
+}
+
+int send_buffer_pool::cache_limit(int c) { return (std::max)(thread_cache_bytes / (min_buffer_size << c), 1); }
+
+std::pair<char*, int> send_buffer_pool::allocate(int size) {
+    int c = size_class_of(size);
+    if (c == num_classes) return std::make_pair(static_cast<char*>(std::malloc(size)), size);
+
+    char* ret = 0;
+#ifdef LIBED2K_THREAD_LOCAL
+    thread_cache& tc = local_cache();
+    mutex::scoped_lock l(tc.cache_mutex);
+    if (tc.count[c] == 0) tc.free_list[c] = pop_buffers(c, (cache_limit(c) + 1) / 2, tc.count[c]);
+    if (tc.count[c] > 0) {
+        ret = tc.free_list[c];
+        tc.free_list[c] = next_buffer(ret);
+        --tc.count[c];
+    }
+#else
+    int popped = 0;
+    ret = pop_buffers(c, 1, popped);
+#endif
+    if (ret == 0) return std::make_pair(ret, 0);
+
+    ++m_classes[c].in_use;
+    return std::make_pair(ret, int(min_buffer_size << c));
+}
+
+void send_buffer_pool::free(char* buf, int size) {
+    if (buf == 0) return;
+    int c = size_class_of(size);
+    if (c == num_classes) {
+        std::free(buf);
+        return;
+    }
+    LIBED2K_ASSERT((min_buffer_size << c) == size);
+    --m_classes[c].in_use;
+
+#ifdef LIBED2K_THREAD_LOCAL
+    thread_cache& tc = local_cache();
+    mutex::scoped_lock l(tc.cache_mutex);
+    // a full cache gives half of it back under one lock
+    if (tc.count[c] >= cache_limit(c)) flush_cache(tc, c, cache_limit(c) / 2);
+    next_buffer(buf) = tc.free_list[c];
+    tc.free_list[c] = buf;
+    ++tc.count[c];
+#else
+    next_buffer(buf) = 0;
+    push_buffers(c, buf, buf, 1);
+#endif
+}
+
+void send_buffer_pool::usage(std::vector<class_usage>& classes) const {
+    classes.resize(num_classes);
+    for (int c = 0; c < num_classes; ++c) {
+        size_class& sc = const_cast<size_class&>(m_classes[c]);
+        mutex::scoped_lock l(sc.list_mutex);
+        classes[c].buffer_size = min_buffer_size << c;
+        classes[c].in_use = sc.in_use;
+        classes[c].allocated = sc.allocated;
+        classes[c].free = sc.free_count;
+    }
+}
+
+char* send_buffer_pool::pop_buffers(int c, int num, int& popped) {
+    size_class& sc = m_classes[c];
+    const int buffer_size = min_buffer_size << c;
+    mutex::scoped_lock l(sc.list_mutex);
+
+    if (sc.free_count < num) {
+        int buffers = (std::max)(slab_size / buffer_size, num);
+        char* slab = static_cast<char*>(std::malloc(buffers * buffer_size));
+        if (slab != 0) {
+            sc.slabs.push_back(slab);
+            for (int i = buffers - 1; i >= 0; --i) {
+                char* buf = slab + i * buffer_size;
+                next_buffer(buf) = sc.free_list;
+                sc.free_list = buf;
+            }
+            sc.free_count += buffers;
+            sc.allocated += buffers;
+        }
+    }
+
+    popped = (std::min)(num, sc.free_count);
+    if (popped == 0) return 0;
+
+    char* head = sc.free_list;
+    char* tail = head;
+    for (int i = 1; i < popped; ++i) tail = next_buffer(tail);
+    sc.free_list = next_buffer(tail);
+    sc.free_count -= popped;
+    next_buffer(tail) = 0;
+    return head;
+}
+
+void send_buffer_pool::push_buffers(int c, char* head, char* tail, int num) {
+    size_class& sc = m_classes[c];
+    mutex::scoped_lock l(sc.list_mutex);
+    next_buffer(tail) = sc.free_list;
+    sc.free_list = head;
+    sc.free_count += num;
+}
+
+#ifdef LIBED2K_THREAD_LOCAL
+send_buffer_pool::thread_cache& send_buffer_pool::local_cache() {
+    if (thread_pool_id == m_id) return *static_cast<thread_cache*>(thread_pool_cache);
+
+    thread_cache* tc = m_thread_cache.get();
+    if (tc == 0 || tc->pool != this) {
+        // first buffer of this pool in this thread. A pool destructed
+        // at the same address may have left its emptied cache
+        mutex::scoped_lock l(cache_registry_mutex());
+        if (tc == 0) {
+            tc = new thread_cache;
+            std::fill(tc->free_list, tc->free_list + num_classes, static_cast<char*>(0));
+            std::fill(tc->count, tc->count + num_classes, 0);
+            m_thread_cache.reset(tc);
+        }
+        tc->pool = this;
+        m_caches.push_back(tc);
+    }
+    thread_pool_id = m_id;
+    thread_pool_cache = tc;
+    return *tc;
+}
+
+void send_buffer_pool::flush_cache(thread_cache& tc, int c, int keep) {
+    int num = tc.count[c] - keep;
+    if (num <= 0) return;
+
+    char* head = tc.free_list[c];
+    char* tail = head;
+    for (int i = 1; i < num; ++i) tail = next_buffer(tail);
+    tc.free_list[c] = next_buffer(tail);
+    tc.count[c] = keep;
+    push_buffers(c, head, tail, num);
+}
+
+void send_buffer_pool::thread_exit(thread_cache* tc) {
+    mutex::scoped_lock l(cache_registry_mutex());
+    if (tc->pool) {
+        send_buffer_pool& p = *tc->pool;
+        mutex::scoped_lock cl(tc->cache_mutex);
+        for (int c = 0; c < num_classes; ++c) p.flush_cache(*tc, c, 0);
+        cl.unlock();
+        p.m_caches.erase(std::find(p.m_caches.begin(), p.m_caches.end(), tc));
+    }
+    if (thread_pool_cache == tc) {
+        thread_pool_id = 0;
+        thread_pool_cache = 0;
+    }
+    delete tc;
+}
+#endif
+}
@@ -67,6 +67,7 @@ server_connection::server_connection(aux::session_impl& ses)
       m_socket(ses.m_io_service),
       current_operation(scs_stop),
       last_action_time(time_now()),
+      m_search_start(min_time()),
       announced_transfers_count(-1),
       last_close_result(errors::no_error) {}
 
@@ -113,11 +114,18 @@ void server_connection::stop(const error_code& ec) {
 void server_connection::post_search_request(search_request& ro) {
     search_request_block srb(ro);
     do_write(srb);
+
+    boost::mutex::scoped_lock l(m_ses.m_mutex);
+    m_search_start = time_now_hires();
+    ++m_ses.m_metrics.counters[session_metrics::server_searches];
 }
 
 void server_connection::post_search_more_result_request() {
     search_more_result smr;
     do_write(smr);
+
+    boost::mutex::scoped_lock l(m_ses.m_mutex);
+    m_search_start = time_now_hires();
 }
 
 void server_connection::post_sources_request(const md4_hash& hFile, boost::uint64_t nSize) {
@@ -446,6 +454,10 @@ void server_connection::handle_read_packet(const error_code& error, size_t nSize
         archive::ed2k_iarchive ia(in_array_stream);
 
         try {
+            ptime start = time_now_hires();
+            bool search_result = false;
+            bool unhandled = false;
+
             // dispatch message
             switch (m_in_header.m_type) {
                 case OP_REJECT:
@@ -509,12 +521,45 @@ void server_connection::handle_read_packet(const error_code& error, size_t nSize
                     break;
                 }
                 case OP_SEARCHRESULT: {
-                    search_result sfl;
-                    ia >> sfl;
+                    search_result = true;
+
+                    // decode entries one by one and let the sink drop them before
+                    // they are copied into the alert
+                    search_result_decoder decoder(ia);
+                    shared_files_list files;
+
+                    // every server counts its own sources
+                    bool aggregate = m_ses.m_search_aggregator.active(search_aggregator::server_search());
+                    bool report = m_ses.m_alerts.should_post<shared_files_alert>();
+
+                    if (m_ses.m_search_result_sink) {
+                        while (decoder.next()) {
+                            if (!m_ses.m_search_result_sink(decoder.entry())) continue;
+                            if (aggregate)
+                                m_ses.m_search_aggregator.add(search_aggregator::server_search(),
+                                                              decoder.entry().m_hFile, decoder.entry().m_list, true);
+                            if (!report) continue;
+                            files.m_collection.push_back(shared_file_entry());
+                            decoder.entry().to_shared_file_entry(files.m_collection.back());
+                        }
+                    } else {
+                        // nothing is filtered, entries are decoded in place and
+                        // the last one is reused while nobody takes the alert
+                        if (report) files.m_collection.reserve(decoder.size());
+                        files.m_collection.push_back(shared_file_entry());
+                        while (decoder.next(files.m_collection.back())) {
+                            const shared_file_entry& entry = files.m_collection.back();
+                            if (aggregate)
+                                m_ses.m_search_aggregator.add(search_aggregator::server_search(), entry.m_hFile,
+                                                              entry.m_list, true);
+                            if (report) files.m_collection.push_back(shared_file_entry());
+                        }
+                        files.m_collection.pop_back();
+                    }
 
                     m_ses.m_alerts.post_alert_should(
                         shared_files_alert(net_identifier(address2int(m_target.address()), m_target.port()), m_hServer,
-                                           sfl.m_files, (sfl.m_more_results_avaliable != 0)));
+                                           files, decoder.more_results_available()));
                     break;
                 }
                 case OP_CALLBACKREQUESTED: {
@@ -533,10 +578,26 @@ void server_connection::handle_read_packet(const error_code& error, size_t nSize
                     DBG("callback request failed - cleanup callbacks? ");
                     break;
                 default:
+                    unhandled = true;
                     ERR("server ignore unhandled packet: " << std::hex << int(m_in_header.m_type));
                     break;
             }
 
+            {
+                // session::get_metrics() copies the metrics in the caller's thread
+                boost::mutex::scoped_lock l(m_ses.m_mutex);
+
+                if (search_result && m_search_start != min_time()) {
+                    m_ses.m_metrics.server_search_time.add(total_microseconds(start - m_search_start));
+                    m_search_start = min_time();
+                }
+
+                if (unhandled) ++m_ses.m_metrics.counters[session_metrics::unhandled_packets];
+
+                m_ses.m_metrics.server_dispatch(m_in_header.m_protocol, m_in_header.m_type)
+                    .add(total_microseconds(time_now_hires() - start));
+            }
+
             m_in_gzip_container.clear();
             m_in_container.clear();
 
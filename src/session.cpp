@@ -24,6 +24,11 @@ session_status session::status() const {
     return m_impl->status();
 }
 
+session_metrics session::get_metrics() const {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    return m_impl->get_metrics();
+}
+
 transfer_handle session::add_transfer(const add_transfer_params& params) {
     boost::mutex::scoped_lock l(m_impl->m_mutex);
 
@@ -33,6 +38,14 @@ transfer_handle session::add_transfer(const add_transfer_params& params) {
     return ret;
 }
 
+void session::open_resume_journal(const std::string& path, std::vector<transfer_resume_data>& transfers) {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+
+    error_code ec;
+    m_impl->open_resume_journal(path, transfers, ec);
+    if (ec) throw libed2k_exception(ec);
+}
+
 void session::post_transfer(const add_transfer_params& params) {
     boost::mutex::scoped_lock l(m_impl->m_mutex);
     m_impl->post_transfer(params);
@@ -61,6 +74,11 @@ std::auto_ptr<alert> session::pop_alert() {
     return m_impl->pop_alert();
 }
 
+void session::pop_alerts(std::vector<alert*>& alerts) {
+    // this function deliberately doesn't acquire the mutex
+    m_impl->pop_alerts(alerts);
+}
+
 void session::set_alert_dispatch(boost::function<void(alert const&)> const& fun) {
     // this function deliberately doesn't acquire the mutex
     return m_impl->set_alert_dispatch(fun);
@@ -93,6 +111,10 @@ void session::post_cancel_search() {
     m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_cancel_search, m_impl));
 }
 
+void session::set_search_result_sink(const search_result_sink& sink) {
+    m_impl->m_io_service.post(boost::bind(&aux::session_impl::set_search_result_sink, m_impl, sink));
+}
+
 void session::post_sources_request(const md4_hash& hFile, boost::uint64_t nSize) {
     m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_sources_request, m_impl, hFile, nSize));
 }
@@ -131,6 +153,26 @@ const ip_filter& session::get_ip_filter() const {
     return m_impl->get_ip_filter();
 }
 
+int session::add_bandwidth_class(const bandwidth_class& c) {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    return m_impl->add_bandwidth_class(c);
+}
+
+void session::set_bandwidth_class(int index, const bandwidth_class& c) {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    m_impl->set_bandwidth_class(index, c);
+}
+
+std::vector<bandwidth_class> session::bandwidth_classes() const {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    return m_impl->bandwidth_classes();
+}
+
+void session::set_bandwidth_class_filter(const ip_filter& f) {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    m_impl->set_bandwidth_class_filter(f);
+}
+
 transfer_handle session::find_transfer(const md4_hash& hash) const {
     boost::mutex::scoped_lock l(m_impl->m_mutex);
     return m_impl->find_transfer_handle(hash);
@@ -41,6 +41,7 @@ void session_impl_base::abort() {
     if (m_abort) return;
     m_abort = true;
     m_tpm.stop();
+    m_resume_journal.close();
 }
 
 void session_impl_base::post_transfer(add_transfer_params const& params) {
@@ -85,15 +86,22 @@ std::auto_ptr<alert> session_impl_base::pop_alert() {
     return std::auto_ptr<alert>(0);
 }
 
+void session_impl_base::pop_alerts(std::vector<alert*>& alerts) { m_alerts.pop_alerts(alerts); }
+
 void session_impl_base::set_alert_dispatch(boost::function<void(alert const&)> const& fun) {
     m_alerts.set_dispatch_function(fun);
 }
 
 session_impl::session_impl(const fingerprint& id, const char* listen_interface, const session_settings& settings)
     : session_impl_base(settings),
+#ifndef LIBED2K_DISABLE_DHT
+      m_dht_announce_timer(m_io_service),
+#endif
       m_host_resolver(m_io_service),
-      m_peer_pool(500),
-      m_send_buffers(send_buffer_size),
+      m_ipv4_peer_pool(sizeof(ipv4_peer)),
+#if LIBED2K_USE_IPV6
+      m_ipv6_peer_pool(sizeof(ipv6_peer)),
+#endif
       m_z_buffers(BLOCK_SIZE),
       m_skip_buffer(4096),
       m_filepool(40),
@@ -102,24 +110,27 @@ session_impl::session_impl(const fingerprint& id, const char* listen_interface,
       m_download_rate(peer_connection::download_channel),
       m_upload_rate(peer_connection::upload_channel),
       m_server_connection(new server_connection(*this)),
+      m_last_search_flush(min_time()),
       m_next_connect_transfer(m_active_transfers),
       m_paused(false),
       m_created(time_now_hires()),
       m_second_timer(seconds(1)),
       m_timer(m_io_service),
       m_last_tick(m_created),
+      m_bandwidth_timer(m_io_service),
+      m_last_bandwidth_tick(m_created),
+      m_bandwidth_timer_armed(false),
       m_total_failed_bytes(0),
       m_total_redundant_bytes(0),
       m_queue_pos(0),
       m_udp_socket(m_io_service, boost::bind(&session_impl::on_receive_udp, this, _1, _2, _3, _4),
-                   boost::bind(&session_impl::on_receive_udp_hostname, this, _1, _2, _3, _4), m_half_open)
-#ifndef LIBED2K_DISABLE_DHT
-      ,
-      m_dht_announce_timer(m_io_service)
-#endif
-{
+                   boost::bind(&session_impl::on_receive_udp_hostname, this, _1, _2, _3, _4), m_half_open),
+      m_utp_socket_manager(m_settings, m_udp_socket, boost::bind(&session_impl::incoming_connection, this, _1)) {
     DBG("*** create ed2k session ***");
 
+    m_search_aggregator.set_limits(m_settings.search_results_top_k, m_settings.search_results_max_files,
+                                   m_settings.search_results_max_searches);
+
     if (!listen_interface) listen_interface = "0.0.0.0";
     error_code ec;
     m_listen_interface = tcp::endpoint(ip::address::from_string(listen_interface, ec), settings.listen_port);
@@ -266,25 +277,34 @@ void session_impl::set_settings(const session_settings& s) {
     if (m_settings.cache_size != s.cache_size || m_settings.cache_expiry != s.cache_expiry ||
         m_settings.optimize_hashing_for_speed != s.optimize_hashing_for_speed ||
         m_settings.file_checks_delay_per_block != s.file_checks_delay_per_block ||
+        m_settings.hashing_threads != s.hashing_threads ||
+        m_settings.file_checks_read_ahead != s.file_checks_read_ahead ||
+        m_settings.file_checks_rate_limit != s.file_checks_rate_limit ||
         m_settings.disk_cache_algorithm != s.disk_cache_algorithm ||
+        m_settings.read_cache_algorithm != s.read_cache_algorithm ||
         m_settings.read_cache_line_size != s.read_cache_line_size ||
+        m_settings.max_read_ahead != s.max_read_ahead || m_settings.read_ahead_time != s.read_ahead_time ||
         m_settings.write_cache_line_size != s.write_cache_line_size ||
         m_settings.coalesce_writes != s.coalesce_writes || m_settings.coalesce_reads != s.coalesce_reads ||
         m_settings.max_queued_disk_bytes != s.max_queued_disk_bytes ||
         m_settings.max_queued_disk_bytes_low_watermark != s.max_queued_disk_bytes_low_watermark ||
         m_settings.disable_hash_checks != s.disable_hash_checks ||
-        m_settings.explicit_read_cache != s.explicit_read_cache
+        m_settings.explicit_read_cache != s.explicit_read_cache ||
+        m_settings.disk_buffer_thread_cache != s.disk_buffer_thread_cache ||
+        m_settings.disk_cache_huge_pages != s.disk_cache_huge_pages
 #ifndef LIBED2K_DISABLE_MLOCK
         || m_settings.lock_disk_cache != s.lock_disk_cache
 #endif
-        || m_settings.use_read_cache != s.use_read_cache || m_settings.disk_io_write_mode != s.disk_io_write_mode ||
+        || m_settings.use_read_cache != s.use_read_cache || m_settings.zero_copy_upload != s.zero_copy_upload ||
+        m_settings.disk_io_write_mode != s.disk_io_write_mode ||
         m_settings.disk_io_read_mode != s.disk_io_read_mode ||
         m_settings.allow_reordered_disk_operations != s.allow_reordered_disk_operations ||
         m_settings.file_pool_size != s.file_pool_size || m_settings.volatile_read_cache != s.volatile_read_cache ||
         m_settings.no_atime_storage != s.no_atime_storage ||
         m_settings.ignore_resume_timestamps != s.ignore_resume_timestamps ||
         m_settings.no_recheck_incomplete_resume != s.no_recheck_incomplete_resume ||
-        m_settings.low_prio_disk != s.low_prio_disk || m_settings.lock_files != s.lock_files)
+        m_settings.low_prio_disk != s.low_prio_disk || m_settings.lock_files != s.lock_files ||
+        m_settings.read_only_seed_files != s.read_only_seed_files)
         update_disk_io_thread = true;
 
     bool connections_limit_changed = m_settings.connections_limit != s.connections_limit;
@@ -301,6 +321,9 @@ void session_impl::set_settings(const session_settings& s) {
 
     if (m_settings.connection_speed < 0) m_settings.connection_speed = 200;
 
+    m_search_aggregator.set_limits(m_settings.search_results_top_k, m_settings.search_results_max_files,
+                                   m_settings.search_results_max_searches);
+
     if (update_disk_io_thread) update_disk_thread_settings();
 }
 
@@ -376,6 +399,65 @@ void session_impl::set_ip_filter(const ip_filter& f) {
 
 const ip_filter& session_impl::get_ip_filter() const { return m_ip_filter; }
 
+int session_impl::add_bandwidth_class(const bandwidth_class& c) {
+    m_bandwidth_classes.push_back(bandwidth_class_entry());
+    int index = int(m_bandwidth_classes.size()) - 1;
+    set_bandwidth_class(index, c);
+    return index;
+}
+
+void session_impl::set_bandwidth_class(int index, const bandwidth_class& c) {
+    if (index < 0 || index >= int(m_bandwidth_classes.size())) return;
+
+    bandwidth_class_entry& e = m_bandwidth_classes[index];
+    e.settings = c;
+    // parents are added before their children, this also rules out cycles
+    if (e.settings.parent >= index) e.settings.parent = -1;
+    e.settings.weight = std::max(1, e.settings.weight);
+
+    const int limit[2] = {e.settings.upload_limit, e.settings.download_limit};
+    const int burst[2] = {e.settings.upload_burst, e.settings.download_burst};
+
+    for (int i = 0; i < 2; ++i) {
+        bandwidth_channel& ch = e.channel[i];
+        ch.parent = e.settings.parent < 0 ? 0 : &m_bandwidth_classes[e.settings.parent].channel[i];
+        ch.weight = e.settings.weight;
+        ch.throttle(std::max(limit[i], 0));
+        ch.burst(std::max(burst[i], 0));
+    }
+}
+
+std::vector<bandwidth_class> session_impl::bandwidth_classes() const {
+    std::vector<bandwidth_class> res;
+    res.reserve(m_bandwidth_classes.size());
+    for (std::deque<bandwidth_class_entry>::const_iterator i = m_bandwidth_classes.begin();
+         i != m_bandwidth_classes.end(); ++i)
+        res.push_back(i->settings);
+    return res;
+}
+
+void session_impl::set_bandwidth_class_filter(const ip_filter& f) { m_bandwidth_class_filter = f; }
+
+int session_impl::bandwidth_class_channels(const address& a, int transfer_class, int channel,
+                                           bandwidth_channel** chan, int size) {
+    if (m_bandwidth_classes.empty()) return 0;
+
+    const int classes = int(m_bandwidth_classes.size());
+    const int start[2] = {int(m_bandwidth_class_filter.access(a)) - 1, transfer_class};
+    int num = 0;
+
+    for (int k = 0; k < 2; ++k) {
+        for (int c = start[k]; c >= 0 && c < classes && num < size; c = m_bandwidth_classes[c].settings.parent) {
+            bandwidth_channel* ch = &m_bandwidth_classes[c].channel[channel];
+            // the peer and the transfer class may share their parents
+            if (std::find(chan, chan + num, ch) != chan + num) break;
+            chan[num++] = ch;
+        }
+    }
+
+    return num;
+}
+
 bool session_impl::listen_on(int port, const char* net_interface) {
     DBG("listen_on(" << ((net_interface) ? net_interface : "null") << ":" << port);
     tcp::endpoint new_interface;
@@ -442,12 +524,13 @@ void session_impl::update_disk_thread_settings() {
 }
 
 void session_impl::async_accept(boost::shared_ptr<ip::tcp::acceptor> const& listener) {
-    boost::shared_ptr<tcp::socket> c(new tcp::socket(m_io_service));
-    listener->async_accept(
-        *c, bind(&session_impl::on_accept_connection, this, c, boost::weak_ptr<tcp::acceptor>(listener), _1));
+    boost::shared_ptr<socket_type> c(new socket_type(m_io_service));
+    c->instantiate<stream_socket>(m_io_service);
+    listener->async_accept(*c->get<stream_socket>(), bind(&session_impl::on_accept_connection, this, c,
+                                                          boost::weak_ptr<tcp::acceptor>(listener), _1));
 }
 
-void session_impl::on_accept_connection(boost::shared_ptr<tcp::socket> const& s,
+void session_impl::on_accept_connection(boost::shared_ptr<socket_type> const& s,
                                         boost::weak_ptr<ip::tcp::acceptor> listen_socket, error_code const& e) {
     boost::shared_ptr<tcp::acceptor> listener = listen_socket.lock();
     if (!listener) return;
@@ -494,12 +577,17 @@ void session_impl::on_accept_connection(boost::shared_ptr<tcp::socket> const& s,
     incoming_connection(s);
 }
 
-void session_impl::incoming_connection(boost::shared_ptr<tcp::socket> const& s) {
+void session_impl::incoming_connection(boost::shared_ptr<socket_type> const& s) {
     if (m_paused) {
         DBG("INCOMING CONNECTION [ ignored, paused ]");
         return;
     }
 
+    if (is_utp(*s) && !m_settings.enable_incoming_utp) {
+        DBG("INCOMING CONNECTION [ ignored, uTP disabled ]");
+        return;
+    }
+
     error_code ec;
     // we got a connection request!
     tcp::endpoint endp = s->remote_endpoint(ec);
@@ -509,7 +597,7 @@ void session_impl::incoming_connection(boost::shared_ptr<tcp::socket> const& s)
         return;
     }
 
-    DBG("<== INCOMING CONNECTION " << endp);
+    DBG("<== INCOMING CONNECTION " << endp << " " << s->type_name());
 
     if (m_ip_filter.access(endp.address()) & ip_filter::blocked) {
         DBG("filtered blocked ip " << endp);
@@ -599,6 +687,10 @@ void session_impl::on_receive_udp(error_code const& e, udp::endpoint const& ep,
         return;
     }
 
+    // uTP and Kad share the port, a uTP header never looks like an
+    // eDonkey protocol byte
+    if (m_utp_socket_manager.incoming_packet(buf, len, ep)) return;
+
 // now process only dht packets
 #ifndef LIBED2K_DISABLE_DHT
     // this is probably a dht message
@@ -798,6 +890,7 @@ void session_impl::remove_transfer(const transfer_handle& h, int options) {
 
         if (options & session::delete_files) t.delete_files();
         t.abort();
+        m_resume_journal.remove_transfer(hash);
 
         // t.set_queue_position(-1);
         m_transfers.erase(i);
@@ -806,6 +899,17 @@ void session_impl::remove_transfer(const transfer_handle& h, int options) {
     }
 }
 
+void session_impl::open_resume_journal(const std::string& path, std::vector<transfer_resume_data>& transfers,
+                                       error_code& ec) {
+    m_resume_journal.open(path, transfers, ec);
+    if (ec) return;
+
+    // transfers added before the journal was opened start with a snapshot
+    for (transfer_map::iterator i = m_transfers.begin(); i != m_transfers.end(); ++i) {
+        if (!m_resume_journal.has_transfer(i->first)) i->second->save_resume_data(transfer_handle::journal_only);
+    }
+}
+
 bool session_impl::add_active_transfer(const boost::shared_ptr<transfer>& t) {
     DBG("add active transfer:" << t->hash().toString());
     return m_active_transfers.insert(std::make_pair(t->hash(), t)).second;
@@ -847,7 +951,8 @@ peer_connection_handle session_impl::add_peer_connection(net_identifier np, erro
     }
 
     tcp::endpoint endp(boost::asio::ip::address::from_string(int2ipstr(np.m_nIP)), np.m_nPort);
-    boost::shared_ptr<tcp::socket> sock(new tcp::socket(m_io_service));
+    boost::shared_ptr<socket_type> sock(new socket_type(m_io_service));
+    sock->instantiate<stream_socket>(m_io_service);
     setup_socket_buffers(*sock);
 
     boost::intrusive_ptr<peer_connection> c(new peer_connection(*this, boost::weak_ptr<transfer>(), sock, endp, NULL));
@@ -860,25 +965,16 @@ peer_connection_handle session_impl::add_peer_connection(net_identifier np, erro
     return (peer_connection_handle(c, this));
 }
 
-std::pair<char*, int> session_impl::allocate_send_buffer(int size) {
-    int num_buffers = (size + send_buffer_size - 1) / send_buffer_size;
-
-    boost::mutex::scoped_lock l(m_send_buffer_mutex);
+std::pair<char*, int> session_impl::allocate_send_buffer(int size) { return m_send_buffers.allocate(size); }
 
-    return std::make_pair((char*)m_send_buffers.ordered_malloc(num_buffers), num_buffers * send_buffer_size);
-}
-
-void session_impl::free_send_buffer(char* buf, int size) {
-    int num_buffers = size / send_buffer_size;
-
-    boost::mutex::scoped_lock l(m_send_buffer_mutex);
-    m_send_buffers.ordered_free(buf, num_buffers);
-}
+void session_impl::free_send_buffer(char* buf, int size) { m_send_buffers.free(buf, size); }
 
 char* session_impl::allocate_disk_buffer(char const* category) { return m_disk_thread.allocate_buffer(category); }
 
 void session_impl::free_disk_buffer(char* buf) { m_disk_thread.free_buffer(buf); }
 
+void session_impl::release_cache_block(char* buf) { m_disk_thread.release_block(buf); }
+
 char* session_impl::allocate_z_buffer() { return (char*)m_z_buffers.ordered_malloc(); }
 
 void session_impl::free_z_buffer(char* buf) { m_z_buffers.ordered_free(buf); }
@@ -891,10 +987,20 @@ std::string session_impl::send_buffer_usage() {
         used_send_buffer += (*i)->send_buffer_size();
     }
 
+    // buffers in use and carved from the heap of every size class
+    std::vector<send_buffer_pool::class_usage> classes;
+    m_send_buffers.usage(classes);
+    std::string pool_usage;
+    for (std::vector<send_buffer_pool::class_usage>::const_iterator i = classes.begin(); i != classes.end(); ++i) {
+        if (i->allocated == 0) continue;
+        if (!pool_usage.empty()) pool_usage += ", ";
+        pool_usage += (boost::format("%1%: %2%/%3%") % i->buffer_size % i->in_use % i->allocated).str();
+    }
+
     return (boost::format("{disk_queued: %1%, send_buf_size: %2%,"
-                          " used_send_buf: %3%, send_buf_utilization: %4%}") %
+                          " used_send_buf: %3%, send_buf_utilization: %4%, send_buf_classes: {%5%}}") %
             m_disk_thread.queue_buffer_size() % send_buffer_capacity % used_send_buffer %
-            (used_send_buffer * 100.f / send_buffer_capacity))
+            (used_send_buffer * 100.f / send_buffer_capacity) % pool_usage)
         .str();
 }
 
@@ -941,6 +1047,15 @@ session_status session_impl::status() const {
     return s;
 }
 
+session_metrics session_impl::get_metrics() const {
+    session_metrics m = m_metrics;
+    m_disk_thread.metrics(m);
+#ifndef LIBED2K_DISABLE_DHT
+    if (m_dht) m_dht->metrics(m);
+#endif
+    return m;
+}
+
 const tcp::endpoint& session_impl::server() const { return m_server_connection->m_target; }
 
 void session_impl::abort() {
@@ -951,6 +1066,7 @@ void session_impl::abort() {
     session_impl_base::abort();
     error_code ec;
     m_timer.cancel(ec);
+    m_bandwidth_timer.cancel(ec);
 
     // close the listen sockets
     for (std::list<listen_socket_t>::iterator i = m_listen_sockets.begin(), end(m_listen_sockets.end()); i != end;
@@ -1036,6 +1152,38 @@ extern ptime g_current_time;
 
 initialize_timer::initialize_timer() { g_current_time = time_now_hires(); }
 
+void session_impl::update_bandwidth(const ptime& now) {
+    int slice = m_settings.bandwidth_slice;
+    if (slice <= 0 || slice > m_settings.tick_interval) slice = m_settings.tick_interval;
+    m_download_rate.set_slice(slice);
+    m_upload_rate.set_slice(slice);
+
+    m_download_rate.update_quotas(now - m_last_bandwidth_tick);
+    m_upload_rate.update_quotas(now - m_last_bandwidth_tick);
+    m_last_bandwidth_tick = now;
+}
+
+void session_impl::arm_bandwidth_timer() {
+    if (m_abort || m_bandwidth_timer_armed) return;
+    if (m_settings.bandwidth_slice <= 0 || m_settings.bandwidth_slice >= m_settings.tick_interval) return;
+    if (m_download_rate.queue_size() == 0 && m_upload_rate.queue_size() == 0) return;
+
+    error_code ec;
+    m_bandwidth_timer.expires_from_now(milliseconds(m_settings.bandwidth_slice), ec);
+    m_bandwidth_timer.async_wait(bind(&session_impl::on_bandwidth_tick, this, _1));
+    m_bandwidth_timer_armed = true;
+}
+
+void session_impl::on_bandwidth_tick(error_code const& e) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_bandwidth_timer_armed = false;
+    if (m_abort || e) return;
+
+    update_bandwidth(time_now_hires());
+    arm_bandwidth_timer();
+}
+
 void session_impl::on_tick(error_code const& e) {
     boost::mutex::scoped_lock l(m_mutex);
 
@@ -1056,8 +1204,17 @@ void session_impl::on_tick(error_code const& e) {
     m_timer.expires_from_now(milliseconds(m_settings.tick_interval), ec);
     m_timer.async_wait(bind(&session_impl::on_tick, this, _1));
 
-    m_download_rate.update_quotas(now - m_last_tick);
-    m_upload_rate.update_quotas(now - m_last_tick);
+    update_bandwidth(now);
+    arm_bandwidth_timer();
+
+    // resends and timeouts of uTP streams
+    m_utp_socket_manager.tick(now);
+
+    if (m_settings.aggregate_search_results &&
+        total_milliseconds(now - m_last_search_flush) >= m_settings.search_results_interval) {
+        m_last_search_flush = now;
+        post_search_results();
+    }
 
     m_last_tick = now;
 
@@ -1167,7 +1324,7 @@ void session_impl::connect_new_peers() {
     }
 }
 
-void session_impl::setup_socket_buffers(ip::tcp::socket& s) {
+void session_impl::setup_socket_buffers(socket_type& s) {
     error_code ec;
     if (m_settings.send_socket_buffer_size) {
         tcp::socket::send_buffer_size option(m_settings.send_socket_buffer_size);
@@ -1220,6 +1377,8 @@ session_impl::listen_socket_t session_impl::setup_listener(ip::tcp::endpoint ep,
 }
 
 void session_impl::post_search_request(search_request& ro) {
+    // a new server search replaces the previous one
+    if (m_settings.aggregate_search_results) m_search_aggregator.start(search_aggregator::server_search());
     m_server_connection->post_search_request(ro);
     BOOST_FOREACH (const slave_sc_vale& val, m_slave_sc) { val.second->post_search_request(ro); }
 }
@@ -1230,11 +1389,19 @@ void session_impl::post_search_more_result_request() {
 }
 
 void session_impl::post_cancel_search() {
+    m_search_aggregator.stop(search_aggregator::server_search());
     shared_files_list sl;
     m_server_connection->post_announce(sl);
     BOOST_FOREACH (const slave_sc_vale& val, m_slave_sc) { val.second->post_announce(sl); }
 }
 
+void session_impl::post_search_results() {
+    std::vector<search_results_delta> deltas;
+    m_search_aggregator.flush(deltas, time_now());
+    for (std::vector<search_results_delta>::const_iterator i = deltas.begin(); i != deltas.end(); ++i)
+        m_alerts.post_alert_should(search_results_alert(*i));
+}
+
 void session_impl::post_announce(shared_files_list& sl) {
     m_server_connection->post_announce(sl);
     BOOST_FOREACH (const slave_sc_vale& val, m_slave_sc) { val.second->post_announce(sl); }
@@ -1321,9 +1488,10 @@ void session_impl::update_rate_settings() {
 void session_impl::update_active_transfers() {
     for (transfer_map::iterator i = m_active_transfers.begin(), end(m_active_transfers.end()); i != end;) {
         transfer& t = *i->second;
-        if (!t.active() && t.last_active() > 20)
+        if (!t.active() && t.last_active() > 20) {
             remove_active_transfer(i++);
-        else
+            t.go_dormant();
+        } else
             ++i;
     }
 }
@@ -1617,6 +1785,7 @@ void session_impl::find_keyword(const std::string& keyword) {
     md4_hash target = hasher::from_string(keyword);
     if (m_active_dht_requests.find(target) == m_active_dht_requests.end()) {
         m_active_dht_requests.insert(target);
+        if (m_settings.aggregate_search_results) m_search_aggregator.start(target);
         if (m_dht)
             m_dht->search_keywords(target, listen_port(), boost::bind(&session_impl::on_traverse_completed, this, _1));
     } else {
@@ -1635,10 +1804,22 @@ void session_impl::find_sources(const md4_hash& hash, size_type size) {
     }
 }
 
+namespace {
+// the seconds Kad nodes have to answer a request, the rpc timeout
+const int kad_search_answers = 12;
+}
+
 void session_impl::on_traverse_completed(const kad_id& id) {
     DBG("traverse for " << id << " completed");
     size_t n = m_active_dht_requests.erase(id);
     LIBED2K_ASSERT(n == 1u);
+
+    // the traversal is done once the requests are out, keyword
+    // searches merge the answers coming in within the rpc timeout
+    if (m_settings.aggregate_search_results)
+        m_search_aggregator.finish(id, time_now() + seconds(kad_search_answers));
+    else
+        m_search_aggregator.stop(id);
     m_alerts.post_alert_should(dht_traverse_finished(id));
 }
 
@@ -1658,6 +1839,10 @@ void session_impl::on_find_dht_source(const md4_hash& hash, uint8_t type, client
 }
 
 void session_impl::on_find_dht_keyword(const md4_hash& h, const std::deque<kad_info_entry>& kk) {
+    // Kad nodes publish the same availability, keep the maximum
+    for (std::deque<kad_info_entry>::const_iterator i = kk.begin(); i != kk.end(); ++i)
+        m_search_aggregator.add(h, i->hash, i->tags, false);
+
     m_alerts.post_alert_should(dht_keyword_search_result_alert(h, kk));
 }
 
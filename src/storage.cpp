@@ -1261,6 +1261,7 @@ piece_manager::piece_manager(boost::shared_ptr<void> const& torrent, boost::intr
       m_scratch_piece(-1),
       m_last_piece(-1),
       m_storage_constructor(sc),
+      m_check_pool(0),
       m_io_thread(io),
       m_torrent(torrent) {
     m_storage->m_disk_pool = &m_io_thread;
@@ -1268,7 +1269,7 @@ piece_manager::piece_manager(boost::shared_ptr<void> const& torrent, boost::intr
 
 void piece_manager::finalize_file(int index) { m_storage->finalize_file(index); }
 
-piece_manager::~piece_manager() {}
+piece_manager::~piece_manager() { clear_check_window(); }
 
 void piece_manager::async_finalize_file(int file) {
     disk_io_job j;
@@ -1380,7 +1381,7 @@ void piece_manager::async_cache(int piece, boost::function<void(int, disk_io_job
 }
 
 void piece_manager::async_read(peer_request const& r, boost::function<void(int, disk_io_job const&)> const& handler,
-                               int cache_line_size, int cache_expiry) {
+                               int cache_line_size, int cache_expiry, int flags) {
     disk_io_job j;
     j.storage = this;
     j.action = disk_io_job::read;
@@ -1390,6 +1391,7 @@ void piece_manager::async_read(peer_request const& r, boost::function<void(int,
     j.buffer = 0;
     j.max_cache_line = cache_line_size;
     j.cache_min_time = cache_expiry;
+    j.flags = flags;
 
     // if a buffer is not specified, only one block can be read
     // since that is the size of the pool allocator's buffers
@@ -1919,7 +1921,7 @@ int piece_manager::check_fastresume(lazy_entry const& rd, error_code& error) {
 // the second return value is the progress the
 // file check is at. 0 is nothing done, and 1
 // is finished
-int piece_manager::check_files(int& current_slot, int& have_piece, error_code& error) {
+int piece_manager::check_files(int& current_slot, int& have_piece, error_code& error, hash_pool* pool) {
     if (m_state == state_none) return check_no_fastresume(error);
 
     LIBED2K_ASSERT(int(m_piece_to_slot.size()) == m_files.num_pieces());
@@ -2015,10 +2017,21 @@ int piece_manager::check_files(int& current_slot, int& have_piece, error_code& e
     LIBED2K_ASSERT(m_state == state_full_check);
     if (m_state == state_finished) return 0;
 
-    int skip = check_one_piece(have_piece);
+    // pieces may be read ahead only while nothing has to be moved
+    // between slots, otherwise slots are checked one by one
+    int skip = 0;
+    int read_ahead = m_storage->settings().file_checks_read_ahead;
+    if (pool && read_ahead > 0 && !m_out_of_place && m_storage_mode != internal_storage_mode_compact_deprecated) {
+        skip = check_one_piece(have_piece, *pool, read_ahead);
+        if (m_out_of_place) clear_check_window();
+    } else {
+        clear_check_window();
+        skip = check_one_piece(have_piece);
+    }
     LIBED2K_ASSERT(m_current_slot <= m_files.num_pieces());
 
     if (skip == -1) {
+        clear_check_window();
         error = m_storage->error();
         LIBED2K_ASSERT(error);
         return fatal_disk_error;
@@ -2046,6 +2059,14 @@ int piece_manager::check_files(int& current_slot, int& have_piece, error_code& e
     ++m_current_slot;
     current_slot = m_current_slot;
 
+    // drop slots read ahead which were skipped
+    while (!m_check_window.empty() && m_check_window.front()->slot < m_current_slot) {
+        if (m_check_window.front()->read == m_files.piece_size(m_check_window.front()->slot))
+            m_check_pool->wait(&m_check_window.front()->job);
+        delete m_check_window.front();
+        m_check_window.pop_front();
+    }
+
     if (m_current_slot >= m_files.num_pieces()) {
         LIBED2K_ASSERT(m_current_slot == m_files.num_pieces());
 
@@ -2094,6 +2115,73 @@ int piece_manager::skip_file() const {
     return ret;
 }
 
+void piece_manager::init_hash_to_piece() {
+    if (!m_hash_to_piece.empty()) return;
+    for (int i = 0; i < m_files.num_pieces(); ++i)
+        m_hash_to_piece.insert(std::pair<const md4_hash, int>(m_info->hash_for_piece(i), i));
+}
+
+int piece_manager::skip_unreadable() const {
+    if (m_storage->error()
+#ifdef LIBED2K_WINDOWS
+        && m_storage->error() != error_code(ERROR_PATH_NOT_FOUND, get_system_category()) &&
+        m_storage->error() != error_code(ERROR_FILE_NOT_FOUND, get_system_category()) &&
+        m_storage->error() != error_code(ERROR_HANDLE_EOF, get_system_category()) &&
+        m_storage->error() != error_code(ERROR_INVALID_HANDLE, get_system_category()))
+#else
+        && m_storage->error() != error_code(ENOENT, get_posix_category()))
+#endif
+    {
+        return -1;
+    }
+    // if the file is incomplete, skip the rest of it
+    return skip_file();
+}
+
+void piece_manager::fill_check_window(hash_pool& pool, int read_ahead) {
+    m_check_pool = &pool;
+    int num_pieces = m_files.num_pieces();
+    int small_piece_size = m_files.piece_size(num_pieces - 1);
+
+    while (int(m_check_window.size()) < read_ahead) {
+        int slot = m_current_slot;
+        if (!m_check_window.empty()) {
+            check_slot const* last = m_check_window.back();
+            // a slot which could not be read ends the window
+            if (last->read != m_files.piece_size(last->slot)) break;
+            slot = last->slot + 1;
+        }
+        if (slot >= num_pieces) break;
+
+        int piece_size = m_files.piece_size(slot);
+        check_slot* s = new check_slot(slot, piece_size);
+        m_check_window.push_back(s);
+
+        file::iovec_t b = {s->buffer.get(), size_t(piece_size)};
+        s->read = m_storage->readv(&b, slot, 0, 1);
+        if (s->read != piece_size) {
+            // keep the error for the time the slot is checked
+            s->error = m_storage->error();
+            s->error_file = m_storage->error_file();
+            clear_error();
+            break;
+        }
+
+        s->job.data = s->buffer.get();
+        s->job.size = piece_size;
+        if (piece_size != small_piece_size) s->job.small_size = small_piece_size;
+        pool.post(&s->job);
+    }
+}
+
+void piece_manager::clear_check_window() {
+    for (std::deque<check_slot*>::iterator i = m_check_window.begin(); i != m_check_window.end(); ++i) {
+        if ((*i)->read == m_files.piece_size((*i)->slot)) m_check_pool->wait(&(*i)->job);
+        delete *i;
+    }
+    m_check_window.clear();
+}
+
 // -1 = error, 0 = ok, >0 = skip this many pieces
 int piece_manager::check_one_piece(int& have_piece) {
     // ------------------------
@@ -2105,42 +2193,47 @@ int piece_manager::check_one_piece(int& have_piece) {
     LIBED2K_ASSERT(have_piece == -1);
 
     // initialization for the full check
-    if (m_hash_to_piece.empty()) {
-        for (int i = 0; i < m_files.num_pieces(); ++i)
-            m_hash_to_piece.insert(std::pair<const md4_hash, int>(m_info->hash_for_piece(i), i));
-    }
+    init_hash_to_piece();
 
     partial_hash ph;
     int num_read = 0;
     int piece_size = m_files.piece_size(m_current_slot);
     int small_piece_size = m_files.piece_size(m_files.num_pieces() - 1);
-    bool read_short = true;
     md4_hash small_hash;
     if (piece_size == small_piece_size) {
         num_read = hash_for_slot(m_current_slot, ph, piece_size, 0, 0);
     } else {
         num_read = hash_for_slot(m_current_slot, ph, piece_size, small_piece_size, &small_hash);
     }
-    read_short = num_read != piece_size;
 
-    if (read_short) {
-        if (m_storage->error()
-#ifdef LIBED2K_WINDOWS
-            && m_storage->error() != error_code(ERROR_PATH_NOT_FOUND, get_system_category()) &&
-            m_storage->error() != error_code(ERROR_FILE_NOT_FOUND, get_system_category()) &&
-            m_storage->error() != error_code(ERROR_HANDLE_EOF, get_system_category()) &&
-            m_storage->error() != error_code(ERROR_INVALID_HANDLE, get_system_category()))
-#else
-            && m_storage->error() != error_code(ENOENT, get_posix_category()))
-#endif
-        {
-            return -1;
-        }
-        // if the file is incomplete, skip the rest of it
-        return skip_file();
+    if (num_read != piece_size) return skip_unreadable();
+
+    return check_piece_hash(ph.h.final(), small_hash, have_piece);
+}
+
+// same as above, the slot is read ahead and hashed by the pool
+int piece_manager::check_one_piece(int& have_piece, hash_pool& pool, int read_ahead) {
+    LIBED2K_ASSERT(int(m_piece_to_slot.size()) == m_files.num_pieces());
+    LIBED2K_ASSERT(int(m_slot_to_piece.size()) == m_files.num_pieces());
+    LIBED2K_ASSERT(have_piece == -1);
+
+    init_hash_to_piece();
+    fill_check_window(pool, read_ahead);
+    LIBED2K_ASSERT(!m_check_window.empty() && m_check_window.front()->slot == m_current_slot);
+
+    boost::scoped_ptr<check_slot> s(m_check_window.front());
+    m_check_window.pop_front();
+
+    if (s->read != m_files.piece_size(m_current_slot)) {
+        m_storage->set_error(s->error_file, s->error);
+        return skip_unreadable();
     }
 
-    md4_hash large_hash = ph.h.final();
+    pool.wait(&s->job);
+    return check_piece_hash(s->job.hash, s->job.small_hash, have_piece);
+}
+
+int piece_manager::check_piece_hash(md4_hash const& large_hash, md4_hash const& small_hash, int& have_piece) {
     int piece_index = identify_data(large_hash, small_hash, m_current_slot);
 
     if (piece_index >= 0) have_piece = piece_index;
@@ -5,26 +5,32 @@
 #include "libed2k/peer.hpp"
 #include "libed2k/peer_connection.hpp"
 #include "libed2k/server_connection.hpp"
+#include "libed2k/instantiate_connection.hpp"
 #include "libed2k/constants.hpp"
 #include "libed2k/util.hpp"
 #include "libed2k/file.hpp"
 #include "libed2k/alert_types.hpp"
+#include "libed2k/bencode.hpp"
+#include "libed2k/event_log.hpp"
 
 namespace libed2k {
 /** fake constructor */
 transfer::transfer(aux::session_impl& ses, const std::vector<peer_entry>& pl, const md4_hash& hash,
                    const std::string& filepath, size_type size, const std::string& resource)
-    : m_ses(ses),
+    : m_bandwidth_class(-1),
+      m_ses(ses),
       m_save_path(parent_path(filepath)),
       m_complete(-1),
       m_incomplete(-1),
       m_policy(this),
       m_info(new transfer_info(hash, filename(filepath), size, std::vector<md4_hash>(), resource)),
-      m_minute_timer(minutes(1), min_time()) {}
+      m_minute_timer(minutes(1), min_time()),
+      m_download_start(min_time()) {}
 
 transfer::transfer(aux::session_impl& ses, ip::tcp::endpoint const& net_interface, int seq,
                    add_transfer_params const& p)
-    : m_ses(ses),
+    : m_bandwidth_class(-1),
+      m_ses(ses),
       m_announced(false),
       m_abort(false),
       m_paused(false),
@@ -36,6 +42,7 @@ transfer::transfer(aux::session_impl& ses, ip::tcp::endpoint const& net_interfac
       m_storage_mode(p.storage_mode),
       m_state(transfer_status::checking_resume_data),
       m_seed_mode(p.seed_mode),
+      m_dormant(false),
       m_upload_mode(false),
       m_eager_mode(false),
       m_auto_managed(false),
@@ -54,6 +61,7 @@ transfer::transfer(aux::session_impl& ses, ip::tcp::endpoint const& net_interfac
       m_total_failed_bytes(0),
       m_total_redundant_bytes(0),
       m_minute_timer(minutes(1), min_time()),
+      m_download_start(min_time()),
       m_need_save_resume_data(true),
       m_last_active(0) {
     if (p.resume_data) m_resume_data.swap(*p.resume_data);
@@ -114,6 +122,11 @@ void transfer::start() {
             std::vector<char>().swap(m_resume_data);
             m_ses.m_alerts.post_alert_should(fastresume_rejected_alert(handle(), errors::fast_resume_parse_error));
         }
+    } else if (m_ses.settings().dormant_seeds && m_storage_mode != storage_mode_compact) {
+        DBG("dormant transfer: {hash: " << hash() << ", file: " << name() << "}");
+        m_dormant = true;
+        set_state(transfer_status::seeding);
+        return;
     }
 
     init();
@@ -148,6 +161,11 @@ void transfer::set_state(transfer_status::state_t s) {
     m_ses.m_alerts.post_alert_should(state_changed_alert(handle(), s, m_state));
     m_state = s;
 
+    if (s == transfer_status::downloading) {
+        m_download_start = time_now_hires();
+        ++m_ses.m_metrics.counters[session_metrics::downloads_started];
+    }
+
     if (s != transfer_status::seeding) activate(true);
 }
 
@@ -189,10 +207,17 @@ bool transfer::connect_to_peer(peer* peerinfo) {
     peerinfo->last_connected = m_ses.session_time();
     peerinfo->next_connect = 0;
 
-    tcp::endpoint ep(peerinfo->endpoint);
+    tcp::endpoint ep(peerinfo->ip());
     LIBED2K_ASSERT((m_ses.m_ip_filter.access(peerinfo->address()) & ip_filter::blocked) == 0);
 
-    boost::shared_ptr<tcp::socket> sock(new tcp::socket(m_ses.m_io_service));
+    // peers that announced uTP get it, the stream yields to other
+    // traffic on the link instead of competing with it like TCP
+    utp_socket_manager* sm = 0;
+    if (peerinfo->supports_utp && m_ses.settings().enable_outgoing_utp && m_ses.m_udp_socket.is_open())
+        sm = &m_ses.m_utp_socket_manager;
+
+    boost::shared_ptr<socket_type> sock(new socket_type(m_ses.m_io_service));
+    instantiate_connection(m_ses.m_io_service, proxy_settings(), *sock, 0, sm, true);
     m_ses.setup_socket_buffers(*sock);
 
     boost::intrusive_ptr<peer_connection> c(new peer_connection(m_ses, shared_from_this(), sock, ep, peerinfo));
@@ -242,6 +267,8 @@ bool transfer::attach_peer(peer_connection* p) {
         p->disconnect(errors::session_closing);
         return false;
     }
+
+    wake_up();
     if (!m_policy.new_connection(*p, m_ses.session_time())) return false;
 
     LIBED2K_ASSERT(m_connections.find(p) == m_connections.end());
@@ -318,9 +345,11 @@ bool transfer::try_connect_peer() {
 }
 
 void transfer::piece_passed(int index) {
+    log_event(ev_piece_passed, index);
     bool was_finished = (num_have() == num_pieces());
     we_have(index);
     m_need_save_resume_data = true;
+    m_ses.m_resume_journal.have_piece(hash(), index);
 
     if (!was_finished && is_finished()) {
         // transfer finished
@@ -374,13 +403,17 @@ void transfer::completed() {
 // called when transfer is finished (all interesting pieces have been downloaded)
 void transfer::finished() {
     DBG("file transfer '" << hash() << ", " << name() << "' completed");
+    log_event(ev_transfer_finished, num_pieces());
     set_state(transfer_status::finished);
     // set_queue_position(-1);
 
     // we have to call completed() before we start
     // disconnecting peers, since there's an assert
     // to make sure we're cleared the piece picker
-    if (is_seed()) completed();
+    if (is_seed())
+        completed();
+    else
+        m_picker->compact();
 
     // disconnect all seeds
     std::vector<peer_connection*> seeds;
@@ -407,6 +440,12 @@ void transfer::add_stats(const stat& s) {
     m_stat += s;
 }
 
+void transfer::payload_received() {
+    if (m_download_start == min_time()) return;
+    m_ses.m_metrics.time_to_first_byte.add(total_microseconds(time_now_hires() - m_download_start));
+    m_download_start = min_time();
+}
+
 void transfer::set_upload_mode(bool b) {
     if (b == m_upload_mode) return;
 
@@ -425,9 +464,7 @@ void transfer::set_upload_mode(bool b) {
         m_upload_mode_time = 0;
     } else {
         // reset last_connected, to force fast reconnect after leaving upload mode
-        for (policy::peers_t::iterator i = m_policy.begin_peer(), end(m_policy.end_peer()); i != end; ++i) {
-            (*i)->last_connected = 0;
-        }
+        m_policy.reset_last_connected();
 
         // send_block_requests on all peers
         for (std::set<peer_connection *>::iterator i = m_connections.begin(), end(m_connections.end()); i != end; ++i) {
@@ -451,6 +488,8 @@ void transfer::do_pause() {
     if (!is_paused()) return;
     DBG("pause transfer {hash: " << hash() << "}");
 
+    m_download_start = min_time();
+
     state_updated();
 
     // this will make the storage close all
@@ -531,11 +570,13 @@ void transfer::move_storage(const std::string& save_path) {
     } else {
         m_ses.m_alerts.post_alert_should(storage_moved_alert(handle(), save_path));
         m_save_path = save_path;
+        m_ses.m_resume_journal.file_path(hash(), file_path());
     }
 }
 
 bool transfer::rename_file(const std::string& name) {
     DBG("renaming file in transfer {hash: " << hash() << ", from: " << transfer::name() << ", to: " << name << "}");
+    wake_up();
     if (!m_owning_storage.get()) return false;
 
     m_owning_storage->async_rename_file(0, name, boost::bind(&transfer::on_file_renamed, shared_from_this(), _1, _2));
@@ -545,6 +586,7 @@ bool transfer::rename_file(const std::string& name) {
 void transfer::delete_files() {
     DBG("deleting file in transfer {hash: " << hash() << ", files: " << name() << "}");
     disconnect_all(errors::transfer_removed);
+    wake_up();
 
     if (m_owning_storage.get()) {
         LIBED2K_ASSERT(m_storage);
@@ -570,7 +612,11 @@ void transfer::set_piece_priority(int index, int priority) {
     LIBED2K_ASSERT(index < int(num_pieces()));
     if (index < 0 || index >= int(num_pieces())) return;
 
-    if (m_picker->set_piece_priority(index, priority)) m_need_save_resume_data = true;
+    if (priority > 0 && !m_picker->have_piece(index)) expand_picker();
+    if (m_picker->set_piece_priority(index, priority)) {
+        m_need_save_resume_data = true;
+        m_ses.m_resume_journal.piece_priority(hash(), index, priority);
+    }
 }
 
 int transfer::piece_priority(int index) const {
@@ -609,7 +655,24 @@ void transfer::set_priority(int prio) {
 
 void transfer::set_sequential_download(bool sd) { m_sequential_download = sd; }
 
+void transfer::expand_picker() {
+    if (!m_picker->is_compact()) return;
+    m_picker->expand();
+
+    // compact picker doesn't count availability, take it from peers again
+    for (std::set<peer_connection*>::const_iterator i = m_connections.begin(); i != m_connections.end(); ++i) {
+        peer_connection* c = *i;
+        if (c->is_seed()) {
+            m_picker->inc_refcount_all();
+        } else {
+            const bitfield& pieces = c->remote_pieces();
+            if (pieces.size() > 0) m_picker->inc_refcount(pieces);
+        }
+    }
+}
+
 void transfer::piece_failed(int index) {
+    log_event(ev_piece_failed, index);
     LIBED2K_ASSERT(m_storage);
     LIBED2K_ASSERT(m_storage->refcount() > 0);
     LIBED2K_ASSERT(m_picker);
@@ -860,6 +923,7 @@ void transfer::on_storage_moved(int ret, disk_io_job const& j) {
         DBG("storage successfully moved {hash: " << hash() << ", to: " << j.str << "}");
         m_ses.m_alerts.post_alert_should(storage_moved_alert(handle(), j.str));
         m_save_path = j.str;
+        m_ses.m_resume_journal.file_path(hash(), file_path());
     } else {
         DBG("storage move failed {hash: " << hash() << ", err: " << j.error << "}");
         m_ses.m_alerts.post_alert_should(storage_moved_failed_alert(handle(), j.error));
@@ -880,15 +944,7 @@ void transfer::on_transfer_paused(int ret, disk_io_job const& j) {
 void transfer::init() {
     DBG("init transfer: {hash: " << hash() << ", file: " << name() << "}");
 
-    // we have only one file with normal priority
-    std::vector<boost::uint8_t> file_prio;
-    file_prio.push_back(1);
-
-    // the shared_from_this() will create an intentional
-    // cycle of ownership, see the hpp file for description.
-    m_owning_storage = new piece_manager(shared_from_this(), m_info, m_save_path, m_ses.m_filepool, m_ses.m_disk_thread,
-                                         default_storage_constructor, m_storage_mode, file_prio);
-    m_storage = m_owning_storage.get();
+    create_storage();
 
     if (has_picker()) {
         int blocks_per_piece = div_ceil(PIECE_SIZE, BLOCK_SIZE);
@@ -930,6 +986,40 @@ void transfer::init() {
     }
 }
 
+void transfer::create_storage() {
+    // we have only one file with normal priority
+    std::vector<boost::uint8_t> file_prio;
+    file_prio.push_back(1);
+
+    // the shared_from_this() will create an intentional
+    // cycle of ownership, see the hpp file for description.
+    m_owning_storage = new piece_manager(shared_from_this(), m_info, m_save_path, m_ses.m_filepool, m_ses.m_disk_thread,
+                                         default_storage_constructor, m_storage_mode, file_prio);
+    m_storage = m_owning_storage.get();
+}
+
+void transfer::wake_up() {
+    if (!m_dormant || m_abort) return;
+    DBG("wake up transfer: {hash: " << hash() << ", file: " << name() << "}");
+    m_dormant = false;
+    // seed storage needs no check, pieces are read in place
+    create_storage();
+}
+
+void transfer::go_dormant() {
+    if (m_dormant || m_abort || !m_ses.settings().dormant_seeds) return;
+    if (has_picker() || m_state != transfer_status::seeding || m_storage_mode == storage_mode_compact) return;
+    if (!m_connections.empty() || !m_owning_storage) return;
+
+    DBG("transfer goes dormant: {hash: " << hash() << ", file: " << name() << "}");
+    // released piece_manager holds the transfer until the job is done
+    m_storage->async_release_files();
+    m_storage->async_clear_read_cache();
+    m_owning_storage = 0;
+    m_storage = 0;
+    m_dormant = true;
+}
+
 void transfer::on_resume_data_checked(int ret, disk_io_job const& j) {
     boost::mutex::scoped_lock l(m_ses.m_mutex);
 
@@ -974,6 +1064,15 @@ void transfer::on_resume_data_checked(int ret, disk_io_job const& j) {
                 }
             }
 
+            lazy_entry const* prio = m_resume_entry.dict_find_string("piece_priority");
+            if (prio && !is_seed() && prio->string_length() == int(this->num_pieces())) {
+                char const* prio_str = prio->string_ptr();
+                for (int i = 0, end(prio->string_length()); i < end; ++i) {
+                    if (prio_str[i] > 0 && !m_picker->have_piece(i)) expand_picker();
+                    m_picker->set_piece_priority(i, prio_str[i]);
+                }
+            }
+
             // parse unfinished pieces
             const int num_blocks_per_piece = div_ceil(PIECE_SIZE, BLOCK_SIZE);
 
@@ -984,7 +1083,10 @@ void transfer::on_resume_data_checked(int ret, disk_io_job const& j) {
                     int piece = e->dict_find_int_value("piece", -1);
                     if (piece < 0 || piece > num_pieces) continue;
 
-                    if (m_picker->have_piece(piece)) m_picker->we_dont_have(piece);
+                    if (m_picker->have_piece(piece)) {
+                        expand_picker();
+                        m_picker->we_dont_have(piece);
+                    }
 
                     std::string bitmask = e->dict_find_string_value("bitmask");
                     if (bitmask.empty()) continue;
@@ -1015,6 +1117,9 @@ void transfer::on_resume_data_checked(int ret, disk_io_job const& j) {
         }
 
         file_checked();
+
+        if (m_ses.m_resume_journal.is_open() && !m_ses.m_resume_journal.has_transfer(hash()))
+            save_resume_data(transfer_handle::journal_only);
     } else if (m_info->is_valid()) {
         DBG("resume data check fails: {hash: " << hash() << ", file: " << name() << "}, metadata: valid");
         set_state(transfer_status::queued_for_checking);
@@ -1213,39 +1318,65 @@ shared_file_entry transfer::get_announce() const {
 }
 
 void transfer::save_resume_data(int flags) {
+    if (m_dormant) {
+        // seed resume data doesn't depend on storage state
+        boost::shared_ptr<entry> rd(new entry);
+        write_resume_data(*rd);
+        journal_resume_data(*rd);
+        if (!(flags & transfer_handle::journal_only)) {
+            m_need_save_resume_data = false;
+            m_ses.m_alerts.post_alert_should(save_resume_data_alert(rd, handle()));
+        }
+        return;
+    }
+
     if (!m_owning_storage.get()) {
         m_ses.m_alerts.post_alert_should(save_resume_data_failed_alert(handle(), errors::destructing_transfer));
         return;
     }
 
-    m_need_save_resume_data = false;
+    if (!(flags & transfer_handle::journal_only)) m_need_save_resume_data = false;
 
     LIBED2K_ASSERT(m_storage);
     if (m_state == transfer_status::queued_for_checking || m_state == transfer_status::checking_files ||
         m_state == transfer_status::checking_resume_data) {
         boost::shared_ptr<entry> rd(new entry);
         write_resume_data(*rd);
-        m_ses.m_alerts.post_alert_should(save_resume_data_alert(rd, handle()));
+        journal_resume_data(*rd);
+        if (!(flags & transfer_handle::journal_only))
+            m_ses.m_alerts.post_alert_should(save_resume_data_alert(rd, handle()));
         return;
     }
 
     if (flags & transfer_handle::flush_disk_cache) m_storage->async_release_files();
 
-    m_storage->async_save_resume_data(boost::bind(&transfer::on_save_resume_data, shared_from_this(), _1, _2));
+    m_storage->async_save_resume_data(
+        boost::bind(&transfer::on_save_resume_data, shared_from_this(), _1, _2, flags));
 }
 
-void transfer::on_save_resume_data(int ret, disk_io_job const& j) {
+void transfer::on_save_resume_data(int ret, disk_io_job const& j, int flags) {
     boost::mutex::scoped_lock l(m_ses.m_mutex);
 
     if (!j.resume_data) {
-        m_ses.m_alerts.post_alert_should(save_resume_data_failed_alert(handle(), j.error));
+        if (!(flags & transfer_handle::journal_only))
+            m_ses.m_alerts.post_alert_should(save_resume_data_failed_alert(handle(), j.error));
     } else {
-        m_need_save_resume_data = false;
+        if (!(flags & transfer_handle::journal_only)) m_need_save_resume_data = false;
         write_resume_data(*j.resume_data);
-        m_ses.m_alerts.post_alert_should(save_resume_data_alert(j.resume_data, handle()));
+        journal_resume_data(*j.resume_data);
+        if (!(flags & transfer_handle::journal_only))
+            m_ses.m_alerts.post_alert_should(save_resume_data_alert(j.resume_data, handle()));
     }
 }
 
+void transfer::journal_resume_data(entry const& rd) {
+    if (!m_ses.m_resume_journal.is_open()) return;
+
+    std::vector<char> data;
+    bencode(std::back_inserter(data), rd);
+    m_ses.m_resume_journal.add_transfer(transfer_resume_data(hash(), file_path(), size(), is_seed(), data));
+}
+
 bool transfer::should_check_file() const {
     return (m_state == transfer_status::checking_files || m_state == transfer_status::queued_for_checking) &&
            !m_paused && !has_error() && !m_abort && !m_ses.is_paused();
@@ -1324,6 +1455,9 @@ void transfer::on_piece_checked(int ret, disk_io_job const& j) {
 
     dequeue_transfer_check();
     file_checked();
+
+    // pieces found by the check replace those in the journal
+    if (m_ses.m_resume_journal.is_open()) save_resume_data(transfer_handle::journal_only);
 }
 
 void transfer::queue_transfer_check() {
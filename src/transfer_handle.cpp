@@ -110,6 +110,10 @@ void transfer_handle::set_download_limit(int limit) const { LIBED2K_FORWARD(set_
 
 int transfer_handle::download_limit() const { LIBED2K_FORWARD_RETURN(download_limit(), 0); }
 
+void transfer_handle::set_bandwidth_class(int c) const { LIBED2K_FORWARD(set_bandwidth_class(c)); }
+
+int transfer_handle::bandwidth_class() const { LIBED2K_FORWARD_RETURN(bandwidth_class(), -1); }
+
 void transfer_handle::set_upload_mode(bool b) const { LIBED2K_FORWARD(set_upload_mode(b)); }
 
 void transfer_handle::set_eager_mode(bool b) const { LIBED2K_FORWARD(set_eager_mode(b)); }
@@ -0,0 +1,32 @@
+#include <cstdlib>
+#include <map>
+#include "bench.hpp"
+
+namespace {
+typedef std::map<std::string, bench_fun> bench_map;
+
+bench_map& benchmarks() {
+    static bench_map m;
+    return m;
+}
+}
+
+bench_registrar::bench_registrar(const char* name, bench_fun f) { benchmarks()[name] = f; }
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: bench <name|all> [iterations]" << std::endl << "Benchmarks:" << std::endl;
+        for (bench_map::const_iterator i = benchmarks().begin(); i != benchmarks().end(); ++i)
+            std::cerr << "  " << i->first << std::endl;
+        return 1;
+    }
+
+    std::string name = argv[1];
+    int iterations = (argc > 2) ? std::atoi(argv[2]) : 0;
+
+    for (bench_map::const_iterator i = benchmarks().begin(); i != benchmarks().end(); ++i) {
+        if (name == "all" || name == i->first) i->second(iterations);
+    }
+
+    return 0;
+}
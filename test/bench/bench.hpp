@@ -0,0 +1,45 @@
+#ifndef __LIBED2K_BENCH__
+#define __LIBED2K_BENCH__
+
+#include <iostream>
+#include <string>
+#include <boost/cstdint.hpp>
+#include "libed2k/time.hpp"
+
+/**
+  * tiny registry for offline benchmarks, every benchmark is a
+  * function registered by name and run from bench's main
+ */
+typedef void (*bench_fun)(int iterations);
+
+struct bench_registrar {
+    bench_registrar(const char* name, bench_fun f);
+};
+
+#define LIBED2K_BENCHMARK(name)                                      \
+    static void bench_##name(int iterations);                        \
+    static bench_registrar bench_registrar_##name(#name, &bench_##name); \
+    static void bench_##name(int iterations)
+
+/**
+  * prints elapsed time and per-operation cost when it goes out of scope
+ */
+class bench_timer {
+   public:
+    bench_timer(const std::string& name, boost::uint64_t operations)
+        : m_name(name), m_operations(operations), m_start(libed2k::time_now_hires()) {}
+
+    ~bench_timer() {
+        boost::int64_t us = libed2k::total_microseconds(libed2k::time_now_hires() - m_start);
+        std::cout << m_name << ": " << m_operations << " ops in " << us << " us";
+        if (m_operations > 0) std::cout << " (" << double(us) * 1000 / m_operations << " ns/op)";
+        std::cout << std::endl;
+    }
+
+   private:
+    std::string m_name;
+    boost::uint64_t m_operations;
+    libed2k::ptime m_start;
+};
+
+#endif
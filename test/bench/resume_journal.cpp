@@ -0,0 +1,119 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "bench.hpp"
+#include "libed2k/bencode.hpp"
+#include "libed2k/entry.hpp"
+#include "libed2k/file.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/resume_journal.hpp"
+
+using namespace libed2k;
+
+namespace {
+const int pieces = 40;
+
+md4_hash transfer_hash(int i) {
+    hasher h;
+    h.update(reinterpret_cast<const char*>(&i), sizeof(i));
+    return h.final();
+}
+
+// resume data of a half downloaded transfer of 40 pieces
+std::vector<char> make_resume_data() {
+    entry rd;
+    rd["file-format"] = "libed2k resume file";
+    rd["file-version"] = 1;
+    rd["total_uploaded"] = 123456;
+    rd["total_downloaded"] = 7654321;
+    rd["pieces"] = std::string(pieces / 2, '\1') + std::string(pieces / 2, '\0');
+    rd["piece_priority"] = std::string(pieces, '\1');
+    rd["unfinished"] = entry::list_type();
+    rd["hashset-values"] = entry::list_type();
+    for (int i = 0; i < pieces; ++i) rd["hashset-values"].list().push_back(transfer_hash(-i).toString());
+    rd["file sizes"] = entry::list_type();
+    rd["slots"] = entry::list_type();
+
+    std::vector<char> data;
+    bencode(std::back_inserter(data), rd);
+    return data;
+}
+}
+
+LIBED2K_BENCHMARK(resume_journal) {
+    const int transfers = (iterations > 0) ? iterations : 100000;
+    const std::string dir = "bench_resume";
+    const std::string journal = "bench_resume.journal";
+    const std::vector<char> data = make_resume_data();
+    error_code ec;
+
+    remove_all(dir, ec);
+    remove(journal, ec);
+    ec.clear();
+    create_directory(dir, ec);
+
+    std::cout << "transfers: " << transfers << " resume data: " << data.size() << " bytes" << std::endl;
+
+    // one file with full resume data per transfer, written on every shutdown
+    {
+        bench_timer t("files::shutdown", transfers);
+        for (int i = 0; i < transfers; ++i) {
+            transfer_resume_data trd(transfer_hash(i), "/downloads/file", size_type(pieces) * PIECE_SIZE, false, data);
+            std::ofstream out(combine_path(dir, trd.m_hash.toString()).c_str(), std::ios_base::binary);
+            archive::ed2k_oarchive ar(out);
+            ar << trd;
+        }
+    }
+
+    size_t restored = 0;
+    {
+        bench_timer t("files::startup", transfers);
+        for (int i = 0; i < transfers; ++i) {
+            std::ifstream in(combine_path(dir, transfer_hash(i).toString()).c_str(), std::ios_base::binary);
+            if (!in) continue;
+            transfer_resume_data trd;
+            archive::ed2k_iarchive ar(in);
+            ar >> trd;
+            ++restored;
+        }
+    }
+    std::cout << "restored from files: " << restored << std::endl;
+
+    // journal gets the snapshot once, later only piece completions
+    {
+        resume_journal j;
+        std::vector<transfer_resume_data> loaded;
+        j.open(journal, loaded, ec);
+        bench_timer t("journal::add", transfers);
+        for (int i = 0; i < transfers; ++i)
+            j.add_transfer(
+                transfer_resume_data(transfer_hash(i), "/downloads/file", size_type(pieces) * PIECE_SIZE, false, data));
+    }
+
+    {
+        resume_journal j;
+        std::vector<transfer_resume_data> loaded;
+        j.open(journal, loaded, ec);
+        for (int i = 0; i < transfers; ++i) {
+            md4_hash h = transfer_hash(i);
+            for (int p = pieces / 2; p < pieces / 2 + 4; ++p) j.have_piece(h, p);
+        }
+
+        bench_timer t("journal::shutdown", transfers);
+        j.close();
+    }
+
+    {
+        resume_journal j;
+        std::vector<transfer_resume_data> loaded;
+        {
+            bench_timer t("journal::startup", transfers);
+            j.open(journal, loaded, ec);
+        }
+        std::cout << "restored from journal: " << loaded.size() << " journal: " << file_size(journal) << " bytes"
+                  << (ec ? " error: " + ec.message() : std::string()) << std::endl;
+    }
+
+    remove_all(dir, ec);
+    remove(journal, ec);
+}
@@ -0,0 +1,67 @@
+#ifndef LIBED2K_DISABLE_DHT
+
+#include <vector>
+#include "bench.hpp"
+#include "libed2k/session_settings.hpp"
+#include "libed2k/kademlia/routing_table.hpp"
+#include "libed2k/kademlia/node_id.hpp"
+
+using namespace libed2k;
+using namespace libed2k::dht;
+
+static void collect_node(void* userdata, node_entry const& e) {
+    static_cast<std::vector<node_entry>*>(userdata)->push_back(e);
+}
+
+LIBED2K_BENCHMARK(routing_table) {
+    if (iterations == 0) iterations = 100000;
+
+    dht_settings settings;
+    settings.restrict_routing_ips = false;
+    routing_table table(generate_random_id(), 10, settings);
+
+    std::vector<udp::endpoint> endpoints;
+    std::vector<node_id> ids;
+    for (int i = 0; i < 5000; ++i) {
+        endpoints.push_back(udp::endpoint(address_v4(0x0a000000 + i * 7), 4672));
+        ids.push_back(generate_random_id());
+    }
+
+    {
+        bench_timer t("routing_table::node_seen (fill)", ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) table.node_seen(ids[i], endpoints[i]);
+    }
+
+    std::cout << "nodes in table: " << table.size().get<0>() << " replacements: " << table.size().get<1>()
+              << std::endl;
+
+    {
+        // a burst of responses from random nodes, most of them end up
+        // churning the replacement cache
+        bench_timer t("routing_table::node_seen (burst)", iterations);
+        for (int i = 0; i < iterations; ++i) {
+            size_t n = i % ids.size();
+            table.node_seen(ids[n], endpoints[n]);
+        }
+    }
+
+    std::vector<node_entry> known;
+    table.for_each_node(&collect_node, &collect_node, &known);
+
+    {
+        // a burst of responses from nodes already in the table
+        bench_timer t("routing_table::node_seen (known)", iterations);
+        for (int i = 0; i < iterations; ++i) {
+            node_entry const& e = known[i % known.size()];
+            table.node_seen(e.id, e.ep());
+        }
+    }
+
+    std::vector<node_entry> res;
+    {
+        bench_timer t("routing_table::find_node", iterations);
+        for (int i = 0; i < iterations; ++i) table.find_node(ids[i % ids.size()], res, 0);
+    }
+}
+
+#endif
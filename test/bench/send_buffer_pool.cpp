@@ -0,0 +1,55 @@
+#include <vector>
+#include <boost/pool/pool.hpp>
+#include "bench.hpp"
+#include "libed2k/send_buffer_pool.hpp"
+
+using namespace libed2k;
+
+namespace {
+const int connections = 5000;
+
+// message sizes of a busy session, mostly small control packets
+int message_size(int i) {
+    static const int sizes[] = {6, 30, 64, 200, 6, 1000, 120, 6, 3000, 10240};
+    return sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+}
+}
+
+LIBED2K_BENCHMARK(send_buffer_pool) {
+    // one round of the ordered pool takes seconds
+    if (iterations == 0) iterations = 1;
+    const int per_round = connections * 4;
+
+    // the old allocator: multiples of 128 bytes from an ordered pool
+    {
+        boost::pool<> pool(128);
+        std::vector<std::pair<char*, int> > bufs;
+        bench_timer t("ordered_pool", boost::uint64_t(per_round) * iterations);
+        for (int r = 0; r < iterations; ++r) {
+            for (int i = 0; i < per_round; ++i) {
+                int n = (message_size(i + r) + 127) / 128;
+                bufs.push_back(std::make_pair((char*)pool.ordered_malloc(n), n));
+            }
+            // connections drain in a different order than they filled
+            for (int i = 0; i < per_round; ++i) {
+                std::pair<char*, int>& b = bufs[(i * 7919) % per_round];
+                pool.ordered_free(b.first, b.second);
+            }
+            bufs.clear();
+        }
+    }
+
+    {
+        send_buffer_pool pool;
+        std::vector<std::pair<char*, int> > bufs;
+        bench_timer t("send_buffer_pool", boost::uint64_t(per_round) * iterations);
+        for (int r = 0; r < iterations; ++r) {
+            for (int i = 0; i < per_round; ++i) bufs.push_back(pool.allocate(message_size(i + r)));
+            for (int i = 0; i < per_round; ++i) {
+                std::pair<char*, int>& b = bufs[(i * 7919) % per_round];
+                pool.free(b.first, b.second);
+            }
+            bufs.clear();
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#include <sstream>
+#include <vector>
+#include "bench.hpp"
+#include "libed2k/ctag.hpp"
+#include "libed2k/compact_tag_list.hpp"
+
+using namespace libed2k;
+
+namespace {
+// tags of a typical search result entry
+tag_list<boost::uint32_t> make_file_tags(int i) {
+    tag_list<boost::uint32_t> tags;
+    std::ostringstream name;
+    name << "Some.Artist-Some.Album.Track." << i << ".mp3";
+    tags.add_tag(make_string_tag(name.str(), FT_FILENAME, true));
+    tags.add_tag(make_typed_tag(boost::uint32_t(3000000 + i), FT_FILESIZE, true));
+    tags.add_tag(make_typed_tag(boost::uint32_t(i % 200), FT_SOURCES, true));
+    tags.add_tag(make_typed_tag(boost::uint32_t(i % 50), FT_COMPLETE_SOURCES, true));
+    tags.add_tag(make_string_tag(std::string("Audio"), FT_FILETYPE, true));
+    tags.add_tag(make_string_tag(std::string("Some Artist"), FT_MEDIA_ARTIST, true));
+    tags.add_tag(make_string_tag(std::string("Some Album"), FT_MEDIA_ALBUM, true));
+    tags.add_tag(make_typed_tag(boost::uint32_t(180 + i % 120), FT_MEDIA_LENGTH, true));
+    tags.add_tag(make_typed_tag(boost::uint16_t(192), FT_MEDIA_BITRATE, true));
+    tags.add_tag(make_string_tag(std::string("mp3"), FT_MEDIA_CODEC, true));
+    return tags;
+}
+
+template <typename List>
+boost::uint64_t parse(const std::string& buffer, int lists, int iterations) {
+    boost::uint64_t sources = 0;
+    for (int i = 0; i < iterations; ++i) {
+        std::istringstream in(buffer, std::ios_base::binary);
+        archive::ed2k_iarchive ar(in);
+        for (int n = 0; n < lists; ++n) {
+            List tags;
+            ar >> tags;
+            sources += tags.getIntTagByNameId(FT_SOURCES) + tags.getStringTagByNameId(FT_FILENAME).size();
+        }
+    }
+    return sources;
+}
+}
+
+LIBED2K_BENCHMARK(tag_list) {
+    if (iterations == 0) iterations = 20;
+    const int lists = 5000;
+
+    std::ostringstream out(std::ios_base::binary);
+    archive::ed2k_oarchive ar(out);
+    for (int i = 0; i < lists; ++i) {
+        tag_list<boost::uint32_t> tags = make_file_tags(i);
+        ar << tags;
+    }
+    std::string buffer = out.str();
+    std::cout << "lists: " << lists << " bytes: " << buffer.size() << std::endl;
+
+    boost::uint64_t r1, r2;
+    {
+        bench_timer t("tag_list::load", boost::uint64_t(lists) * iterations);
+        r1 = parse<tag_list<boost::uint32_t> >(buffer, lists, iterations);
+    }
+
+    {
+        bench_timer t("compact_tag_list::load", boost::uint64_t(lists) * iterations);
+        r2 = parse<compact_tag_list<boost::uint32_t> >(buffer, lists, iterations);
+    }
+
+    if (r1 != r2) std::cout << "results differ: " << r1 << " " << r2 << std::endl;
+
+    tag_list<boost::uint32_t> tags = make_file_tags(1);
+    compact_tag_list<boost::uint32_t> compact(tags);
+    boost::uint64_t found = 0;
+    {
+        bench_timer t("tag_list::getIntTagByNameId", boost::uint64_t(lists) * iterations);
+        for (int i = 0; i < lists * iterations; ++i) found += tags.getIntTagByNameId(FT_MEDIA_BITRATE);
+    }
+
+    {
+        bench_timer t("compact_tag_list::getIntTagByNameId", boost::uint64_t(lists) * iterations);
+        for (int i = 0; i < lists * iterations; ++i) found += compact.getIntTagByNameId(FT_MEDIA_BITRATE);
+    }
+
+    std::cout << "lookups: " << found << std::endl;
+}
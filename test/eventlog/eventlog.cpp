@@ -0,0 +1,85 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "libed2k/event_log.hpp"
+
+using namespace libed2k;
+
+namespace {
+void print_ip(boost::int32_t a) {
+    boost::uint32_t ip = boost::uint32_t(a);
+    std::printf("%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+}
+
+void print_record(const event_record& e) {
+    const event_info* info = describe_event(e.id);
+
+    std::printf("%4u.%06u [%2u] ", unsigned(e.time / 1000000), unsigned(e.time % 1000000), unsigned(e.thread));
+    if (info)
+        std::printf("%-18s", info->name);
+    else
+        std::printf("event_%-12x", unsigned(e.id));
+
+    for (int i = 0; i < 5; ++i) {
+        const char* arg = info ? info->args[i] : 0;
+        if (info && !arg) break;
+        if (!info && e.arg[i] == 0) continue;
+
+        std::printf(" %s=", arg ? arg : "?");
+        if (arg && std::strcmp(arg, "ip") == 0)
+            print_ip(e.arg[i]);
+        else
+            std::printf("%d", e.arg[i]);
+    }
+    std::printf("\n");
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: eventlog <event log> [event name...]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios_base::binary);
+    if (!in) {
+        std::cerr << "can't open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    event_log_header h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || std::memcmp(h.magic, "L2KE", 4) != 0) {
+        std::cerr << argv[1] << " is not an event log" << std::endl;
+        return 1;
+    }
+
+    if (h.byte_order != event_log_byte_order || h.record_size != sizeof(event_record)) {
+        std::cerr << "event log was written on a host of another byte order or version" << std::endl;
+        return 1;
+    }
+
+    std::set<std::string> names;
+    for (int i = 2; i < argc; ++i) names.insert(argv[i]);
+
+    std::time_t start = std::time_t(h.start);
+    std::printf("event log version %u opened %s", unsigned(h.version), std::ctime(&start));
+
+    event_record e;
+    size_t records = 0;
+    while (in.read(reinterpret_cast<char*>(&e), sizeof(e))) {
+        ++records;
+        if (!names.empty()) {
+            const event_info* info = describe_event(e.id);
+            if (!info || names.count(info->name) == 0) continue;
+        }
+        print_record(e);
+    }
+
+    std::printf("%u records\n", unsigned(records));
+    return 0;
+}
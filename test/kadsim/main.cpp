@@ -0,0 +1,139 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "libed2k/time.hpp"
+#include "network.hpp"
+
+using namespace kadsim;
+
+namespace {
+void usage() {
+    std::cerr << "Usage: kadsim [options]" << std::endl
+              << "  --nodes N          number of Kad nodes (1000)" << std::endl
+              << "  --seed N           random seed, equal seeds give equal runs (1)" << std::endl
+              << "  --latency MS       mean one way latency (50)" << std::endl
+              << "  --jitter MS        random extra latency per packet (20)" << std::endl
+              << "  --loss PERCENT     packet loss (0)" << std::endl
+              << "  --contacts N       known nodes of a joining node (8)" << std::endl
+              << "  --warmup S         simulated seconds before the lookups (300)" << std::endl
+              << "  --lookups N        number of lookups (200)" << std::endl
+              << "  --timeout S        lookup timeout in simulated seconds (60)" << std::endl
+              << "  --branching N      dht_settings::search_branching" << std::endl
+              << "  --max-branching N  dht_settings::max_search_branching" << std::endl
+              << "  --quorum N         dht_settings::search_quorum" << std::endl;
+}
+
+int percentile(std::vector<int> const& sorted, int p) {
+    if (sorted.empty()) return 0;
+    return sorted[(std::min)(sorted.size() - 1, sorted.size() * p / 100)];
+}
+}
+
+int main(int argc, char* argv[]) {
+    config cfg;
+    libed2k::dht_settings settings;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) {
+            usage();
+            return 1;
+        }
+        std::string opt = argv[i];
+        int value = std::atoi(argv[++i]);
+        if (opt == "--nodes")
+            cfg.nodes = value;
+        else if (opt == "--seed")
+            cfg.seed = value;
+        else if (opt == "--latency")
+            cfg.latency = value;
+        else if (opt == "--jitter")
+            cfg.jitter = value;
+        else if (opt == "--loss")
+            cfg.loss = value;
+        else if (opt == "--contacts")
+            cfg.bootstrap_contacts = value;
+        else if (opt == "--warmup")
+            cfg.warmup = value;
+        else if (opt == "--lookups")
+            cfg.lookups = value;
+        else if (opt == "--timeout")
+            cfg.lookup_timeout = value;
+        else if (opt == "--branching")
+            settings.search_branching = value;
+        else if (opt == "--max-branching")
+            settings.max_search_branching = value;
+        else if (opt == "--quorum")
+            settings.search_quorum = value;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (cfg.nodes < 2) {
+        usage();
+        return 1;
+    }
+
+    std::cout << "nodes: " << cfg.nodes << " seed: " << cfg.seed << " latency: " << cfg.latency
+              << "ms jitter: " << cfg.jitter << "ms loss: " << cfg.loss << "% branching: " << settings.search_branching
+              << "/" << settings.max_search_branching << " quorum: " << settings.search_quorum << std::endl;
+
+    libed2k::ptime start = libed2k::time_now_hires();
+    network net(cfg, settings);
+
+    net.warmup();
+    std::cout << std::endl << "routing tables" << std::endl;
+    std::cout << std::setw(8) << "time" << std::setw(12) << "live" << std::setw(14) << "replacements"
+              << std::setw(13) << "neighbours" << std::endl;
+    for (std::vector<convergence_sample>::const_iterator i = net.convergence().begin(), end(net.convergence().end());
+         i != end; ++i) {
+        std::cout << std::setw(7) << i->time << "s" << std::fixed << std::setprecision(1) << std::setw(12)
+                  << i->live_nodes << std::setw(14) << i->replacements << std::setw(12) << i->neighbours * 100 << "%"
+                  << std::endl;
+    }
+
+    net.run_lookups();
+
+    std::vector<int> latencies;
+    double requests = 0;
+    double found = 0;
+    for (std::vector<lookup_result>::const_iterator i = net.lookups().begin(), end(net.lookups().end()); i != end;
+         ++i) {
+        requests += i->requests;
+        if (!i->finished) continue;
+        latencies.push_back(i->latency);
+        found += i->found;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << std::endl
+              << "lookups: " << net.lookups().size() << " finished: " << latencies.size() << std::endl;
+    if (!latencies.empty()) {
+        std::cout << "latency ms: min " << latencies.front() << " p50 " << percentile(latencies, 50) << " p90 "
+                  << percentile(latencies, 90) << " p99 " << percentile(latencies, 99) << " max "
+                  << latencies.back() << std::endl;
+        std::cout << "closest nodes found: " << std::setprecision(1) << found * 10 / latencies.size() << "%"
+                  << std::endl;
+    }
+    if (!net.lookups().empty())
+        std::cout << "requests per lookup: " << std::setprecision(1) << requests / net.lookups().size() << std::endl;
+
+    std::cout << std::endl << "packets" << std::endl;
+    std::cout << std::setw(28) << "type" << std::setw(12) << "sent" << std::setw(12) << "lost" << std::setw(12)
+              << "unhandled" << std::setw(14) << "bytes" << std::endl;
+    for (std::map<int, counters>::const_iterator i = net.packets().begin(), end(net.packets().end()); i != end;
+         ++i) {
+        std::cout << std::setw(28) << libed2k::kad2string(i->first) << std::setw(12) << i->second.sent
+                  << std::setw(12) << i->second.lost << std::setw(12) << i->second.unhandled << std::setw(14)
+                  << i->second.bytes << std::endl;
+    }
+
+    std::cout << std::endl
+              << "simulated " << net.now() / 1000 << "s in "
+              << libed2k::total_milliseconds(libed2k::time_now_hires() - start) << "ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cstdlib>
+#include <boost/bind.hpp>
+#include <boost/tuple/tuple.hpp>
+
+#include "libed2k/time.hpp"
+#include "libed2k/random.hpp"
+#include "libed2k/kademlia/find_data.hpp"
+#include "network.hpp"
+
+namespace libed2k {
+namespace aux {
+// defined in time.cpp
+extern ptime g_current_time;
+}
+}
+
+namespace kadsim {
+
+using namespace libed2k;
+using libed2k::dht::node_id;
+using libed2k::dht::node_entry;
+
+namespace {
+const boost::int64_t refresh_interval = 5000000;
+// the size of a k-bucket in the Kad implementation
+const int k = 10;
+
+void nop() {}
+
+// Kad stamps requests and measures round trip times with the simulated clock
+ptime sim_clock() { return aux::g_current_time; }
+}
+
+sim_random::sim_random(boost::uint32_t seed) : m_x(seed), m_y(362436069), m_z(521288629), m_w(88675123) {
+    // seeds sharing most bits give similar sequences at first
+    for (int i = 0; i < 16; ++i) (*this)();
+}
+
+boost::uint32_t sim_random::operator()() {
+    boost::uint32_t t = m_x ^ (m_x << 11);
+    m_x = m_y;
+    m_y = m_z;
+    m_z = m_w;
+    return m_w = m_w ^ (m_w >> 19) ^ (t ^ (t >> 8));
+}
+
+bool send_fun(void* userdata, udp_message const& m, udp::endpoint const& to, int flags) {
+    network::node* n = static_cast<network::node*>(userdata);
+    return n->net->send(*n, m, to);
+}
+
+network::network(config const& cfg, dht_settings const& settings)
+    : m_cfg(cfg),
+      m_settings(settings),
+      m_random(cfg.seed),
+      m_alerts(m_ios),
+      m_seq(0),
+      m_now(0),
+      m_epoch(time_now_hires()),
+      m_current(-1),
+      m_lookup_start(0),
+      m_searcher(-1) {
+    // node ids come from std::rand() and libed2k::random()
+    std::srand(cfg.seed);
+    random_seed(cfg.seed);
+    aux::g_current_time = m_epoch;
+    dht::rtt_clock = &sim_clock;
+
+    m_nodes.resize(cfg.nodes);
+    for (int i = 0; i < cfg.nodes; ++i) {
+        node& n = m_nodes[i];
+        // multiplying by an odd number is a bijection, it spreads
+        // the nodes over 11.0.0.0/8 without collisions
+        boost::uint32_t ip = 0x0b000000 | ((boost::uint32_t(i + 1) * 0x9e3779b1u) & 0xffffff);
+        n.ep = udp::endpoint(address_v4(ip), 4672);
+        n.access_latency = (cfg.latency * 250 + m_random.below(cfg.latency * 500 + 1));
+        n.joined = false;
+        n.requests = 0;
+        n.net = this;
+        m_addresses[ip] = i;
+    }
+}
+
+network::~network() {}
+
+void network::schedule(boost::int64_t time, event_type type, int node, int packet, udp::endpoint const& from) {
+    event e;
+    e.time = time;
+    e.seq = m_seq++;
+    e.type = type;
+    e.node = node;
+    e.packet = packet;
+    e.from = from;
+    m_queue.push(e);
+}
+
+void network::run(boost::int64_t until) {
+    while (!m_queue.empty() && m_queue.top().time <= until) {
+        event e = m_queue.top();
+        m_queue.pop();
+        m_now = e.time;
+        aux::g_current_time = m_epoch + seconds(int(m_now / 1000000)) + microsec(int(m_now % 1000000));
+        dispatch(e);
+    }
+    m_now = until;
+    aux::g_current_time = m_epoch + seconds(int(m_now / 1000000)) + microsec(int(m_now % 1000000));
+}
+
+void network::dispatch(event const& e) {
+    node& n = m_nodes[e.node];
+    switch (e.type) {
+        case deliver_packet: {
+            udp_message m;
+            m.first = m_in_flight[e.packet].first;
+            m.second.swap(m_in_flight[e.packet].second);
+            m_free_packets.push_back(e.packet);
+            deliver(n, e.from, m);
+            break;
+        }
+        case rpc_tick: {
+            time_duration d = n.impl->connection_timeout();
+            schedule(m_now + (std::max)(total_microseconds(d), boost::int64_t(1000)), rpc_tick, e.node);
+            break;
+        }
+        case refresh_tick:
+            n.impl->tick();
+            schedule(m_now + refresh_interval, refresh_tick, e.node);
+            break;
+        case join_node:
+            join(e.node);
+            break;
+    }
+}
+
+bool network::send(node& from, udp_message const& m, udp::endpoint const& to) {
+    counters& c = m_packets[m.first.m_type];
+    ++c.sent;
+    c.bytes += sizeof(m.first) + m.second.size();
+    if (m.first.m_type == KADEMLIA2_REQ) ++from.requests;
+
+    std::map<boost::uint32_t, int>::const_iterator i = m_addresses.find(to.address().to_v4().to_ulong());
+    if (i == m_addresses.end() || !m_nodes[i->second].joined || m_random.below(100) < m_cfg.loss) {
+        ++c.lost;
+        // like UDP, a lost packet is still sent successfully
+        return true;
+    }
+
+    int packet;
+    if (m_free_packets.empty()) {
+        packet = int(m_in_flight.size());
+        m_in_flight.push_back(m);
+    } else {
+        packet = m_free_packets.back();
+        m_free_packets.pop_back();
+        m_in_flight[packet] = m;
+    }
+
+    node const& dest = m_nodes[i->second];
+    boost::int64_t delay = from.access_latency + dest.access_latency + m_random.below(m_cfg.jitter * 1000 + 1);
+    schedule(m_now + delay, deliver_packet, i->second, packet, from.ep);
+    return true;
+}
+
+void network::deliver(node& n, udp::endpoint const& from, udp_message const& m) {
+    counters& c = m_packets[m.first.m_type];
+    ++c.delivered;
+
+    typedef boost::iostreams::basic_array_source<char> Device;
+    boost::iostreams::stream_buffer<Device> buffer(m.second.data(), m.second.size());
+    std::istream in(&buffer);
+    archive::ed2k_iarchive ia(in);
+
+    dht::node_impl& impl = *n.impl;
+    try {
+        // the requests and replies dht_tracker::on_receive hands to the node
+        switch (m.first.m_type) {
+            case KADEMLIA_FIREWALLED_REQ: {
+                kad_firewalled_req p;
+                ia >> p;
+                impl.incoming_request(p, from);
+                break;
+            }
+            case KADEMLIA2_BOOTSTRAP_REQ: {
+                kad2_bootstrap_req p;
+                ia >> p;
+                impl.incoming_request(p, from);
+                break;
+            }
+            case KADEMLIA2_BOOTSTRAP_RES: {
+                kad2_bootstrap_res p;
+                ia >> p;
+                impl.incoming(p, from);
+                break;
+            }
+            case KADEMLIA2_HELLO_REQ: {
+                kad2_hello_req p;
+                ia >> p;
+                impl.incoming_request(p, from);
+                break;
+            }
+            case KADEMLIA2_HELLO_RES: {
+                kad2_hello_res p;
+                ia >> p;
+                impl.incoming(p, from);
+                break;
+            }
+            case KADEMLIA2_REQ: {
+                kademlia2_req p;
+                ia >> p;
+                impl.incoming_request(p, from);
+                break;
+            }
+            case KADEMLIA2_RES: {
+                kademlia2_res p;
+                ia >> p;
+                impl.incoming(p, from);
+                break;
+            }
+            case KADEMLIA2_PING: {
+                kad2_ping p;
+                ia >> p;
+                impl.incoming_request(p, from);
+                break;
+            }
+            case KADEMLIA2_PONG: {
+                kad2_pong p;
+                ia >> p;
+                impl.incoming(p, from);
+                break;
+            }
+            default:
+                ++c.unhandled;
+                break;
+        }
+    } catch (libed2k_exception&) {
+        ++c.unhandled;
+    }
+}
+
+void network::join(int i) {
+    node& n = m_nodes[i];
+    n.impl.reset(new dht::node_impl(m_alerts, &send_fun, m_settings, (node_id::min)(), n.ep.address(), 4662,
+                                    dht::node_impl::external_ip_fun(), &n));
+    n.joined = true;
+
+    // a few of the nodes that joined before, like a nodes.dat would have
+    std::vector<udp::endpoint> contacts;
+    for (int tries = 0; i > 0 && int(contacts.size()) < (std::min)(m_cfg.bootstrap_contacts, i) && tries < 100;
+         ++tries) {
+        udp::endpoint ep = m_nodes[m_random.below(i)].ep;
+        if (std::find(contacts.begin(), contacts.end(), ep) == contacts.end()) contacts.push_back(ep);
+    }
+
+    n.impl->bootstrap(contacts, boost::bind(&nop));
+    schedule(m_now + 1000000, rpc_tick, i);
+    schedule(m_now + refresh_interval, refresh_tick, i);
+}
+
+void network::warmup() {
+    boost::int64_t period = boost::int64_t(m_cfg.warmup) * 1000000;
+    for (int i = 0; i < int(m_nodes.size()); ++i) schedule(period / 2 * i / int(m_nodes.size()), join_node, i);
+
+    const int samples = 10;
+    for (int s = 1; s <= samples; ++s) {
+        run(period * s / samples);
+        sample_convergence();
+    }
+}
+
+void network::closest_nodes(node_id const& target, int count, std::vector<node_id>& ret) const {
+    ret.clear();
+    for (std::vector<node>::const_iterator i = m_nodes.begin(), end(m_nodes.end()); i != end; ++i)
+        if (i->joined) ret.push_back(i->impl->nid());
+    count = (std::min)(count, int(ret.size()));
+    std::partial_sort(ret.begin(), ret.begin() + count, ret.end(), boost::bind(&dht::compare_ref, _1, _2, target));
+    ret.resize(count);
+}
+
+void network::sample_convergence() {
+    convergence_sample s;
+    s.time = int(m_now / 1000000);
+    s.live_nodes = 0;
+    s.replacements = 0;
+    s.neighbours = 0;
+
+    std::vector<int> joined;
+    for (int i = 0; i < int(m_nodes.size()); ++i)
+        if (m_nodes[i].joined) joined.push_back(i);
+    if (joined.empty()) return;
+
+    // every n-th node, sampling must not draw from the random
+    // generator or it would change the network conditions
+    int stride = (std::max)(int(joined.size()) / 50, 1);
+    int sampled = 0;
+    std::vector<node_id> closest;
+    std::vector<node_entry> table;
+    for (int j = 0; j < int(joined.size()); j += stride, ++sampled) {
+        dht::node_impl& impl = *m_nodes[joined[j]].impl;
+        int live, replacements;
+        boost::tie(live, replacements) = impl.size();
+        s.live_nodes += live;
+        s.replacements += replacements;
+
+        // the closest node is the node itself
+        closest_nodes(impl.nid(), k + 1, closest);
+        closest.erase(closest.begin());
+        impl.m_table.find_node(impl.nid(), table, dht::routing_table::include_failed, k);
+        int found = 0;
+        for (std::vector<node_entry>::const_iterator i = table.begin(), end(table.end()); i != end; ++i)
+            if (std::find(closest.begin(), closest.end(), i->id) != closest.end()) ++found;
+        if (!closest.empty()) s.neighbours += double(found) / closest.size();
+    }
+
+    s.live_nodes /= sampled;
+    s.replacements /= sampled;
+    s.neighbours /= sampled;
+    m_convergence.push_back(s);
+}
+
+void network::on_lookup_done(std::vector<std::pair<node_entry, std::string> > const& v, int lookup) {
+    // a late callback of a lookup that already timed out
+    if (lookup != m_current) return;
+
+    lookup_result& r = m_lookups[lookup];
+    r.finished = true;
+    r.latency = int((m_now - m_lookup_start) / 1000);
+
+    std::vector<node_id> closest;
+    closest_nodes(m_target, k, closest);
+    for (std::vector<std::pair<node_entry, std::string> >::const_iterator i = v.begin(), end(v.end()); i != end; ++i)
+        if (std::find(closest.begin(), closest.end(), i->first.id) != closest.end()) ++r.found;
+}
+
+void network::run_lookups() {
+    m_lookups.resize(m_cfg.lookups);
+    for (int l = 0; l < m_cfg.lookups; ++l) {
+        m_current = l;
+        m_searcher = m_random.below(int(m_nodes.size()));
+        for (int i = 0; i < int(m_target.size); ++i) m_target[i] = boost::uint8_t(m_random());
+        m_lookup_start = m_now;
+
+        node& n = m_nodes[m_searcher];
+        int requests = n.requests;
+        boost::intrusive_ptr<dht::find_data> ta(new dht::find_data(
+            *n.impl, m_target, dht::find_data::data_callback(),
+            boost::bind(&network::on_lookup_done, this, _1, l), KADEMLIA_FIND_NODE));
+        ta->start();
+        ta.reset();
+
+        boost::int64_t deadline = m_now + boost::int64_t(m_cfg.lookup_timeout) * 1000000;
+        while (!m_lookups[l].finished && m_now < deadline) run(m_now + 10000);
+        m_current = -1;
+        m_lookups[l].requests = n.requests - requests;
+
+        // let the late replies drain before the next lookup starts
+        run(m_now + 1000000);
+    }
+}
+}
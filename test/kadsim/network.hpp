@@ -0,0 +1,197 @@
+#ifndef __KADSIM_NETWORK__
+#define __KADSIM_NETWORK__
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/io_service.hpp"
+#include "libed2k/alert.hpp"
+#include "libed2k/session_settings.hpp"
+#include "libed2k/packet_struct.hpp"
+#include "libed2k/kademlia/node.hpp"
+
+namespace kadsim {
+
+using libed2k::udp;
+using libed2k::udp_message;
+
+struct config {
+    config()
+        : nodes(1000),
+          seed(1),
+          latency(50),
+          jitter(20),
+          loss(0),
+          bootstrap_contacts(8),
+          warmup(300),
+          lookups(200),
+          lookup_timeout(60) {}
+
+    int nodes;
+    boost::uint32_t seed;
+    // mean one way latency and its random part, in milliseconds
+    int latency;
+    int jitter;
+    // packet loss in percent
+    int loss;
+    // number of earlier nodes every node knows when it joins
+    int bootstrap_contacts;
+    // simulated seconds the network runs before the lookups start
+    int warmup;
+    int lookups;
+    // simulated seconds after which a lookup counts as failed
+    int lookup_timeout;
+};
+
+/**
+  * xorshift generator of the simulation. It's separate from the one
+  * Kad uses, so changes to Kad don't change the network conditions
+ */
+class sim_random {
+   public:
+    explicit sim_random(boost::uint32_t seed);
+    boost::uint32_t operator()();
+    // uniform in [0, n)
+    int below(int n) { return n <= 0 ? 0 : int((*this)() % boost::uint32_t(n)); }
+
+   private:
+    boost::uint32_t m_x, m_y, m_z, m_w;
+};
+
+struct counters {
+    counters() : sent(0), delivered(0), lost(0), bytes(0), unhandled(0) {}
+    boost::uint64_t sent;
+    boost::uint64_t delivered;
+    boost::uint64_t lost;
+    boost::uint64_t bytes;
+    // delivered packets nobody answers in this build, search requests and the like
+    boost::uint64_t unhandled;
+};
+
+struct lookup_result {
+    lookup_result() : finished(false), latency(0), requests(0), found(0) {}
+    bool finished;
+    // milliseconds of simulated time
+    int latency;
+    // requests sent by the searching node
+    int requests;
+    // how many of the k nodes closest to the target were found
+    int found;
+};
+
+struct convergence_sample {
+    int time;
+    double live_nodes;
+    double replacements;
+    // fraction of the k nodes closest to a node that are in its routing table
+    double neighbours;
+};
+
+/**
+  * runs nodes of the Kad implementation in one process. The nodes talk
+  * through the send callback of node_impl, packets are queued with a
+  * simulated delivery time and dispatched in time order. The library
+  * clock is set to the simulated time before every event, so a run
+  * depends on the configuration and the seed only
+ */
+class network : boost::noncopyable {
+   public:
+    network(config const& cfg, libed2k::dht_settings const& settings);
+    ~network();
+
+    // joins the nodes over the first half of the warmup period and
+    // runs until it's over, recording routing table convergence
+    void warmup();
+
+    // runs the lookups one after the other from random nodes to random targets
+    void run_lookups();
+
+    std::vector<convergence_sample> const& convergence() const { return m_convergence; }
+    std::vector<lookup_result> const& lookups() const { return m_lookups; }
+    std::map<int, counters> const& packets() const { return m_packets; }
+
+    // milliseconds of simulated time
+    boost::int64_t now() const { return m_now / 1000; }
+
+   private:
+    struct node {
+        boost::shared_ptr<libed2k::dht::node_impl> impl;
+        udp::endpoint ep;
+        // one way latency of the node's access link in microseconds
+        int access_latency;
+        bool joined;
+        // requests sent, to count the messages of a lookup
+        int requests;
+        network* net;
+    };
+
+    enum event_type { deliver_packet, rpc_tick, refresh_tick, join_node };
+
+    struct event {
+        boost::int64_t time;
+        boost::uint64_t seq;
+        event_type type;
+        int node;
+        // deliver_packet only
+        int packet;
+        udp::endpoint from;
+
+        // std::priority_queue is a max heap
+        bool operator<(event const& e) const { return time != e.time ? time > e.time : seq > e.seq; }
+    };
+
+    friend bool send_fun(void* userdata, udp_message const& m, udp::endpoint const& to, int flags);
+    bool send(node& from, udp_message const& m, udp::endpoint const& to);
+
+    void schedule(boost::int64_t time, event_type type, int node, int packet = -1,
+                  udp::endpoint const& from = udp::endpoint());
+    // dispatches events until the queue is empty or the next one is after until
+    void run(boost::int64_t until);
+    void dispatch(event const& e);
+    void deliver(node& n, udp::endpoint const& from, udp_message const& m);
+    void join(int i);
+
+    void on_lookup_done(std::vector<std::pair<libed2k::dht::node_entry, std::string> > const& v, int lookup);
+
+    // the count nodes closest to target among the joined ones
+    void closest_nodes(libed2k::dht::node_id const& target, int count, std::vector<libed2k::dht::node_id>& ret) const;
+    void sample_convergence();
+
+    config m_cfg;
+    libed2k::dht_settings const& m_settings;
+    sim_random m_random;
+
+    libed2k::io_service m_ios;
+    libed2k::alert_manager m_alerts;
+
+    std::vector<node> m_nodes;
+    // node index by IPv4 address
+    std::map<boost::uint32_t, int> m_addresses;
+
+    std::priority_queue<event> m_queue;
+    boost::uint64_t m_seq;
+    // packets in flight, indexed by event::packet
+    std::vector<udp_message> m_in_flight;
+    std::vector<int> m_free_packets;
+
+    // simulated time in microseconds
+    boost::int64_t m_now;
+    libed2k::ptime m_epoch;
+
+    std::map<int, counters> m_packets;
+    std::vector<convergence_sample> m_convergence;
+    std::vector<lookup_result> m_lookups;
+
+    // the lookup in progress
+    int m_current;
+    boost::int64_t m_lookup_start;
+    libed2k::dht::node_id m_target;
+    int m_searcher;
+};
+}
+
+#endif
@@ -84,4 +84,47 @@ BOOST_AUTO_TEST_CASE(test_alerts) {
     BOOST_CHECK(bGlobal);
 }
 
+BOOST_AUTO_TEST_CASE(test_pop_alerts) {
+    libed2k::io_service io;
+    libed2k::alert_manager al(io);
+    std::vector<libed2k::alert*> alerts;
+
+    al.pop_alerts(alerts);
+    BOOST_CHECK(alerts.empty());
+
+    for (int i = 0; i < 2000; ++i) {
+        al.post_alert(libed2k::server_connection_initialized_alert("server", "host", i, i, 0, 0));
+    }
+
+    // one alert taken alone, the rest in batch up to queue limit
+    std::auto_ptr<libed2k::alert> a = al.get();
+    BOOST_REQUIRE(a.get());
+    BOOST_CHECK_EQUAL(a->type(), int(libed2k::server_connection_initialized_alert::alert_type));
+
+    al.pop_alerts(alerts);
+    BOOST_REQUIRE_EQUAL(alerts.size(), size_t(libed2k::alert_manager::queue_size_limit_default - 1));
+    BOOST_CHECK(!al.pending());
+
+    for (size_t i = 0; i < alerts.size(); ++i) {
+        switch (alerts[i]->type()) {
+            case libed2k::server_connection_initialized_alert::alert_type:
+                BOOST_CHECK_EQUAL(static_cast<libed2k::server_connection_initialized_alert*>(alerts[i])->client_id,
+                                  i + 1);
+                break;
+            default:
+                BOOST_ERROR("unexpected alert type");
+        }
+    }
+
+    // base types are still found by cast
+    al.post_alert(libed2k::server_name_resolved_alert("server", "host", 1, "endpoint"));
+    std::vector<libed2k::alert*> next;
+    al.pop_alerts(next);
+    BOOST_REQUIRE_EQUAL(next.size(), 1U);
+    BOOST_CHECK(libed2k::alert_cast<libed2k::server_name_resolved_alert>(next[0]));
+    BOOST_CHECK(libed2k::alert_cast<libed2k::server_alert>(next[0]));
+    BOOST_CHECK(!libed2k::alert_cast<libed2k::server_connection_initialized_alert>(next[0]));
+    BOOST_CHECK(next[0]->type() != libed2k::server_alert::alert_type);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 #include <boost/iostreams/stream.hpp>
 #include "libed2k/archive.hpp"
 #include "libed2k/ctag.hpp"
+#include "libed2k/compact_tag_list.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/kad_packet_struct.hpp"
 #include "libed2k/log.hpp"
@@ -744,6 +745,83 @@ BOOST_AUTO_TEST_CASE(test_tag_list_equals) {
     BOOST_CHECK(!(list1 == list5));
 }
 
+BOOST_AUTO_TEST_CASE(test_compact_tag_list) {
+    libed2k::md4_hash md4 = libed2k::md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    std::vector<char> vBlob(3, '\x0B');
+    libed2k::tag_list<boost::uint16_t> src_list;
+    src_list.add_tag(libed2k::make_string_tag(std::string("IVAN"), libed2k::CT_NAME, true));
+    src_list.add_tag(libed2k::make_string_tag(std::string("\xEF\xBB\xBF" "BOM"), libed2k::FT_FILETYPE, true));
+    src_list.add_tag(libed2k::make_string_tag(std::string(20, 'x'), libed2k::FT_FILEFORMAT, false));
+    src_list.add_tag(libed2k::make_typed_tag(boost::uint8_t(0x10), libed2k::CT_SERVER_FLAGS, false));
+    src_list.add_tag(libed2k::make_typed_tag(boost::uint16_t(1000), libed2k::FT_FILESIZE, true));
+    src_list.add_tag(libed2k::make_typed_tag(boost::uint32_t(233332), "Charoff", true));
+    src_list.add_tag(libed2k::make_typed_tag(boost::uint64_t(32323267673ULL), libed2k::FT_ATREQUESTED, true));
+    src_list.add_tag(libed2k::make_typed_tag(true, libed2k::FT_FLAGS, true));
+    src_list.add_tag(libed2k::make_blob_tag(vBlob, libed2k::FT_DL_PREVIEW, true));
+    src_list.add_tag(libed2k::make_typed_tag(1129.4f, libed2k::FT_MEDIA_ALBUM, true));
+    src_list.add_tag(libed2k::make_typed_tag(md4, libed2k::FT_AICH_HASH, true));
+
+    // same bytes on the wire as tag_list
+    std::ostringstream src_stream(std::ios_base::binary);
+    libed2k::archive::ed2k_oarchive src_archive(src_stream);
+    src_archive << src_list;
+
+    libed2k::compact_tag_list<boost::uint16_t> converted(src_list);
+    std::ostringstream converted_stream(std::ios_base::binary);
+    libed2k::archive::ed2k_oarchive converted_archive(converted_stream);
+    converted_archive << converted;
+    BOOST_CHECK(src_stream.str() == converted_stream.str());
+
+    std::istringstream in_stream(src_stream.str(), std::ios_base::binary);
+    libed2k::archive::ed2k_iarchive in_archive(in_stream);
+    libed2k::compact_tag_list<boost::uint16_t> list;
+    in_archive >> list;
+    BOOST_REQUIRE_EQUAL(list.size(), src_list.size());
+
+    std::ostringstream list_stream(std::ios_base::binary);
+    libed2k::archive::ed2k_oarchive list_archive(list_stream);
+    list_archive << list;
+    std::istringstream reload_stream(list_stream.str(), std::ios_base::binary);
+    libed2k::archive::ed2k_iarchive reload_archive(reload_stream);
+    libed2k::compact_tag_list<boost::uint16_t> reloaded;
+    reload_archive >> reloaded;
+    BOOST_CHECK(list == reloaded);
+
+    for (size_t n = 0; n < list.size(); ++n) {
+        BOOST_CHECK_EQUAL(list.getTagNameId(n), src_list.getTagNameId(n));
+        // the byte order mark is dropped on load
+        if (n == 1) continue;
+        BOOST_CHECK_EQUAL(list.getTagType(n), src_list.getTagType(n));
+        BOOST_CHECK(list[n]->is_equal(src_list[n].get()));
+    }
+
+    BOOST_CHECK_EQUAL(list.getTagType(1), libed2k::TAGTYPE_STR3);
+
+    BOOST_CHECK_EQUAL(list.getStringTagByNameId(libed2k::CT_NAME), "IVAN");
+    BOOST_CHECK_EQUAL(list.getStringTagByNameId(libed2k::FT_FILETYPE), "BOM");
+    BOOST_CHECK_EQUAL(list.getStringTagByNameId(libed2k::FT_FILEFORMAT), std::string(20, 'x'));
+    BOOST_CHECK_EQUAL(list.getStringTagByNameId(libed2k::FT_FILESIZE), "");  // incorrect type
+    BOOST_CHECK_EQUAL(list.getStringTagByNameId(libed2k::FT_GAPSTART), "");  // tag not exists
+    BOOST_CHECK_EQUAL(list.getIntTagByNameId(libed2k::CT_SERVER_FLAGS), 0x10u);
+    BOOST_CHECK_EQUAL(list.getIntTagByNameId(libed2k::FT_FILESIZE), 1000u);
+    BOOST_CHECK_EQUAL(list.getIntTagByName("Charoff"), 233332u);
+    BOOST_CHECK_EQUAL(list.getIntTagByNameId(libed2k::FT_ATREQUESTED), 32323267673ULL);
+    BOOST_CHECK_EQUAL(list.getIntTagByNameId(libed2k::CT_NAME), 0u);
+    BOOST_CHECK_EQUAL(list.getTagName(5), "Charoff");
+    BOOST_CHECK(list.asBool(list.find(libed2k::FT_FLAGS)));
+    BOOST_CHECK(list.asBlob(list.find(libed2k::FT_DL_PREVIEW)) == vBlob);
+    BOOST_CHECK_EQUAL(list.asFloat(list.find(libed2k::FT_MEDIA_ALBUM)), 1129.4f);
+    BOOST_CHECK_EQUAL(list.asHash(list.find(libed2k::FT_AICH_HASH)), md4);
+    BOOST_CHECK_THROW(list.asHash(list.find(libed2k::FT_FLAGS)), libed2k::libed2k_exception);
+    BOOST_CHECK_EQUAL(list.find(libed2k::FT_GAPSTART), libed2k::compact_tag_storage::npos);
+    BOOST_CHECK(!list.getTagByName("Bitrate"));
+    BOOST_REQUIRE(list.getTagByNameId(libed2k::FT_AICH_HASH));
+    BOOST_CHECK_EQUAL(list.getTagByNameId(libed2k::FT_AICH_HASH)->asHash(), md4);
+
+    list.clear();
+    BOOST_CHECK(list != reloaded);
+}
+
 BOOST_AUTO_TEST_CASE(test_packets) {
     libed2k::shared_file_entry sh(libed2k::md4_hash::terminal(), 100, 12);
     libed2k::shared_files_list flist;
@@ -774,6 +852,63 @@ BOOST_AUTO_TEST_CASE(test_packets) {
     BOOST_CHECK(flist.m_collection[2].m_network_point.m_nPort == 5);
 }
 
+BOOST_AUTO_TEST_CASE(test_search_result_decoder) {
+    libed2k::shared_files_list flist;
+    for (int i = 0; i < 3; ++i) {
+        libed2k::shared_file_entry e(libed2k::md4_hash::terminal(), i, 4662 + i);
+        e.m_list.add_tag(libed2k::make_string_tag(std::string(i + 5, 'f'), libed2k::FT_FILENAME, true));
+        e.m_list.add_tag(libed2k::make_typed_tag(boost::uint32_t(10 * i), libed2k::FT_SOURCES, true));
+        flist.m_collection.push_back(e);
+    }
+
+    for (int more = 0; more < 2; ++more) {
+        std::ostringstream out(std::ios_base::binary);
+        libed2k::archive::ed2k_oarchive out_archive(out);
+        out_archive << flist;
+        if (more) out.put('\x01');
+
+        std::istringstream in(out.str(), std::ios_base::binary);
+        libed2k::archive::ed2k_iarchive in_archive(in);
+        libed2k::search_result_decoder decoder(in_archive);
+        BOOST_CHECK_EQUAL(decoder.size(), 3u);
+
+        size_t n = 0;
+        while (decoder.next()) {
+            const libed2k::compact_file_entry& e = decoder.entry();
+            BOOST_REQUIRE(n < flist.m_collection.size());
+            BOOST_CHECK(e.m_network_point == flist.m_collection[n].m_network_point);
+            BOOST_CHECK_EQUAL(e.m_list.getStringTagByNameId(libed2k::FT_FILENAME), std::string(n + 5, 'f'));
+            BOOST_CHECK_EQUAL(e.m_list.getIntTagByNameId(libed2k::FT_SOURCES), 10 * n);
+
+            libed2k::shared_file_entry sf;
+            e.to_shared_file_entry(sf);
+            BOOST_CHECK(sf.m_hFile == flist.m_collection[n].m_hFile);
+            BOOST_CHECK(sf.m_list == flist.m_collection[n].m_list);
+            ++n;
+        }
+
+        BOOST_CHECK_EQUAL(n, 3u);
+        BOOST_CHECK_EQUAL(decoder.more_results_available(), more != 0);
+
+        // straight into shared entries, one entry object reused
+        std::istringstream in2(out.str(), std::ios_base::binary);
+        libed2k::archive::ed2k_iarchive in_archive2(in2);
+        libed2k::search_result_decoder decoder2(in_archive2);
+        libed2k::shared_file_entry sf;
+        n = 0;
+        while (decoder2.next(sf)) {
+            BOOST_REQUIRE(n < flist.m_collection.size());
+            BOOST_CHECK(sf.m_hFile == flist.m_collection[n].m_hFile);
+            BOOST_CHECK(sf.m_network_point == flist.m_collection[n].m_network_point);
+            BOOST_CHECK(sf.m_list == flist.m_collection[n].m_list);
+            ++n;
+        }
+
+        BOOST_CHECK_EQUAL(n, 3u);
+        BOOST_CHECK_EQUAL(decoder2.more_results_available(), more != 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_emule_collection) {
 #ifdef WIN32
     libed2k::emule_collection ec = libed2k::emule_collection::fromFile("../../unit/test_collection.emulecollection");
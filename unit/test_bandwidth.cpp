@@ -0,0 +1,218 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/bandwidth_manager.hpp"
+#include "libed2k/bandwidth_queue_entry.hpp"
+#include "libed2k/time.hpp"
+
+using libed2k::bandwidth_channel;
+using libed2k::bandwidth_manager;
+using libed2k::bandwidth_socket;
+using libed2k::bw_request;
+
+namespace {
+// a peer asking for blk bytes again whenever it got some, if repeat is set
+struct test_socket : bandwidth_socket {
+    test_socket(bandwidth_manager& m, bandwidth_channel* c, int b, int prio, std::vector<test_socket*>* o)
+        : manager(m), chan(c), blk(b), priority(prio), repeat(false), refs(0), grants(0), bytes(0), order(o) {}
+
+    void request() { BOOST_REQUIRE_EQUAL(manager.request_bandwidth(this, blk, priority, &chan, 1), 0); }
+
+    void assign_bandwidth(int, int amount) {
+        ++grants;
+        bytes += amount;
+        if (order) order->push_back(this);
+        if (repeat) request();
+    }
+
+    bool is_disconnecting() const { return false; }
+    void add_ref() { ++refs; }
+    void release() { --refs; }
+
+    bandwidth_manager& manager;
+    bandwidth_channel* chan;
+    int blk;
+    int priority;
+    bool repeat;
+    int refs;
+    int grants;
+    int bytes;
+    std::vector<test_socket*>* order;
+};
+
+// runs ms milliseconds of the manager in ticks of one slice
+void run(bandwidth_manager& m, int ms) {
+    for (int t = 0; t < ms; t += m.slice()) m.update_quotas(libed2k::milliseconds(m.slice()));
+}
+
+// what bandwidth_manager keeps in the channels for the queued requests
+void enqueue(bandwidth_channel& parent, bw_request* reqs, int num) {
+    parent.tmp = 0;
+    parent.tmp_weight = 0;
+    for (int i = 0; i < num; ++i) reqs[i].channel[1]->tmp = 0;
+
+    for (int i = 0; i < num; ++i) {
+        if (reqs[i].channel[1]->tmp == 0) parent.tmp_weight += reqs[i].channel[1]->weight;
+        parent.tmp += reqs[i].priority;
+        reqs[i].channel[1]->tmp += reqs[i].priority;
+    }
+}
+}
+
+BOOST_AUTO_TEST_SUITE(test_bandwidth)
+
+BOOST_AUTO_TEST_CASE(test_burst) {
+    bandwidth_channel c;
+    c.throttle(1000);
+    for (int i = 0; i < 10; ++i) c.update_quota(1000);
+    BOOST_CHECK_EQUAL(c.quota_left(), 3000);
+
+    c.burst(500);
+    c.update_quota(1000);
+    BOOST_CHECK_EQUAL(c.quota_left(), 1500);
+}
+
+BOOST_AUTO_TEST_CASE(test_class_weights) {
+    bandwidth_channel parent;
+    parent.throttle(3000);
+
+    bandwidth_channel heavy;
+    heavy.parent = &parent;
+    heavy.weight = 2;
+
+    bandwidth_channel light;
+    light.parent = &parent;
+    light.weight = 1;
+
+    // one request of the heavy class, two of the light class
+    bw_request reqs[3] = {bw_request(0, 10000, 1), bw_request(0, 10000, 1), bw_request(0, 10000, 1)};
+    reqs[0].channel[0] = &parent;
+    reqs[0].channel[1] = &heavy;
+    reqs[1].channel[0] = &parent;
+    reqs[1].channel[1] = &light;
+    reqs[2].channel[0] = &parent;
+    reqs[2].channel[1] = &light;
+
+    enqueue(parent, reqs, 3);
+    BOOST_CHECK_EQUAL(reqs[0].quantum(1000), 2000);
+    BOOST_CHECK_EQUAL(reqs[1].quantum(1000), 500);
+    BOOST_CHECK_EQUAL(reqs[2].quantum(1000), 500);
+    BOOST_CHECK_EQUAL(reqs[0].quantum(10), 20);
+
+    // an idle class leaves its share to the others
+    enqueue(parent, reqs + 1, 2);
+    BOOST_CHECK_EQUAL(reqs[1].quantum(1000), 1500);
+    BOOST_CHECK_EQUAL(reqs[2].quantum(1000), 1500);
+
+    // waiting requests always earn something
+    BOOST_CHECK_EQUAL(reqs[1].quantum(0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_grant_order) {
+    bandwidth_manager m(0);
+    bandwidth_channel c;
+    c.throttle(3000);
+
+    std::vector<test_socket*> order;
+    test_socket a(m, &c, bandwidth_manager::min_grant, 1, &order);
+    test_socket b(m, &c, bandwidth_manager::min_grant, 1, &order);
+    test_socket d(m, &c, bandwidth_manager::min_grant, 1, &order);
+    a.request();
+    b.request();
+    d.request();
+    BOOST_CHECK_EQUAL(m.queue_size(), 3);
+    BOOST_CHECK_EQUAL(m.queued_bytes(), 3 * bandwidth_manager::min_grant);
+
+    // requests earning at the same rate are granted first come, first served
+    run(m, 2000);
+    BOOST_REQUIRE_EQUAL(order.size(), 3U);
+    BOOST_CHECK(order[0] == &a);
+    BOOST_CHECK(order[1] == &b);
+    BOOST_CHECK(order[2] == &d);
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+    BOOST_CHECK_EQUAL(c.tmp, 0);
+
+    // the manager lets go of the peers it is done with
+    BOOST_CHECK_EQUAL(a.refs, 0);
+    BOOST_CHECK_EQUAL(b.refs, 0);
+    BOOST_CHECK_EQUAL(d.refs, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_fair_share) {
+    bandwidth_manager m(0);
+    bandwidth_channel c;
+    c.throttle(30000);
+
+    test_socket low(m, &c, 4096, 1, 0);
+    test_socket high(m, &c, 4096, 2, 0);
+    low.repeat = true;
+    high.repeat = true;
+    low.request();
+    high.request();
+
+    run(m, 10000);
+
+    // the channel is used up, and split by priority
+    int total = low.bytes + high.bytes;
+    BOOST_CHECK_GE(total, 30000 * 9);
+    BOOST_CHECK_LE(total, 30000 * 10);
+    BOOST_CHECK_CLOSE(double(high.bytes) / low.bytes, 2.0, 10.0);
+
+    m.close();
+    BOOST_CHECK_EQUAL(low.refs, 0);
+    BOOST_CHECK_EQUAL(high.refs, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_max_wait) {
+    bandwidth_manager m(0);
+    bandwidth_channel c;
+    c.throttle(100);
+
+    // a slow request gets what it earned instead of
+    // waiting ten seconds for a full grant
+    test_socket slow(m, &c, 10000, 1, 0);
+    slow.request();
+    run(m, bandwidth_manager::max_wait - m.slice());
+    BOOST_CHECK_EQUAL(slow.grants, 0);
+    run(m, 2 * m.slice());
+    BOOST_CHECK_EQUAL(slow.grants, 1);
+    BOOST_CHECK_GT(slow.bytes, 0);
+    BOOST_CHECK_LT(slow.bytes, int(bandwidth_manager::min_grant));
+}
+
+BOOST_AUTO_TEST_CASE(test_cancel_releases_reservation) {
+    bandwidth_manager m(0);
+    bandwidth_channel c;
+    c.throttle(1000);
+    // an earlier burst drained the channel for a few seconds
+    c.use_quota(5000);
+
+    test_socket s(m, &c, bandwidth_manager::min_grant, 1, 0);
+    s.request();
+    BOOST_CHECK_EQUAL(s.refs, 1);
+
+    // the request has earned its grant, and waits
+    // for the quota of the channel it holds back
+    run(m, 1500);
+    BOOST_CHECK_EQUAL(s.grants, 0);
+    BOOST_CHECK_EQUAL(c.reserved, int(bandwidth_manager::min_grant));
+
+    m.cancel(&s);
+    BOOST_CHECK_EQUAL(c.reserved, 0);
+    BOOST_CHECK_EQUAL(c.tmp, 0);
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+    BOOST_CHECK_EQUAL(m.queued_bytes(), 0);
+    BOOST_CHECK_EQUAL(s.refs, 0);
+
+    run(m, 10000);
+    BOOST_CHECK_EQUAL(s.grants, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <set>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/constants.hpp"
+#include "libed2k/disk_buffer_pool.hpp"
+
+namespace {
+struct test_pool : libed2k::disk_buffer_pool {
+    test_pool(int thread_cache) : libed2k::disk_buffer_pool(libed2k::BLOCK_SIZE / 16) {
+        m_settings.disk_buffer_thread_cache = thread_cache;
+    }
+    libed2k::session_settings& settings() { return m_settings; }
+};
+
+void churn(test_pool* pool, int rounds) {
+    std::vector<char*> bufs;
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < 13; ++i) bufs.push_back(pool->allocate_buffer("test"));
+        for (int i = 0; i < 5; ++i) {
+            pool->free_buffer(bufs.back());
+            bufs.pop_back();
+        }
+        pool->free_multiple_buffers(&bufs[0], int(bufs.size()));
+        bufs.clear();
+    }
+}
+
+struct parking {
+    parking() : churned(false), done(false) {}
+    libed2k::mutex m;
+    libed2k::condition cond;
+    bool churned;
+    bool done;
+};
+
+// keeps the thread and its cache alive until done
+void churn_and_park(test_pool* pool, parking* p) {
+    churn(pool, 1);
+    libed2k::mutex::scoped_lock l(p->m);
+    p->churned = true;
+    p->cond.signal_all(l);
+    while (!p->done) p->cond.wait(l);
+}
+}
+
+BOOST_AUTO_TEST_SUITE(test_disk_buffer_pool)
+
+BOOST_AUTO_TEST_CASE(test_thread_cache_accounting) {
+    test_pool pool(8);
+    std::vector<char*> bufs;
+    for (int i = 0; i < 20; ++i) bufs.push_back(pool.allocate_buffer("test"));
+    BOOST_CHECK_EQUAL(pool.in_use(), 20);
+    BOOST_CHECK_EQUAL(std::set<char*>(bufs.begin(), bufs.end()).size(), bufs.size());
+
+    // cached buffers are not in use
+    for (int i = 0; i < 15; ++i) {
+        pool.free_buffer(bufs.back());
+        bufs.pop_back();
+    }
+    BOOST_CHECK_EQUAL(pool.in_use(), 5);
+
+    // buffers come back from the cache
+    char* buf = pool.allocate_buffer("test");
+    BOOST_CHECK(buf != 0);
+    BOOST_CHECK_EQUAL(pool.in_use(), 6);
+    bufs.push_back(buf);
+
+    pool.free_multiple_buffers(&bufs[0], int(bufs.size()));
+    BOOST_CHECK_EQUAL(pool.in_use(), 0);
+    pool.release_memory();
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_cache_threads) {
+    test_pool pool(8);
+    libed2k::thread t1(boost::bind(&churn, &pool, 1000));
+    libed2k::thread t2(boost::bind(&churn, &pool, 1000));
+    churn(&pool, 1000);
+    t1.join();
+    t2.join();
+    BOOST_CHECK_EQUAL(pool.in_use(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_exit_flushes_cache) {
+    test_pool pool(8);
+    churn(&pool, 1);
+    int cached = pool.cached();
+    BOOST_CHECK(cached > 0);
+
+    libed2k::thread t(boost::bind(&churn, &pool, 1));
+    t.join();
+    BOOST_CHECK_EQUAL(pool.cached(), cached);
+    BOOST_CHECK_EQUAL(pool.in_use(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_release_memory_flushes_all_caches) {
+    test_pool pool(8);
+    parking p;
+    libed2k::thread t(boost::bind(&churn_and_park, &pool, &p));
+    {
+        libed2k::mutex::scoped_lock l(p.m);
+        while (!p.churned) p.cond.wait(l);
+    }
+    churn(&pool, 1);
+    BOOST_CHECK(pool.cached() > 0);
+
+    pool.release_memory();
+    BOOST_CHECK_EQUAL(pool.cached(), 0);
+
+    {
+        libed2k::mutex::scoped_lock l(p.m);
+        p.done = true;
+        p.cond.signal_all(l);
+    }
+    t.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_no_thread_cache) {
+    test_pool pool(0);
+    churn(&pool, 10);
+    BOOST_CHECK_EQUAL(pool.in_use(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_huge_pages) {
+    test_pool pool(8);
+    pool.settings().disk_cache_huge_pages = true;
+    std::vector<char*> bufs;
+    for (int i = 0; i < 100; ++i) {
+        bufs.push_back(pool.allocate_buffer("test"));
+        BOOST_REQUIRE(bufs.back() != 0);
+        bufs.back()[0] = bufs.back()[pool.block_size() - 1] = char(i);
+    }
+
+    // regular buffers in use at the same time go back to their own pool
+    pool.settings().disk_cache_huge_pages = false;
+    for (int i = 0; i < 100; ++i) {
+        bufs.push_back(pool.allocate_buffer("test"));
+        BOOST_REQUIRE(bufs.back() != 0);
+    }
+    pool.free_multiple_buffers(&bufs[0], int(bufs.size()));
+    BOOST_CHECK_EQUAL(pool.in_use(), 0);
+    pool.release_memory();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
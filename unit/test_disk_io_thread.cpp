@@ -0,0 +1,271 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/constants.hpp"
+#include "libed2k/disk_io_thread.hpp"
+#include "libed2k/file_pool.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/storage.hpp"
+#include "libed2k/transfer_info.hpp"
+
+using namespace libed2k;
+
+namespace {
+const int block_size = BLOCK_SIZE / 16;
+
+void nop() {}
+
+void on_job(int ret, disk_io_job const& j, disk_io_thread* disk, int* result) {
+    if (ret > 0 && j.action == disk_io_job::read) disk->free_buffer(j.buffer);
+    *result = ret;
+}
+
+void on_ref_job(int ret, disk_io_job const& j, disk_io_job* out, int* result) {
+    *out = j;
+    *result = ret;
+}
+
+// a sparse file of two pieces and a disk thread with room
+// for one cached block besides the send buffer
+struct disk_fixture {
+    disk_fixture()
+        : path(complete("test_disk_io_thread")), disk(ios, &nop, fp, block_size) {
+        error_code ec;
+        create_directory(path, ec);
+        file f(combine_path(path, "file"), file::read_write, ec);
+        BOOST_REQUIRE(!ec);
+        f.set_size(PIECE_SIZE + 4 * block_size, ec);
+        BOOST_REQUIRE(!ec);
+        f.close();
+
+        boost::intrusive_ptr<transfer_info> info(
+            new transfer_info(md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0"), "file",
+                              PIECE_SIZE + 4 * block_size));
+        storage = new piece_manager(boost::shared_ptr<void>(), info, path, fp, disk, default_storage_constructor,
+                                    storage_mode_sparse, std::vector<boost::uint8_t>());
+
+        settings.cache_size = 2;
+        settings.read_cache_line_size = 1;
+        settings.read_cache_algorithm = session_settings::read_2q;
+        settings.default_cache_min_age = 0;
+        settings.use_disk_read_ahead = false;
+        apply_settings();
+    }
+
+    ~disk_fixture() {
+        storage = 0;
+        disk.abort();
+        disk.join();
+        error_code ec;
+        remove_all(path, ec);
+    }
+
+    // returns once the disk thread is done with the jobs queued
+    // before, including read ahead
+    void apply_settings() {
+        int ret = -100;
+        disk_io_job j;
+        j.buffer = (char*)new session_settings(settings);
+        j.action = disk_io_job::update_settings;
+        disk.add_job(j, boost::bind(&on_job, _1, _2, &disk, &ret));
+        while (ret == -100) ios.run_one();
+    }
+
+    bool cached(int piece, int block) {
+        std::vector<cached_piece_info> pieces;
+        disk.get_cache_info(storage->info()->info_hash(), pieces);
+        for (std::vector<cached_piece_info>::iterator i = pieces.begin(); i != pieces.end(); ++i)
+            if (i->piece == piece) return i->blocks[block];
+        return false;
+    }
+
+    int read(int piece, int block) {
+        int ret = -100;
+        peer_request r;
+        r.piece = piece;
+        r.start = block * block_size;
+        r.length = block_size;
+        storage->async_read(r, boost::bind(&on_job, _1, _2, &disk, &ret));
+        while (ret == -100) ios.run_one();
+        return ret;
+    }
+
+    // a read answered with references to the cache blocks if possible
+    int read_refs(int piece, int start, int length, disk_io_job& j) {
+        int ret = -100;
+        peer_request r;
+        r.piece = piece;
+        r.start = start;
+        r.length = length;
+        storage->async_read(r, boost::bind(&on_ref_job, _1, _2, &j, &ret), 0, 0, disk_io_job::reference_cache);
+        while (ret == -100) ios.run_one();
+        return ret;
+    }
+
+    int clear_read_cache() {
+        int ret = -100;
+        storage->async_clear_read_cache(boost::bind(&on_job, _1, _2, &disk, &ret));
+        while (ret == -100) ios.run_one();
+        return ret;
+    }
+
+    int release_files() {
+        int ret = -100;
+        storage->async_release_files(boost::bind(&on_job, _1, _2, &disk, &ret));
+        while (ret == -100) ios.run_one();
+        return ret;
+    }
+
+    std::string path;
+    io_service ios;
+    file_pool fp;
+    disk_io_thread disk;
+    boost::intrusive_ptr<piece_manager> storage;
+    session_settings settings;
+};
+}
+
+BOOST_AUTO_TEST_SUITE(test_disk_io_thread)
+
+BOOST_FIXTURE_TEST_CASE(test_ghost_hit_promotes_piece, disk_fixture) {
+    BOOST_CHECK_EQUAL(read(0, 0), block_size);
+    // makes room by evicting piece 0 to the ghost list
+    BOOST_CHECK_EQUAL(read(1, 0), block_size);
+    BOOST_CHECK_EQUAL(disk.status().ghost_hits, 0);
+
+    // reading it again protects it
+    BOOST_CHECK_EQUAL(read(0, 0), block_size);
+    BOOST_CHECK_EQUAL(disk.status().ghost_hits, 1);
+
+    BOOST_CHECK(cached(0, 0));
+    BOOST_CHECK(!cached(1, 0));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_release_files_purges_ghosts, disk_fixture) {
+    BOOST_CHECK_EQUAL(read(0, 0), block_size);
+    BOOST_CHECK_EQUAL(read(1, 0), block_size);
+
+    // a storage allocated at the same address must not inherit them
+    BOOST_CHECK_EQUAL(release_files(), 0);
+    BOOST_CHECK_EQUAL(read(0, 0), block_size);
+    BOOST_CHECK_EQUAL(disk.status().ghost_hits, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_sequential_reads_refill, disk_fixture) {
+    settings.cache_size = 16;
+    settings.max_read_ahead = 8;
+    apply_settings();
+
+    // the third read in a row detects the stream and a few
+    // blocks past it are read once the disk is idle
+    for (int b = 0; b < 3; ++b) BOOST_CHECK_EQUAL(read(0, b), block_size);
+    apply_settings();
+    BOOST_CHECK(cached(0, 6));
+    BOOST_CHECK(!cached(0, 7));
+
+    // the next read continues the refill
+    BOOST_CHECK_EQUAL(read(0, 3), block_size);
+    apply_settings();
+    BOOST_CHECK(cached(0, 10));
+    BOOST_CHECK(!cached(0, 11));
+
+    // a released storage forgets its streams, the reads
+    // following them start a new one
+    BOOST_CHECK_EQUAL(release_files(), 0);
+    for (int b = 4; b < 7; ++b) BOOST_CHECK_EQUAL(read(0, b), block_size);
+    apply_settings();
+    BOOST_CHECK(!cached(0, 11));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_reference_spans_two_blocks, disk_fixture) {
+    settings.cache_size = 16;
+    settings.read_cache_line_size = 4;
+    apply_settings();
+
+    disk_io_job j;
+    BOOST_CHECK_EQUAL(read_refs(0, block_size / 2, block_size, j), block_size);
+    BOOST_CHECK(j.buffer == 0);
+    BOOST_REQUIRE(j.refs[0].buf && j.refs[1].buf);
+    BOOST_CHECK(j.refs[0].buf != j.refs[1].buf);
+    BOOST_CHECK_EQUAL(j.refs[0].offset, block_size / 2);
+    BOOST_CHECK_EQUAL(j.refs[0].size, block_size / 2);
+    BOOST_CHECK_EQUAL(j.refs[1].offset, 0);
+    BOOST_CHECK_EQUAL(j.refs[1].size, block_size / 2);
+
+    // the blocks stay in the cache once released
+    int in_use = disk.in_use();
+    disk.release_block(j.refs[0].buf);
+    disk.release_block(j.refs[1].buf);
+    BOOST_CHECK_EQUAL(disk.in_use(), in_use);
+    BOOST_CHECK(cached(0, 0));
+    BOOST_CHECK(cached(0, 1));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_evicted_block_freed_on_last_release, disk_fixture) {
+    settings.cache_size = 16;
+    apply_settings();
+
+    disk_io_job j1;
+    disk_io_job j2;
+    BOOST_CHECK_EQUAL(read_refs(0, 0, block_size, j1), block_size);
+    BOOST_CHECK_EQUAL(read_refs(0, 0, block_size, j2), block_size);
+    BOOST_REQUIRE(j1.refs[0].buf);
+    BOOST_CHECK(j1.refs[0].buf == j2.refs[0].buf);
+    BOOST_CHECK(j1.refs[1].buf == 0);
+
+    // evicting the block leaves it to the peers sending it
+    int in_use = disk.in_use();
+    BOOST_CHECK_EQUAL(clear_read_cache(), 0);
+    BOOST_CHECK(!cached(0, 0));
+    BOOST_CHECK_EQUAL(disk.in_use(), in_use);
+
+    disk.release_block(j1.refs[0].buf);
+    BOOST_CHECK_EQUAL(disk.in_use(), in_use);
+    disk.release_block(j2.refs[0].buf);
+    BOOST_CHECK_EQUAL(disk.in_use(), in_use - 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_reference_falls_back_to_copy, disk_fixture) {
+    // the cache is full of blocks still being sent
+    disk_io_job j1;
+    disk_io_job j2;
+    BOOST_CHECK_EQUAL(read_refs(0, 0, block_size, j1), block_size);
+    BOOST_CHECK_EQUAL(read_refs(1, 0, block_size, j2), block_size);
+    BOOST_REQUIRE(j1.refs[0].buf && j2.refs[0].buf);
+
+    disk_io_job j;
+    BOOST_CHECK_EQUAL(read_refs(0, 2 * block_size, block_size, j), block_size);
+    BOOST_CHECK(j.buffer != 0);
+    BOOST_CHECK(j.refs[0].buf == 0);
+    disk.free_buffer(j.buffer);
+
+    disk.release_block(j1.refs[0].buf);
+    disk.release_block(j2.refs[0].buf);
+
+    // and without a read cache or zero copy uploads
+    settings.use_read_cache = false;
+    apply_settings();
+    j = disk_io_job();
+    BOOST_CHECK_EQUAL(read_refs(0, 0, block_size, j), block_size);
+    BOOST_CHECK(j.buffer != 0);
+    BOOST_CHECK(j.refs[0].buf == 0);
+    disk.free_buffer(j.buffer);
+
+    settings.use_read_cache = true;
+    settings.zero_copy_upload = false;
+    apply_settings();
+    j = disk_io_job();
+    BOOST_CHECK_EQUAL(read_refs(0, 0, block_size, j), block_size);
+    BOOST_CHECK(j.buffer != 0);
+    BOOST_CHECK(j.refs[0].buf == 0);
+    disk.free_buffer(j.buffer);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/event_log.hpp"
+#include "libed2k/filesystem.hpp"
+
+using namespace libed2k;
+
+namespace {
+const char log_file[] = "test_event_log.bin";
+
+void log_blocks(int peer, int count) {
+    for (int i = 0; i < count; ++i) log_event(ev_peer_send_block, peer, i / 54, i % 54 * 10240, 10240);
+}
+
+bool read_log(event_log_header& h, std::vector<event_record>& records) {
+    std::ifstream in(log_file, std::ios_base::binary);
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+    event_record e;
+    while (in.read(reinterpret_cast<char*>(&e), sizeof(e))) records.push_back(e);
+    return true;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(test_event_log)
+
+BOOST_AUTO_TEST_CASE(test_describe) {
+    BOOST_CHECK_EQUAL(sizeof(event_record), 32u);
+    BOOST_REQUIRE(describe_event(ev_bw_grant));
+    BOOST_CHECK_EQUAL(std::string(describe_event(ev_bw_grant)->name), "bw_grant");
+    BOOST_CHECK_EQUAL(std::string(describe_event(ev_disk_job)->args[3]), "result");
+    BOOST_CHECK(describe_event(0x7f00) == 0);
+    BOOST_CHECK_EQUAL(event_category_of(ev_disk_job), int(disk_events));
+}
+
+BOOST_AUTO_TEST_CASE(test_write_and_read) {
+    // nothing is recorded while the log is closed
+    log_event(ev_peer_send_block, 1, 2, 3, 4);
+
+    error_code ec;
+    BOOST_REQUIRE(open_event_log(log_file, peer_events, ec));
+
+    boost::thread t1(boost::bind(&log_blocks, 1, 1000));
+    boost::thread t2(boost::bind(&log_blocks, 2, 1000));
+    t1.join();
+    t2.join();
+
+    // filtered out
+    log_event(ev_disk_job, 0, 1, 2, 3);
+    set_event_categories(peer_events | disk_events);
+    log_event(ev_disk_job, 0, 5, 0, 10240);
+    close_event_log();
+
+    event_log_header h;
+    std::vector<event_record> records;
+    BOOST_REQUIRE(read_log(h, records));
+    BOOST_CHECK(std::memcmp(h.magic, "L2KE", 4) == 0);
+    BOOST_CHECK_EQUAL(h.byte_order, event_log_byte_order);
+    BOOST_CHECK_EQUAL(int(h.record_size), int(sizeof(event_record)));
+
+    std::map<int, int> blocks;
+    std::map<int, int> last;
+    int disk_jobs = 0;
+    bool opened = false;
+    for (std::vector<event_record>::const_iterator i = records.begin(); i != records.end(); ++i) {
+        if (i->id == ev_log_opened) opened = true;
+        if (i->id == ev_disk_job) {
+            ++disk_jobs;
+            BOOST_CHECK_EQUAL(i->arg[1], 5);
+        }
+        if (i->id != ev_peer_send_block) continue;
+        // records of a thread keep their order
+        int seq = i->arg[1] * 54 + i->arg[2] / 10240;
+        if (blocks[i->arg[0]] > 0) BOOST_CHECK_EQUAL(seq, last[i->arg[0]] + 1);
+        last[i->arg[0]] = seq;
+        ++blocks[i->arg[0]];
+    }
+
+    BOOST_CHECK(opened);
+    BOOST_CHECK_EQUAL(disk_jobs, 1);
+    BOOST_CHECK_EQUAL(blocks.size(), 2u);
+    BOOST_CHECK_EQUAL(blocks[1], 1000);
+    BOOST_CHECK_EQUAL(blocks[2], 1000);
+
+    remove(log_file, ec);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,7 @@
 #include "libed2k/lazy_entry.hpp"
 #include "libed2k/log.hpp"
 #include "libed2k/hasher.hpp"
+#include "libed2k/resume_journal.hpp"
 
 BOOST_AUTO_TEST_SUITE(test_fast_resume_data)
 
@@ -169,4 +170,114 @@ BOOST_AUTO_TEST_CASE(test_entries_hash) {
     BOOST_CHECK(lev->list_at(2)->string_value() == h3.toString());
 }
 
+BOOST_AUTO_TEST_CASE(test_resume_journal) {
+    const std::string path = "resume_journal.dmp";
+    libed2k::error_code ec;
+    libed2k::remove(path, ec);
+    ec.clear();
+
+    libed2k::md4_hash h1 = libed2k::md4_hash::fromString("DB48A1C00CC972488C29D3FEC9F16A79");
+    libed2k::md4_hash h2 = libed2k::md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+
+    libed2k::entry rd;
+    rd["pieces"] = std::string(3, '\0');
+    rd["piece_priority"] = std::string(3, '\1');
+    rd["unfinished"] = libed2k::entry::list_type();
+    libed2k::entry up(libed2k::entry::dictionary_t);
+    up["piece"] = 1;
+    up["bitmask"] = std::string("\x01");
+    rd["unfinished"].list().push_back(up);
+    std::vector<char> data;
+    libed2k::bencode(std::back_inserter(data), rd);
+
+    {
+        libed2k::resume_journal j;
+        std::vector<libed2k::transfer_resume_data> transfers;
+        j.open(path, transfers, ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_CHECK(transfers.empty());
+
+        j.have_piece(h1, 0);  // no snapshot yet, ignored
+        j.add_transfer(libed2k::transfer_resume_data(h1, "/tmp/file1", 100, false, data));
+        j.add_transfer(libed2k::transfer_resume_data(h2, "/tmp/file2", 200, false, data));
+        j.have_piece(h1, 1);
+        j.piece_priority(h1, 2, 7);
+        j.file_path(h1, "/home/file1");
+        j.remove_transfer(h2);
+        BOOST_CHECK(j.has_transfer(h1));
+        BOOST_CHECK(!j.has_transfer(h2));
+    }
+
+    // cut record at the end is dropped
+    {
+        std::ofstream out(path.c_str(), std::ios_base::app | std::ios_base::binary);
+        out.write("\x02\x01", 2);
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        libed2k::resume_journal j;
+        std::vector<libed2k::transfer_resume_data> transfers;
+        j.open(path, transfers, ec);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(transfers.size(), 1U);
+
+        const libed2k::transfer_resume_data& trd = transfers[0];
+        BOOST_CHECK_EQUAL(trd.m_hash, h1);
+        BOOST_CHECK_EQUAL(trd.m_filename.m_collection, "/home/file1");
+        BOOST_CHECK_EQUAL(trd.m_filesize, 100);
+
+        const std::vector<char>& blob =
+            trd.m_fast_resume_data.getTagByNameId(libed2k::FT_FAST_RESUME_DATA)->asBlob();
+        libed2k::entry e = libed2k::bdecode(blob.begin(), blob.end());
+        BOOST_CHECK_EQUAL(e["pieces"].string(), std::string("\0\1\0", 3));
+        BOOST_CHECK_EQUAL(e["piece_priority"].string(), std::string("\1\1\7", 3));
+        BOOST_CHECK(e["unfinished"].list().empty());
+    }
+
+    libed2k::remove(path, ec);
+}
+
+BOOST_AUTO_TEST_CASE(test_resume_journal_failed_compaction) {
+    const std::string path = "resume_journal_nc.dmp";
+    libed2k::error_code ec;
+    libed2k::remove(path, ec);
+    ec.clear();
+
+    // the journal can't be rewritten while its temporary file is a directory
+    libed2k::create_directory(path + ".tmp", ec);
+    BOOST_REQUIRE(!ec);
+
+    libed2k::md4_hash h1 = libed2k::md4_hash::fromString("DB48A1C00CC972488C29D3FEC9F16A79");
+    libed2k::entry rd;
+    rd["pieces"] = std::string(3, '\0');
+    std::vector<char> data;
+    libed2k::bencode(std::back_inserter(data), rd);
+
+    {
+        libed2k::resume_journal j;
+        std::vector<libed2k::transfer_resume_data> transfers;
+        j.open(path, transfers, ec);
+        BOOST_REQUIRE(!ec);
+        j.add_transfer(libed2k::transfer_resume_data(h1, "/tmp/file1", 100, false, data));
+        for (int i = 0; i < 10000; ++i) j.have_piece(h1, i % 2);
+    }
+
+    libed2k::remove(path + ".tmp", ec);
+    ec.clear();
+
+    // no record is lost by the failed compactions
+    libed2k::resume_journal j;
+    std::vector<libed2k::transfer_resume_data> transfers;
+    j.open(path, transfers, ec);
+    BOOST_REQUIRE(!ec);
+    BOOST_REQUIRE_EQUAL(transfers.size(), 1U);
+    const std::vector<char>& blob =
+        transfers[0].m_fast_resume_data.getTagByNameId(libed2k::FT_FAST_RESUME_DATA)->asBlob();
+    libed2k::entry e = libed2k::bdecode(blob.begin(), blob.end());
+    BOOST_CHECK_EQUAL(e["pieces"].string(), std::string("\1\1\0", 3));
+    j.close();
+
+    libed2k::remove(path, ec);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/lexical_cast.hpp>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/file_pool.hpp"
+#include "libed2k/file_storage.hpp"
+
+using namespace libed2k;
+
+namespace {
+const int num_files = 8;
+
+struct pool_fixture {
+    pool_fixture() : path(complete("test_file_pool")) {
+        error_code ec;
+        create_directories(combine_path(path, "files"), ec);
+        for (int i = 0; i < num_files; ++i)
+            fs.add_file(combine_path("files", boost::lexical_cast<std::string>(i)), 1024);
+    }
+
+    ~pool_fixture() {
+        error_code ec;
+        remove_all(path, ec);
+    }
+
+    boost::intrusive_ptr<file> open(file_pool& pool, void* st, int index, int mode) {
+        error_code ec;
+        boost::intrusive_ptr<file> f = pool.open_file(st, path, fs.begin() + index, fs, mode, ec);
+        BOOST_REQUIRE(!ec);
+        return f;
+    }
+
+    std::string path;
+    file_storage fs;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(test_file_pool, pool_fixture)
+
+BOOST_AUTO_TEST_CASE(test_lru) {
+    file_pool pool(4);
+    int st = 0;
+
+    boost::intrusive_ptr<file> first = open(pool, &st, 0, file::read_write);
+    for (int i = 1; i < 4; ++i) open(pool, &st, i, file::read_write);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 4);
+
+    // using the first file again makes the second the oldest
+    BOOST_CHECK(open(pool, &st, 0, file::read_write) == first);
+    open(pool, &st, 4, file::read_write);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 4);
+    BOOST_CHECK(open(pool, &st, 0, file::read_write) == first);
+
+    pool.resize(2);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 2);
+    BOOST_CHECK(open(pool, &st, 0, file::read_write) == first);
+
+    pool.release(&st, 0);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 1);
+    BOOST_CHECK(open(pool, &st, 0, file::read_write) != first);
+
+    pool.release(&st);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_storages) {
+    file_pool pool(num_files);
+    int st[num_files];
+
+    // storages in other shards make room for each other
+    for (int round = 0; round < 3; ++round)
+        for (int i = 0; i < num_files; ++i) open(pool, &st[i], i, file::read_write);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), num_files);
+
+    pool.resize(3);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 3);
+    for (int i = 0; i < num_files; ++i) open(pool, &st[i], i, file::read_write);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 3);
+
+    pool.release(0);
+    BOOST_CHECK_EQUAL(pool.num_open_files(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_share_read_only) {
+    file_pool pool(4);
+    int st = 0;
+    open(pool, &st, 0, file::read_write);
+
+    // other access flags reopen the file
+    BOOST_CHECK(open(pool, &st, 0, file::read_only | file::random_access)->open_mode() & file::random_access);
+    BOOST_CHECK(!(open(pool, &st, 0, file::read_only)->open_mode() & file::random_access));
+
+    // unless reads share the open one
+    pool.set_share_read_only(true);
+    open(pool, &st, 0, file::read_only);
+    BOOST_CHECK(!(open(pool, &st, 0, file::read_only | file::random_access)->open_mode() & file::random_access));
+
+    // writes still reopen it
+    BOOST_CHECK_EQUAL(open(pool, &st, 0, file::read_write)->open_mode() & file::rw_mask, int(file::read_write));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@
 #include "libed2k/hasher.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/node_id.hpp"
+#include "libed2k/kademlia/flat_routing_table.hpp"
 #include "common.hpp"
 
 BOOST_AUTO_TEST_SUITE(test_kad)
@@ -99,5 +100,136 @@ BOOST_AUTO_TEST_CASE(test_kad_tolerance) {
     BOOST_CHECK_EQUAL(KADEMLIA_TOLERANCE_ZONE, libed2k::dht::distance_exp(tolerance, md4_hash::invalid()));
 }
 
+struct closer_to {
+    libed2k::dht::node_id target;
+    closer_to(libed2k::dht::node_id const& t) : target(t) {}
+    bool operator()(libed2k::dht::node_entry const& lhs, libed2k::dht::node_entry const& rhs) const {
+        return libed2k::dht::compare_ref(lhs.id, rhs.id, target);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_flat_routing_table) {
+    using namespace libed2k;
+    using namespace libed2k::dht;
+
+    node_id self = generate_random_id();
+    flat_routing_table table(self);
+    std::vector<node_entry> live;
+
+    for (int i = 0; i < 300; ++i) {
+        node_entry e(generate_random_id(), udp::endpoint(address_v4(0x0a000000 + i), 4672), true);
+        if (i % 5 == 0) e.timed_out();
+        table.update(e, i % 3 != 0);
+        if (i % 3 != 0) live.push_back(e);
+    }
+
+    BOOST_CHECK_EQUAL(table.size(), int(live.size()));
+    BOOST_CHECK_EQUAL(table.num_endpoints(), 300);
+
+    // remove some of the live nodes and move a replacement node into the live set
+    for (int i = 0; i < 20; ++i) table.erase(live[i].ep());
+    live.erase(live.begin(), live.begin() + 20);
+    node_entry promoted(generate_random_id(), udp::endpoint(address_v4(0x0a000000 + 3), 4672), true);
+    table.update(promoted, true);
+    live.push_back(promoted);
+
+    node_id id;
+    bool is_live = true;
+    BOOST_CHECK(!table.find(udp::endpoint(address_v4(0x0a000001), 4672), id, is_live));
+    BOOST_REQUIRE(table.find(promoted.ep(), id, is_live));
+    BOOST_CHECK_EQUAL(id, promoted.id);
+    BOOST_CHECK(is_live);
+    BOOST_REQUIRE(table.find(udp::endpoint(address_v4(0x0a000000 + 6), 4672), id, is_live));
+    BOOST_CHECK(!is_live);
+
+    for (int t = 0; t < 50; ++t) {
+        node_id target = (t == 0) ? self : generate_random_id();
+        std::vector<node_entry> expected;
+        for (std::vector<node_entry>::const_iterator i = live.begin(); i != live.end(); ++i)
+            if (i->confirmed()) expected.push_back(*i);
+        std::sort(expected.begin(), expected.end(), closer_to(target));
+        expected.resize(10);
+
+        std::vector<node_entry> res;
+        table.find_closest(target, res, 10, false);
+        BOOST_REQUIRE_EQUAL(res.size(), expected.size());
+        for (size_t i = 0; i < res.size(); ++i) {
+            BOOST_CHECK_EQUAL(res[i].id, expected[i].id);
+            BOOST_CHECK(res[i].ep() == expected[i].ep());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_node_rtt) {
+    using namespace libed2k;
+    using namespace libed2k::dht;
+
+    node_entry e(generate_random_id(), udp::endpoint(address_v4(0x0a000001), 4672), true);
+    BOOST_CHECK_EQUAL(e.rtt, 0xffff);
+    e.update_rtt(0xffff);
+    BOOST_CHECK_EQUAL(e.rtt, 0xffff);
+    e.update_rtt(300);
+    BOOST_CHECK_EQUAL(e.rtt, 300);
+    e.update_rtt(0);
+    BOOST_CHECK_EQUAL(e.rtt, 200);
+
+    flat_routing_table table(generate_random_id());
+    BOOST_CHECK_EQUAL(table.rtt(e.ep()), 0xffff);
+    table.update(e, true);
+    BOOST_CHECK_EQUAL(table.rtt(e.ep()), 200);
+    e.update_rtt(500);
+    table.update(e, true);
+    BOOST_CHECK_EQUAL(table.rtt(e.ep()), e.rtt);
+    table.update(e, false);
+    BOOST_CHECK_EQUAL(table.rtt(e.ep()), e.rtt);
+    table.erase(e.ep());
+    BOOST_CHECK_EQUAL(table.rtt(e.ep()), 0xffff);
+}
+
+BOOST_AUTO_TEST_CASE(test_kad_snapshot_serialization) {
+    using namespace libed2k;
+
+    kad_snapshot s;
+    s.self_id = dht::generate_random_id();
+    for (int i = 0; i < 3; ++i) {
+        kad_snapshot_entry e;
+        e.point = net_identifier(0x0100000a + i, 4672 + i);
+        e.pid = dht::generate_random_id();
+        e.rtt = i == 2 ? 0xffff : 100 * i;
+        e.last_seen = i == 2 ? 0 : 1400000000 + i;
+        e.flags = i == 0 ? kad_snapshot_entry::verified : 0;
+        s.entries.m_collection.push_back(e);
+    }
+
+    std::ostringstream sstream(std::ios_base::binary);
+    archive::ed2k_oarchive out_archive(sstream);
+    out_archive << s;
+    // version, id, count and 29 bytes a contact
+    BOOST_CHECK_EQUAL(sstream.str().size(), 4u + 16u + 4u + 3u * 29u);
+
+    std::istringstream istream(sstream.str(), std::ios_base::binary);
+    archive::ed2k_iarchive in_archive(istream);
+    kad_snapshot r;
+    in_archive >> r;
+    BOOST_CHECK_EQUAL(r.self_id, s.self_id);
+    BOOST_REQUIRE_EQUAL(r.entries.m_collection.size(), 3u);
+    for (int i = 0; i < 3; ++i) {
+        kad_snapshot_entry const& a = s.entries.m_collection[i];
+        kad_snapshot_entry const& b = r.entries.m_collection[i];
+        BOOST_CHECK(a.point == b.point);
+        BOOST_CHECK_EQUAL(a.pid, b.pid);
+        BOOST_CHECK_EQUAL(a.rtt, b.rtt);
+        BOOST_CHECK_EQUAL(a.last_seen, b.last_seen);
+        BOOST_CHECK_EQUAL(a.flags, b.flags);
+    }
+
+    // files of another version are not taken
+    std::string data = sstream.str();
+    data[0] = '\x7f';
+    std::istringstream bad_stream(data, std::ios_base::binary);
+    archive::ed2k_iarchive bad_archive(bad_stream);
+    BOOST_CHECK_THROW(bad_archive >> r, libed2k_exception);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 #endif
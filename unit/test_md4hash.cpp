@@ -11,6 +11,7 @@
 #include <fstream>
 #include <boost/test/unit_test.hpp>
 #include "libed2k/hasher.hpp"
+#include "libed2k/hash_pool.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/node_id.hpp"
 #include "libed2k/kademlia/kad_packet_struct.hpp"
@@ -114,4 +115,38 @@ BOOST_AUTO_TEST_CASE(test_partial_hashing_and_hashset) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_hash_pool) {
+    const int piece_size = 1000;
+    std::vector<char> data(piece_size * 8);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = char(i * 7);
+
+    for (int threads = 0; threads < 3; ++threads) {
+        libed2k::hash_pool pool;
+        if (threads > 0) pool.set_num_threads(threads);
+
+        std::vector<libed2k::hash_job> jobs(8);
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            jobs[i].data = &data[i * piece_size];
+            jobs[i].size = piece_size;
+            jobs[i].small_size = i % 2 ? 100 : 0;
+            pool.post(&jobs[i]);
+        }
+
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            pool.wait(&jobs[i]);
+            BOOST_CHECK(pool.done(&jobs[i]));
+
+            libed2k::hasher h;
+            h.update(&data[i * piece_size], piece_size);
+            BOOST_CHECK_EQUAL(jobs[i].hash, h.final());
+
+            if (jobs[i].small_size > 0) {
+                libed2k::hasher sh;
+                sh.update(&data[i * piece_size], 100);
+                BOOST_CHECK_EQUAL(jobs[i].small_hash, sh.final());
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+#include "libed2k/metrics.hpp"
+
+using libed2k::latency_histogram;
+
+BOOST_AUTO_TEST_SUITE(test_metrics)
+
+BOOST_AUTO_TEST_CASE(test_buckets) {
+    // small values are exact
+    for (int i = 0; i < 2 * latency_histogram::sub_buckets; ++i) {
+        BOOST_CHECK_EQUAL(latency_histogram::bucket(i), i);
+        BOOST_CHECK_EQUAL(latency_histogram::bucket_limit(i), boost::uint64_t(i));
+    }
+
+    // every value falls into the bucket whose range holds it
+    for (boost::uint64_t v = 1; v < (boost::uint64_t(1) << latency_histogram::max_bits); v = v * 3 + 1) {
+        int b = latency_histogram::bucket(v);
+        BOOST_REQUIRE(b < latency_histogram::num_buckets);
+        BOOST_CHECK(latency_histogram::bucket_limit(b) >= v);
+        BOOST_CHECK(b == 0 || latency_histogram::bucket_limit(b - 1) < v);
+        // and its limit is no more than 1/16 off
+        BOOST_CHECK(latency_histogram::bucket_limit(b) - v <= v / latency_histogram::sub_buckets);
+    }
+
+    BOOST_CHECK_EQUAL(latency_histogram::bucket(boost::uint64_t(1) << 40), latency_histogram::num_buckets - 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_percentiles) {
+    latency_histogram h;
+    BOOST_CHECK_EQUAL(h.percentile(99), 0u);
+
+    // 990 fast samples and a slow tail of 10
+    for (int i = 0; i < 990; ++i) h.add(100 + i % 10);
+    for (int i = 0; i < 10; ++i) h.add(50000);
+
+    BOOST_CHECK_EQUAL(h.count(), 1000u);
+    BOOST_CHECK_EQUAL(h.maximum(), 50000u);
+    BOOST_CHECK(h.percentile(50) >= 104 && h.percentile(50) <= 111);
+    BOOST_CHECK(h.percentile(99) <= 111);
+    BOOST_CHECK_EQUAL(h.percentile(99.9), 50000u);
+    BOOST_CHECK_EQUAL(h.percentile(100), 50000u);
+
+    latency_histogram slow;
+    for (int i = 0; i < 1000; ++i) slow.add(1000000);
+    h.merge(slow);
+    BOOST_CHECK_EQUAL(h.count(), 2000u);
+    BOOST_CHECK_EQUAL(h.maximum(), 1000000u);
+    BOOST_CHECK_EQUAL(h.percentile(99), 1000000u);
+    BOOST_CHECK(h.percentile(40) <= 111);
+
+    h.clear();
+    BOOST_CHECK_EQUAL(h.count(), 0u);
+    BOOST_CHECK_EQUAL(h.percentile(50), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/bitfield.hpp"
+#include "libed2k/piece_picker.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_piece_picker)
+
+BOOST_AUTO_TEST_CASE(test_compact_picker) {
+    libed2k::piece_picker p;
+    p.init(4, 2, 8);
+    p.set_piece_priority(6, 0);
+
+    // pieces are still wanted
+    p.compact();
+    BOOST_CHECK(!p.is_compact());
+
+    for (int i = 0; i < 8; ++i)
+        if (i != 6) p.we_have(i);
+    BOOST_CHECK_EQUAL(p.num_want_left(), 0);
+
+    p.compact();
+    BOOST_REQUIRE(p.is_compact());
+    BOOST_CHECK_EQUAL(p.num_pieces(), 8);
+    BOOST_CHECK_EQUAL(p.num_have(), 7);
+    BOOST_CHECK_EQUAL(p.num_filtered(), 1);
+    BOOST_CHECK(p.have_piece(5));
+    BOOST_CHECK(!p.have_piece(6));
+    BOOST_CHECK_EQUAL(p.piece_priority(6), 0);
+    BOOST_CHECK_EQUAL(p.blocks_in_piece(7), 2);
+
+    // availability isn't tracked and nothing can be picked
+    libed2k::bitfield peer(8, true);
+    p.inc_refcount(peer);
+    p.inc_refcount_all();
+    std::vector<int> avail;
+    p.get_availability(avail);
+    BOOST_CHECK_EQUAL(avail.size(), 8u);
+    BOOST_CHECK_EQUAL(avail[0], 0);
+
+    std::vector<libed2k::piece_block> picked;
+    p.pick_pieces(peer, picked, 10, 0, 0, libed2k::piece_picker::fast, libed2k::piece_picker::rarest_first,
+                  std::vector<int>(), 10);
+    BOOST_CHECK(picked.empty());
+
+    // filtering pieces we have stays compact
+    BOOST_CHECK(p.set_piece_priority(1, 0));
+    BOOST_CHECK(p.set_piece_priority(1, 3));
+    BOOST_CHECK(p.is_compact());
+
+    // unfiltered piece has to be downloaded by the full picker, the owner
+    // expands it and adds the availability of its peers again
+    BOOST_CHECK(!p.set_piece_priority(6, 1));
+    BOOST_CHECK(p.is_compact());
+    p.expand();
+    BOOST_REQUIRE(!p.is_compact());
+    BOOST_CHECK(p.set_piece_priority(6, 1));
+    BOOST_CHECK_EQUAL(p.num_want_left(), 1);
+    BOOST_CHECK(p.have_piece(5));
+    BOOST_CHECK(!p.have_piece(6));
+
+    p.inc_refcount(peer);
+    p.get_availability(avail);
+    BOOST_CHECK_EQUAL(avail[6], 1);
+    p.pick_pieces(peer, picked, 10, 0, 0, libed2k::piece_picker::fast, libed2k::piece_picker::rarest_first,
+                  std::vector<int>(), 10);
+    BOOST_REQUIRE(!picked.empty());
+    BOOST_CHECK_EQUAL(picked[0].piece_index, 6u);
+
+    // a compact picker has no downloads
+    p.we_have(6);
+    p.compact();
+    BOOST_REQUIRE(p.is_compact());
+    BOOST_CHECK_EQUAL(p.num_peers(libed2k::piece_block(2, 0)), 0);
+
+    // lost piece needs the full picker too
+    p.expand();
+    p.we_dont_have(2);
+    BOOST_CHECK(!p.is_compact());
+    BOOST_CHECK_EQUAL(p.num_have(), 7);
+    BOOST_CHECK(!p.have_piece(2));
+    BOOST_CHECK_EQUAL(p.num_want_left(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -47,4 +47,24 @@ BOOST_AUTO_TEST_CASE(test_extract_message) {
     BOOST_CHECK_EQUAL(ec, libed2k::errors::make_error_code(libed2k::errors::unsupported_udp_res1_type));
 }
 
+BOOST_AUTO_TEST_CASE(test_misc_options2_utp) {
+    libed2k::misc_options2 mo2;
+    mo2.set_captcha();
+    mo2.set_large_files();
+    mo2.set_source_ext2();
+    BOOST_CHECK(!mo2.support_utp());
+
+    mo2.set_utp();
+    BOOST_CHECK(mo2.support_utp());
+    BOOST_CHECK(mo2.support_captcha());
+    BOOST_CHECK(mo2.support_large_files());
+    BOOST_CHECK(mo2.support_source_ext2());
+    BOOST_CHECK(!mo2.support_ext_multipacket());
+
+    // the bit survives the hello tag and isn't one eMule sets
+    libed2k::misc_options2 parsed(mo2.generate());
+    BOOST_CHECK(parsed.support_utp());
+    BOOST_CHECK(!libed2k::misc_options2(~(1u << UTP_OFFSET)).support_utp());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
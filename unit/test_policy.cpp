@@ -0,0 +1,166 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+#include "libed2k/session_impl.hpp"
+#include "libed2k/transfer.hpp"
+#include "libed2k/policy.hpp"
+#include "libed2k/peer_info.hpp"
+#include "libed2k/add_transfer_params.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/peer_connection.hpp"
+#include "libed2k/error_code.hpp"
+#include "libed2k/socket_type.hpp"
+
+using namespace libed2k;
+
+namespace {
+
+tcp::endpoint ep(const char* ip, int port) { return tcp::endpoint(ip::address::from_string(ip), port); }
+
+struct policy_fixture {
+    policy_fixture(bool utp = false) {
+        session_settings s;
+        s.listen_port = 0;
+        s.enable_outgoing_utp = utp;
+        ses.reset(new aux::session_impl(fingerprint(), "0.0.0.0", s));
+
+        add_transfer_params atp;
+        atp.file_hash = md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+        atp.file_path = complete("test_policy_file");
+        atp.file_size = 1024;
+
+        boost::mutex::scoped_lock l(ses->m_mutex);
+        error_code ec;
+        ses->add_transfer(atp, ec);
+        t = ses->find_transfer(atp.file_hash).lock();
+    }
+
+    boost::shared_ptr<aux::session_impl> ses;
+    boost::shared_ptr<transfer> t;
+};
+
+struct utp_fixture : policy_fixture {
+    utp_fixture() : policy_fixture(true) {
+        // without a listen port the session doesn't open its UDP socket
+        boost::mutex::scoped_lock l(ses->m_mutex);
+        error_code ec;
+        ses->m_udp_socket.bind(udp::endpoint(ip::address_v4::loopback(), 0), ec);
+    }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(test_policy)
+
+BOOST_FIXTURE_TEST_CASE(test_erase_peer_keeps_index, policy_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    policy& pol = t->get_policy();
+
+    peer* p1 = pol.add_peer(ep("10.0.0.1", 4662), peer_info::tracker, 0);
+    peer* p2 = pol.add_peer(ep("10.0.0.2", 4662), peer_info::tracker, 0);
+    peer* p3 = pol.add_peer(ep("10.0.0.3", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p1 && p2 && p3);
+    BOOST_CHECK_EQUAL(pol.num_peers(), 3U);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 3);
+
+    // the last peer moves into the hole of the erased one
+    pol.erase_peer(p1);
+    BOOST_CHECK_EQUAL(pol.num_peers(), 2U);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 2);
+    BOOST_CHECK(*pol.begin_peer() == p3);
+
+    // known peers are still found through the index
+    BOOST_CHECK(pol.add_peer(ep("10.0.0.2", 4662), peer_info::tracker, 0) == p2);
+    BOOST_CHECK(pol.add_peer(ep("10.0.0.3", 4662), peer_info::tracker, 0) == p3);
+    BOOST_CHECK_EQUAL(pol.num_peers(), 2U);
+
+    pol.erase_peer(p3);
+    BOOST_CHECK_EQUAL(pol.num_peers(), 1U);
+    BOOST_CHECK(pol.add_peer(ep("10.0.0.2", 4662), peer_info::tracker, 0) == p2);
+
+    // a freed entry is handed out again by the pool
+    peer* p4 = pol.add_peer(ep("10.0.0.4", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p4);
+    BOOST_CHECK_EQUAL(pol.num_peers(), 2U);
+    BOOST_CHECK(p4->address() == ip::address::from_string("10.0.0.4"));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_disconnected_peer_is_candidate_again, policy_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    policy& pol = t->get_policy();
+
+    peer* p = pol.add_peer(ep("127.0.0.1", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 1);
+
+    BOOST_REQUIRE(t->connect_to_peer(p));
+    BOOST_REQUIRE(p->connection);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 0);
+
+    // the session still knows the connection while the policy is told
+    p->connection->disconnect(errors::timed_out, 1);
+    BOOST_CHECK(p->connection == 0);
+    BOOST_CHECK_EQUAL(int(p->failcount), 1);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_utp_only_to_announcing_peers, utp_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    policy& pol = t->get_policy();
+
+    peer* p1 = pol.add_peer(ep("127.0.0.1", 4662), peer_info::tracker, 0);
+    peer* p2 = pol.add_peer(ep("127.0.0.2", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p1 && p2);
+    p1->supports_utp = true;
+
+    BOOST_REQUIRE(t->connect_to_peer(p1));
+    BOOST_REQUIRE(t->connect_to_peer(p2));
+    BOOST_CHECK(is_utp(*p1->connection->socket()));
+    BOOST_CHECK(!is_utp(*p2->connection->socket()));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_utp_disabled_connects_over_tcp, policy_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    policy& pol = t->get_policy();
+
+    peer* p = pol.add_peer(ep("127.0.0.1", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p);
+    p->supports_utp = true;
+
+    BOOST_REQUIRE(t->connect_to_peer(p));
+    BOOST_CHECK(!is_utp(*p->connection->socket()));
+}
+
+BOOST_FIXTURE_TEST_CASE(test_failed_utp_connect_falls_back_to_tcp, utp_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    policy& pol = t->get_policy();
+
+    peer* p = pol.add_peer(ep("127.0.0.1", 4662), peer_info::tracker, 0);
+    BOOST_REQUIRE(p);
+    p->supports_utp = true;
+
+    BOOST_REQUIRE(t->connect_to_peer(p));
+    BOOST_REQUIRE(is_utp(*p->connection->socket()));
+
+    // not counted as a failure, the peer is a candidate right away
+    p->connection->on_connect(errors::timed_out);
+    BOOST_CHECK(p->connection == 0);
+    BOOST_CHECK(!p->supports_utp);
+    BOOST_CHECK_EQUAL(int(p->failcount), 0);
+    BOOST_CHECK_EQUAL(pol.num_connect_candidates(), 1);
+
+    BOOST_REQUIRE(t->connect_to_peer(p));
+    BOOST_CHECK(!is_utp(*p->connection->socket()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,8 @@
 #include "libed2k/log.hpp"
 #include "libed2k/file.hpp"
 #include "libed2k/search.hpp"
+#include "libed2k/search_aggregator.hpp"
+#include "libed2k/time.hpp"
 
 BOOST_AUTO_TEST_SUITE(test_search_request)
 
@@ -262,4 +264,156 @@ BOOST_AUTO_TEST_CASE(test_limits) {
                       libed2k::libed2k_exception);
 }
 
+BOOST_AUTO_TEST_CASE(test_search_aggregator) {
+    using libed2k::md4_hash;
+    libed2k::search_aggregator aggregator;
+    aggregator.set_limits(2, 3, 16);
+    libed2k::ptime now = libed2k::time_now();
+
+    md4_hash search = libed2k::search_aggregator::server_search();
+    md4_hash a = md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    md4_hash b = md4_hash::fromString("100102030405060708090A0B0C0D0E0F");
+    md4_hash c = md4_hash::fromString("200102030405060708090A0B0C0D0E0F");
+    md4_hash d = md4_hash::fromString("300102030405060708090A0B0C0D0E0F");
+    std::vector<libed2k::search_results_delta> deltas;
+
+    // results of searches not started are dropped
+    aggregator.add(search, a, "a.avi", 100, 5, 1, true);
+    aggregator.flush(deltas, now);
+    BOOST_CHECK(deltas.empty());
+
+    aggregator.start(search);
+    aggregator.add(search, a, "a.avi", 100, 5, 1, true);
+    aggregator.add(search, b, "b.avi", 200, 3, 0, true);
+    aggregator.add(search, c, "c.avi", 300, 1, 0, true);
+    aggregator.flush(deltas, now);
+    BOOST_REQUIRE_EQUAL(deltas.size(), 1u);
+    BOOST_CHECK_EQUAL(deltas[0].m_files, 3);
+    BOOST_REQUIRE_EQUAL(deltas[0].m_updated.size(), 2u);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_hFile, a);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[1].m_hFile, b);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[1].m_rank, 1);
+    BOOST_CHECK(deltas[0].m_removed.empty());
+
+    // nothing changed, nothing to report
+    deltas.clear();
+    aggregator.flush(deltas, now);
+    BOOST_CHECK(deltas.empty());
+
+    // second server reports c with more sources and another name
+    aggregator.add(search, c, "c2.avi", 0, 9, 2, true);
+    aggregator.flush(deltas, now);
+    BOOST_REQUIRE_EQUAL(deltas.size(), 1u);
+    BOOST_REQUIRE_EQUAL(deltas[0].m_updated.size(), 2u);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_hFile, c);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_sources, 10);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_complete_sources, 2);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_size, 300);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_reports, 2);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_name, "c.avi");
+    BOOST_REQUIRE_EQUAL(deltas[0].m_updated[0].m_names.size(), 1u);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_names[0], "c2.avi");
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[1].m_hFile, a);
+    BOOST_REQUIRE_EQUAL(deltas[0].m_removed.size(), 1u);
+    BOOST_CHECK_EQUAL(deltas[0].m_removed[0], b);
+
+    // not additive results keep the maximum, full table drops the worst file
+    aggregator.add(search, a, "a.avi", 100, 4, 1, false);
+    aggregator.add(search, d, "d.avi", 400, 2, 0, true);
+    std::vector<libed2k::search_file_info> top;
+    aggregator.top(search, top);
+    BOOST_REQUIRE_EQUAL(top.size(), 2u);
+    BOOST_CHECK_EQUAL(top[0].m_hFile, c);
+    BOOST_CHECK_EQUAL(top[1].m_hFile, a);
+    BOOST_CHECK_EQUAL(top[1].m_sources, 5);
+    deltas.clear();
+    aggregator.flush(deltas, now);
+    BOOST_REQUIRE_EQUAL(deltas.size(), 1u);
+    BOOST_CHECK_EQUAL(deltas[0].m_files, 3);
+
+    aggregator.stop(search);
+    BOOST_CHECK(!aggregator.active(search));
+}
+
+BOOST_AUTO_TEST_CASE(test_search_aggregator_finish) {
+    using libed2k::md4_hash;
+    libed2k::search_aggregator aggregator;
+    aggregator.set_limits(10, 100, 3);
+    libed2k::ptime now = libed2k::time_now();
+
+    md4_hash file = md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    md4_hash searches[5] = {md4_hash::fromString("100102030405060708090A0B0C0D0E0F"),
+                            md4_hash::fromString("200102030405060708090A0B0C0D0E0F"),
+                            md4_hash::fromString("300102030405060708090A0B0C0D0E0F"),
+                            md4_hash::fromString("400102030405060708090A0B0C0D0E0F"),
+                            md4_hash::fromString("500102030405060708090A0B0C0D0E0F")};
+    std::vector<libed2k::search_results_delta> deltas;
+
+    // the oldest searches are dropped to keep the bound
+    for (int i = 0; i < 5; ++i) {
+        aggregator.start(searches[i]);
+        aggregator.add(searches[i], file, "a.avi", 100, i + 1, 0, false);
+    }
+    BOOST_CHECK_EQUAL(aggregator.num_searches(), 3);
+    BOOST_CHECK(!aggregator.active(searches[0]));
+    BOOST_CHECK(!aggregator.active(searches[1]));
+    BOOST_CHECK(aggregator.active(searches[4]));
+
+    // an expired search reports its last delta before it is dropped
+    aggregator.finish(searches[2], now);
+    aggregator.finish(searches[3], now);
+    BOOST_CHECK_EQUAL(aggregator.num_searches(), 3);
+    aggregator.flush(deltas, now);
+    BOOST_CHECK_EQUAL(deltas.size(), 3u);
+    BOOST_CHECK_EQUAL(aggregator.num_searches(), 1);
+
+    // without pending results it is dropped by the next flush
+    aggregator.finish(searches[4], now);
+    BOOST_CHECK_EQUAL(aggregator.num_searches(), 1);
+    deltas.clear();
+    aggregator.flush(deltas, now);
+    BOOST_CHECK(deltas.empty());
+    BOOST_CHECK_EQUAL(aggregator.num_searches(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_search_aggregator_answers_after_finish) {
+    using libed2k::md4_hash;
+    libed2k::search_aggregator aggregator;
+    libed2k::ptime now = libed2k::time_now();
+
+    md4_hash search = md4_hash::fromString("100102030405060708090A0B0C0D0E0F");
+    md4_hash a = md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    md4_hash b = md4_hash::fromString("200102030405060708090A0B0C0D0E0F");
+    std::vector<libed2k::search_results_delta> deltas;
+
+    // Kad traversals finish once the requests are sent, the answers come later
+    aggregator.start(search);
+    aggregator.finish(search, now + libed2k::seconds(12));
+    aggregator.flush(deltas, now);
+    BOOST_CHECK(deltas.empty());
+    BOOST_CHECK(aggregator.active(search));
+
+    aggregator.add(search, a, "a.avi", 100, 5, 1, false);
+    aggregator.flush(deltas, now + libed2k::seconds(1));
+    BOOST_REQUIRE_EQUAL(deltas.size(), 1u);
+    BOOST_REQUIRE_EQUAL(deltas[0].m_updated.size(), 1u);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_hFile, a);
+    BOOST_CHECK(aggregator.active(search));
+
+    // the last answers are reported with the delta dropping the search
+    aggregator.add(search, b, "b.avi", 200, 7, 0, false);
+    deltas.clear();
+    aggregator.flush(deltas, now + libed2k::seconds(12));
+    BOOST_REQUIRE_EQUAL(deltas.size(), 1u);
+    BOOST_REQUIRE_EQUAL(deltas[0].m_updated.size(), 2u);
+    BOOST_CHECK_EQUAL(deltas[0].m_updated[0].m_hFile, b);
+    BOOST_CHECK(!aggregator.active(search));
+
+    // answers coming in later are ignored
+    aggregator.add(search, a, "a.avi", 100, 5, 1, false);
+    deltas.clear();
+    aggregator.flush(deltas, now + libed2k::seconds(13));
+    BOOST_CHECK(deltas.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <cstring>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include "libed2k/send_buffer_pool.hpp"
+
+using libed2k::send_buffer_pool;
+
+namespace {
+int in_use(const send_buffer_pool& pool, int buffer_size) {
+    std::vector<send_buffer_pool::class_usage> classes;
+    pool.usage(classes);
+    for (size_t i = 0; i < classes.size(); ++i)
+        if (classes[i].buffer_size == buffer_size) return classes[i].in_use;
+    return -1;
+}
+
+void churn(send_buffer_pool* pool, int rounds) {
+    std::vector<std::pair<char*, int> > bufs;
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < 50; ++i) {
+            bufs.push_back(pool->allocate(1 + (r * 37 + i * 101) % 5000));
+            std::memset(bufs.back().first, r, bufs.back().second);
+        }
+        for (size_t i = 0; i < bufs.size(); ++i) pool->free(bufs[i].first, bufs[i].second);
+        bufs.clear();
+    }
+}
+}
+
+BOOST_AUTO_TEST_SUITE(test_send_buffer_pool)
+
+BOOST_AUTO_TEST_CASE(test_size_classes) {
+    send_buffer_pool pool;
+    std::pair<char*, int> b1 = pool.allocate(1);
+    std::pair<char*, int> b2 = pool.allocate(128);
+    std::pair<char*, int> b3 = pool.allocate(129);
+    std::pair<char*, int> b4 = pool.allocate(100000);
+    std::pair<char*, int> b5 = pool.allocate(4 * 1024 * 1024);
+
+    BOOST_CHECK_EQUAL(b1.second, 128);
+    BOOST_CHECK_EQUAL(b2.second, 128);
+    BOOST_CHECK_EQUAL(b3.second, 256);
+    BOOST_CHECK_EQUAL(b4.second, 128 * 1024);
+    BOOST_CHECK_EQUAL(b5.second, 4 * 1024 * 1024);
+    BOOST_CHECK(b1.first != b2.first);
+    BOOST_CHECK_EQUAL(in_use(pool, 128), 2);
+    BOOST_CHECK_EQUAL(in_use(pool, 256), 1);
+
+    pool.free(b1.first, b1.second);
+    pool.free(b3.first, b3.second);
+    pool.free(b4.first, b4.second);
+    pool.free(b5.first, b5.second);
+    BOOST_CHECK_EQUAL(in_use(pool, 128), 1);
+    BOOST_CHECK_EQUAL(in_use(pool, 256), 0);
+    BOOST_CHECK_EQUAL(in_use(pool, 128 * 1024), 0);
+
+    // freed buffer is reused
+    std::pair<char*, int> b6 = pool.allocate(200);
+    BOOST_CHECK(b6.first == b3.first);
+    pool.free(b6.first, b6.second);
+    pool.free(b2.first, b2.second);
+}
+
+BOOST_AUTO_TEST_CASE(test_threads) {
+    send_buffer_pool pool;
+    libed2k::thread t1(boost::bind(&churn, &pool, 2000));
+    libed2k::thread t2(boost::bind(&churn, &pool, 2000));
+    churn(&pool, 2000);
+    t1.join();
+    t2.join();
+
+    std::vector<send_buffer_pool::class_usage> classes;
+    pool.usage(classes);
+    for (size_t i = 0; i < classes.size(); ++i) BOOST_CHECK_EQUAL(classes[i].in_use, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_exit_flushes_cache) {
+    send_buffer_pool pool;
+    libed2k::thread t(boost::bind(&churn, &pool, 10));
+    t.join();
+
+    // buffers cached by the exited thread are back in the shared lists
+    std::vector<send_buffer_pool::class_usage> classes;
+    pool.usage(classes);
+    for (size_t i = 0; i < classes.size(); ++i) {
+        BOOST_CHECK_EQUAL(classes[i].in_use, 0);
+        BOOST_CHECK_EQUAL(classes[i].free, classes[i].allocated);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
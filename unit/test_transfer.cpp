@@ -0,0 +1,120 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+#include "libed2k/session_impl.hpp"
+#include "libed2k/transfer.hpp"
+#include "libed2k/add_transfer_params.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/peer_connection.hpp"
+#include "libed2k/socket_type.hpp"
+#include "libed2k/error_code.hpp"
+#include "libed2k/stat.hpp"
+
+using namespace libed2k;
+
+namespace {
+
+struct dormant_fixture {
+    dormant_fixture() {
+        session_settings s;
+        s.listen_port = 0;
+        s.dormant_seeds = true;
+        ses.reset(new aux::session_impl(fingerprint(), "0.0.0.0", s));
+
+        add_transfer_params atp;
+        atp.file_hash = md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+        atp.file_path = complete("test_transfer_file");
+        atp.file_size = 1024;
+        atp.seed_mode = true;
+
+        boost::mutex::scoped_lock l(ses->m_mutex);
+        error_code ec;
+        ses->add_transfer(atp, ec);
+        t = ses->find_transfer(atp.file_hash).lock();
+    }
+
+    // an incoming peer the session knows about
+    boost::intrusive_ptr<peer_connection> incoming(const char* ip) {
+        boost::shared_ptr<socket_type> s(new socket_type(ses->m_io_service));
+        s->instantiate<stream_socket>(ses->m_io_service);
+        tcp::endpoint ep(ip::address::from_string(ip), 4662);
+        boost::intrusive_ptr<peer_connection> c(new peer_connection(*ses, s, ep, NULL));
+        ses->m_connections.insert(c);
+        return c;
+    }
+
+    boost::shared_ptr<aux::session_impl> ses;
+    boost::shared_ptr<transfer> t;
+};
+}
+
+BOOST_AUTO_TEST_SUITE(test_transfer)
+
+BOOST_FIXTURE_TEST_CASE(test_seed_starts_dormant, dormant_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    BOOST_CHECK(t->is_dormant());
+    BOOST_CHECK(t->get_storage() == 0);
+    BOOST_CHECK_EQUAL(t->state(), transfer_status::seeding);
+
+    // nothing to release yet
+    t->go_dormant();
+    BOOST_CHECK(t->is_dormant());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_rename_wakes_dormant_seed, dormant_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    BOOST_CHECK(t->rename_file("test_transfer_file2"));
+    BOOST_CHECK(!t->is_dormant());
+    BOOST_CHECK(t->get_storage() != 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_delete_wakes_dormant_seed, dormant_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+    t->delete_files();
+    BOOST_CHECK(!t->is_dormant());
+    BOOST_CHECK(t->get_storage() != 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(test_idle_seed_goes_dormant_again, dormant_fixture) {
+    BOOST_REQUIRE(t);
+    boost::mutex::scoped_lock l(ses->m_mutex);
+
+    boost::intrusive_ptr<peer_connection> c = incoming("10.0.0.1");
+    BOOST_REQUIRE(t->attach_peer(c.get()));
+    BOOST_CHECK(!t->is_dormant());
+    BOOST_CHECK(t->get_storage() != 0);
+
+    // a transfer with peers stays awake
+    ses->update_active_transfers();
+    t->go_dormant();
+    BOOST_CHECK(!t->is_dormant());
+
+    c->disconnect(errors::timed_out);
+    libed2k::stat accumulator;
+    for (int i = 0; i < 20; ++i) t->second_tick(accumulator, 1000, time_now());
+    ses->update_active_transfers();
+    BOOST_CHECK(!t->is_dormant());
+
+    // idle long enough to leave the active transfers
+    t->second_tick(accumulator, 1000, time_now());
+    ses->update_active_transfers();
+    BOOST_CHECK(t->is_dormant());
+    BOOST_CHECK(t->get_storage() == 0);
+
+    // and the next peer wakes it once more
+    boost::intrusive_ptr<peer_connection> c2 = incoming("10.0.0.2");
+    BOOST_REQUIRE(t->attach_peer(c2.get()));
+    BOOST_CHECK(!t->is_dormant());
+    BOOST_CHECK(t->get_storage() != 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()